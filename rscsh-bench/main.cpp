@@ -0,0 +1,62 @@
+#include "BenchSuite.h"
+#include "CoreBenchmarks.h"
+#include "TextOutput.h"
+
+#include <cstdlib>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+
+// Console benchmark of the code below the shell, for CI: the exit status is 1 when a benchmark is
+// slower than the baseline, 2 on errors.
+//   rscsh-bench [<filter>] [json <file>] [baseline <file> [tolerance <percent>]]
+static int run(int argc, char *argv[]) {
+    std::string filter;
+    std::wstring jsonPath, baselinePath;
+    double tolerance = 0.1;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "json" && i + 1 < argc) {
+            jsonPath = from_utf8(argv[++i]);
+        } else if (arg == "baseline" && i + 1 < argc) {
+            baselinePath = from_utf8(argv[++i]);
+        } else if (arg == "tolerance" && i + 1 < argc && !baselinePath.empty()) {
+            tolerance = std::stod(argv[++i]) / 100;
+            if (tolerance < 0)
+                throw std::runtime_error("tolerance must not be negative");
+        } else if (filter.empty() && arg != "json" && arg != "baseline" && arg != "tolerance") {
+            filter = arg;
+        } else {
+            std::cerr << "usage: rscsh-bench [<filter>] [json <file>] [baseline <file> [tolerance <percent>]]\n";
+            return 2;
+        }
+    }
+
+    std::map<std::string, double> baseline;
+    if (!baselinePath.empty())
+        baseline = BenchSuite::read_baseline(baselinePath);
+
+    BenchSuite suite;
+    add_core_benchmarks(suite);
+    auto results = suite.run(filter);
+    if (results.empty())
+        throw std::runtime_error("no benchmark matches the filter");
+
+    BenchSuite::print(std::cout, results, baselinePath.empty() ? nullptr : &baseline, tolerance);
+    if (!jsonPath.empty())
+        BenchSuite::write_json(jsonPath, results);
+
+    auto slower = BenchSuite::regressions(results, baseline, tolerance);
+    for (auto const &name : slower)
+        std::cerr << name << " is slower than the baseline by more than " << tolerance * 100 << "%\n";
+    return slower.empty() ? EXIT_SUCCESS : 1;
+}
+
+int main(int argc, char *argv[]) {
+    try {
+        return run(argc, argv);
+    } catch (std::exception const &e) {
+        std::cerr << "rscsh-bench: " << e.what() << "\n";
+        return 2;
+    }
+}
@@ -0,0 +1,27 @@
+#include "AllocationCounter.h"
+
+#include <cstdlib>
+#include <new>
+
+static thread_local AllocationCount allocations;
+
+AllocationCount thread_allocations() noexcept {
+    return allocations;
+}
+
+// Array and nothrow forms of the standard library forward to these two
+void* operator new(std::size_t size) {
+    allocations.count++;
+    allocations.bytes += size;
+    if (auto p = std::malloc(size ? size : 1))
+        return p;
+    throw std::bad_alloc();
+}
+
+void operator delete(void *p) noexcept {
+    std::free(p);
+}
+
+void operator delete(void *p, std::size_t) noexcept {
+    std::free(p);
+}
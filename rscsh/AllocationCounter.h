@@ -0,0 +1,18 @@
+#pragma once
+
+#include <cstddef>
+
+// Heap allocations made by the calling thread, counted by the replaced global operator new.
+struct AllocationCount {
+    unsigned long long count = 0;
+    unsigned long long bytes = 0;
+
+    inline AllocationCount operator-(AllocationCount const &other) const noexcept {
+        return { count - other.count, bytes - other.bytes };
+    }
+    inline AllocationCount operator+(AllocationCount const &other) const noexcept {
+        return { count + other.count, bytes + other.bytes };
+    }
+};
+
+AllocationCount thread_allocations() noexcept;
@@ -0,0 +1,159 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+
+#include <scb/Bytes.h>
+
+// APDU bytes stored inline up to the size of short APDUs, so that exchanges need no heap.
+// Extended length APDUs spill to a heap block, which is kept for the next long one.
+template <size_t InlineCapacity>
+class ApduBuffer {
+public:
+    static constexpr size_t inline_capacity = InlineCapacity;
+
+    ApduBuffer() = default;
+    ApduBuffer(unsigned char const *data, size_t size) { assign(data, size); }
+    explicit ApduBuffer(scb::Bytes const &bytes) { assign(bytes.data(), bytes.size()); }
+
+    ApduBuffer(ApduBuffer const &other) { assign(other.data(), other.size()); }
+    ApduBuffer& operator=(ApduBuffer const &other) {
+        if (this != &other)
+            assign(other.data(), other.size());
+        return *this;
+    }
+
+    void assign(unsigned char const *data, size_t size) {
+        size_ = 0;
+        resize(size);
+        std::memcpy(this->data(), data, size);
+    }
+
+    // Contents up to the smaller size are kept.
+    void resize(size_t size) {
+        if (size > InlineCapacity) {
+            if (size > spillCapacity_) {
+                auto spill = std::make_unique<unsigned char[]>(size);
+                std::memcpy(spill.get(), data(), std::min(size_, size));
+                spill_ = std::move(spill);
+                spillCapacity_ = size;
+            } else if (size_ <= InlineCapacity) {
+                std::memcpy(spill_.get(), inline_.data(), size_);
+            }
+        } else if (size_ > InlineCapacity) {
+            std::memcpy(inline_.data(), spill_.get(), size);
+        }
+        size_ = size;
+    }
+
+    inline unsigned char* data() noexcept { return size_ > InlineCapacity ? spill_.get() : inline_.data(); }
+    inline unsigned char const* data() const noexcept { return size_ > InlineCapacity ? spill_.get() : inline_.data(); }
+    inline size_t size() const noexcept { return size_; }
+    inline bool empty() const noexcept { return size_ == 0; }
+    inline bool spilled() const noexcept { return size_ > InlineCapacity; }
+
+    inline unsigned char& operator[](size_t i) noexcept { return data()[i]; }
+    inline unsigned char operator[](size_t i) const noexcept { return data()[i]; }
+
+    // Status word of a response, 0 when there is none.
+    inline unsigned char sw1() const noexcept { return size_ >= 2 ? data()[size_ - 2] : 0; }
+    inline unsigned char sw2() const noexcept { return size_ >= 2 ? data()[size_ - 1] : 0; }
+    inline unsigned short sw() const noexcept { return static_cast<unsigned short>(sw1() << 8 | sw2()); }
+
+    scb::Bytes bytes() const {
+        scb::Bytes bytes(size_);
+        std::copy(data(), data() + size_, bytes.begin());
+        return bytes;
+    }
+
+private:
+    std::array<unsigned char, InlineCapacity> inline_;
+    std::unique_ptr<unsigned char[]> spill_;
+    size_t spillCapacity_ = 0;
+    size_t size_ = 0;
+};
+
+// CLA INS P1 P2 Lc, 255 data bytes and Le
+using CommandApdu = ApduBuffer<261>;
+// 256 data bytes and SW
+using ResponseApdu = ApduBuffer<258>;
+
+// Builders of common commands. Evaluated at compile time (constexpr variables), an invalid
+// header does not compile; at run time it throws.
+namespace apdu {
+
+template <size_t N>
+struct Fixed {
+    std::array<unsigned char, N> bytes{};
+
+    constexpr unsigned char const* data() const noexcept { return bytes.data(); }
+    constexpr size_t size() const noexcept { return N; }
+};
+
+constexpr Fixed<5> get_response(unsigned le) {
+    if (le == 0 || le > 256)
+        throw std::invalid_argument("Le of GET RESPONSE must be 1 to 256");
+    return { { 0x00, 0xC0, 0x00, 0x00, static_cast<unsigned char>(le) } };
+}
+
+constexpr Fixed<5> read_record(unsigned record, unsigned sfi) {
+    if (record == 0 || record > 0xFE)
+        throw std::invalid_argument("record number must be 1 to 254");
+    if (sfi == 0 || sfi > 30)
+        throw std::invalid_argument("SFI must be 1 to 30");
+    return { { 0x00, 0xB2, static_cast<unsigned char>(record), static_cast<unsigned char>(sfi << 3 | 0x04), 0x00 } };
+}
+
+constexpr Fixed<5> get_data(unsigned tag, unsigned char cla = 0x80) {
+    if (tag == 0 || tag > 0xFFFF)
+        throw std::invalid_argument("GET DATA tag must be one or two bytes");
+    if (cla != 0x00 && cla != 0x80)
+        throw std::invalid_argument("GET DATA class must be 00 or 80");
+    return { { cla, 0xCA, static_cast<unsigned char>(tag >> 8), static_cast<unsigned char>(tag), 0x00 } };
+}
+
+constexpr unsigned char hex_byte(char high, char low) {
+    auto digit = [](char c) -> unsigned {
+        if (c >= '0' && c <= '9') return static_cast<unsigned>(c - '0');
+        if (c >= 'a' && c <= 'f') return static_cast<unsigned>(c - 'a' + 10);
+        if (c >= 'A' && c <= 'F') return static_cast<unsigned>(c - 'A' + 10);
+        throw std::invalid_argument("AID is not hex");
+    };
+    return static_cast<unsigned char>(digit(high) << 4 | digit(low));
+}
+
+// SELECT by name of the AID in hex, e.g. select("a0000000031010").
+template <size_t HexSize>
+constexpr Fixed<5 + (HexSize - 1) / 2 + 1> select(char const (&aid)[HexSize], bool first = true) {
+    constexpr size_t length = (HexSize - 1) / 2;
+    static_assert((HexSize - 1) % 2 == 0, "AID must have even number of hex digits");
+    static_assert(length >= 5 && length <= 16, "AID must be 5 to 16 bytes");
+
+    Fixed<5 + length + 1> command;
+    command.bytes[0] = 0x00;
+    command.bytes[1] = 0xA4;
+    command.bytes[2] = 0x04;
+    command.bytes[3] = first ? 0x00 : 0x02;
+    command.bytes[4] = static_cast<unsigned char>(length);
+    for (size_t i = 0; i < length; i++)
+        command.bytes[5 + i] = hex_byte(aid[2 * i], aid[2 * i + 1]);
+    command.bytes[5 + length] = 0x00;
+    return command;
+}
+
+// Command with Le replaced by the length from 6Cxx, appended when the command had no Le.
+template <size_t N>
+void fix_length(ApduBuffer<N> &command, unsigned char le) {
+    if (command.size() < 4)
+        throw std::invalid_argument("command has no header");
+    bool hasLe = command.size() == 5 || (command.size() > 5 && command.size() == 5u + command[4] + 1);
+    if (!hasLe)
+        command.resize(command.size() + 1);
+    command[command.size() - 1] = le;
+}
+
+}
@@ -0,0 +1,163 @@
+#include "ApduSweep.h"
+
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include <stdexcept>
+
+ApduSweep::ApduSweep(Spec spec)
+    : spec_(std::move(spec))
+    , command_(4)
+{
+    for (auto const &field : spec_.fields) {
+        if (field.empty())
+            throw std::runtime_error("sweep field has no values");
+        total_ *= field.size();
+    }
+    command_ += spec_.tail;
+    update_command();
+}
+
+std::vector<unsigned char> ApduSweep::parse_field(std::wstring const &field) {
+    std::vector<unsigned char> values;
+    std::wistringstream stream(field);
+    for (std::wstring item; std::getline(stream, item, L','); ) {
+        auto dash = item.find(L'-');
+        auto first = std::stoul(item.substr(0, dash), nullptr, 16);
+        auto last = dash == std::wstring::npos ? first : std::stoul(item.substr(dash + 1), nullptr, 16);
+        if (first > 0xFF || last > 0xFF || first > last)
+            throw std::runtime_error("sweep range must be within 00-FF");
+        for (auto value = first; value <= last; value++)
+            values.push_back(static_cast<unsigned char>(value));
+    }
+    return values;
+}
+
+std::wstring ApduSweep::format_field(std::vector<unsigned char> const &values) {
+    std::wostringstream stream;
+    stream << std::hex << std::setfill(L'0');
+    for (size_t i = 0; i < values.size(); ) {
+        size_t j = i;
+        while (j + 1 < values.size() && values[j + 1] == values[j] + 1)
+            j++;
+        if (i > 0)
+            stream << L',';
+        stream << std::setw(2) << static_cast<unsigned>(values[i]);
+        if (j > i)
+            stream << L'-' << std::setw(2) << static_cast<unsigned>(values[j]);
+        i = j + 1;
+    }
+    return stream.str();
+}
+
+void ApduSweep::record(unsigned short sw) {
+    sent_++;
+
+    auto &bucket = histogram_[sw];
+    bucket.count++;
+    if (bucket.exampleCount < Bucket::MaxExamples)
+        bucket.examples[bucket.exampleCount++] = (command_[0] << 24) | (command_[1] << 16) | (command_[2] << 8) | command_[3];
+
+    if (sw == 0x6E00) {
+        // Class not supported: nothing else of this CLA is worth sending
+        skipped_ += spec_.fields[1].size() * spec_.fields[2].size() * spec_.fields[3].size()
+            - (position_[1] * spec_.fields[2].size() * spec_.fields[3].size() + position_[2] * spec_.fields[3].size() + position_[3] + 1);
+        advance(0);
+    } else if (sw == 0x6D00) {
+        // Instruction not supported: skip all P1 / P2 of it
+        skipped_ += spec_.fields[2].size() * spec_.fields[3].size() - (position_[2] * spec_.fields[3].size() + position_[3] + 1);
+        advance(1);
+    } else {
+        advance(3);
+    }
+}
+
+void ApduSweep::advance(size_t level) {
+    for (size_t i = level + 1; i < 4; i++)
+        position_[i] = 0;
+    for (size_t i = level; ; i--) {
+        if (++position_[i] < spec_.fields[i].size() || i == 0)
+            break;
+        position_[i] = 0;
+    }
+    if (!done())
+        update_command();
+}
+
+void ApduSweep::update_command() {
+    for (size_t i = 0; i < 4; i++)
+        command_[i] = spec_.fields[i][position_[i]];
+}
+
+void ApduSweep::save(std::filesystem::path const &path) const {
+    std::wofstream file(path);
+    if (!file)
+        throw std::runtime_error("cannot write sweep checkpoint");
+
+    file << L"spec";
+    for (auto const &field : spec_.fields)
+        file << L' ' << format_field(field);
+    file << L' ';
+    spec_.tail.print(file, L"");
+    file << L"\nposition " << position_[0] << L' ' << position_[1] << L' ' << position_[2] << L' ' << position_[3];
+    file << L"\ncounters " << sent_ << L' ' << skipped_;
+    file << L"\nrate " << spec_.rate << L'\n';
+
+    for (auto const &[sw, bucket] : histogram_) {
+        file << L"sw " << std::hex << sw << L' ' << std::dec << bucket.count;
+        for (unsigned char i = 0; i < bucket.exampleCount; i++)
+            file << L' ' << std::hex << bucket.examples[i] << std::dec;
+        file << L'\n';
+    }
+
+    if (!file)
+        throw std::runtime_error("cannot write sweep checkpoint");
+}
+
+ApduSweep ApduSweep::load(std::filesystem::path const &path) {
+    std::wifstream file(path);
+    if (!file)
+        throw std::runtime_error("cannot read sweep checkpoint");
+
+    std::wstring keyword, line;
+    std::getline(file, line);
+    std::wistringstream specLine(line);
+    Spec spec;
+    std::wstring fields[4], tail;
+    if (!(specLine >> keyword >> fields[0] >> fields[1] >> fields[2] >> fields[3]) || keyword != L"spec")
+        throw std::runtime_error("invalid sweep checkpoint");
+    specLine >> tail;
+    for (size_t i = 0; i < 4; i++)
+        spec.fields[i] = parse_field(fields[i]);
+    spec.tail = scb::Bytes(tail);
+
+    ApduSweep sweep(std::move(spec));
+    if (!(file >> keyword >> sweep.position_[0] >> sweep.position_[1] >> sweep.position_[2] >> sweep.position_[3]) || keyword != L"position")
+        throw std::runtime_error("invalid sweep checkpoint");
+    if (!(file >> keyword >> sweep.sent_ >> sweep.skipped_) || keyword != L"counters")
+        throw std::runtime_error("invalid sweep checkpoint");
+    for (size_t i = 0; i < 4; i++)
+        if (sweep.position_[i] > sweep.spec_.fields[i].size() || (i > 0 && sweep.position_[i] == sweep.spec_.fields[i].size()))
+            throw std::runtime_error("invalid sweep checkpoint");
+
+    std::getline(file, line);
+    while (std::getline(file, line)) {
+        std::wistringstream swLine(line);
+        // Checkpoints written before the rate was saved have no rate line, they resume at full speed
+        if (swLine >> keyword && keyword == L"rate") {
+            swLine >> sweep.spec_.rate;
+            continue;
+        }
+        unsigned sw;
+        Bucket bucket;
+        if (keyword != L"sw" || !(swLine >> std::hex >> sw >> std::dec >> bucket.count))
+            continue;
+        for (std::uint32_t example; bucket.exampleCount < Bucket::MaxExamples && swLine >> std::hex >> example; )
+            bucket.examples[bucket.exampleCount++] = example;
+        sweep.histogram_[static_cast<unsigned short>(sw)] = bucket;
+    }
+
+    if (!sweep.done())
+        sweep.update_command();
+    return sweep;
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <scb/Bytes.h>
+
+// Generates APDUs for every CLA / INS / P1 / P2 combination of a spec, and classifies the status words.
+// Each field of the spec is a comma separated list of bytes and ranges, e.g. "00,80-8f".
+// Subtrees are skipped when the card rejects them: 6E00 skips the rest of the CLA, 6D00 the rest of the INS.
+// The sweep position, its rate and the histogram can be saved to a checkpoint file and resumed later.
+class ApduSweep {
+public:
+    struct Spec {
+        std::vector<unsigned char> fields[4];   // CLA, INS, P1, P2
+        scb::Bytes tail;                        // appended to every header: Le, or Lc and data
+        unsigned long rate = 0;                 // commands per second, 0 for as fast as the reader allows
+    };
+
+    // Status word bucket, keeps only a few example headers packed in 32 bits.
+    struct Bucket {
+        static constexpr size_t MaxExamples = 4;
+
+        unsigned long long count = 0;
+        std::uint32_t examples[MaxExamples] = {};
+        unsigned char exampleCount = 0;
+    };
+
+    explicit ApduSweep(Spec spec);
+
+    static std::vector<unsigned char> parse_field(std::wstring const &field);
+    static std::wstring format_field(std::vector<unsigned char> const &values);
+
+    static ApduSweep load(std::filesystem::path const &path);
+    void save(std::filesystem::path const &path) const;
+
+    inline bool done() const noexcept { return position_[0] >= spec_.fields[0].size(); }
+
+    // Command at the current position, valid until the next call of record().
+    inline scb::Bytes const& command() const noexcept { return command_; }
+    // Records status word of command() and moves to the next command.
+    void record(unsigned short sw);
+
+    inline Spec const& spec() const noexcept { return spec_; }
+    inline unsigned long long total() const noexcept { return total_; }
+    inline unsigned long long sent() const noexcept { return sent_; }
+    inline unsigned long long skipped() const noexcept { return skipped_; }
+    inline std::unordered_map<unsigned short, Bucket> const& histogram() const noexcept { return histogram_; }
+
+private:
+    void advance(size_t level);
+    void update_command();
+
+    Spec spec_;
+    size_t position_[4] = {};
+    scb::Bytes command_;
+    unsigned long long total_ = 1;
+    unsigned long long sent_ = 0;
+    unsigned long long skipped_ = 0;
+    std::unordered_map<unsigned short, Bucket> histogram_;
+};
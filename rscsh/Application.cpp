@@ -5,6 +5,7 @@
 #include <vector>
 #include <system_error>
 #include <cwchar>
+#include <thread>
 
 #include "version.ver"
 
@@ -24,6 +25,14 @@ static INT_PTR CALLBACK input_proc(HWND hwnd, UINT uMsg, WPARAM wParam, LPARAM l
     return app->input_proc(hwnd, uMsg, wParam, lParam);
 }
 
+// Posted by the auto-connect worker, lParam owns a ConnectedCard
+static UINT const WM_CARD_CONNECTED = WM_APP + 1;
+
+struct ConnectedCard {
+    std::unique_ptr<rsc::Card> card;
+    std::wstring reader;
+};
+
 wchar_t const *Application::APP_NAME = L"rscsh";
 wchar_t const *Application::APP_VERSION = L"" VERSION;
 
@@ -42,8 +51,12 @@ Application::Application(HINSTANCE hInstance)
     , origInputProc_(NULL)
     , fontSize_(DEF_FONT_SIZE)
     , input_ctrl_pressed_(false)
-    , selectedInput_(inputHistory_.end())
+    , inputHistory_(InputHistory::default_path())
+    , selectedInput_(InputHistory::npos)
+    , searchingInput_(false)
+    , searchMatch_(InputHistory::npos)
     , shell_(shell_log_, std::bind(&Application::shell_done, this))
+    , completion_(std::bind(&Application::completion_values, this, std::placeholders::_1))
 {
     create_main_dialog();
 
@@ -100,6 +113,12 @@ INT_PTR Application::main_dialog_proc(HWND hwndDlg, UINT uMsg, WPARAM wParam, LP
         case WM_DESTROY:
             PostQuitMessage(0);
             return TRUE;
+
+        case WM_CARD_CONNECTED: {
+            std::unique_ptr<ConnectedCard> connected(reinterpret_cast<ConnectedCard*>(lParam));
+            card_connected(std::move(connected->card), connected->reader);
+            return TRUE;
+        }
     }
     return FALSE;
 }
@@ -174,16 +193,22 @@ void Application::shell_done() {
 
 void Application::rsc_event(DWORD event, rsc::Context const &context, std::wstring const &reader) {
     try {
+        if (event & (SCARD_STATE_UNKNOWN | SCARD_STATE_UNAVAILABLE))
+            shell_.card_shell().reader_registry().detach(reader);
+        else
+            shell_.card_shell().reader_registry().update(context, reader, (event & SCARD_STATE_PRESENT) != 0);
+
         if (event & SCARD_STATE_PRESENT) {
             logf(L"Smart card was connected to the reader \"%s\"\r\n", reader.c_str());
-            if (!shell_.card_shell().has_card()) {
-                logf(L"Connecting ...\r\n");
-                Sleep(1000);
-                shell_.card_shell().create_card_and_connect(reader.c_str());
-                shell_.card_shell().print_connection_info();
-                log_shell();
-            } else {
+            if (shell_.card_shell().has_card() || shell_.card_shell().has_simulated_card()) {
                 logf(L"Not connecting because other connection outstanding.\r\n");
+            } else if (!shell_.card_shell().auto_connect().wants(reader)) {
+                logf(L"Not connecting because of auto-connect policy.\r\n");
+            } else if (autoConnecting_.valid() && autoConnecting_.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+                logf(L"Not connecting because other connection is being established.\r\n");
+            } else {
+                logf(L"Connecting ...\r\n");
+                autoConnecting_ = std::async(std::launch::async, &Application::auto_connect, this, std::cref(context), reader, std::chrono::steady_clock::now());
             }
         } else if (event & SCARD_STATE_EMPTY) {
             logf(L"Smart card was disconnected from the reader \"%s\"\r\n", reader.c_str());
@@ -198,6 +223,36 @@ void Application::rsc_event(DWORD event, rsc::Context const &context, std::wstri
     }
 }
 
+void Application::auto_connect(rsc::Context const &context, std::wstring const &reader, std::chrono::steady_clock::time_point inserted) {
+    try {
+        auto connected = std::make_unique<ConnectedCard>();
+        connected->card = shell_.card_shell().auto_connect().connect(context, reader, inserted);
+        connected->reader = reader;
+        if (PostMessage(hMainDialog_, WM_CARD_CONNECTED, 0, reinterpret_cast<LPARAM>(connected.get())))
+            connected.release();
+    } catch (std::exception const &e) {
+        logf("Error: %s\r\n", e.what());
+    }
+}
+
+void Application::card_connected(std::unique_ptr<rsc::Card> card, std::wstring const &reader) {
+    try {
+        if (shell_.card_shell().has_card() || shell_.card_shell().has_simulated_card()) {
+            logf(L"Not connecting because other connection outstanding.\r\n");
+            card->disconnect();
+            return;
+        }
+
+        auto stats = shell_.card_shell().auto_connect().stats();
+        logf(L"Connected in %.1f ms (%u attempts)\r\n", stats.lastMs, stats.lastAttempts);
+        shell_.card_shell().set_card(std::move(card), reader);
+        shell_.card_shell().print_connection_info();
+        log_shell();
+    } catch (std::exception const &e) {
+        logf("Error: %s\r\n", e.what());
+    }
+}
+
 void Application::card_shell_connection_changed(std::wstring const &reader) {
     if (!reader.empty()) {
         set_title(L"Connected to " + reader);
@@ -207,10 +262,33 @@ void Application::card_shell_connection_changed(std::wstring const &reader) {
 }
 
 bool Application::input_proc_char(WPARAM wParam, LPARAM lParam) {
+    if (searchingInput_) {
+        if (wParam == 0x12) // Ctrl+R
+            return true;
+        if (wParam == VK_ESCAPE) {
+            leave_input_history_search(true);
+            return true;
+        }
+        if (wParam == VK_BACK) {
+            if (!searchQuery_.empty())
+                searchQuery_.pop_back();
+            search_input_history(false);
+            return true;
+        }
+        if (wParam >= L' ' && wParam != 127) {
+            searchQuery_ += static_cast<wchar_t>(wParam);
+            search_input_history(false);
+            return true;
+        }
+        leave_input_history_search(false);
+    }
+
     switch (wParam) {
         case VK_RETURN:
             process_input();
             return true;
+        case VK_TAB:
+            return true;
         case VK_LBUTTON:
             return true;
         case 127: // DEL
@@ -224,6 +302,21 @@ bool Application::input_proc_keydown(WPARAM wParam, LPARAM lParam) {
         case VK_CONTROL:
             input_ctrl_pressed_ = true;
             return true;
+        case 'R':
+            if (input_ctrl_pressed_) {
+                if (!searchingInput_) {
+                    std::vector<wchar_t> buffer(2048);
+                    auto length = GetWindowText(hInput_, buffer.data(), static_cast<int>(buffer.size()));
+                    searchOrigin_.assign(buffer.data(), length);
+                    searchQuery_ = searchOrigin_;
+                    searchingInput_ = true;
+                    search_input_history(false);
+                } else {
+                    search_input_history(true);
+                }
+                return true;
+            }
+            break;
         case 'A':
             if (input_ctrl_pressed_) {
                 SendMessage(hInput_, EM_SETSEL, 0, -1);
@@ -235,10 +328,16 @@ bool Application::input_proc_keydown(WPARAM wParam, LPARAM lParam) {
             if (input_ctrl_pressed_)
                 return erase_word_at_cursor();
             break;
+        case VK_TAB:
+            leave_input_history_search(false);
+            complete_input();
+            return true;
         case VK_DOWN:
+            leave_input_history_search(false);
             select_input_history_entry(+1);
             return true;
         case VK_UP:
+            leave_input_history_search(false);
             select_input_history_entry(-1);
             return true;
     }
@@ -362,12 +461,25 @@ void Application::logf(wchar_t const *fmt, ...) {
 }
 
 void Application::log_shell() {
-    log(shell_log_.str().c_str());
+    // The window is the only place where shell output is UTF-16
+    Profiler::Scope scope(&shell_.profiler(), Profiler::Phase::UiAppend);
+    log(from_utf8(shell_log_.str()).c_str());
     clear_shell_log();
 }
 
+void Application::log_profile() {
+    auto &profiler = shell_.profiler();
+    if (!profiler.in_command())
+        return;
+    profiler.end_command();
+
+    std::ostringstream text;
+    profiler.print_command(text);
+    log(from_utf8(text.str()).c_str());
+}
+
 void Application::clear_shell_log() {
-    shell_log_.str(std::wstring());
+    shell_log_.str(std::string());
     shell_log_.clear();
 }
 
@@ -379,10 +491,10 @@ void Application::process_input() {
 
     SetWindowText(hInput_, L"");
 
-    if (buffer.size() > 1 && (inputHistory_.empty() || inputHistory_.back() != buffer.data())) {
-        inputHistory_.emplace_back(buffer.data());
-    }
-    selectedInput_ = inputHistory_.end();
+    leave_input_history_search(false);
+    if (buffer.size() > 1)
+        inputHistory_.add(buffer.data());
+    selectedInput_ = InputHistory::npos;
 
     shell_execute(buffer.data());
 }
@@ -398,25 +510,96 @@ void Application::shell_execute(LPCTSTR command) {
         log_shell();
         logf("Error: %s\r\n", e.what());
     }
+    log_profile();
 }
 
 void Application::select_input_history_entry(int offset) {
-    if (inputHistory_.empty())
+    auto size = inputHistory_.size();
+    if (size == 0)
         return;
 
-    selectedInput_ += offset;
+    // Positions 0 to size - 1 are entries, size is the empty input
+    auto position = static_cast<long long>(std::min(selectedInput_, size)) + offset;
+    position %= static_cast<long long>(size + 1);
+    if (position < 0)
+        position += size + 1;
+    selectedInput_ = static_cast<size_t>(position);
 
-    while (selectedInput_ < inputHistory_.begin())
-        selectedInput_ += inputHistory_.end() - inputHistory_.begin() + 1;
-    while (selectedInput_ > inputHistory_.end())
-        selectedInput_ -= inputHistory_.end() - inputHistory_.begin() + 1;
+    set_input(selectedInput_ != size ? inputHistory_.at(selectedInput_) : std::wstring());
+}
 
-    if (selectedInput_ != inputHistory_.end()) {
-        SetWindowText(hInput_, selectedInput_->c_str());
-        SendMessage(hInput_, EM_SETSEL, selectedInput_->size(), selectedInput_->size());
-    } else {
-        SetWindowText(hInput_, L"");
+void Application::set_input(std::wstring const &text) {
+    SetWindowText(hInput_, text.c_str());
+    SendMessage(hInput_, EM_SETSEL, text.size(), text.size());
+}
+
+void Application::search_input_history(bool older) {
+    auto before = older && searchMatch_ != InputHistory::npos ? searchMatch_ : inputHistory_.size();
+    auto match = inputHistory_.search(searchQuery_, before);
+    if (match != InputHistory::npos || !older)
+        searchMatch_ = match;
+
+    set_input(searchMatch_ != InputHistory::npos ? inputHistory_.at(searchMatch_) : searchQuery_);
+    SetWindowText(hSymbols_, (L"? " + searchQuery_).c_str());
+}
+
+void Application::leave_input_history_search(bool restore) {
+    if (!searchingInput_)
+        return;
+    searchingInput_ = false;
+    if (restore)
+        set_input(searchOrigin_);
+    selectedInput_ = searchMatch_ != InputHistory::npos && !restore ? searchMatch_ : InputHistory::npos;
+    searchMatch_ = InputHistory::npos;
+}
+
+void Application::complete_input() {
+    std::vector<wchar_t> buffer(2048);
+    auto length = GetWindowText(hInput_, buffer.data(), static_cast<int>(buffer.size()));
+    DWORD selStart, selEnd;
+    SendMessage(hInput_, EM_GETSEL, reinterpret_cast<WPARAM>(&selStart), reinterpret_cast<LPARAM>(&selEnd));
+    selEnd = std::min(selEnd, static_cast<DWORD>(length));
+
+    std::wstring line(buffer.data(), selEnd);
+    std::wstring rest(buffer.data() + selEnd, length - selEnd);
+    auto candidates = completion_.complete(line);
+    if (candidates.empty())
+        return;
+
+    auto wordStart = line.find_last_of(L' ') + 1;
+    auto completed = candidates.size() == 1 ? candidates[0] + L' ' : Completion::common_prefix(candidates);
+    if (candidates.size() > 1 && completed.size() <= line.size() - wordStart) {
+        std::wstring list;
+        for (auto const &candidate : candidates)
+            list += candidate + L"  ";
+        log((list + L"\r\n").c_str());
+        return;
+    }
+
+    line = line.substr(0, wordStart) + completed;
+    SetWindowText(hInput_, (line + rest).c_str());
+    SendMessage(hInput_, EM_SETSEL, line.size(), line.size());
+}
+
+std::vector<std::wstring> Application::completion_values(Completion::Source source) {
+    std::vector<std::wstring> values;
+    switch (source) {
+        case Completion::Source::Readers:
+            for (auto const &reader : shell_.card_shell().reader_registry().list()) {
+                if (reader.attached)
+                    values.push_back(reader.name);
+            }
+            break;
+        case Completion::Source::KeySets:
+            values = shell_.card_shell().key_set_names();
+            break;
+        case Completion::Source::Aids:
+            values = shell_.card_shell().known_aids();
+            break;
+        default:
+            break;
     }
+    return values;
 }
 
 bool Application::erase_word_at_cursor() {
@@ -1,9 +1,15 @@
 #pragma once
 
 #include "MainShell.h"
+#include "InputHistory.h"
+#include "Completion.h"
 
 #include <rsc/EventListener.h>
 
+#include <chrono>
+#include <future>
+#include <memory>
+
 #include <Windows.h>
 
 class Application {
@@ -34,6 +40,8 @@ private:
     void shell_done();
 
     void rsc_event(DWORD event, rsc::Context const &context, std::wstring const &reader);
+    void auto_connect(rsc::Context const &context, std::wstring const &reader, std::chrono::steady_clock::time_point inserted);
+    void card_connected(std::unique_ptr<rsc::Card> card, std::wstring const &reader);
     void card_shell_connection_changed(std::wstring const &reader);
 
     bool input_proc_char(WPARAM wParam, LPARAM lParam);
@@ -51,12 +59,21 @@ private:
     void logf(wchar_t const *fmt, ...);
 
     void log_shell();
+    // Breakdown of the command just logged, when profiling.
+    void log_profile();
     void clear_shell_log();
     
     void process_input();
     void shell_execute(LPCTSTR command);
 
     void select_input_history_entry(int offset);
+    void set_input(std::wstring const &text);
+    // Ctrl+R: typed characters narrow the search, Ctrl+R again finds older entries, Escape restores the input.
+    void search_input_history(bool older);
+    void leave_input_history_search(bool restore);
+    // Tab: completes the word before the cursor, or lists the candidates when it cannot be extended.
+    void complete_input();
+    std::vector<std::wstring> completion_values(Completion::Source source);
     bool erase_word_at_cursor();
 
     HINSTANCE hInstance_;
@@ -76,10 +93,19 @@ private:
 
     bool input_ctrl_pressed_;
 
-    std::vector<std::wstring> inputHistory_;
-    std::vector<std::wstring>::iterator selectedInput_;
+    InputHistory inputHistory_;
+    size_t selectedInput_;     // inputHistory_.size() when none
+
+    bool searchingInput_;
+    std::wstring searchQuery_;
+    std::wstring searchOrigin_;
+    size_t searchMatch_;
 
     rsc::EventListener rscEventListener_;
     MainShell shell_;
-    std::wostringstream shell_log_;
+    std::ostringstream shell_log_;     // UTF-8
+    Completion completion_;
+
+    // Connects on a worker thread, the card is handed over to the shell on the dialog thread
+    std::future<void> autoConnecting_;
 };
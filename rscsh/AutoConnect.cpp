@@ -0,0 +1,90 @@
+#include "AutoConnect.h"
+
+#include <algorithm>
+#include <cwctype>
+#include <system_error>
+#include <thread>
+
+static constexpr auto FirstRetryDelay = std::chrono::milliseconds(5);
+static constexpr auto MaxRetryDelay = std::chrono::milliseconds(320);
+static constexpr auto GiveUpAfter = std::chrono::seconds(5);
+
+void AutoConnect::set_policy(Policy policy, std::wstring const &pinnedReader) {
+    std::lock_guard lock(mutex_);
+    policy_ = policy;
+    pinnedReader_ = pinnedReader;
+    std::transform(pinnedReader_.begin(), pinnedReader_.end(), pinnedReader_.begin(), ::towlower);
+}
+
+AutoConnect::Policy AutoConnect::policy() const {
+    std::lock_guard lock(mutex_);
+    return policy_;
+}
+
+std::wstring AutoConnect::pinned_reader() const {
+    std::lock_guard lock(mutex_);
+    return pinnedReader_;
+}
+
+bool AutoConnect::wants(std::wstring const &reader) const {
+    std::lock_guard lock(mutex_);
+    switch (policy_) {
+        case FirstReader:
+            return true;
+        case PinnedReader: {
+            auto name = reader;
+            std::transform(name.begin(), name.end(), name.begin(), ::towlower);
+            return name.find(pinnedReader_) != std::wstring::npos;
+        }
+        default:
+            return false;
+    }
+}
+
+std::unique_ptr<rsc::Card> AutoConnect::connect(rsc::Context const &context, std::wstring const &reader, std::chrono::steady_clock::time_point inserted) {
+    auto delay = std::chrono::duration_cast<std::chrono::steady_clock::duration>(FirstRetryDelay);
+    unsigned attempts = 0;
+    for (;;) {
+        attempts++;
+        try {
+            auto card = std::make_unique<rsc::Card>(context, reader.c_str());
+
+            auto ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - inserted).count();
+            std::lock_guard lock(mutex_);
+            stats_.connects++;
+            stats_.lastAttempts = attempts;
+            stats_.lastMs = ms;
+            stats_.totalMs += ms;
+            stats_.maxMs = std::max(stats_.maxMs, ms);
+            return card;
+        } catch (std::system_error const &e) {
+            if (!retryable(e.code().value()) || std::chrono::steady_clock::now() + delay - inserted > GiveUpAfter) {
+                std::lock_guard lock(mutex_);
+                stats_.failures++;
+                throw;
+            }
+        }
+        std::this_thread::sleep_for(delay);
+        delay = std::min<std::chrono::steady_clock::duration>(delay * 2, MaxRetryDelay);
+    }
+}
+
+AutoConnect::Stats AutoConnect::stats() const {
+    std::lock_guard lock(mutex_);
+    return stats_;
+}
+
+bool AutoConnect::retryable(long code) {
+    // Card not answering yet, or reader still held by the application which noticed the card first
+    switch (code) {
+        case SCARD_E_SHARING_VIOLATION:
+        case SCARD_E_NOT_READY:
+        case SCARD_E_NO_SMARTCARD:
+        case SCARD_W_UNRESPONSIVE_CARD:
+        case SCARD_W_UNPOWERED_CARD:
+        case SCARD_W_RESET_CARD:
+            return true;
+        default:
+            return false;
+    }
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <rsc/Card.h>
+#include <rsc/Context.h>
+
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <string>
+
+// Policy and statistics of connecting to cards when they are inserted.
+// Cards are connected right away and retried with exponential backoff while they are still
+// powering up or the reader is used by another application, instead of waiting a fixed time.
+// All methods are safe to call from several threads.
+class AutoConnect {
+public:
+    enum Policy {
+        Off,
+        FirstReader,    // any reader, when not connected
+        PinnedReader,   // only the reader with (part of) the pinned name
+    };
+
+    struct Stats {
+        unsigned long long connects = 0;
+        unsigned long long failures = 0;
+        unsigned lastAttempts = 0;
+        double lastMs = 0;
+        double totalMs = 0;
+        double maxMs = 0;
+    };
+
+    void set_policy(Policy policy, std::wstring const &pinnedReader = std::wstring());
+    Policy policy() const;
+    std::wstring pinned_reader() const;
+    bool wants(std::wstring const &reader) const;
+
+    // Connects to the card, latency is measured from the insertion event.
+    std::unique_ptr<rsc::Card> connect(rsc::Context const &context, std::wstring const &reader, std::chrono::steady_clock::time_point inserted);
+
+    Stats stats() const;
+
+private:
+    static bool retryable(long code);
+
+    mutable std::mutex mutex_;
+    Policy policy_ = FirstReader;
+    std::wstring pinnedReader_;
+    Stats stats_;
+};
@@ -0,0 +1,159 @@
+#include "BenchSuite.h"
+#include "AllocationCounter.h"
+#include "Platform.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <stdexcept>
+
+using Clock = std::chrono::steady_clock;
+
+static double elapsed_ns(std::function<void()> const &body, unsigned long long iterations) {
+    auto start = Clock::now();
+    for (unsigned long long i = 0; i < iterations; i++)
+        body();
+    return std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+}
+
+BenchSuite::BenchSuite(std::chrono::milliseconds sampleTime, unsigned samples)
+    : sampleTime_(sampleTime)
+    , samples_(std::max(samples, 1u))
+{
+}
+
+void BenchSuite::add(std::string name, std::function<void()> body, std::function<void()> setup) {
+    benchmarks_.push_back({ std::move(name), std::move(body), std::move(setup) });
+}
+
+BenchSuite::Result BenchSuite::measure(Benchmark const &benchmark) const {
+    if (benchmark.setup)
+        benchmark.setup();
+
+    // Calibration doubles as warm-up: caches, branch predictors and buffers kept by the code under test
+    double target = std::chrono::duration<double, std::nano>(sampleTime_).count();
+    unsigned long long iterations = 1;
+    for (;;) {
+        auto ns = elapsed_ns(benchmark.body, iterations);
+        if (ns >= target)
+            break;
+        auto scale = ns > 0 ? target / ns : 100.0;
+        iterations = static_cast<unsigned long long>(iterations * std::clamp(scale * 1.1, 1.5, 100.0)) + 1;
+    }
+    elapsed_ns(benchmark.body, iterations);
+
+    std::vector<double> perIteration;
+    perIteration.reserve(samples_);
+    auto allocations = thread_allocations();
+    for (unsigned i = 0; i < samples_; i++)
+        perIteration.push_back(elapsed_ns(benchmark.body, iterations) / iterations);
+    auto allocated = thread_allocations() - allocations;
+
+    std::sort(perIteration.begin(), perIteration.end());
+    auto runs = static_cast<double>(iterations) * samples_;
+    Result result;
+    result.name = benchmark.name;
+    result.iterations = iterations;
+    result.medianNs = perIteration[perIteration.size() / 2];
+    result.minNs = perIteration.front();
+    result.maxNs = perIteration.back();
+    result.allocations = allocated.count / runs;
+    result.bytes = allocated.bytes / runs;
+    return result;
+}
+
+std::vector<BenchSuite::Result> BenchSuite::run(std::string_view filter) const {
+    RaisedThreadPriority priority;
+
+    std::vector<Result> results;
+    for (auto const &benchmark : benchmarks_) {
+        if (filter.empty() || benchmark.name.find(filter) != std::string::npos)
+            results.push_back(measure(benchmark));
+    }
+    return results;
+}
+
+void BenchSuite::print(std::ostream &output, std::vector<Result> const &results, std::map<std::string, double> const *baseline, double tolerance) {
+    auto flags = output.flags();
+    auto precision = output.precision();
+    output << std::fixed << std::setprecision(1)
+        << std::left << std::setw(24) << "benchmark" << std::right << std::setw(12) << "median ns" << std::setw(12) << "min ns"
+        << std::setw(8) << "spread" << std::setw(10) << "allocs" << std::setw(10) << "bytes";
+    if (baseline)
+        output << std::setw(12) << "baseline" << std::setw(9) << "change";
+    output << "\r\n";
+
+    for (auto const &result : results) {
+        output << std::left << std::setw(24) << result.name << std::right << std::setw(12) << result.medianNs << std::setw(12) << result.minNs
+            << std::setw(7) << 100 * (result.maxNs - result.minNs) / result.medianNs << '%'
+            << std::setprecision(2) << std::setw(10) << result.allocations << std::setprecision(1) << std::setw(10) << result.bytes;
+        if (baseline) {
+            if (auto base = baseline->find(result.name); base != baseline->end() && base->second > 0) {
+                auto change = 100 * (result.medianNs / base->second - 1);
+                output << std::setw(12) << base->second << std::showpos << std::setw(8) << change << '%' << std::noshowpos;
+                if (result.medianNs > base->second * (1 + tolerance))
+                    output << "  regression";
+            } else {
+                output << std::setw(12) << "-";
+            }
+        }
+        output << "\r\n";
+    }
+    output.flags(flags);
+    output.precision(precision);
+}
+
+void BenchSuite::write_json(std::wstring const &path, std::vector<Result> const &results) {
+    std::ofstream file(std::filesystem::path{ path }, std::ios::binary);
+    if (!file)
+        throw std::runtime_error("cannot open benchmark file");
+
+    // Names are ASCII without quotes, they are made by the shell
+    file << std::fixed << std::setprecision(3) << "{\"benchmarks\":[\n";
+    for (size_t i = 0; i < results.size(); i++) {
+        auto const &result = results[i];
+        file << "{\"name\":\"" << result.name << "\",\"median_ns\":" << result.medianNs << ",\"min_ns\":" << result.minNs
+            << ",\"max_ns\":" << result.maxNs << ",\"iterations\":" << result.iterations
+            << ",\"allocations\":" << result.allocations << ",\"bytes\":" << result.bytes << '}'
+            << (i + 1 < results.size() ? ",\n" : "\n");
+    }
+    file << "]}\n";
+
+    if (!file)
+        throw std::runtime_error("cannot write benchmark file");
+}
+
+std::map<std::string, double> BenchSuite::read_baseline(std::wstring const &path) {
+    std::ifstream file(std::filesystem::path{ path }, std::ios::binary);
+    if (!file)
+        throw std::runtime_error("cannot open baseline file");
+
+    static constexpr std::string_view nameKey = "\"name\":\"", medianKey = "\"median_ns\":";
+    std::map<std::string, double> baseline;
+    std::string line;
+    while (std::getline(file, line)) {
+        auto name = line.find(nameKey);
+        auto median = line.find(medianKey);
+        if (name == std::string::npos || median == std::string::npos)
+            continue;
+        name += nameKey.size();
+        auto nameEnd = line.find('"', name);
+        if (nameEnd == std::string::npos)
+            continue;
+        baseline[line.substr(name, nameEnd - name)] = std::strtod(line.c_str() + median + medianKey.size(), nullptr);
+    }
+    if (baseline.empty())
+        throw std::runtime_error("baseline file has no benchmarks");
+    return baseline;
+}
+
+std::vector<std::string> BenchSuite::regressions(std::vector<Result> const &results, std::map<std::string, double> const &baseline, double tolerance) {
+    std::vector<std::string> names;
+    for (auto const &result : results) {
+        if (auto base = baseline.find(result.name); base != baseline.end() && base->second > 0 && result.medianNs > base->second * (1 + tolerance))
+            names.push_back(result.name);
+    }
+    return names;
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <chrono>
+#include <functional>
+#include <map>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Named micro benchmarks run as a suite. Every benchmark is warmed up, its iteration count is
+// calibrated to a sample time, and the median of several samples is reported with the spread, so
+// that a run can be compared with a baseline written by an earlier one.
+class BenchSuite {
+public:
+    struct Result {
+        std::string name;
+        unsigned long long iterations = 0;      // per sample
+        double medianNs = 0;
+        double minNs = 0;
+        double maxNs = 0;
+        double allocations = 0;                 // per iteration
+        double bytes = 0;
+    };
+
+    explicit BenchSuite(std::chrono::milliseconds sampleTime = std::chrono::milliseconds(20), unsigned samples = 7);
+
+    // The body is one iteration; it is called many times in a row. The setup runs untimed before
+    // the benchmark, only when it is selected.
+    void add(std::string name, std::function<void()> body, std::function<void()> setup = {});
+
+    // Benchmarks with the filter in their name, all when it is empty.
+    std::vector<Result> run(std::string_view filter) const;
+
+    static void print(std::ostream &output, std::vector<Result> const &results, std::map<std::string, double> const *baseline = nullptr, double tolerance = 0);
+    // One benchmark per line, read back by read_baseline.
+    static void write_json(std::wstring const &path, std::vector<Result> const &results);
+    // Median ns of every benchmark in a file written by write_json.
+    static std::map<std::string, double> read_baseline(std::wstring const &path);
+    // Names of the results slower than baseline * (1 + tolerance).
+    static std::vector<std::string> regressions(std::vector<Result> const &results, std::map<std::string, double> const &baseline, double tolerance);
+
+private:
+    struct Benchmark {
+        std::string name;
+        std::function<void()> body;
+        std::function<void()> setup;
+    };
+
+    Result measure(Benchmark const &benchmark) const;
+
+    std::chrono::milliseconds sampleTime_;
+    unsigned samples_;
+    std::vector<Benchmark> benchmarks_;
+};
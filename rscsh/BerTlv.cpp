@@ -0,0 +1,116 @@
+#include "BerTlv.h"
+
+#include <stdexcept>
+
+size_t BerTlv::parse_tag(unsigned char const *data, size_t offset, size_t end, unsigned &tag) {
+    size_t position = offset;
+    tag = data[position++];
+    if ((tag & 0x1F) == 0x1F) {
+        do {
+            if (position == end || position - offset == 4)
+                throw std::runtime_error("malformed TLV tag");
+            tag = (tag << 8) | data[position];
+        } while (data[position++] & 0x80);
+    }
+    return position - offset;
+}
+
+std::vector<BerTlv::Element> BerTlv::parse(scb::Bytes const &data, size_t offset, size_t size) {
+    return parse(data.data(), data.size(), offset, size);
+}
+
+std::vector<BerTlv::Element> BerTlv::parse(unsigned char const *data, size_t dataSize, size_t offset, size_t size) {
+    std::vector<Element> elements;
+
+    size_t end = offset + size;
+    if (end > dataSize)
+        throw std::runtime_error("TLV range is outside of data");
+
+    for (size_t position = offset; position < end; ) {
+        if (data[position] == 0x00 || data[position] == 0xFF) {
+            position++;
+            continue;
+        }
+
+        Element element;
+        element.offset = position;
+        element.constructed = (data[position] & 0x20) != 0;
+        position += parse_tag(data, position, end, element.tag);
+
+        if (position == end)
+            throw std::runtime_error("malformed TLV length");
+        size_t length = data[position++];
+        if (length & 0x80) {
+            size_t count = length & 0x7F;
+            if (count == 0 || count > 3 || position + count > end)
+                throw std::runtime_error("malformed TLV length");
+            length = 0;
+            while (count--)
+                length = (length << 8) | data[position++];
+        }
+
+        element.headerSize = position - element.offset;
+        element.length = length;
+        if (element.end() > end)
+            throw std::runtime_error("TLV value exceeds data");
+
+        elements.push_back(element);
+        position = element.end();
+    }
+
+    return elements;
+}
+
+std::vector<BerTlv::Element> BerTlv::parse(scb::Bytes const &data) {
+    return parse(data, 0, data.size());
+}
+
+static void collect_range(scb::Bytes const &data, size_t offset, size_t size, std::map<unsigned, scb::Bytes> &values) {
+    for (auto const &element : BerTlv::parse(data, offset, size)) {
+        if (element.constructed)
+            collect_range(data, element.value_offset(), element.length, values);
+        else
+            values.emplace(element.tag, BerTlv::value(data, element));
+    }
+}
+
+void BerTlv::collect(scb::Bytes const &data, std::map<unsigned, scb::Bytes> &values) {
+    collect_range(data, 0, data.size(), values);
+}
+
+bool BerTlv::find(scb::Bytes const &data, size_t offset, size_t size, unsigned tag, Element &element) {
+    return find(data.data(), data.size(), offset, size, tag, element);
+}
+
+bool BerTlv::find(unsigned char const *data, size_t dataSize, size_t offset, size_t size, unsigned tag, Element &element) {
+    for (auto const &candidate : parse(data, dataSize, offset, size)) {
+        if (candidate.tag == tag) {
+            element = candidate;
+            return true;
+        }
+        if (candidate.constructed && find(data, dataSize, candidate.value_offset(), candidate.length, tag, element))
+            return true;
+    }
+    return false;
+}
+
+bool BerTlv::find(scb::Bytes const &data, unsigned tag, scb::Bytes &value) {
+    Element element;
+    if (!find(data, 0, data.size(), tag, element))
+        return false;
+    value = BerTlv::value(data, element);
+    return true;
+}
+
+std::vector<BerTlv::DolEntry> BerTlv::parse_dol(scb::Bytes const &dol) {
+    std::vector<DolEntry> entries;
+    for (size_t position = 0; position < dol.size(); ) {
+        DolEntry entry;
+        position += parse_tag(dol.data(), position, dol.size(), entry.tag);
+        if (position == dol.size())
+            throw std::runtime_error("malformed DOL");
+        entry.length = dol[position++];
+        entries.push_back(entry);
+    }
+    return entries;
+}
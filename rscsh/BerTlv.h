@@ -0,0 +1,50 @@
+#pragma once
+
+#include <map>
+#include <vector>
+
+#include <scb/Bytes.h>
+
+// Lightweight BER-TLV walker (ISO 7816-4 / EMV), working on offsets into the parsed buffer.
+// Unlike rsc::TLVList it does not copy values, and it is safe to use from several threads.
+class BerTlv {
+public:
+    struct Element {
+        unsigned tag = 0;
+        bool constructed = false;
+        size_t offset = 0;      // of the tag
+        size_t headerSize = 0;  // tag and length bytes
+        size_t length = 0;      // of the value
+
+        inline size_t value_offset() const noexcept { return offset + headerSize; }
+        inline size_t end() const noexcept { return offset + headerSize + length; }
+    };
+
+    struct DolEntry {
+        unsigned tag = 0;
+        size_t length = 0;
+    };
+
+    // Parses one level of elements in data[offset, offset + size), skipping 00 / FF padding between them.
+    static std::vector<Element> parse(scb::Bytes const &data, size_t offset, size_t size);
+    static std::vector<Element> parse(scb::Bytes const &data);
+    // Same on a buffer that is not scb::Bytes, e.g. an inline response.
+    static std::vector<Element> parse(unsigned char const *data, size_t dataSize, size_t offset, size_t size);
+
+    // Adds values of all primitive elements, at any depth, to `values`. Earlier values are kept.
+    static void collect(scb::Bytes const &data, std::map<unsigned, scb::Bytes> &values);
+
+    // Searches depth first, returns false when tag is not present.
+    static bool find(scb::Bytes const &data, unsigned tag, scb::Bytes &value);
+    // Same within data[offset, offset + size), the element refers into `data`.
+    static bool find(scb::Bytes const &data, size_t offset, size_t size, unsigned tag, Element &element);
+    static bool find(unsigned char const *data, size_t dataSize, size_t offset, size_t size, unsigned tag, Element &element);
+
+    // Data Object List: tags and lengths without values (PDOL, CDOL, DDOL).
+    static std::vector<DolEntry> parse_dol(scb::Bytes const &dol);
+
+    static inline scb::Bytes value(scb::Bytes const &data, Element const &element) { return data.bytes(element.value_offset(), element.length); }
+
+private:
+    static size_t parse_tag(unsigned char const *data, size_t offset, size_t end, unsigned &tag);
+};
@@ -0,0 +1,121 @@
+#include "BlockCipher.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+void BlockCipher::encrypt_cbc(unsigned char *data, size_t length, unsigned char *iv) const {
+    auto size = block_size();
+    if (length % size)
+        throw std::runtime_error("data length is not a multiple of block size");
+    for (size_t i = 0; i < length; i += size) {
+        for (size_t j = 0; j < size; j++)
+            iv[j] ^= data[i + j];
+        encrypt_block(iv, iv);
+        std::copy(iv, iv + size, data + i);
+    }
+}
+
+void BlockCipher::decrypt_cbc(unsigned char *data, size_t length, unsigned char *iv) const {
+    auto size = block_size();
+    if (length % size)
+        throw std::runtime_error("data length is not a multiple of block size");
+    unsigned char block[16];
+    for (size_t i = 0; i < length; i += size) {
+        std::copy(data + i, data + i + size, block);
+        decrypt_block(data + i, data + i);
+        for (size_t j = 0; j < size; j++)
+            data[i + j] ^= iv[j];
+        std::copy(block, block + size, iv);
+    }
+}
+
+scb::Bytes BlockCipher::encrypt_cbc(scb::Bytes const &data, scb::Bytes const &iv) const {
+    scb::Bytes result(data), chain(block_size());
+    std::copy(iv.begin(), iv.begin() + std::min(iv.size(), chain.size()), chain.begin());
+    encrypt_cbc(result.data(), result.size(), chain.data());
+    return result;
+}
+
+scb::Bytes BlockCipher::decrypt_cbc(scb::Bytes const &data, scb::Bytes const &iv) const {
+    scb::Bytes result(data), chain(block_size());
+    std::copy(iv.begin(), iv.begin() + std::min(iv.size(), chain.size()), chain.begin());
+    decrypt_cbc(result.data(), result.size(), chain.data());
+    return result;
+}
+
+scb::Bytes BlockCipher::encrypt_ecb(scb::Bytes const &data) const {
+    auto size = block_size();
+    if (data.size() % size)
+        throw std::runtime_error("data length is not a multiple of block size");
+    scb::Bytes result(data);
+    for (size_t i = 0; i < result.size(); i += size)
+        encrypt_block(result.data() + i, result.data() + i);
+    return result;
+}
+
+std::unique_ptr<BlockCipher> BlockCipher::des(scb::Bytes const &key) {
+    return std::make_unique<DesCipher>(key);
+}
+
+std::unique_ptr<BlockCipher> BlockCipher::aes(scb::Bytes const &key) {
+    return std::make_unique<AesCipher>(key);
+}
+
+EvpBlockCipher::EvpBlockCipher(EVP_CIPHER const *cipher, unsigned char const *key)
+    : blockSize_(static_cast<size_t>(EVP_CIPHER_get_block_size(cipher)))
+    , encrypt_(init(cipher, key, true))
+    , decrypt_(init(cipher, key, false))
+{
+}
+
+EvpBlockCipher::Context EvpBlockCipher::init(EVP_CIPHER const *cipher, unsigned char const *key, bool encrypt) {
+    Context context(EVP_CIPHER_CTX_new());
+    if (!context || EVP_CipherInit_ex(context.get(), cipher, nullptr, key, nullptr, encrypt ? 1 : 0) != 1
+        || EVP_CIPHER_CTX_set_padding(context.get(), 0) != 1)
+        throw std::runtime_error("cannot initialize block cipher");
+    return context;
+}
+
+void EvpBlockCipher::update(EVP_CIPHER_CTX *context, unsigned char const *in, unsigned char *out) const {
+    int length = 0;
+    if (EVP_CipherUpdate(context, out, &length, in, static_cast<int>(blockSize_)) != 1)
+        throw std::runtime_error("block cipher failed");
+}
+
+void EvpBlockCipher::encrypt_block(unsigned char const *in, unsigned char *out) const {
+    update(encrypt_.get(), in, out);
+}
+
+void EvpBlockCipher::decrypt_block(unsigned char const *in, unsigned char *out) const {
+    update(decrypt_.get(), in, out);
+}
+
+static scb::Bytes des_ede3_key(scb::Bytes const &key) {
+    if (key.size() != 8 && key.size() != 16 && key.size() != 24)
+        throw std::runtime_error("DES key must be 8, 16 or 24 bytes long");
+
+    // K1 K1 K1 for DES, K1 K2 K1 for two key 3DES
+    scb::Bytes ede3(24);
+    for (size_t i = 0; i < ede3.size(); i++)
+        ede3[i] = key[i % key.size()];
+    return ede3;
+}
+
+DesCipher::DesCipher(scb::Bytes const &key)
+    : EvpBlockCipher(EVP_des_ede3_ecb(), des_ede3_key(key).data())
+{
+}
+
+static EVP_CIPHER const* aes_ecb(scb::Bytes const &key) {
+    switch (key.size()) {
+        case 16: return EVP_aes_128_ecb();
+        case 24: return EVP_aes_192_ecb();
+        case 32: return EVP_aes_256_ecb();
+    }
+    throw std::runtime_error("AES key must be 16, 24 or 32 bytes long");
+}
+
+AesCipher::AesCipher(scb::Bytes const &key)
+    : EvpBlockCipher(aes_ecb(key), key.data())
+{
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <memory>
+
+#include <scb/Bytes.h>
+
+#include <openssl/evp.h>
+
+// Block cipher with the key schedule expanded once at construction.
+// Unlike scc::DES / scc::AES, blocks are processed in place, without temporary buffers,
+// which is what MAC engines and secure channels need on their per-APDU paths.
+class BlockCipher {
+public:
+    virtual ~BlockCipher() = default;
+
+    virtual size_t block_size() const noexcept = 0;
+    virtual void encrypt_block(unsigned char const *in, unsigned char *out) const = 0;
+    virtual void decrypt_block(unsigned char const *in, unsigned char *out) const = 0;
+
+    // In place CBC over `length` bytes, which must be a multiple of block size. `iv` is updated.
+    void encrypt_cbc(unsigned char *data, size_t length, unsigned char *iv) const;
+    void decrypt_cbc(unsigned char *data, size_t length, unsigned char *iv) const;
+
+    scb::Bytes encrypt_cbc(scb::Bytes const &data, scb::Bytes const &iv = scb::Bytes()) const;
+    scb::Bytes decrypt_cbc(scb::Bytes const &data, scb::Bytes const &iv = scb::Bytes()) const;
+    scb::Bytes encrypt_ecb(scb::Bytes const &data) const;
+
+    // DES for 8 byte keys, 3DES for 16 / 24 byte keys.
+    static std::unique_ptr<BlockCipher> des(scb::Bytes const &key);
+    static std::unique_ptr<BlockCipher> aes(scb::Bytes const &key);
+};
+
+// ECB context of an EVP cipher without padding, for one block at a time.
+class EvpBlockCipher : public BlockCipher {
+public:
+    size_t block_size() const noexcept override { return blockSize_; }
+    void encrypt_block(unsigned char const *in, unsigned char *out) const override;
+    void decrypt_block(unsigned char const *in, unsigned char *out) const override;
+
+protected:
+    EvpBlockCipher(EVP_CIPHER const *cipher, unsigned char const *key);
+
+private:
+    struct ContextFree {
+        void operator()(EVP_CIPHER_CTX *context) const noexcept { EVP_CIPHER_CTX_free(context); }
+    };
+    using Context = std::unique_ptr<EVP_CIPHER_CTX, ContextFree>;
+
+    static Context init(EVP_CIPHER const *cipher, unsigned char const *key, bool encrypt);
+    void update(EVP_CIPHER_CTX *context, unsigned char const *in, unsigned char *out) const;
+
+    size_t blockSize_;
+    Context encrypt_;
+    Context decrypt_;
+};
+
+// Single DES is 3DES with three equal keys, OpenSSL 3 provides DES-ECB only in its legacy provider.
+class DesCipher : public EvpBlockCipher {
+public:
+    DesCipher(scb::Bytes const &key);
+};
+
+class AesCipher : public EvpBlockCipher {
+public:
+    AesCipher(scb::Bytes const &key);
+};
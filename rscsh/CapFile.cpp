@@ -0,0 +1,365 @@
+#include "CapFile.h"
+
+#include <algorithm>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+#include <string>
+
+namespace {
+
+// Minimal DEFLATE (RFC 1951) decoder, CAP archives are usually compressed.
+class Inflater {
+public:
+    Inflater(unsigned char const *data, size_t size)
+        : data_(data)
+        , size_(size)
+    {}
+
+    std::vector<unsigned char> run() {
+        bool last;
+        do {
+            last = bits(1);
+            switch (bits(2)) {
+                case 0: stored(); break;
+                case 1: fixed(); break;
+                case 2: dynamic(); break;
+                default: throw std::runtime_error("invalid deflate block type");
+            }
+        } while (!last);
+        return std::move(out_);
+    }
+
+private:
+    struct Huffman {
+        unsigned short count[16];
+        unsigned short symbol[288];
+    };
+
+    unsigned bits(unsigned count) {
+        while (bitCount_ < count) {
+            if (position_ == size_)
+                throw std::runtime_error("deflate stream is truncated");
+            bitBuffer_ |= static_cast<unsigned long>(data_[position_++]) << bitCount_;
+            bitCount_ += 8;
+        }
+        unsigned value = bitBuffer_ & ((1ul << count) - 1);
+        bitBuffer_ >>= count;
+        bitCount_ -= count;
+        return value;
+    }
+
+    static void build(Huffman &huffman, unsigned char const *lengths, unsigned count) {
+        std::fill(std::begin(huffman.count), std::end(huffman.count), 0);
+        for (unsigned i = 0; i < count; i++)
+            huffman.count[lengths[i]]++;
+
+        unsigned short offsets[16];
+        offsets[1] = 0;
+        for (unsigned i = 1; i < 15; i++)
+            offsets[i + 1] = offsets[i] + huffman.count[i];
+        for (unsigned i = 0; i < count; i++)
+            if (lengths[i])
+                huffman.symbol[offsets[lengths[i]]++] = static_cast<unsigned short>(i);
+    }
+
+    unsigned decode(Huffman const &huffman) {
+        int code = 0, first = 0, index = 0;
+        for (unsigned length = 1; length < 16; length++) {
+            code |= bits(1);
+            int count = huffman.count[length];
+            if (code - count < first)
+                return huffman.symbol[index + (code - first)];
+            index += count;
+            first = (first + count) << 1;
+            code <<= 1;
+        }
+        throw std::runtime_error("invalid deflate code");
+    }
+
+    void stored() {
+        bitBuffer_ = 0;
+        bitCount_ = 0;
+        if (position_ + 4 > size_)
+            throw std::runtime_error("deflate stream is truncated");
+        size_t length = data_[position_] | (data_[position_ + 1] << 8);
+        position_ += 4;
+        if (position_ + length > size_)
+            throw std::runtime_error("deflate stream is truncated");
+        out_.insert(out_.end(), data_ + position_, data_ + position_ + length);
+        position_ += length;
+    }
+
+    void fixed() {
+        unsigned char lengths[288 + 30];
+        std::fill(lengths, lengths + 144, 8);
+        std::fill(lengths + 144, lengths + 256, 9);
+        std::fill(lengths + 256, lengths + 280, 7);
+        std::fill(lengths + 280, lengths + 288, 8);
+        std::fill(lengths + 288, lengths + 318, 5);
+
+        Huffman literals, distances;
+        build(literals, lengths, 288);
+        build(distances, lengths + 288, 30);
+        codes(literals, distances);
+    }
+
+    void dynamic() {
+        static unsigned char const order[19] = { 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+
+        unsigned literalCount = bits(5) + 257;
+        unsigned distanceCount = bits(5) + 1;
+        unsigned codeCount = bits(4) + 4;
+        if (literalCount > 286 || distanceCount > 30)
+            throw std::runtime_error("invalid deflate code lengths");
+
+        unsigned char lengths[288 + 30] = {};
+        for (unsigned i = 0; i < codeCount; i++)
+            lengths[order[i]] = static_cast<unsigned char>(bits(3));
+
+        Huffman lengthCodes;
+        build(lengthCodes, lengths, 19);
+
+        std::fill(std::begin(lengths), std::end(lengths), 0);
+        for (unsigned i = 0; i < literalCount + distanceCount; ) {
+            unsigned symbol = decode(lengthCodes);
+            if (symbol < 16) {
+                lengths[i++] = static_cast<unsigned char>(symbol);
+                continue;
+            }
+
+            unsigned char length = 0;
+            unsigned repeat;
+            if (symbol == 16) {
+                if (i == 0)
+                    throw std::runtime_error("invalid deflate code lengths");
+                length = lengths[i - 1];
+                repeat = 3 + bits(2);
+            } else if (symbol == 17) {
+                repeat = 3 + bits(3);
+            } else {
+                repeat = 11 + bits(7);
+            }
+            if (i + repeat > literalCount + distanceCount)
+                throw std::runtime_error("invalid deflate code lengths");
+            while (repeat--)
+                lengths[i++] = length;
+        }
+
+        Huffman literals, distances;
+        build(literals, lengths, literalCount);
+        build(distances, lengths + literalCount, distanceCount);
+        codes(literals, distances);
+    }
+
+    void codes(Huffman const &literals, Huffman const &distances) {
+        static unsigned short const lengthBase[29] = {
+            3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+        static unsigned char const lengthExtra[29] = {
+            0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+        static unsigned short const distanceBase[30] = {
+            1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577 };
+        static unsigned char const distanceExtra[30] = {
+            0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+
+        for (;;) {
+            unsigned symbol = decode(literals);
+            if (symbol < 256) {
+                out_.push_back(static_cast<unsigned char>(symbol));
+            } else if (symbol == 256) {
+                return;
+            } else {
+                symbol -= 257;
+                if (symbol >= 29)
+                    throw std::runtime_error("invalid deflate length");
+                size_t length = lengthBase[symbol] + bits(lengthExtra[symbol]);
+
+                unsigned distanceSymbol = decode(distances);
+                if (distanceSymbol >= 30)
+                    throw std::runtime_error("invalid deflate distance");
+                size_t distance = distanceBase[distanceSymbol] + bits(distanceExtra[distanceSymbol]);
+                if (distance > out_.size())
+                    throw std::runtime_error("deflate distance is too far back");
+
+                for (size_t from = out_.size() - distance; length--; from++)
+                    out_.push_back(out_[from]);
+            }
+        }
+    }
+
+    unsigned char const *data_;
+    size_t size_;
+    size_t position_ = 0;
+    unsigned long bitBuffer_ = 0;
+    unsigned bitCount_ = 0;
+    std::vector<unsigned char> out_;
+};
+
+unsigned read_u16(std::vector<unsigned char> const &data, size_t offset) {
+    if (offset + 2 > data.size())
+        throw std::runtime_error("CAP archive is truncated");
+    return data[offset] | (data[offset + 1] << 8);
+}
+
+unsigned long read_u32(std::vector<unsigned char> const &data, size_t offset) {
+    return read_u16(data, offset) | (static_cast<unsigned long>(read_u16(data, offset + 2)) << 16);
+}
+
+scb::Bytes to_bytes(unsigned char const *begin, unsigned char const *end) {
+    scb::Bytes bytes(static_cast<size_t>(end - begin));
+    std::copy(begin, end, bytes.begin());
+    return bytes;
+}
+
+// Component file names indexed by component tag.
+char const *const componentNames[12] = {
+    "", "Header", "Directory", "Applet", "Import", "ConstantPool",
+    "Class", "Method", "StaticField", "RefLocation", "Export", "Descriptor",
+};
+
+// Order of components in the load file, Descriptor and Debug components are not loaded.
+unsigned char const loadOrder[] = { 1, 2, 4, 3, 6, 7, 8, 10, 5, 9 };
+
+} // namespace
+
+CapFile::CapFile(std::filesystem::path const &path) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file)
+        throw std::runtime_error("cannot open CAP file");
+    std::vector<unsigned char> content{ std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>() };
+
+    if (content.size() >= 4 && content[0] == 'P' && content[1] == 'K' && content[2] == 0x03 && content[3] == 0x04) {
+        read_archive(content);
+        for (auto tag : loadOrder)
+            loadFile_ += components_[tag];
+    } else {
+        loadFile_ = to_bytes(content.data(), content.data() + content.size());
+    }
+
+    parse_components();
+}
+
+scb::Bytes CapFile::load_file_data_block() const {
+    size_t size = loadFile_.size();
+
+    scb::Bytes block;
+    if (size < 0x80) {
+        block = scb::Bytes(2);
+        block[1] = static_cast<unsigned char>(size);
+    } else if (size < 0x100) {
+        block = scb::Bytes(3);
+        block[1] = 0x81;
+        block[2] = static_cast<unsigned char>(size);
+    } else if (size < 0x10000) {
+        block = scb::Bytes(4);
+        block[1] = 0x82;
+        block[2] = static_cast<unsigned char>(size >> 8);
+        block[3] = static_cast<unsigned char>(size);
+    } else {
+        block = scb::Bytes(5);
+        block[1] = 0x83;
+        block[2] = static_cast<unsigned char>(size >> 16);
+        block[3] = static_cast<unsigned char>(size >> 8);
+        block[4] = static_cast<unsigned char>(size);
+    }
+    block[0] = 0xC4;
+    block += loadFile_;
+    return block;
+}
+
+void CapFile::read_archive(std::vector<unsigned char> const &archive) {
+    // End of central directory record is at most 64 KiB of comment away from the end
+    size_t end = archive.size() < 22 ? 0 : archive.size() - 22;
+    size_t limit = end > 0xFFFF ? end - 0xFFFF : 0;
+    for (; end > limit && read_u32(archive, end) != 0x06054B50; end--)
+        ;
+    if (read_u32(archive, end) != 0x06054B50)
+        throw std::runtime_error("CAP archive has no central directory");
+
+    unsigned entries = read_u16(archive, end + 10);
+    size_t entry = read_u32(archive, end + 16);
+
+    for (unsigned i = 0; i < entries; i++) {
+        if (read_u32(archive, entry) != 0x02014B50)
+            throw std::runtime_error("CAP archive central directory is corrupted");
+
+        unsigned method = read_u16(archive, entry + 10);
+        size_t compressedSize = read_u32(archive, entry + 20);
+        size_t size = read_u32(archive, entry + 24);
+        size_t nameLength = read_u16(archive, entry + 28);
+        size_t extraLength = read_u16(archive, entry + 30);
+        size_t commentLength = read_u16(archive, entry + 32);
+        size_t local = read_u32(archive, entry + 42);
+        if (entry + 46 + nameLength > archive.size())
+            throw std::runtime_error("CAP archive is truncated");
+        std::string name(archive.begin() + entry + 46, archive.begin() + entry + 46 + nameLength);
+        entry += 46 + nameLength + extraLength + commentLength;
+
+        // Components are stored as <package path>/javacard/<Component>.cap
+        auto slash = name.rfind('/');
+        if (slash == std::string::npos || name.size() < 4 || name.compare(name.size() - 4, 4, ".cap") != 0)
+            continue;
+        auto component = name.substr(slash + 1, name.size() - slash - 5);
+        unsigned char tag = 0;
+        for (unsigned char t = 1; t < 12; t++)
+            if (component == componentNames[t])
+                tag = t;
+        if (tag == 0)
+            continue;
+
+        if (read_u32(archive, local) != 0x04034B50)
+            throw std::runtime_error("CAP archive local header is corrupted");
+        size_t offset = local + 30 + read_u16(archive, local + 26) + read_u16(archive, local + 28);
+        if (offset + compressedSize > archive.size())
+            throw std::runtime_error("CAP archive is truncated");
+
+        auto data = archive.data() + offset;
+        if (method == 0) {
+            components_[tag] = to_bytes(data, data + compressedSize);
+        } else if (method == 8) {
+            auto inflated = Inflater(data, compressedSize).run();
+            if (inflated.size() != size)
+                throw std::runtime_error("CAP component size mismatch");
+            components_[tag] = to_bytes(inflated.data(), inflated.data() + inflated.size());
+        } else {
+            throw std::runtime_error("CAP archive uses unsupported compression method");
+        }
+    }
+
+    if (components_[1].size() == 0)
+        throw std::runtime_error("CAP archive has no Header component");
+}
+
+void CapFile::parse_components() {
+    // Walk components in the load file: tag(1) size(2) info(size)
+    for (size_t offset = 0; offset + 3 <= loadFile_.size(); ) {
+        unsigned char tag = loadFile_[offset];
+        size_t size = (loadFile_[offset + 1] << 8) | loadFile_[offset + 2];
+        if (offset + 3 + size > loadFile_.size())
+            throw std::runtime_error("CAP component is truncated");
+        auto info = loadFile_.bytes(offset + 3, size);
+        offset += 3 + size;
+
+        if (tag == 1) {
+            // magic(4) minor(1) major(1) flags(1) package minor(1) package major(1) AID length(1) AID
+            if (info.size() < 10 || info[0] != 0xDE || info[1] != 0xCA || info[2] != 0xFF || info[3] != 0xED)
+                throw std::runtime_error("invalid CAP Header component");
+            size_t aidLength = info[9];
+            if (10 + aidLength > info.size())
+                throw std::runtime_error("invalid CAP Header component");
+            packageAid_ = info.bytes(10, aidLength);
+        } else if (tag == 3) {
+            // count(1) { AID length(1) AID install method offset(2) }
+            size_t position = 1;
+            for (unsigned i = 0; info.size() > 0 && i < info[0]; i++) {
+                if (position >= info.size() || position + 1 + info[position] + 2 > info.size())
+                    throw std::runtime_error("invalid CAP Applet component");
+                appletAids_.push_back(info.bytes(position + 1, info[position]));
+                position += 1 + info[position] + 2;
+            }
+        }
+    }
+
+    if (packageAid_.size() == 0)
+        throw std::runtime_error("CAP file has no Header component");
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <filesystem>
+#include <vector>
+
+#include <scb/Bytes.h>
+
+// Java Card CAP file, either as JAR/ZIP archive of components or as already concatenated load file (.ijc).
+class CapFile {
+public:
+    explicit CapFile(std::filesystem::path const &path);
+
+    // Components concatenated in the order required by the card for loading.
+    inline scb::Bytes const& load_file() const noexcept { return loadFile_; }
+    inline scb::Bytes const& package_aid() const noexcept { return packageAid_; }
+    inline std::vector<scb::Bytes> const& applet_aids() const noexcept { return appletAids_; }
+
+    // Load File Data Block (tag C4) to be split into LOAD commands.
+    scb::Bytes load_file_data_block() const;
+
+private:
+    void read_archive(std::vector<unsigned char> const &archive);
+    void parse_components();
+
+    scb::Bytes components_[12];
+    scb::Bytes loadFile_;
+    scb::Bytes packageAid_;
+    std::vector<scb::Bytes> appletAids_;
+};
@@ -1,6 +1,19 @@
 #include "CardShell.h"
-
-#include <scb/ByteStream.h>
+#include "AllocationCounter.h"
+#include "BerTlv.h"
+#include "CapFile.h"
+#include "DumpTree.h"
+#include "Parallel.h"
+#include "ParseText.h"
+
+#include <openssl/rand.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cwctype>
+#include <iomanip>
+#include <system_error>
+#include <thread>
 
 std::unordered_map<std::wstring, void (CardShell::*)(std::vector<std::wstring> const &)> const CardShell::command_map_{
 #define X(name, func, _) { name, &CardShell::func },
@@ -23,44 +36,255 @@ void CardShell::create_readers() {
 }
 
 void CardShell::create_card_and_connect(LPCTSTR szReader) {
-    rscCard_ = std::make_unique<rsc::Card>(*rscContext_, szReader);
+    set_card(std::make_unique<rsc::Card>(*rscContext_, szReader), szReader);
+}
+
+void CardShell::set_card(std::unique_ptr<rsc::Card> card, std::wstring const &reader) {
+    release_transaction();
+    simCard_.reset();
+    secureChannel_.reset();
+    rscCard_ = std::move(card);
+    readerName_ = reader;
     if (connectionChangedCb_)
-        connectionChangedCb_(szReader);
+        connectionChangedCb_(reader);
+
+    if (!resumeSteps_.empty())
+        resume_session();
+}
+
+CardShell::Command CardShell::find_command(std::wstring const &name) {
+    auto cmd = command_map_.find(name);
+    return cmd != command_map_.end() ? cmd->second : nullptr;
 }
 
 void CardShell::execute(std::vector<std::wstring> const &argv) {
     if (auto cmd = command_map_.find(argv[0]); cmd != command_map_.end()) {
-        (this->*cmd->second)(argv);
+        invoke(cmd->second, argv);
     } else {
         execution_yield_ << "Unknown card shell command\r\n";
     }
 }
 
+void CardShell::invoke(Command command, std::vector<std::wstring> const &argv) {
+    // Nested commands run under the lock of the outermost one
+    std::unique_lock<std::mutex> readerLock;
+    if (commandDepth_ == 0) {
+        if (auto reader = command_reader(command, argv); !reader.empty())
+            readerLock = std::unique_lock(reader_mutex(reader));
+    }
+    commandDepth_++;
+    try {
+        (this->*command)(argv);
+    } catch (...) {
+        commandDepth_--;
+        throw;
+    }
+    commandDepth_--;
+}
+
+std::mutex& CardShell::reader_mutex(std::wstring const &reader) {
+    static std::mutex mapMutex;
+    static std::map<std::wstring, std::unique_ptr<std::mutex>> mutexes;
+
+    std::lock_guard lock(mapMutex);
+    auto &mutex = mutexes[reader];
+    if (!mutex)
+        mutex = std::make_unique<std::mutex>();
+    return *mutex;
+}
+
+std::wstring CardShell::command_reader(Command command, std::vector<std::wstring> const &argv) {
+    if (command == &CardShell::connect) {
+        // Invalid arguments are reported by the command itself
+        try {
+            if (argv.size() >= 2)
+                return find_reader(argv).name;
+        } catch (std::exception const&) {
+        }
+        return std::wstring();
+    }
+    return has_card() ? readerName_ : std::wstring();
+}
+
 void CardShell::execute(rsc::cAPDU const &capdu) {
-    transmit(capdu.buffer());
-    if (last_rapdu_.SW().response_bytes_still_available()) {
-        execute(rsc::cAPDU::GET_RESPONSE(last_rapdu_.SW().response_bytes_still_available()));
-    } else if (last_rapdu_.SW().wrong_length()) {
-        execute(rsc::cAPDU::FIX_LENGTH(capdu, last_rapdu_.SW2()));
+    // GET RESPONSE chains and wrapped exchanges must not be interleaved
+    ScopedTransaction transaction(*this);
+
+    if (!secureChannel_) {
+        exchange(capdu);
+        record_select(capdu.buffer());
+        record_exchange(capdu.buffer(), lastResponse_);
+        return;
     }
+
+    try {
+        scb::Bytes wrapped;
+        {
+            Profiler::Scope scope(profiler_, Profiler::Phase::Crypto);
+            wrapped = secureChannel_->wrap(capdu.buffer());
+        }
+        exchange(wrapped.data(), wrapped.size());
+        Profiler::Scope scope(profiler_, Profiler::Phase::Crypto);
+        auto unwrapped = secureChannel_->unwrap(lastResponse_.bytes());
+        lastResponse_.assign(unwrapped.data(), unwrapped.size());
+        lastRapduStale_ = true;
+    } catch (...) {
+        // Wrapped command without matching response, the session cannot continue
+        secureChannel_.reset();
+        throw;
+    }
+    execution_yield_ << "= ";
+    execution_yield_ << hex_bytes(lastResponse_.data(), lastResponse_.size(), " ");
+    execution_yield_ << "\r\n";
+    // Selecting an application ends the session on the card (GlobalPlatform), the response is still wrapped
+    if (capdu.buffer()[1] == 0xA4 && (lastResponse_.sw1() == 0x90 || lastResponse_.sw1() == 0x61))
+        secureChannel_.reset();
+    record_select(capdu.buffer());
+    record_exchange(capdu.buffer(), lastResponse_);
 }
 
-void CardShell::transmit(scb::Bytes const &buffer) {
+void CardShell::record_exchange(scb::Bytes const &command, scb::Bytes const &response) {
+    if (history_)
+        history_->record(command, response);
+    if (exchangeObserver_)
+        exchangeObserver_(command, response);
+}
+
+void CardShell::record_exchange(scb::Bytes const &command, ResponseApdu const &response) {
+    // The response bytes are only copied out of the inline buffer when somebody keeps them
+    if (history_ || exchangeObserver_)
+        record_exchange(command, response.bytes());
+}
+
+void CardShell::exchange(rsc::cAPDU const &capdu) {
+    exchange(capdu.buffer().data(), capdu.buffer().size());
+}
+
+void CardShell::exchange(unsigned char const *command, size_t size) {
+    transmit(command, size);
+    if (lastResponse_.sw1() == 0x61) {
+        auto getResponse = apdu::get_response(lastResponse_.sw2() ? lastResponse_.sw2() : 256);
+        exchange(getResponse.data(), getResponse.size());
+    } else if (lastResponse_.sw1() == 0x6C) {
+        CommandApdu fixed(command, size);
+        apdu::fix_length(fixed, lastResponse_.sw2());
+        exchange(fixed.data(), fixed.size());
+    }
+}
+
+void CardShell::exchange(unsigned char const *command, size_t size, ResponseApdu &response) {
+    transceive(command, size, response);
+    if (response.sw1() == 0x61) {
+        auto getResponse = apdu::get_response(response.sw2() ? response.sw2() : 256);
+        exchange(getResponse.data(), getResponse.size(), response);
+    } else if (response.sw1() == 0x6C) {
+        CommandApdu fixed(command, size);
+        apdu::fix_length(fixed, response.sw2());
+        exchange(fixed.data(), fixed.size(), response);
+    }
+}
+
+rsc::rAPDU CardShell::transceive(scb::Bytes const &buffer) {
+    Profiler::Scope scope(profiler_, Profiler::Phase::Transmit);
+    if (simCard_)
+        return rsc::rAPDU(simCard_->transmit(buffer));
+    if (!has_card())
+        throw std::runtime_error("cannot transmit, no card present");
+    return rscCard_->raw_transmit(buffer);
+}
+
+void CardShell::transceive(unsigned char const *command, size_t size, ResponseApdu &response) {
+    Profiler::Scope scope(profiler_, Profiler::Phase::Transmit);
+    if (simCard_) {
+        // The simulated card works on scb::Bytes, only reader exchanges stay off the heap
+        scb::Bytes buffer(size);
+        std::copy(command, command + size, buffer.begin());
+        auto answer = simCard_->transmit(buffer);
+        response.assign(answer.data(), answer.size());
+        return;
+    }
     if (!has_card())
         throw std::runtime_error("cannot transmit, no card present");
 
-    last_rapdu_ = rscCard_->raw_transmit(buffer);
-    execution_yield_ << "< ";
-    buffer.print(execution_yield_, L" ");
-    execution_yield_ << "\r\n> ";
-    last_rapdu_.buffer().print(execution_yield_, L" ");
-    execution_yield_ << "\r\n";
+    // Up to 256 bytes and SW for short commands, extended length commands (P3 of 00 followed by more
+    // bytes) may get up to 64K whatever their own length
+    bool extended = size > 5 && command[4] == 0x00;
+    response.resize(extended ? 65538 : ResponseApdu::inline_capacity);
+    auto length = static_cast<DWORD>(response.size());
+    auto pci = card().protocol() == SCARD_PROTOCOL_T0 ? SCARD_PCI_T0 : SCARD_PCI_T1;
+    auto result = SCardTransmit(card().handle(), pci, command, static_cast<DWORD>(size), NULL, response.data(), &length);
+    if (result != SCARD_S_SUCCESS) {
+        response.resize(0);
+        throw std::system_error(static_cast<int>(result), std::system_category(), "failed to transmit command");
+    }
+    response.resize(length);
+}
+
+rsc::rAPDU const& CardShell::last_rapdu() const {
+    if (lastRapduStale_) {
+        last_rapdu_ = rsc::rAPDU(lastResponse_.bytes());
+        lastRapduStale_ = false;
+    }
+    return last_rapdu_;
+}
+
+void CardShell::set_last_response(rsc::rAPDU const &rapdu) {
+    lastResponse_.assign(rapdu.buffer().data(), rapdu.buffer().size());
+    last_rapdu_ = rapdu;
+    lastRapduStale_ = false;
+}
+
+void CardShell::transmit(scb::Bytes const &buffer) {
+    transmit(buffer.data(), buffer.size());
+}
+
+void CardShell::transmit(unsigned char const *command, size_t size) {
+    transceive(command, size, lastResponse_);
+    lastRapduStale_ = true;
+    if (auto emitter = structured_output()) {
+        emitter->exchange(command, size, lastResponse_.data(), lastResponse_.size());
+        return;
+    }
+    Profiler::Scope scope(profiler_, Profiler::Phase::Format);
+    execution_yield_ << "< " << hex_bytes(command, size, " ") << "\r\n> " << hex_bytes(lastResponse_.data(), lastResponse_.size(), " ") << "\r\n";
 }
 
 void CardShell::print_connection_info() {
+    if (auto emitter = structured_output()) {
+        emitter->begin("connection");
+        if (simCard_) {
+            emitter->field("atr", simCard_->atr());
+            emitter->field("protocol", std::string_view("T=1"));
+            emitter->field("simulated", 1ull);
+        } else {
+            card().fetch_status();
+            emitter->field("atr", card().atr());
+            switch (card().protocol()) {
+                case SCARD_PROTOCOL_T0:
+                    emitter->field("protocol", std::string_view("T=0"));
+                    break;
+                case SCARD_PROTOCOL_T1:
+                    emitter->field("protocol", std::string_view("T=1"));
+                    break;
+                case SCARD_PROTOCOL_RAW:
+                    emitter->field("protocol", std::string_view("RAW"));
+                    break;
+            }
+        }
+        emitter->end();
+        return;
+    }
+
+    if (simCard_) {
+        execution_yield_ << "ATR: ";
+        execution_yield_ << hex_bytes(simCard_->atr(), " ");
+        execution_yield_ << "\r\nProtocol: T=1 (simulated card)\r\n";
+        return;
+    }
+
     card().fetch_status();
     execution_yield_ << "ATR: ";
-    card().atr().print(execution_yield_, L" ");
+    execution_yield_ << hex_bytes(card().atr(), " ");
     execution_yield_ << "\r\n";
     execution_yield_ << "Protocol: ";
     switch (card().protocol()) {
@@ -82,14 +306,17 @@ void CardShell::set_on_connection_changed_callback(ConnectionChangedCb callback)
 }
 
 void CardShell::reset_card() {
+    release_transaction();
+    secureChannel_.reset();
     rscCard_.reset();
+    readerName_.clear();
     if (connectionChangedCb_)
         connectionChangedCb_(L"");
 }
 
 void CardShell::help(std::wstring const &prefix) {
     for (auto const& [cmd, help] : help_map_) {
-        execution_yield_ << "\r\n" << prefix << ' ' << cmd << ' ' << help << "\r\n";
+        execution_yield_ << "\r\n" << utf8(prefix) << ' ' << utf8(cmd) << ' ' << utf8(help) << "\r\n";
     }
     execution_yield_ << "\r\n";
 }
@@ -99,19 +326,32 @@ void CardShell::validate_context() const {
         throw std::runtime_error("Smart card context is not established. Most likely there are no readers connected to this PC.");
 }
 
-void CardShell::readers(std::vector<std::wstring> const&) {
-    validate_context();
-
+void CardShell::synchronize_readers() {
     if (!has_readers()) {
         create_readers();
     } else {
         readers().fetch();
     }
 
+    readerRegistry_.synchronize(context(), readers().list());
+}
+
+void CardShell::readers(std::vector<std::wstring> const &argv) {
+    validate_context();
+
+    if (readerRegistry_.empty() || (argv.size() == 2 && is_keyword(argv[1], L"refresh")))
+        synchronize_readers();
+
     execution_yield_ << "Readers:\r\n";
-    for (size_t i = 0; i < readers().list().size(); i++) {
-        auto const &reader = readers().list()[i];
-        execution_yield_ << "    " << i + 1 << ". " << reader << "\r\n";
+    for (auto const &reader : readerRegistry_.list()) {
+        execution_yield_ << "    " << reader.id << ". " << utf8(reader.name);
+        if (!reader.attached) {
+            execution_yield_ << " (detached)";
+        } else if (reader.cardPresent) {
+            execution_yield_ << "\r\n       ATR: ";
+            execution_yield_ << hex_bytes(reader.atr, " ");
+        }
+        execution_yield_ << "\r\n";
     }
     execution_yield_ << "\r\n";
 }
@@ -119,38 +359,101 @@ void CardShell::readers(std::vector<std::wstring> const&) {
 void CardShell::connect(std::vector<std::wstring> const &argv) {
     validate_context();
 
-    if (argv.size() != 2) {
-        execution_yield_ << "connect <reader id/name>\r\n";
+    if (argv.size() < 2 || (is_keyword(argv[1], L"atr") && argv.size() != 3)) {
+        execution_yield_ << "connect <id> / <name> / atr <pattern>\r\n";
         return;
     }
 
-    if (!has_readers()) {
-        create_readers();
+    auto reader = find_reader(argv);
+    if (!reader.attached)
+        throw std::runtime_error("reader is detached");
+    create_card_and_connect(reader.name.c_str());
+
+    print_connection_info();
+}
+
+ReaderRegistry::Reader CardShell::find_reader(std::vector<std::wstring> const &argv) {
+    validate_context();
+    if (readerRegistry_.empty())
+        synchronize_readers();
+
+    ReaderRegistry::Reader reader;
+    if (is_keyword(argv[1], L"atr")) {
+        if (argv.size() != 3)
+            throw std::runtime_error("usage: connect atr <pattern>");
+        if (!readerRegistry_.find_by_atr(argv[2], reader))
+            throw std::runtime_error("no card with matching ATR");
+    } else if (argv.size() == 2 && std::all_of(argv[1].begin(), argv[1].end(), ::iswdigit)) {
+        if (!readerRegistry_.find_by_id(static_cast<unsigned>(std::stoul(argv[1])), reader))
+            throw std::runtime_error("invalid reader id");
     } else {
-        readers().fetch();
+        // Reader names contain spaces, the arguments are joined back
+        std::wstring name = argv[1];
+        for (size_t i = 2; i < argv.size(); i++)
+            name += L' ' + argv[i];
+        if (!readerRegistry_.find_by_name(name, reader))
+            throw std::runtime_error("no reader with matching name");
     }
+    return reader;
+}
 
-    auto &reader = argv[1];
-    auto reader_id = _wtoi(reader.c_str());
+void CardShell::autoconnect(std::vector<std::wstring> const &argv) {
+    if (argv.size() == 2 && is_keyword(argv[1], L"off")) {
+        autoConnect_.set_policy(AutoConnect::Off);
+    } else if (argv.size() == 2 && is_keyword(argv[1], L"first")) {
+        autoConnect_.set_policy(AutoConnect::FirstReader);
+    } else if (argv.size() >= 3 && is_keyword(argv[1], L"pinned")) {
+        std::wstring name = argv[2];
+        for (size_t i = 3; i < argv.size(); i++)
+            name += L' ' + argv[i];
+        autoConnect_.set_policy(AutoConnect::PinnedReader, name);
+    } else if (argv.size() != 1) {
+        execution_yield_ << "usage: autoconnect [off / first / pinned <reader name>]\r\n";
+        return;
+    }
 
-    reader_id--; // input is 1-based
-    if (reader_id < 0 || reader_id >= readers().list().size())
-        throw std::runtime_error("invalid reader id");
-    create_card_and_connect(readers().list()[reader_id].c_str());
+    execution_yield_ << "Auto-connect: ";
+    switch (autoConnect_.policy()) {
+        case AutoConnect::Off:
+            execution_yield_ << "off";
+            break;
+        case AutoConnect::FirstReader:
+            execution_yield_ << "first reader";
+            break;
+        case AutoConnect::PinnedReader:
+            execution_yield_ << "reader \"" << utf8(autoConnect_.pinned_reader()) << "\"";
+            break;
+    }
+    execution_yield_ << "\r\n";
 
-    print_connection_info();
+    auto stats = autoConnect_.stats();
+    execution_yield_ << stats.connects << " connects, " << stats.failures << " failures\r\n";
+    if (stats.connects > 0) {
+        execution_yield_
+            << "Latency: last " << stats.lastMs << " ms (" << stats.lastAttempts << " attempts), average "
+            << stats.totalMs / stats.connects << " ms, max " << stats.maxMs << " ms\r\n";
+    }
 }
 
 void CardShell::disconnect(std::vector<std::wstring> const&) {
     if (has_card()) {
+        release_transaction();
         card().disconnect();
         reset_card();
+        resumeSteps_.clear();
     } else {
         execution_yield_ << "Not connected to any card\r\n";
     }
 }
 
 void CardShell::reset(std::vector<std::wstring> const &argv) {
+    if (simCard_) {
+        secureChannel_.reset();
+        simCard_ = std::make_unique<SimulatedCard>(keySets_.at(L"default"));
+        print_connection_info();
+        return;
+    }
+
     validate_context();
 
     if (!has_card())
@@ -158,16 +461,20 @@ void CardShell::reset(std::vector<std::wstring> const &argv) {
 
     bool cold = true;
     if (argv.size() > 1) {
-        if (argv[1] == L"cold")
+        if (is_keyword(argv[1], L"cold"))
             cold = true;
-        else if (argv[1] == L"warm")
+        else if (is_keyword(argv[1], L"warm"))
             cold = false;
         else
-            execution_yield_ << "Unknown reset type \"" << argv[1] << "\". Cold reset will be done.\r\n";
+            execution_yield_ << "Unknown reset type \"" << utf8(argv[1]) << "\". Cold reset will be done.\r\n";
     } else {
         execution_yield_ << "Type of reset was not specified (cold or warm).\r\nImplying cold reset.\r\n";
     }
 
+    // The reset ends the transaction on the card side, and the session on purpose
+    release_transaction();
+    secureChannel_.reset();
+    resumeSteps_.clear();
     card().cold_reset();
     card().fetch_status();
 
@@ -176,59 +483,1025 @@ void CardShell::reset(std::vector<std::wstring> const &argv) {
 
 void CardShell::dump(std::vector<std::wstring> const &argv) {
     if (argv.size() == 1) {
-        last_rapdu_.buffer().dump(execution_yield_);
-        execution_yield_ << "\r\n";
+        execution_yield_ << dump_bytes(last_rapdu().buffer()) << "\r\n";
     } else if (argv.size() > 1) {
-        scb::Bytes bytes;
-        for (size_t i = 1; i < argv.size(); i++) {
-            auto const &arg = argv[i];
-            bytes += arg;
-        }
-        bytes.dump(execution_yield_);
-        execution_yield_ << "\r\n";
+        execution_yield_ << dump_bytes(hex_arguments(argv.begin() + 1, argv.end())) << "\r\n";
     }
 }
 
 void CardShell::parse(std::vector<std::wstring> const &argv) {
     if (argv.size() == 1) {
-        parse(last_rapdu_.tlv_list());
-    } else if (argv.size() > 1 && argv[1] == L"atr") {
+        parse(last_rapdu().tlv_list());
+    } else if (argv.size() > 1 && is_keyword(argv[1], L"atr")) {
         if (argv.size() > 2) {
-            scb::Bytes bytes;
-            for (size_t i = 2; i < argv.size(); i++) {
-                auto const &arg = argv[i];
-                bytes += arg;
-            }
-            parse_atr(bytes);
+            parse_atr(hex_arguments(argv.begin() + 2, argv.end()));
         } else if (has_card()) {
             parse_atr(card().atr());
         } else {
             execution_yield_ << "No card and no ATR provided\r\n";
         }
     } else {
-        scb::Bytes bytes;
-        for (size_t i = 1; i < argv.size(); i++) {
-            auto const &arg = argv[i];
-            bytes += arg;
-        }
-        parse(bytes);
+        parse(hex_arguments(argv.begin() + 1, argv.end()));
     }
 }
 
 void CardShell::raw(std::vector<std::wstring> const &argv) {
-    scb::Bytes bytes;
-    for (auto arg = argv.begin() + 1; arg != argv.end(); ++arg)
-        bytes += *arg;
+    auto bytes = hex_arguments(argv.begin() + 1, argv.end());
     transmit(bytes);
+    record_exchange(bytes, lastResponse_);
 }
 
 void CardShell::apdu(std::vector<std::wstring> const &argv) {
-    scb::Bytes bytes;
-    for (auto arg = argv.begin() + 1; arg != argv.end(); ++arg)
-        bytes += *arg;
+    auto bytes = hex_arguments(argv.begin() + 1, argv.end());
+    if (apduMac_)
+        bytes = append_mac(bytes);
     execute(rsc::cAPDU(bytes));
 }
 
+void CardShell::mac(std::vector<std::wstring> const &argv) {
+    if (argv.size() == 2 && is_keyword(argv[1], L"off")) {
+        apduMac_.reset();
+        return;
+    }
+
+    if (argv.size() != 3) {
+        execution_yield_
+            << "usage: mac <retail/des-cbc/aes-cbc/des-cmac/aes-cmac> <key>\r\n"
+            << "       mac off\r\n"
+            << "C-MAC is currently " << (apduMac_ ? "on" : "off") << "\r\n";
+        return;
+    }
+
+    apduMac_ = Mac::create(lowercase(argv[1]), scb::Bytes(argv[2]));
+}
+
+scb::Bytes CardShell::append_mac(scb::Bytes const &apdu) {
+    size_t const macSize = 8;
+
+    if (apdu.size() < 4)
+        throw std::runtime_error("APDU is too short");
+
+    // Short APDU cases only: CLA INS P1 P2 [Lc data] [Le]
+    size_t lc = 0;
+    bool hasLe = apdu.size() == 5;
+    if (apdu.size() > 5) {
+        lc = apdu[4];
+        if (lc == 0 || (apdu.size() != 5 + lc && apdu.size() != 5 + lc + 1))
+            throw std::runtime_error("C-MAC is supported for short APDUs only");
+        hasLe = apdu.size() == 5 + lc + 1;
+    }
+    if (lc + macSize > 255)
+        throw std::runtime_error("APDU data is too long for C-MAC");
+
+    scb::Bytes result(5 + lc + macSize + (hasLe ? 1 : 0));
+    std::copy(apdu.begin(), apdu.begin() + 4, result.begin());
+    result[0] |= 0x04; // secure messaging indication
+    result[4] = static_cast<unsigned char>(lc + macSize);
+    if (lc)
+        std::copy(apdu.begin() + 5, apdu.begin() + 5 + lc, result.begin() + 5);
+    if (hasLe)
+        result[result.size() - 1] = apdu[apdu.size() - 1];
+
+    Profiler::Scope scope(profiler_, Profiler::Phase::Crypto);
+    unsigned char mac[16];
+    apduMac_->update(result.data(), 5 + lc);
+    apduMac_->final(mac);
+    std::copy(mac, mac + macSize, result.begin() + 5 + lc);
+
+    return result;
+}
+
+SecureChannel::KeySet CardShell::default_key_set() {
+    SecureChannel::KeySet keys;
+    keys.enc = scb::Bytes(L"404142434445464748494A4B4C4D4E4F");
+    keys.mac = keys.enc;
+    keys.dek = keys.enc;
+    return keys;
+}
+
+void CardShell::sim(std::vector<std::wstring> const &argv) {
+    if (argv.size() == 2 && is_keyword(argv[1], L"off")) {
+        if (simCard_) {
+            release_transaction();
+            secureChannel_.reset();
+            simCard_.reset();
+            if (connectionChangedCb_)
+                connectionChangedCb_(L"");
+        }
+        return;
+    }
+
+    if (argv.size() > 2 || (argv.size() == 2 && !is_keyword(argv[1], L"on"))) {
+        execution_yield_
+            << "usage: sim [on / off]\r\n"
+            << "Simulated card is currently " << (simCard_ ? "on" : "off") << "\r\n";
+        return;
+    }
+
+    release_transaction();
+    if (has_card()) {
+        card().disconnect();
+        reset_card();
+    }
+
+    secureChannel_.reset();
+    simCard_ = std::make_unique<SimulatedCard>(keySets_.at(L"default"));
+    if (connectionChangedCb_)
+        connectionChangedCb_(L"simulated card");
+
+    print_connection_info();
+}
+
+void CardShell::scp(std::vector<std::wstring> const &argv) {
+    if (argv.size() >= 5 && is_keyword(argv[1], L"key")) {
+        SecureChannel::KeySet keys;
+        keys.version = static_cast<unsigned char>(std::stoul(argv[3], nullptr, 16));
+        if (argv.size() == 5) {
+            keys.enc = scb::Bytes(argv[4]);
+            keys.mac = keys.enc;
+            keys.dek = keys.enc;
+        } else if (argv.size() == 7) {
+            keys.enc = scb::Bytes(argv[4]);
+            keys.mac = scb::Bytes(argv[5]);
+            keys.dek = scb::Bytes(argv[6]);
+        } else {
+            goto usage;
+        }
+        keySets_[lowercase(argv[2])] = keys;
+    } else if (argv.size() == 2 && is_keyword(argv[1], L"keys")) {
+        for (auto const &[name, keys] : keySets_) {
+            execution_yield_ << utf8(name) << " (version " << std::hex << static_cast<unsigned>(keys.version) << std::dec << ")\r\n    ENC: ";
+            execution_yield_ << hex_bytes(keys.enc);
+            execution_yield_ << "\r\n    MAC: ";
+            execution_yield_ << hex_bytes(keys.mac);
+            execution_yield_ << "\r\n    DEK: ";
+            execution_yield_ << hex_bytes(keys.dek);
+            execution_yield_ << "\r\n";
+        }
+    } else if (argv.size() >= 2 && is_keyword(argv[1], L"open")) {
+        scp_open(argv);
+    } else if (argv.size() == 2 && is_keyword(argv[1], L"close")) {
+        secureChannel_.reset();
+        drop_resume_session_steps();
+    } else if (argv.size() >= 3 && is_keyword(argv[1], L"bench")) {
+        scp_bench(argv);
+    } else {
+    usage:
+        execution_yield_
+            << "usage: scp key <name> <version> <enc> <mac> <dek>\r\n"
+            << "       scp key <name> <version> <key>\r\n"
+            << "       scp keys\r\n"
+            << "       scp open [keyset] [security level]\r\n"
+            << "       scp close\r\n"
+            << "       scp bench <count> [data size]\r\n";
+        if (secureChannel_) {
+            execution_yield_
+                << "SCP0" << static_cast<unsigned>(secureChannel_->protocol())
+                << " session is open, security level " << std::hex << static_cast<unsigned>(secureChannel_->security_level()) << std::dec << "\r\n";
+        } else {
+            execution_yield_ << "No secure channel session\r\n";
+        }
+    }
+}
+
+void CardShell::scp_open(std::vector<std::wstring> const &argv) {
+    auto keySetName = argv.size() > 2 ? lowercase(argv[2]) : L"default";
+
+    unsigned char securityLevel = SecureChannel::CMac;
+    if (argv.size() > 3)
+        securityLevel = static_cast<unsigned char>(std::stoul(argv[3], nullptr, 16));
+
+    open_secure_channel(keySetName, securityLevel, false);
+    record_resume_step({ scb::Bytes(), scb::Bytes(), keySetName, securityLevel });
+
+    execution_yield_
+        << "SCP0" << static_cast<unsigned>(secureChannel_->protocol())
+        << " session opened, security level " << std::hex << static_cast<unsigned>(securityLevel) << std::dec << "\r\n";
+}
+
+void CardShell::open_secure_channel(std::wstring const &keySetName, unsigned char securityLevel, bool quiet) {
+    auto keySet = keySets_.find(keySetName);
+    if (keySet == keySets_.end())
+        throw std::runtime_error("unknown key set");
+
+    secureChannel_.reset();
+    ScopedTransaction transaction(*this);
+
+    auto send = [this, quiet](scb::Bytes const &command) {
+        if (quiet)
+            set_last_response(transceive(command));
+        else
+            exchange(rsc::cAPDU(command));
+    };
+
+    scb::Bytes hostChallenge(8);
+    if (RAND_bytes(hostChallenge.data(), static_cast<int>(hostChallenge.size())) != 1)
+        throw std::runtime_error("failed to generate host challenge");
+
+    send(SecureChannel::initialize_update(keySet->second.version, hostChallenge));
+    if (last_rapdu().SW1() != 0x90 || last_rapdu().SW2() != 0x00)
+        throw std::runtime_error("INITIALIZE UPDATE failed");
+
+    auto const &response = last_rapdu().buffer();
+    auto session = SecureChannel::open(keySet->second, hostChallenge, response.left(response.size() - 2), securityLevel);
+
+    send(session->external_authenticate());
+    if (last_rapdu().SW1() != 0x90 || last_rapdu().SW2() != 0x00)
+        throw std::runtime_error("EXTERNAL AUTHENTICATE failed");
+
+    secureChannel_ = std::move(session);
+}
+
+void CardShell::scp_bench(std::vector<std::wstring> const &argv) {
+    auto count = std::stoul(argv[2]);
+    auto size = argv.size() > 3 ? std::stoul(argv[3]) : 200ul;
+    if (count == 0 || size == 0 || size > 239)
+        throw std::runtime_error("count must be positive and data size must be between 1 and 239");
+
+    // STORE DATA blocks, numbered modulo 256, the last one is flagged
+    scb::Bytes command(5 + size);
+    command[0] = 0x80;
+    command[1] = 0xE2;
+    command[4] = static_cast<unsigned char>(size);
+    for (size_t i = 0; i < size; i++)
+        command[5 + i] = static_cast<unsigned char>(i);
+
+    ScopedTransaction transaction(*this);
+    auto start = std::chrono::steady_clock::now();
+    for (unsigned long i = 0; i < count; i++) {
+        command[2] = i + 1 == count ? 0x80 : 0x00;
+        command[3] = static_cast<unsigned char>(i);
+
+        auto rapdu = transceive(secureChannel_ ? secureChannel_->wrap(command) : command);
+        if (secureChannel_)
+            rapdu = rsc::rAPDU(secureChannel_->unwrap(rapdu.buffer()));
+        if (rapdu.SW1() != 0x90 || rapdu.SW2() != 0x00) {
+            set_last_response(rapdu);
+            throw std::runtime_error("STORE DATA failed, see last response");
+        }
+    }
+    auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    execution_yield_
+        << count << " STORE DATA commands, " << count * size << " bytes in " << elapsed * 1000 << " ms\r\n"
+        << count / elapsed << " commands/s, " << count * size / elapsed << " bytes/s\r\n";
+}
+
+// LOAD block size when none is given, below the 255 bytes of a short APDU: cards with smaller
+// APDU buffers reject longer blocks, faster cards take a larger size as argument.
+static constexpr size_t DefaultLoadBlockSize = 240;
+
+void CardShell::gp_load(std::vector<std::wstring> const &argv) {
+    if (argv.size() != 2 && argv.size() != 3) {
+        execution_yield_ << "usage: gp-load <cap file> [max block size]\r\n";
+        return;
+    }
+
+    CapFile cap(std::filesystem::path{ argv[1] });
+    auto block = cap.load_file_data_block();
+
+    execution_yield_ << "Package AID: ";
+    execution_yield_ << hex_bytes(cap.package_aid());
+    execution_yield_ << "\r\n";
+    for (auto const &aid : cap.applet_aids()) {
+        execution_yield_ << "Applet AID: ";
+        execution_yield_ << hex_bytes(aid);
+        execution_yield_ << "\r\n";
+    }
+    execution_yield_ << "Load file: " << cap.load_file().size() << " bytes\r\n";
+
+    // INSTALL [for load]: package AID, security domain (current), no hash, no parameters, no token
+    auto const &aid = cap.package_aid();
+    scb::Bytes install(5 + 1 + aid.size() + 4);
+    install[0] = 0x80;
+    install[1] = 0xE6;
+    install[2] = 0x02;
+    install[4] = static_cast<unsigned char>(install.size() - 5);
+    install[5] = static_cast<unsigned char>(aid.size());
+    std::copy(aid.begin(), aid.end(), install.begin() + 6);
+
+    // A card may abort the whole load on a rejected LOAD, so the block size is not probed
+    size_t blockSize = secureChannel_ ? secureChannel_->max_data_size() : 255;
+    blockSize = std::min<size_t>(blockSize, argv.size() == 3 ? std::stoul(argv[2]) : DefaultLoadBlockSize);
+    if (blockSize == 0)
+        throw std::runtime_error("invalid block size");
+    auto const blocks = (block.size() + blockSize - 1) / blockSize;
+
+    ScopedTransaction transaction(*this);
+    auto start = std::chrono::steady_clock::now();
+
+    execute(rsc::cAPDU(install));
+    if (last_rapdu().SW1() != 0x90 || last_rapdu().SW2() != 0x00)
+        throw std::runtime_error("INSTALL [for load] failed");
+
+    auto send = [this](scb::Bytes const &command) {
+        auto rapdu = transceive(command);
+        return secureChannel_ ? rsc::rAPDU(secureChannel_->unwrap(rapdu.buffer())) : rapdu;
+    };
+
+    rsc::rAPDU rapdu;
+    size_t loaded = 0;
+    try {
+        rapdu = send(load_command(block, 0, std::min(blockSize, block.size()), 0));
+        if (rapdu.SW1() == 0x90 && rapdu.SW2() == 0x00)
+            loaded++;
+
+        // Following blocks are sliced and wrapped on a worker thread, while the previous one is on the wire
+        if (loaded == 1 && blocks > 1) {
+            BoundedQueue<scb::Bytes> prepared(4);
+            std::exception_ptr error;
+            std::thread producer([&]() {
+                try {
+                    for (size_t n = 1; n < blocks; n++) {
+                        auto offset = n * blockSize;
+                        if (!prepared.push(load_command(block, offset, std::min(blockSize, block.size() - offset), static_cast<unsigned>(n))))
+                            break;
+                    }
+                } catch (...) {
+                    error = std::current_exception();
+                }
+                prepared.close();
+            });
+
+            try {
+                scb::Bytes command;
+                while (prepared.pop(command)) {
+                    rapdu = send(command);
+                    if (rapdu.SW1() != 0x90 || rapdu.SW2() != 0x00)
+                        break;
+                    loaded++;
+                }
+            } catch (...) {
+                prepared.close();
+                producer.join();
+                throw;
+            }
+            prepared.close();
+            producer.join();
+            if (error)
+                std::rethrow_exception(error);
+
+            // Commands wrapped ahead of the failed one were never sent, the session is out of sync
+            if (loaded < blocks)
+                secureChannel_.reset();
+        }
+    } catch (...) {
+        secureChannel_.reset();
+        throw;
+    }
+
+    set_last_response(rapdu);
+    if (loaded < blocks) {
+        execution_yield_ << "LOAD block " << loaded << " failed: ";
+        execution_yield_ << hex_bytes(rapdu.buffer(), " ");
+        execution_yield_ << "\r\n";
+        if (rapdu.SW1() == 0x67 && rapdu.SW2() == 0x00)
+            throw std::runtime_error("LOAD failed, the card does not take blocks of " + std::to_string(blockSize) + " bytes, give a smaller max block size");
+        throw std::runtime_error("LOAD failed");
+    }
+
+    auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    execution_yield_
+        << "Loaded " << block.size() << " bytes in " << blocks << " blocks of " << blockSize << " bytes\r\n"
+        << "Elapsed " << elapsed * 1000 << " ms, " << block.size() / elapsed << " bytes/s\r\n";
+}
+
+scb::Bytes CardShell::load_command(scb::Bytes const &block, size_t offset, size_t size, unsigned blockNumber) {
+    scb::Bytes command(5 + size);
+    command[0] = 0x80;
+    command[1] = 0xE8;
+    command[2] = offset + size == block.size() ? 0x80 : 0x00;
+    command[3] = static_cast<unsigned char>(blockNumber);
+    command[4] = static_cast<unsigned char>(size);
+    std::copy(block.begin() + offset, block.begin() + offset + size, command.begin() + 5);
+    return secureChannel_ ? secureChannel_->wrap(command) : command;
+}
+
+void CardShell::emv_oda(std::vector<std::wstring> const &argv) {
+    if (argv.size() == 6 && is_keyword(argv[1], L"ca")) {
+        emvOda_.add_ca_key(scb::Bytes(argv[2]), static_cast<unsigned char>(std::stoul(argv[3], nullptr, 16)), scb::Bytes(argv[4]), scb::Bytes(argv[5]));
+    } else if (argv.size() == 3 && is_keyword(argv[1], L"ca-file")) {
+        auto count = emvOda_.load_ca_keys(std::filesystem::path{ argv[2] });
+        execution_yield_ << "Loaded " << count << " CA public keys\r\n";
+    } else if (argv.size() == 3 && is_keyword(argv[1], L"card")) {
+        emv_oda_card(scb::Bytes(argv[2]));
+    } else if (argv.size() >= 3 && is_keyword(argv[1], L"dump")) {
+        emv_oda_dumps(argv);
+    } else if (argv.size() == 2 && is_keyword(argv[1], L"cache")) {
+        execution_yield_
+            << emvOda_.cached_issuer_keys() << " cached issuer public keys, "
+            << emvOda_.issuer_key_recoveries() << " recoveries, "
+            << emvOda_.issuer_key_cache_hits() << " cache hits\r\n";
+    } else if (argv.size() == 3 && is_keyword(argv[1], L"cache") && is_keyword(argv[2], L"clear")) {
+        emvOda_.clear_cache();
+    } else {
+        execution_yield_
+            << "usage: emv-oda ca <rid> <index> <modulus> <exponent>\r\n"
+            << "       emv-oda ca-file <file>\r\n"
+            << "       emv-oda card <aid>\r\n"
+            << "       emv-oda dump <transcript file / directory> [...]\r\n"
+            << "       emv-oda cache [clear]\r\n"
+            << emvOda_.ca_keys() << " CA public keys loaded\r\n";
+    }
+}
+
+void CardShell::emv_oda_card(scb::Bytes const &aid) {
+    ScopedTransaction transaction(*this);
+    std::vector<EmvOda::Exchange> exchanges;
+    auto send = [&](scb::Bytes const &command) {
+        execute(rsc::cAPDU(command));
+        exchanges.push_back({ command, last_rapdu().buffer() });
+        if (last_rapdu().SW1() != 0x90 || last_rapdu().SW2() != 0x00)
+            throw std::runtime_error("card returned error status");
+        auto const &response = last_rapdu().buffer();
+        return response.left(response.size() - 2);
+    };
+
+    std::map<unsigned, scb::Bytes> terminal;
+    terminal[0x9F37] = scb::Bytes(4);
+    if (RAND_bytes(terminal[0x9F37].data(), 4) != 1)
+        throw std::runtime_error("failed to generate unpredictable number");
+
+    auto fci = send(rsc::cAPDU::SELECT(aid, true, true).buffer());
+
+    // GET PROCESSING OPTIONS, PDOL filled with the unpredictable number and zeros
+    scb::Bytes pdol;
+    auto pdolData = BerTlv::find(fci, 0x9F38, pdol) ? EmvOda::dol_data(pdol, terminal) : scb::Bytes();
+    scb::Bytes gpo(5 + 2 + pdolData.size() + 1);
+    gpo[0] = 0x80;
+    gpo[1] = 0xA8;
+    gpo[4] = static_cast<unsigned char>(2 + pdolData.size());
+    gpo[5] = 0x83;
+    gpo[6] = static_cast<unsigned char>(pdolData.size());
+    std::copy(pdolData.begin(), pdolData.end(), gpo.begin() + 7);
+    send(gpo);
+
+    auto card = EmvOda::collect(exchanges);
+    auto afl = card.tags[0x94];
+    for (size_t i = 0; i + 4 <= afl.size(); i += 4) {
+        for (unsigned number = afl[i + 1]; number <= afl[i + 2]; number++) {
+            scb::Bytes readRecord(L"00B2000000");
+            readRecord[2] = static_cast<unsigned char>(number);
+            readRecord[3] = static_cast<unsigned char>(afl[i] | 0x04);
+            send(readRecord);
+        }
+    }
+
+    // DDA needs INTERNAL AUTHENTICATE, CDA would need GENERATE AC, which changes the card state
+    auto aip = card.tags[0x82];
+    if (aip.size() == 2 && (aip[0] & 0x20)) {
+        card = EmvOda::collect(exchanges);
+        auto ddol = card.tags.count(0x9F49) ? card.tags[0x9F49] : scb::Bytes(L"9F3704");
+        auto ddolData = EmvOda::dol_data(ddol, terminal);
+        scb::Bytes internalAuthenticate(5 + ddolData.size() + 1);
+        internalAuthenticate[1] = 0x88;
+        internalAuthenticate[4] = static_cast<unsigned char>(ddolData.size());
+        std::copy(ddolData.begin(), ddolData.end(), internalAuthenticate.begin() + 5);
+        send(internalAuthenticate);
+    }
+
+    auto result = emvOda_.verify(EmvOda::collect(exchanges));
+    execution_yield_ << utf8(result.summary) << "\r\n";
+}
+
+// Files of the arguments and the regular files in directories of the arguments, sorted.
+static std::vector<std::filesystem::path> dump_files(std::vector<std::wstring>::const_iterator begin, std::vector<std::wstring>::const_iterator end) {
+    std::vector<std::filesystem::path> files;
+    for (auto arg = begin; arg != end; ++arg) {
+        std::filesystem::path path{ *arg };
+        if (std::filesystem::is_directory(path)) {
+            for (auto const &entry : std::filesystem::directory_iterator(path))
+                if (entry.is_regular_file())
+                    files.push_back(entry.path());
+        } else {
+            files.push_back(path);
+        }
+    }
+    std::sort(files.begin(), files.end());
+    return files;
+}
+
+void CardShell::emv_oda_dumps(std::vector<std::wstring> const &argv) {
+    auto files = dump_files(argv.begin() + 2, argv.end());
+
+    auto recoveries = emvOda_.issuer_key_recoveries();
+    auto start = std::chrono::steady_clock::now();
+
+    std::vector<EmvOda::Result> results(files.size());
+    parallel_for(files.size(), [&](size_t i) {
+        try {
+            results[i] = emvOda_.verify(EmvOda::collect(EmvOda::read_transcript(files[i])));
+        } catch (std::exception const &e) {
+            std::string what = e.what();
+            results[i].summary = L"failed: " + std::wstring(what.begin(), what.end());
+        }
+    });
+
+    auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    size_t passed = 0;
+    for (size_t i = 0; i < files.size(); i++) {
+        execution_yield_ << utf8(files[i].filename().wstring()) << ": " << utf8(results[i].summary) << "\r\n";
+        if (results[i].passed)
+            passed++;
+    }
+    execution_yield_
+        << passed << " of " << files.size() << " dumps passed in " << elapsed * 1000 << " ms, "
+        << emvOda_.issuer_key_recoveries() - recoveries << " issuer key recoveries\r\n";
+}
+
+static void print_difference(std::ostream &output, DumpTree::Difference const &difference) {
+    output << DumpTree::kind_name(difference.kind) << ' ' << (difference.path.empty() ? "/" : difference.path) << ": ";
+    switch (difference.kind) {
+        case DumpTree::Difference::Added:
+            output << difference.b;
+            break;
+        case DumpTree::Difference::Removed:
+            output << difference.a;
+            break;
+        default:
+            output << difference.a << " -> " << difference.b;
+            break;
+    }
+    output << "\r\n";
+}
+
+void CardShell::dump_diff(std::vector<std::wstring> const &argv) {
+    if (argv.size() < 3) {
+        execution_yield_ << "usage: dump-diff <reference transcript> <transcript / directory> [...]\r\n";
+        return;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    auto reference = DumpTree::read(std::filesystem::path{ argv[1] });
+    auto files = dump_files(argv.begin() + 2, argv.end());
+    if (files.empty())
+        throw std::runtime_error("no transcripts to compare");
+
+    if (files.size() == 1 && !std::filesystem::is_directory(std::filesystem::path{ argv[2] })) {
+        auto dump = DumpTree::read(files.front());
+        auto comparison = DumpTree::compare(reference, dump);
+        auto elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        for (auto const &difference : comparison.differences)
+            print_difference(execution_yield_, difference);
+        execution_yield_
+            << comparison.differences.size() << " differences, " << comparison.visited << " of " << reference.size() + dump.size()
+            << " nodes compared in " << elapsed << " ms\r\n";
+        return;
+    }
+
+    // Differences of many cards are summarized by path: personalized values differ on every card,
+    // structural ones on a few
+    std::vector<DumpTree::Comparison> comparisons(files.size());
+    std::vector<std::string> errors(files.size());
+    parallel_for(files.size(), [&](size_t i) {
+        try {
+            comparisons[i] = DumpTree::compare(reference, DumpTree::read(files[i]));
+        } catch (std::exception const &e) {
+            errors[i] = e.what();
+        }
+    });
+    auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    std::map<std::pair<std::string, DumpTree::Difference::Kind>, size_t> byPath;
+    size_t identical = 0;
+    for (size_t i = 0; i < files.size(); i++) {
+        execution_yield_ << utf8(files[i].filename().wstring()) << ": ";
+        if (!errors[i].empty())
+            execution_yield_ << "failed: " << errors[i];
+        else if (comparisons[i].differences.empty())
+            execution_yield_ << "identical";
+        else
+            execution_yield_ << comparisons[i].differences.size() << " differences";
+        execution_yield_ << "\r\n";
+
+        if (errors[i].empty() && comparisons[i].differences.empty())
+            identical++;
+        for (auto const &difference : comparisons[i].differences)
+            byPath[{ difference.path, difference.kind }]++;
+    }
+
+    std::vector<std::pair<size_t, std::pair<std::string, DumpTree::Difference::Kind>>> ranked;
+    for (auto const &[path, count] : byPath)
+        ranked.push_back({ count, path });
+    std::stable_sort(ranked.begin(), ranked.end(), [](auto const &x, auto const &y) { return x.first > y.first; });
+    if (!ranked.empty())
+        execution_yield_ << "\r\nDumps with the difference:\r\n";
+    for (auto const &[count, path] : ranked) {
+        execution_yield_
+            << std::setw(8) << count << ' ' << DumpTree::kind_name(path.second) << ' '
+            << (path.first.empty() ? "/" : path.first) << "\r\n";
+    }
+    execution_yield_
+        << identical << " of " << files.size() << " dumps identical to the reference, compared in " << elapsed * 1000 << " ms\r\n";
+}
+
+scb::Bytes CardShell::current_atr() {
+    if (simCard_)
+        return simCard_->atr();
+    card().fetch_status();
+    return card().atr();
+}
+
+void CardShell::record_select(scb::Bytes const &command) {
+    if (command.size() < 4 || command[1] != 0xA4 || command[2] != 0x04)
+        return;
+    if (lastResponse_.sw1() != 0x90 && lastResponse_.sw1() != 0x61)
+        return;
+
+    if (command.size() > 5 && command.size() >= 5u + command[4]) {
+        std::wostringstream aid;
+        command.bytes(5, command[4]).print(aid, L"");
+        auto hex = aid.str();
+        std::transform(hex.begin(), hex.end(), hex.begin(), ::towlower);
+        selectedAids_.insert(hex);
+    }
+    if (!resumeEnabled_)
+        return;
+
+    // A SELECT starts a new session, also through the secure channel, which it ends; it is replayed plain
+    resumeSteps_.clear();
+    record_resume_step({ command, last_rapdu().buffer() });
+}
+
+std::vector<std::wstring> CardShell::key_set_names() const {
+    std::vector<std::wstring> names;
+    for (auto const &[name, keys] : keySets_)
+        names.push_back(name);
+    return names;
+}
+
+std::vector<std::wstring> CardShell::known_aids() const {
+    static wchar_t const *const wellKnown[] = {
+        L"a0000000031010",      // Visa credit / debit
+        L"a0000000032010",      // Visa Electron
+        L"a0000000041010",      // Mastercard
+        L"a0000000043060",      // Maestro
+        L"a00000002501",        // American Express
+        L"a0000001523010",      // Discover
+        L"a0000000651010",      // JCB
+        L"a000000151000000",    // GlobalPlatform ISD
+        L"a000000003000000",    // Visa card manager
+        L"315041592e5359532e4444463031",    // 1PAY.SYS.DDF01
+        L"325041592e5359532e4444463031",    // 2PAY.SYS.DDF01
+    };
+
+    std::vector<std::wstring> aids(std::begin(wellKnown), std::end(wellKnown));
+    for (auto const &aid : selectedAids_) {
+        if (std::find(aids.begin(), aids.end(), aid) == aids.end())
+            aids.push_back(aid);
+    }
+    return aids;
+}
+
+void CardShell::record_resume_step(ResumeStep step) {
+    if (!resumeEnabled_)
+        return;
+    if (step.command.empty())
+        drop_resume_session_steps();
+    if (resumeSteps_.empty())
+        resumeAtr_ = current_atr();
+    resumeSteps_.push_back(std::move(step));
+}
+
+void CardShell::drop_resume_session_steps() {
+    auto channel = std::find_if(resumeSteps_.begin(), resumeSteps_.end(), [](auto const &step) { return step.command.empty(); });
+    resumeSteps_.erase(channel, resumeSteps_.end());
+}
+
+void CardShell::resume_session() {
+    auto steps = std::move(resumeSteps_);
+    resumeSteps_.clear();
+
+    if (current_atr() != resumeAtr_) {
+        execution_yield_ << "Different card, session not resumed\r\n";
+        return;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    try {
+        ScopedTransaction transaction(*this);
+        for (auto const &step : steps) {
+            if (step.command.empty()) {
+                open_secure_channel(step.keySet, step.securityLevel, true);
+                continue;
+            }
+
+            // GET RESPONSE chains are followed as when the step was recorded, T=0 cards answer 61xx first
+            ResponseApdu response;
+            exchange(step.command.data(), step.command.size(), response);
+            // The FCI tells whether it is still the same card
+            if (response.sw1() != 0x90 || response.bytes() != step.response)
+                throw std::runtime_error("card answers differently");
+        }
+    } catch (std::exception const &e) {
+        secureChannel_.reset();
+        execution_yield_ << "Session not resumed: " << e.what() << "\r\n";
+        return;
+    }
+    auto elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+    resumeSteps_ = std::move(steps);
+    execution_yield_ << "Session resumed, " << resumeSteps_.size() << " steps in " << elapsed << " ms\r\n";
+}
+
+void CardShell::resume(std::vector<std::wstring> const &argv) {
+    if (argv.size() == 2 && is_keyword(argv[1], L"on")) {
+        resumeEnabled_ = true;
+    } else if (argv.size() == 2 && is_keyword(argv[1], L"off")) {
+        resumeEnabled_ = false;
+        resumeSteps_.clear();
+    } else if (argv.size() == 2 && is_keyword(argv[1], L"clear")) {
+        resumeSteps_.clear();
+    } else if (argv.size() == 2 && is_keyword(argv[1], L"now")) {
+        if (resumeSteps_.empty())
+            throw std::runtime_error("no session to resume");
+        resume_session();
+        return;
+    } else if (argv.size() != 1) {
+        execution_yield_ << "usage: resume [on / off / clear / now]\r\n";
+        return;
+    }
+
+    execution_yield_ << "Session resume is " << (resumeEnabled_ ? "on" : "off") << "\r\n";
+    for (auto const &step : resumeSteps_) {
+        if (step.command.empty()) {
+            execution_yield_ << "    scp open " << utf8(step.keySet) << ' ' << std::hex << static_cast<unsigned>(step.securityLevel) << std::dec << "\r\n";
+        } else {
+            execution_yield_ << "    " << hex_bytes(step.command, " ");
+            execution_yield_ << "\r\n";
+        }
+    }
+}
+
+void CardShell::begin_transaction() {
+    if (transactionDepth_ == 0 && !simCard_ && has_card())
+        transaction_ = std::make_unique<CardTransaction>(card().handle());
+    transactionDepth_++;
+}
+
+void CardShell::end_transaction() {
+    if (transactionDepth_ > 0 && --transactionDepth_ == 0)
+        transaction_.reset();
+}
+
+void CardShell::release_transaction() {
+    transaction_.reset();
+    transactionDepth_ = 0;
+    explicitTransaction_ = false;
+}
+
+void CardShell::begin(std::vector<std::wstring> const&) {
+    if (explicitTransaction_) {
+        execution_yield_ << "Transaction already started\r\n";
+        return;
+    }
+    if (!simCard_ && !has_card())
+        throw std::runtime_error("cannot begin transaction, no card present");
+
+    begin_transaction();
+    explicitTransaction_ = true;
+}
+
+void CardShell::end(std::vector<std::wstring> const&) {
+    if (!explicitTransaction_) {
+        execution_yield_ << "No transaction started\r\n";
+        return;
+    }
+
+    explicitTransaction_ = false;
+    end_transaction();
+}
+
+void CardShell::tx_bench(std::vector<std::wstring> const &argv) {
+    if (argv.size() != 2 && argv.size() != 3) {
+        execution_yield_ << "usage: tx-bench <count> [command]\r\n";
+        return;
+    }
+    if (!simCard_ && !has_card())
+        throw std::runtime_error("cannot transmit, no card present");
+    if (explicitTransaction_)
+        throw std::runtime_error("end the current transaction first");
+
+    auto count = std::stoul(argv[1]);
+    if (count == 0)
+        throw std::runtime_error("count must be positive");
+    // GET DATA of card data by default, answered by every GlobalPlatform card
+    static constexpr auto getCardData = apdu::get_data(0x0066);
+    CommandApdu command(getCardData.data(), getCardData.size());
+    if (argv.size() == 3) {
+        scb::Bytes bytes(argv[2]);
+        command.assign(bytes.data(), bytes.size());
+    }
+    ResponseApdu response;
+
+    auto measure = [&] {
+        auto start = std::chrono::steady_clock::now();
+        for (unsigned long i = 0; i < count; i++)
+            transceive(command.data(), command.size(), response);
+        return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count() / count;
+    };
+
+    auto single = measure();
+    double batched;
+    {
+        ScopedTransaction transaction(*this);
+        batched = measure();
+    }
+
+    execution_yield_
+        << "Without transaction: " << single << " us/command\r\n"
+        << "Within transaction:  " << batched << " us/command\r\n"
+        << "Locking overhead:    " << single - batched << " us/command\r\n";
+}
+
+void CardShell::apdu_bench(std::vector<std::wstring> const &argv) {
+    if (argv.size() != 2) {
+        execution_yield_ << "usage: apdu-bench <count>\r\n";
+        return;
+    }
+    auto count = std::stoul(argv[1]);
+    if (count == 0)
+        throw std::runtime_error("count must be positive");
+
+    struct Result {
+        double ns;
+        double allocations;
+    };
+    auto measure = [count](auto &&f) {
+        auto before = thread_allocations();
+        auto start = std::chrono::steady_clock::now();
+        for (unsigned long i = 0; i < count; i++)
+            f();
+        auto elapsed = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+        return Result{ elapsed / count, static_cast<double>((thread_allocations() - before).count) / count };
+    };
+    auto print = [this](char const *name, Result const &result) {
+        execution_yield_ << name << result.ns << " ns, " << result.allocations << " allocations per command\r\n";
+    };
+
+    // Both ways do the same work around an exchange: build a SELECT, take the response and find the
+    // DF name in its FCI. Offline the response is the canned answer, otherwise it is transmitted.
+    static scb::Bytes const aid(L"a0000000031010");
+    static scb::Bytes const answer(L"6f098407a00000000310109000");
+    static constexpr auto select = apdu::select("a0000000031010");
+    size_t sink = 0;
+
+    auto df_name = [&](unsigned char const *data, size_t size) {
+        BerTlv::Element element;
+        if (size > 2 && data[size - 2] == 0x90 && BerTlv::find(data, size, 0, size - 2, 0x84, element))
+            sink += element.length;
+    };
+    auto rapdu_way = [&](auto &&take) {
+        return measure([&] {
+            auto capdu = rsc::cAPDU::SELECT(aid, true, true);
+            rsc::rAPDU rapdu = take(capdu);
+            df_name(rapdu.buffer().data(), rapdu.buffer().size());
+        });
+    };
+    ResponseApdu response;
+    auto inline_way = [&](auto &&take) {
+        return measure([&] {
+            take(select);
+            df_name(response.data(), response.size());
+        });
+    };
+
+    print("cAPDU / rAPDU:        ", rapdu_way([&](rsc::cAPDU const&) { return rsc::rAPDU(answer); }));
+    print("constexpr / inline:   ", inline_way([&](auto const&) { response.assign(answer.data(), answer.size()); }));
+
+    if (simCard_ || has_card()) {
+        ScopedTransaction transaction(*this);
+        print("transmit cAPDU/rAPDU: ", rapdu_way([&](rsc::cAPDU const &capdu) { return transceive(capdu.buffer()); }));
+        print("transmit inline:      ", inline_way([&](auto const &command) { transceive(command.data(), command.size(), response); }));
+    }
+    // Keeps the loops from being optimized away
+    if (sink == 0)
+        execution_yield_ << "\r\n";
+}
+
+void CardShell::sweep(std::vector<std::wstring> const &argv) {
+    if (argv.size() == 2 && is_keyword(argv[1], L"status")) {
+        if (!sweep_)
+            throw std::runtime_error("no sweep");
+        sweep_print();
+        return;
+    }
+
+    if ((argv.size() == 2 || argv.size() == 3) && is_keyword(argv[1], L"resume")) {
+        if (argv.size() == 3) {
+            sweep_ = std::make_unique<ApduSweep>(ApduSweep::load(argv[2]));
+            sweepCheckpoint_ = argv[2];
+        } else if (!sweep_) {
+            throw std::runtime_error("no sweep to resume");
+        }
+        sweep_run();
+        return;
+    }
+
+    if (argv.size() < 5 || argv.size() % 2 == 0) {
+        execution_yield_ << "usage: sweep <cla> <ins> <p1> <p2> [data <hex>] [rate <commands/s>] [checkpoint <file>] / resume [checkpoint] / status\r\n";
+        return;
+    }
+
+    ApduSweep::Spec spec;
+    for (size_t i = 0; i < 4; i++)
+        spec.fields[i] = ApduSweep::parse_field(argv[1 + i]);
+
+    std::wstring checkpoint;
+    for (size_t i = 5; i < argv.size(); i += 2) {
+        if (is_keyword(argv[i], L"data")) {
+            spec.tail = scb::Bytes(argv[i + 1]);
+        } else if (is_keyword(argv[i], L"rate")) {
+            spec.rate = std::stoul(argv[i + 1]);
+        } else if (is_keyword(argv[i], L"checkpoint")) {
+            checkpoint = argv[i + 1];
+        } else {
+            throw std::runtime_error("unknown sweep option");
+        }
+    }
+
+    sweep_ = std::make_unique<ApduSweep>(std::move(spec));
+    sweepCheckpoint_ = checkpoint;
+    sweep_run();
+}
+
+void CardShell::sweep_run() {
+    auto &sweep = *sweep_;
+
+    if (!simCard_ && !has_card())
+        throw std::runtime_error("cannot transmit, no card present");
+
+    // One transaction for the whole sweep, other applications would otherwise get the reader between commands
+    ScopedTransaction transaction(*this);
+
+    auto const interval = std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+        std::chrono::duration<double>(sweep.spec().rate ? 1.0 / sweep.spec().rate : 0.0));
+    auto const sentBefore = sweep.sent();
+    auto const start = std::chrono::steady_clock::now();
+    auto next = start;
+    ResponseApdu response;
+
+    try {
+        while (!sweep.done()) {
+            if (sweep.spec().rate) {
+                std::this_thread::sleep_until(next);
+                next += interval;
+            }
+            auto const &command = sweep.command();
+            transceive(command.data(), command.size(), response);
+            sweep.record(response.sw());
+
+            if (!sweepCheckpoint_.empty() && (sweep.sent() - sentBefore) % 1024 == 0)
+                sweep.save(sweepCheckpoint_);
+        }
+    } catch (...) {
+        // Card removed or reader gone: the position is kept, the sweep continues after reconnecting
+        if (!sweepCheckpoint_.empty())
+            sweep.save(sweepCheckpoint_);
+        execution_yield_ << "Sweep interrupted after " << sweep.sent() << " commands, continue with: sweep resume\r\n";
+        throw;
+    }
+    auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    if (!sweepCheckpoint_.empty())
+        sweep.save(sweepCheckpoint_);
+
+    auto sent = sweep.sent() - sentBefore;
+    execution_yield_ << sent << " commands in " << elapsed * 1000 << " ms";
+    if (elapsed > 0)
+        execution_yield_ << ", " << sent / elapsed << " commands/s";
+    execution_yield_ << "\r\n";
+    sweep_print();
+}
+
+void CardShell::sweep_print() const {
+    auto const &sweep = *sweep_;
+
+    execution_yield_
+        << "Sent " << sweep.sent() << ", skipped " << sweep.skipped() << " of " << sweep.total() << " commands"
+        << (sweep.done() ? "" : " (incomplete)") << "\r\n";
+
+    std::vector<std::pair<unsigned short, ApduSweep::Bucket const*>> buckets;
+    for (auto const &[sw, bucket] : sweep.histogram())
+        buckets.emplace_back(sw, &bucket);
+    std::sort(buckets.begin(), buckets.end(), [](auto const &a, auto const &b) {
+        return a.second->count != b.second->count ? a.second->count > b.second->count : a.first < b.first;
+    });
+
+    auto const flags = execution_yield_.flags();
+    auto const fill = execution_yield_.fill();
+    execution_yield_ << std::uppercase << std::setfill('0');
+    for (auto const &[sw, bucket] : buckets) {
+        execution_yield_ << "SW " << std::hex << std::setw(4) << sw << std::dec << ": " << bucket->count << ", e.g.";
+        for (unsigned char i = 0; i < bucket->exampleCount; i++)
+            execution_yield_ << ' ' << std::hex << std::setw(8) << bucket->examples[i] << std::dec;
+        execution_yield_ << "\r\n";
+    }
+    execution_yield_.flags(flags);
+    execution_yield_.fill(fill);
+}
+
 void CardShell::select(std::vector<std::wstring> const &argv) {
     scb::Bytes name;
     bool first = true;
@@ -242,10 +1515,10 @@ void CardShell::select(std::vector<std::wstring> const &argv) {
 
     auto nextArg = argv.begin() + 1;
 
-    if (*nextArg == L"first") {
+    if (is_keyword(*nextArg, L"first")) {
         first = true;
         ++nextArg;
-    } else if (*nextArg == L"next") {
+    } else if (is_keyword(*nextArg, L"next")) {
         first = false;
         ++nextArg;
     }
@@ -253,13 +1526,13 @@ void CardShell::select(std::vector<std::wstring> const &argv) {
     if (nextArg == argv.end())
         goto usage;
 
-    if (*nextArg == L"hex") {
+    if (is_keyword(*nextArg, L"hex")) {
         stringAs = scb::Bytes::Hex;
         ++nextArg;
-    } else if (*nextArg == L"ascii") {
+    } else if (is_keyword(*nextArg, L"ascii")) {
         stringAs = scb::Bytes::ASCII;
         ++nextArg;
-    } else if (*nextArg == L"unicode") {
+    } else if (is_keyword(*nextArg, L"unicode")) {
         stringAs = scb::Bytes::Unicode;
         ++nextArg;
     }
@@ -267,200 +1540,67 @@ void CardShell::select(std::vector<std::wstring> const &argv) {
     if (nextArg == argv.end())
         goto usage;
 
-    while (nextArg != argv.end())
-        name += scb::Bytes(*nextArg++, stringAs);
+    for (; nextArg != argv.end(); ++nextArg)
+        name += stringAs == scb::Bytes::Hex ? hex_argument(*nextArg) : scb::Bytes(*nextArg, stringAs);
 
     execution_yield_
         << "SELECT "
         << (first ? "first" : "next")
         << " hex ";
-    name.print(execution_yield_, L" ");
+    execution_yield_ << hex_bytes(name, " ");
     execution_yield_ << "\r\n";
 
     execute(rsc::cAPDU::SELECT(name, true, first));
 }
 
 void CardShell::parse(rsc::TLVList const &tlvList, size_t parse_depth) const {
-    std::wstring prefix;
-    for (size_t i = 0; i < parse_depth; i++) {
-        prefix += L"| ";
-    }
-    for (auto const &tlv : tlvList) {
-        execution_yield_
-            << prefix
-            << "* ";
-        tlv.tag().bytes().print(execution_yield_);
-        execution_yield_
-            << " (" << tlv.length() << ") " << tlv.tag().name()
-            << "\r\n"
-            << prefix
-            << "|\\\r\n";
-
-        if (tlv.tag().is_constructed()) {
-            parse(tlv.value_as_tlv_list(), parse_depth + 1);
-        } else {
-            for (size_t i = 0; i < tlv.value().size(); i += 16) {
-                size_t length = 16;
-                if (i + length >= tlv.value().size())
-                    length = tlv.value().size() - i;
-                execution_yield_ << prefix << "| > ";
-                tlv.value().bytes(i, length).print(execution_yield_);
-                execution_yield_ << "\r\n";
-            }
-            if (tlv.value().all_ascii()) {
-                execution_yield_
-                    << prefix
-                    << "| > ASCII: "
-                    << tlv.value().ascii()
-                    << "\r\n";
-            }
+    // Measured once for the whole tree
+    Profiler::Scope scope(parse_depth == 0 ? profiler_ : nullptr, Profiler::Phase::Format);
+    if (auto emitter = structured_output()) {
+        for (auto const &tlv : tlvList) {
+            emitter->begin("tlv");
+            emitter->field("depth", static_cast<unsigned long long>(parse_depth));
+            emitter->field("tag", tlv.tag().bytes());
+            emitter->field("length", static_cast<unsigned long long>(tlv.length()));
+            emitter->field("name", std::wstring_view(tlv.tag().name()));
+            if (!tlv.tag().is_constructed())
+                emitter->field("value", tlv.value());
+            emitter->end();
+
+            if (tlv.tag().is_constructed())
+                parse(tlv.value_as_tlv_list(), parse_depth + 1);
         }
-
-        execution_yield_ << prefix << "|/\r\n";
+        return;
     }
 
-    if (parse_depth == 0)
-        execution_yield_ << prefix << "\r\n";
+    write_tlv_tree(execution_yield_, tlvList, parse_depth);
 }
 
 void CardShell::parse_atr(scb::Bytes const &atr) const {
-    std::ios::fmtflags flags(execution_yield_.flags());
-    scb::ByteStream bs(atr);
-
-    execution_yield_ << std::uppercase << std::setfill(L'0');
-
-    auto TS = bs.next_u8();
-    switch (TS) {
-        case 0x3B:
-            execution_yield_ << "TS  = 3B | Direct convention\r\n";
-            break;
-        case 0x3F:
-            execution_yield_ << "TS  = 3F | Inverse convention\r\n";
-            break;
-        default:
-            execution_yield_ << "TS  = " << std::hex << std::setw(2) << TS << " | Unexpected value\r\n";
-    }
-
-    auto T0 = bs.next_u8();
-    execution_yield_ << "T0  = " << std::hex << std::setw(2) << T0 << " | ";
-    parse_atr_yield_interface_bytes(T0, 1);
-    execution_yield_ << "present, and " << std::dec << (T0 & 0x0F) << " historical bytes\r\n";
-
-    // TA1
-    if (T0 & (1 << 4)) {
-        auto TA1 = bs.next_u8();
-        execution_yield_ << "TA1 = " << std::hex << std::setw(2) << TA1 << " | ";
-        unsigned D = 0;
-        switch (TA1 & 0x0F) {
-            case 1: D = 1;  break; 
-            case 2: D = 2;  break; 
-            case 3: D = 4;  break; 
-            case 4: D = 8;  break; 
-            case 5: D = 16; break; 
-            case 6: D = 32; break; 
-            case 7: D = 64; break; 
-            case 8: D = 12; break; 
-            case 9: D = 20; break; 
-        }
-        if (D)
-            execution_yield_ << "D = " << std::dec << D << ", ";
-        else
-            execution_yield_ << "D = unknown, ";
-
-        unsigned F = 0;
-        float fmax = 0;
-        switch (TA1 >> 4) {
-            case 1:  F = 372;  fmax = 5;   break; 
-            case 2:  F = 558;  fmax = 6;   break; 
-            case 3:  F = 744;  fmax = 8;   break; 
-            case 4:  F = 1116; fmax = 12;  break; 
-            case 5:  F = 1488; fmax = 16;  break; 
-            case 6:  F = 1860; fmax = 20;  break; 
-            case 9:  F = 512;  fmax = 5;   break; 
-            case 10: F = 768;  fmax = 7.5; break; 
-            case 11: F = 1024; fmax = 10;  break; 
-            case 12: F = 1536; fmax = 15;  break; 
-            case 13: F = 2048; fmax = 20;  break; 
-        }
-        if (F)
-            execution_yield_ << "F = " << std::dec << F << " and fmax = " << fmax << ", ";
-        else
-            execution_yield_ << "F = Internal and fmax = 9600, ";
-
-        float etu;
-        if (F)
-            etu = 1.0f / static_cast<float>(D) * F / fmax;
-        else
-            etu = 1.0f / static_cast<float>(D) * 1.0f / 9600.0f;
-
-        execution_yield_ << "etu = " << etu << "\r\n";
-    }
-
-    // TB1
-    if (T0 & (1 << 5)) {
-        auto TB1 = bs.next_u8();
-        execution_yield_ << "TB1 = " << std::hex << std::setw(2) << TB1 << " | ";
-
-        unsigned I = 0;
-        switch ((TB1 >> 5) & 0x03) {
-            case 0: I = 25; break;
-            case 1: I = 50; break;
-            case 2: I = 100; break;
+    Profiler::Scope scope(profiler_, Profiler::Phase::Format);
+
+    // One line or record per ATR byte: "TA1 = 96 | D = 32, ...", the description is optional
+    auto yield = [this](std::wstring const &name, unsigned char value, std::wstring const &description) {
+        if (auto emitter = structured_output()) {
+            emitter->begin("atr");
+            emitter->field("field", std::wstring_view(name));
+            emitter->field("value", static_cast<unsigned long long>(value));
+            if (!description.empty())
+                emitter->field("description", std::wstring_view(description));
+            emitter->end();
+            return;
         }
+        write_atr_field(execution_yield_, name, value, description);
+    };
 
-        unsigned PI1 = (TB1 & 0x1F);
-
-        execution_yield_ << "I = " << std::dec << I << " and PI1 = " << PI1 << "\r\n";
-    }
-
-    // TC1
-    if (T0 & (1 << 6)) {
-        auto TC1 = bs.next_u8();
-        execution_yield_
-            << "TC1 = " << std::hex << std::setw(2) << TC1 << " | "
-            << "N = " << std::dec << TC1 << "\r\n";
-    }
-
-    // TD1
-    if (T0 & (1 << 7)) {
-        auto TD1 = bs.next_u8();
-        execution_yield_ << "TD1 = " << std::hex << std::setw(2) << TD1 << " | ";
-
-        unsigned T = TD1 & 0x0F;
-
-        parse_atr_yield_interface_bytes(TD1, 2);
-        execution_yield_ << "present, and protocol is T=" << T << "\r\n";
-
-        unsigned i = 2;
-        for (auto TDi = TD1; ; i++) {
-            if (TDi & (1 << 4)) execution_yield_ << "TA" << i << " = " << std::hex << std::setw(2) << bs.next_u8() << "\r\n";
-            if (TDi & (1 << 5)) execution_yield_ << "TB" << i << " = " << std::hex << std::setw(2) << bs.next_u8() << "\r\n";
-            if (TDi & (1 << 6)) execution_yield_ << "TC" << i << " = " << std::hex << std::setw(2) << bs.next_u8() << "\r\n";
-            unsigned char next_TDi = 0;
-            if (TDi & (1 << 7)) {
-                next_TDi = bs.next_u8();
-                execution_yield_ << "TD" << i << " = " << std::hex << std::setw(2) << next_TDi;
-                if (next_TDi & 0xF0) {
-                    execution_yield_ << " | ";
-                    parse_atr_yield_interface_bytes(next_TDi, i + 1);
-                    execution_yield_ << "present";
-                }
-                execution_yield_ << "\r\n";
-            }
-            if (!(TDi & 0xF0))
-                break;
-            TDi = next_TDi;
-        }
+    if (parse_atr_fields(atr, yield))
+        return;
+    if (auto emitter = structured_output()) {
+        emitter->begin("atr");
+        emitter->field("field", std::string_view("TD1"));
+        emitter->field("description", std::string_view("not present, protocol is T=0"));
+        emitter->end();
     } else {
         execution_yield_ << "TD1 is not present, protocol is T=0\r\n";
     }
-
-    execution_yield_.flags(flags);
-}
-
-void CardShell::parse_atr_yield_interface_bytes(unsigned char byte, unsigned i) const {
-    if (byte & (1 << 4)) execution_yield_ << "TA" << i << ' ';
-    if (byte & (1 << 5)) execution_yield_ << "TB" << i << ' ';
-    if (byte & (1 << 6)) execution_yield_ << "TC" << i << ' ';
-    if (byte & (1 << 7)) execution_yield_ << "TD" << i << ' ';
 }
@@ -1,18 +1,32 @@
 #pragma once
 
 #include "Shell.h"
+#include "ApduBuffer.h"
+#include "ApduSweep.h"
+#include "AutoConnect.h"
+#include "CardTransaction.h"
+#include "ReaderRegistry.h"
+#include "EmvOda.h"
+#include "Mac.h"
+#include "SecureChannel.h"
+#include "SimulatedCard.h"
 
 #include <rsc/Readers.h>
 #include <rsc/Context.h>
 #include <rsc/Card.h>
 
 #include <functional>
+#include <map>
+#include <set>
 #include <memory>
+#include <mutex>
 #include <unordered_map>
 
 class CardShell : public Shell {
 public:
     using ConnectionChangedCb = std::function<void(std::wstring const &reader)>;
+    // Command and response of an exchange as recorded in the history, unwrapped in a secure channel.
+    using ExchangeObserver = std::function<void(scb::Bytes const &command, scb::Bytes const &response)>;
 
     using Shell::Shell;
     using Shell::operator=;
@@ -20,26 +34,50 @@ public:
     void set_context(rsc::Context const &context);
     void create_readers();
     void create_card_and_connect(LPCTSTR szReader);
+    // Takes over card connected elsewhere, e.g. by auto-connect on another thread.
+    void set_card(std::unique_ptr<rsc::Card> card, std::wstring const &reader);
 
     void help(std::wstring const &prefix);
 
     void execute(std::vector<std::wstring> const &argv);
+
+    using Command = void (CardShell::*)(std::vector<std::wstring> const &);
+    // Handler of the command, nullptr when unknown, so that a command can be resolved once and invoked many times.
+    static Command find_command(std::wstring const &name);
+    // Commands hold the mutex of their reader, so sessions of the shell and of server clients do not
+    // interleave exchanges with the same card.
+    void invoke(Command command, std::vector<std::wstring> const &argv);
+    // Process-wide, by reader name.
+    static std::mutex& reader_mutex(std::wstring const &reader);
     void execute(rsc::cAPDU const &capdu);
 
     void transmit(scb::Bytes const &buffer);
+    void transmit(unsigned char const *command, size_t size);
 
     void print_connection_info();
 
     void set_on_connection_changed_callback(ConnectionChangedCb callback);
+    // Called on the thread of the command, which waits for it.
+    inline void set_exchange_observer(ExchangeObserver observer) { exchangeObserver_ = std::move(observer); }
 
     inline bool context_established() const noexcept { return rscContext_ ? rscContext_->established() : false; }
 
     inline bool has_readers() const noexcept { return rscReaders_ != nullptr; }
     inline bool has_card() const noexcept { return rscCard_ != nullptr; }
+    inline bool has_simulated_card() const noexcept { return simCard_ != nullptr; }
+    inline std::wstring const& reader_name() const noexcept { return readerName_; }
+    inline rsc::rAPDU const& last_response() const { return last_rapdu(); }
 
     inline rsc::Context const& context() { return *rscContext_; }
     inline rsc::Readers& readers() { return *rscReaders_; }
     inline rsc::Card& card() { return *rscCard_; }
+    inline ReaderRegistry& reader_registry() { return readerRegistry_; }
+    inline AutoConnect& auto_connect() { return autoConnect_; }
+
+    // Offered by tab completion.
+    std::vector<std::wstring> key_set_names() const;
+    // Well-known payment and GlobalPlatform AIDs, and AIDs selected in this session, in hex.
+    std::vector<std::wstring> known_aids() const;
 
     inline void reset_context() { rscContext_ = nullptr; }
     inline void reset_readers() { rscReaders_.reset(); }
@@ -47,9 +85,16 @@ public:
 
 private:
     void validate_context() const;
+    // Full reader enumeration, only when the registry has not been fed yet or on request.
+    void synchronize_readers();
+    // Reader of the connect arguments: id, name or atr <pattern>.
+    ReaderRegistry::Reader find_reader(std::vector<std::wstring> const &argv);
+    // Reader the command works with, empty when none.
+    std::wstring command_reader(Command command, std::vector<std::wstring> const &argv);
 
     void readers(std::vector<std::wstring> const&);
     void connect(std::vector<std::wstring> const &argv);
+    void autoconnect(std::vector<std::wstring> const &argv);
     void disconnect(std::vector<std::wstring> const&);
     void reset(std::vector<std::wstring> const &argv);
     void dump(std::vector<std::wstring> const &argv);
@@ -59,18 +104,127 @@ private:
     void apdu(std::vector<std::wstring> const &argv);
 
     void select(std::vector<std::wstring> const &argv);
+    void mac(std::vector<std::wstring> const &argv);
+    void sim(std::vector<std::wstring> const &argv);
+    void scp(std::vector<std::wstring> const &argv);
+    void gp_load(std::vector<std::wstring> const &argv);
+    void emv_oda(std::vector<std::wstring> const &argv);
+    void sweep(std::vector<std::wstring> const &argv);
+    void begin(std::vector<std::wstring> const &argv);
+    void end(std::vector<std::wstring> const &argv);
+    void tx_bench(std::vector<std::wstring> const &argv);
+    void apdu_bench(std::vector<std::wstring> const &argv);
+    void resume(std::vector<std::wstring> const &argv);
+    void dump_diff(std::vector<std::wstring> const &argv);
+
+    scb::Bytes append_mac(scb::Bytes const &apdu);
+    // Adds the exchange to the history and passes it to the observer.
+    void record_exchange(scb::Bytes const &command, scb::Bytes const &response);
+    void record_exchange(scb::Bytes const &command, ResponseApdu const &response);
+
+    // Keeps a card transaction open while alive, nested scopes and `begin` share the outermost transaction,
+    // so multi-APDU operations are not interleaved with other applications and lock the reader only once.
+    class ScopedTransaction {
+    public:
+        explicit ScopedTransaction(CardShell &shell) : shell_(shell) { shell_.begin_transaction(); }
+        ~ScopedTransaction() { shell_.end_transaction(); }
+
+        ScopedTransaction(ScopedTransaction const&) = delete;
+        ScopedTransaction& operator=(ScopedTransaction const&) = delete;
+
+    private:
+        CardShell &shell_;
+    };
+
+    // State-establishing step replayed after the card was reinserted: SELECT, or opening the
+    // secure channel when the command is empty.
+    struct ResumeStep {
+        scb::Bytes command;
+        scb::Bytes response;            // FCI of the SELECT, checked on replay
+        std::wstring keySet;
+        unsigned char securityLevel = 0;
+    };
+
+    scb::Bytes current_atr();
+    void record_select(scb::Bytes const &command);
+    void record_resume_step(ResumeStep step);
+    // Forgets the secure channel and the steps done through it.
+    void drop_resume_session_steps();
+    void resume_session();
+
+    void begin_transaction();
+    void end_transaction();
+    // Drops the transaction before the card is disconnected or reset.
+    void release_transaction();
+
+    // Sends command as is, and follows GET RESPONSE / wrong length status words.
+    void exchange(rsc::cAPDU const &capdu);
+    void exchange(unsigned char const *command, size_t size);
+    // Same chain into the response, without any output.
+    void exchange(unsigned char const *command, size_t size, ResponseApdu &response);
+    // Sends buffer to the card or to the simulated card, without any output.
+    rsc::rAPDU transceive(scb::Bytes const &buffer);
+    // Quiet exchange into an inline buffer, without heap allocation on a reader.
+    void transceive(unsigned char const *command, size_t size, ResponseApdu &response);
+
+    // Last response is kept inline, the rAPDU view of it is built when asked for.
+    rsc::rAPDU const& last_rapdu() const;
+    void set_last_response(rsc::rAPDU const &rapdu);
+
+    void scp_open(std::vector<std::wstring> const &argv);
+    void open_secure_channel(std::wstring const &keySetName, unsigned char securityLevel, bool quiet);
+    void scp_bench(std::vector<std::wstring> const &argv);
+
+    // Builds LOAD command for the block of the load file data block, wrapped when secure channel is open.
+    scb::Bytes load_command(scb::Bytes const &block, size_t offset, size_t size, unsigned blockNumber);
+
+    void emv_oda_card(scb::Bytes const &aid);
+    void emv_oda_dumps(std::vector<std::wstring> const &argv);
+
+    // Sends the remaining commands of the sweep back-to-back, saves checkpoint when interrupted.
+    void sweep_run();
+    void sweep_print() const;
 
     void parse(rsc::TLVList const &tlvList, size_t parse_depth = 0) const;
     void parse_atr(scb::Bytes const &atr) const;
-    void parse_atr_yield_interface_bytes(unsigned char byte, unsigned i) const;
 
     rsc::Context const *rscContext_ = nullptr;
     std::unique_ptr<rsc::Readers> rscReaders_ = nullptr;
     std::unique_ptr<rsc::Card> rscCard_ = nullptr;
+    std::wstring readerName_;
+    unsigned commandDepth_ = 0;
+    ReaderRegistry readerRegistry_;
+    AutoConnect autoConnect_;
 
     ConnectionChangedCb connectionChangedCb_;
+    ExchangeObserver exchangeObserver_;
+
+    ResponseApdu lastResponse_;
+    mutable rsc::rAPDU last_rapdu_;
+    mutable bool lastRapduStale_ = false;
+
+    std::unique_ptr<Mac> apduMac_;
+
+    std::unique_ptr<SecureChannel> secureChannel_;
+    std::map<std::wstring, SecureChannel::KeySet> keySets_{ { L"default", default_key_set() } };
+    std::unique_ptr<SimulatedCard> simCard_;
+
+    std::unique_ptr<CardTransaction> transaction_;
+    unsigned transactionDepth_ = 0;
+    bool explicitTransaction_ = false;
+
+    std::vector<ResumeStep> resumeSteps_;
+    scb::Bytes resumeAtr_;
+    bool resumeEnabled_ = true;
+
+    std::set<std::wstring> selectedAids_;
+
+    EmvOda emvOda_;
+
+    std::unique_ptr<ApduSweep> sweep_;
+    std::wstring sweepCheckpoint_;
 
-    rsc::rAPDU last_rapdu_;
+    static SecureChannel::KeySet default_key_set();
 
     static const std::unordered_map<std::wstring, void (CardShell::*)(std::vector<std::wstring> const &)> command_map_;
     static const std::unordered_map<std::wstring, std::wstring> help_map_;
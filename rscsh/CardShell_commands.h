@@ -1,5 +1,6 @@
-X( L"readers",               readers,               L"\r\n\t-- Lists available readers." )
-X( L"connect",               connect,               L"<id>\r\n\t-- Connects to the card in the specied reader <id>." )
+X( L"readers",               readers,               L"[refresh]\r\n\t-- Lists readers with card presence and ATR, refresh enumerates the readers again." )
+X( L"connect",               connect,               L"<id> / <name> / atr <pattern>\r\n\t-- Connects to the card in the specied reader <id>, reader with (part of) the name, or card with ATR matching hex pattern (?? for any byte)." )
+X( L"autoconnect",           autoconnect,           L"[off / first / pinned <reader name>]\r\n\t-- Sets which reader is connected when a card is inserted, and shows connect latency." )
 X( L"disconnect",            disconnect,            L"\r\n\t-- Disconnects from the card and reader." )
 X( L"reset",                 reset,                 L"[cold / warm]\r\n\t-- Sends cold / warm reset to the card, and returns ATR." )
 X( L"dump",                  dump,                  L"{hex string}\r\n\t-- Dumps hex string or last output to hex table." )
@@ -7,3 +8,15 @@ X( L"parse",                 parse,                 L"[atr {hex string} / {hex s
 X( L"raw",                   raw,                   L"{command}\r\n\t-- Transmits raw buffer to the card." )
 X( L"apdu",                  apdu,                  L"CLA INS P1 P2 [Lc {buffer}] [Le]\r\n\t-- Transmits APDU command to the card." )
 X( L"select",                select,                L"[<first/next>] [<hex/ascii/unicode>] <name>\r\n\t-- Sends select command to the card." )
+X( L"mac",                   mac,                   L"[<retail/des-cbc/aes-cbc/des-cmac/aes-cmac> <key> / off]\r\n\t-- Appends 8 byte C-MAC over header and data to every following apdu command." )
+X( L"sim",                   sim,                   L"[on / off]\r\n\t-- Replaces the reader with a simulated card, which implements GlobalPlatform SCP03." )
+X( L"scp",                   scp,                   L"[key <name> <version> <enc> <mac> <dek> / keys / open [keyset] [level] / close / bench <count> [size]]\r\n\t-- Opens GlobalPlatform SCP02/SCP03 session, following commands are wrapped and unwrapped transparently." )
+X( L"gp-load",               gp_load,               L"<cap file> [max block size]\r\n\t-- Loads CAP file with INSTALL [for load] and LOAD, through secure channel when open; blocks are 240 bytes unless given." )
+X( L"emv-oda",               emv_oda,               L"[ca <rid> <index> <modulus> <exponent> / ca-file <file> / card <aid> / dump <files> / cache [clear]]\r\n\t-- Verifies EMV offline data authentication (SDA, DDA, CDA) on the card or in captured transcripts." )
+X( L"dump-diff",             dump_diff,             L"<reference transcript> <transcript / directory> [...]\r\n\t-- Compares the TLV trees of the responses in card transcripts with the reference, skipping equal subtrees by their hashes, and lists changed, added, removed and reordered elements." )
+X( L"sweep",                 sweep,                 L"<cla> <ins> <p1> <p2> [data <hex>] [rate <commands/s>] [checkpoint <file>] / resume [checkpoint] / status\r\n\t-- Sends every combination of the byte ranges (e.g. 00,80-8f) and classifies the status words, skipping INS / CLA rejected with 6D00 / 6E00." )
+X( L"begin",                 begin,                 L"\r\n\t-- Begins exclusive card transaction, no other application can use the card until end." )
+X( L"end",                   end,                   L"\r\n\t-- Ends exclusive card transaction." )
+X( L"tx-bench",              tx_bench,              L"<count> [command]\r\n\t-- Measures per-command time without and within a card transaction." )
+X( L"apdu-bench",            apdu_bench,            L"<count>\r\n\t-- Compares building a SELECT, taking its response and finding the DF name with cAPDU / rAPDU and with constexpr builders and inline buffers, offline and transmitting when a card is present." )
+X( L"resume",                resume,                L"[on / off / clear / now]\r\n\t-- Shows the SELECT and secure channel steps replayed when the same card is reinserted." )
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <Windows.h>
+#include <winscard.h>
+
+#include <stdexcept>
+
+// Holds a PC/SC transaction on the card for its lifetime: other applications cannot interleave commands,
+// and the card keeps its state (selected application, security status) between the commands.
+class CardTransaction {
+public:
+    explicit CardTransaction(SCARDHANDLE handle)
+        : handle_(handle)
+    {
+        if (SCardBeginTransaction(handle_) != SCARD_S_SUCCESS)
+            throw std::runtime_error("cannot begin card transaction");
+    }
+
+    ~CardTransaction() {
+        SCardEndTransaction(handle_, SCARD_LEAVE_CARD);
+    }
+
+    CardTransaction(CardTransaction const&) = delete;
+    CardTransaction& operator=(CardTransaction const&) = delete;
+
+private:
+    SCARDHANDLE handle_;
+};
@@ -0,0 +1,19 @@
+#include "CommandArena.h"
+
+#include <algorithm>
+
+CommandArena::CommandArena(size_t size)
+    : block_(std::make_unique<std::byte[]>(size))
+    , monotonic_(block_.get(), size)
+{}
+
+void CommandArena::reset() {
+    monotonic_.release();
+    used_ = 0;
+}
+
+void* CommandArena::do_allocate(size_t bytes, size_t alignment) {
+    used_ += bytes;
+    highWater_ = std::max(highWater_, used_);
+    return monotonic_.allocate(bytes, alignment);
+}
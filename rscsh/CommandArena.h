@@ -0,0 +1,34 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <memory_resource>
+
+// Monotonic arena living for one command execution: argument decoding and other shell-internal
+// temporaries allocate from it, and everything is dropped at once when the command is done.
+// The initial block is kept across commands, so that commands fitting in it never reach the heap.
+class CommandArena : public std::pmr::memory_resource {
+public:
+    static constexpr size_t DefaultSize = 64 * 1024;
+
+    explicit CommandArena(size_t size = DefaultSize);
+
+    CommandArena(CommandArena const&) = delete;
+    CommandArena& operator=(CommandArena const&) = delete;
+
+    void reset();
+
+    // Bytes handed out since the last reset, and the most of any command.
+    inline size_t used() const noexcept { return used_; }
+    inline size_t high_water() const noexcept { return highWater_; }
+
+private:
+    void* do_allocate(size_t bytes, size_t alignment) override;
+    void do_deallocate(void*, size_t, size_t) override {}
+    bool do_is_equal(std::pmr::memory_resource const &other) const noexcept override { return this == &other; }
+
+    std::unique_ptr<std::byte[]> block_;
+    std::pmr::monotonic_buffer_resource monotonic_;
+    size_t used_ = 0;
+    size_t highWater_ = 0;
+};
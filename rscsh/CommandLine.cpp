@@ -0,0 +1,40 @@
+#include "CommandLine.h"
+
+#include <algorithm>
+#include <cwctype>
+
+void tokenize(std::wstring_view line, std::vector<std::wstring> &argv) {
+    size_t count = 0;
+    for (size_t i = 0; i < line.size(); ) {
+        while (i < line.size() && iswspace(line[i]))
+            i++;
+        if (i == line.size())
+            break;
+        auto start = i;
+        while (i < line.size() && !iswspace(line[i]))
+            i++;
+        if (count == argv.size())
+            argv.emplace_back();
+        argv[count++].assign(line.data() + start, i - start);
+    }
+    argv.resize(count);
+}
+
+std::wstring lowercase(std::wstring_view text) {
+    std::wstring lower(text);
+    std::transform(lower.begin(), lower.end(), lower.begin(), ::towlower);
+    return lower;
+}
+
+void lowercase_command(std::vector<std::wstring> &argv) {
+    if (argv.empty())
+        return;
+    std::transform(argv[0].begin(), argv[0].end(), argv[0].begin(), ::towlower);
+    if (argv[0] == L"crypto" && argv.size() > 1)
+        std::transform(argv[1].begin(), argv[1].end(), argv[1].begin(), ::towlower);
+}
+
+bool is_keyword(std::wstring_view argument, std::wstring_view keyword) noexcept {
+    return argument.size() == keyword.size()
+        && std::equal(argument.begin(), argument.end(), keyword.begin(), [](wchar_t a, wchar_t k) { return static_cast<wchar_t>(towlower(a)) == k; });
+}
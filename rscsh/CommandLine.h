@@ -0,0 +1,19 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Command lines keep the case of their tokens: file names and text are passed on as typed,
+// command names and keywords are matched in any case.
+
+// Splits the line at white space into argv, reusing the strings of the previous line.
+void tokenize(std::wstring_view line, std::vector<std::wstring> &argv);
+
+std::wstring lowercase(std::wstring_view text);
+
+// Lowercases the words the shells dispatch on: the command name, and the subcommand of crypto.
+void lowercase_command(std::vector<std::wstring> &argv);
+
+// Whether the argument is the keyword, which is given in lowercase.
+bool is_keyword(std::wstring_view argument, std::wstring_view keyword) noexcept;
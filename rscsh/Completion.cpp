@@ -0,0 +1,228 @@
+#include "Completion.h"
+
+#include <algorithm>
+#include <cwctype>
+
+static constexpr std::wstring_view commands[] = {
+#define X(name, func, desc) name,
+#include "MainShell_commands.h"
+#include "CardShell_commands.h"
+#undef X
+    L"crypto",
+};
+
+static constexpr std::wstring_view commandHelp[] = {
+#define X(name, func, desc) desc,
+#include "MainShell_commands.h"
+#include "CardShell_commands.h"
+#undef X
+    L"",
+};
+
+static constexpr std::wstring_view cryptoCommands[] = {
+#define X(name, func, desc) name,
+#include "CryptoShell_commands.h"
+#undef X
+};
+
+static constexpr std::wstring_view cryptoHelp[] = {
+#define X(name, func, desc) desc,
+#include "CryptoShell_commands.h"
+#undef X
+};
+
+static constexpr StaticTrie<trie_nodes(commands)> commandTrie(commands);
+static constexpr StaticTrie<trie_nodes(cryptoCommands)> cryptoTrie(cryptoCommands);
+
+// Words or values offered for an argument, position 1 is the first argument after the command.
+// A rule with a previous word applies only after that word. Keywords added to a command grammar
+// go here too; every word must appear in the help of its command, which is checked below.
+struct Argument {
+    std::wstring_view command;
+    unsigned position;
+    std::wstring_view after;
+    std::wstring_view words;
+    Completion::Source source;
+};
+
+static constexpr std::wstring_view macAlgorithms = L"retail des-cbc aes-cbc des-cmac aes-cmac";
+
+static constexpr Argument arguments[] = {
+    { L"history",           1, L"",         L"budget clear",                        Completion::Source::None },
+    { L"alloc",             1, L"",         L"bench",                               Completion::Source::None },
+    { L"script",            1, L"",         L"run dump bench",                      Completion::Source::None },
+    { L"server",            1, L"",         L"start stop bench",                    Completion::Source::None },
+    { L"output",            1, L"",         L"text json cbor bench",                Completion::Source::None },
+    { L"profile",           1, L"",         L"on off clear export",                 Completion::Source::None },
+    { L"bench",             1, L"",         L"json baseline tolerance",             Completion::Source::None },
+    { L"diff-run",          1, L"",         L"sim",                                 Completion::Source::None },
+    { L"diff-run",          2, L"",         L"sim",                                 Completion::Source::None },
+
+    { L"readers",           1, L"",         L"refresh",                             Completion::Source::None },
+    { L"connect",           1, L"",         L"atr",                                 Completion::Source::Readers },
+    { L"autoconnect",       1, L"",         L"off first pinned",                    Completion::Source::None },
+    { L"autoconnect",       2, L"pinned",   L"",                                    Completion::Source::Readers },
+    { L"reset",             1, L"",         L"cold warm",                           Completion::Source::None },
+    { L"parse",             1, L"",         L"atr",                                 Completion::Source::None },
+    { L"select",            1, L"",         L"first next hex ascii unicode",        Completion::Source::Aids },
+    { L"select",            2, L"first",    L"hex ascii unicode",                   Completion::Source::Aids },
+    { L"select",            2, L"next",     L"hex ascii unicode",                   Completion::Source::Aids },
+    { L"select",            2, L"hex",      L"",                                    Completion::Source::Aids },
+    { L"select",            3, L"hex",      L"",                                    Completion::Source::Aids },
+    { L"mac",               1, L"",         L"retail des-cbc aes-cbc des-cmac aes-cmac off", Completion::Source::None },
+    { L"sim",               1, L"",         L"on off",                              Completion::Source::None },
+    { L"scp",               1, L"",         L"key keys open close bench",           Completion::Source::None },
+    { L"scp",               2, L"open",     L"",                                    Completion::Source::KeySets },
+    { L"emv-oda",           1, L"",         L"ca ca-file card dump cache",          Completion::Source::None },
+    { L"emv-oda",           2, L"card",     L"",                                    Completion::Source::Aids },
+    { L"emv-oda",           2, L"cache",    L"clear",                               Completion::Source::None },
+    { L"sweep",             1, L"",         L"resume status",                       Completion::Source::None },
+    { L"sweep",             5, L"",         L"data rate checkpoint",                Completion::Source::None },
+    { L"sweep",             7, L"",         L"data rate checkpoint",                Completion::Source::None },
+    { L"sweep",             9, L"",         L"data rate checkpoint",                Completion::Source::None },
+    { L"resume",            1, L"",         L"on off clear now",                    Completion::Source::None },
+
+    { L"crypto sha",        1, L"",         L"1 224 256 384 512",                   Completion::Source::None },
+    { L"crypto sha",        2, L"",         L"hex ascii unicode",                   Completion::Source::None },
+    { L"crypto rsa",        1, L"",         L"crt",                                 Completion::Source::None },
+    { L"crypto rsa-keygen", 1, L"",         L"status cancel",                       Completion::Source::None },
+    { L"crypto des",        1, L"",         L"decrypt encrypt",                     Completion::Source::None },
+    { L"crypto des",        2, L"",         L"cbc ecb",                             Completion::Source::None },
+    { L"crypto aes",        1, L"",         L"decrypt encrypt",                     Completion::Source::None },
+    { L"crypto aes",        2, L"",         L"cbc ecb",                             Completion::Source::None },
+    { L"crypto mac",        1, L"",         macAlgorithms,                          Completion::Source::None },
+    { L"crypto mac-bench",  1, L"",         macAlgorithms,                          Completion::Source::None },
+    { L"crypto emv",        1, L"",         L"derive arqc arpc arpc2 batch",        Completion::Source::None },
+    { L"crypto emv",        2, L"",         L"des aes",                             Completion::Source::None },
+};
+
+static constexpr bool is_word_char(wchar_t c) {
+    return (c >= L'a' && c <= L'z') || (c >= L'A' && c <= L'Z') || (c >= L'0' && c <= L'9') || c == L'-';
+}
+
+// Whether the word stands on its own in the text, e.g. "ca" in "ca <rid> / ca-file <file>".
+static constexpr bool contains_word(std::wstring_view text, std::wstring_view word) {
+    for (auto i = text.find(word); i != std::wstring_view::npos; i = text.find(word, i + 1)) {
+        auto end = i + word.size();
+        if ((i == 0 || !is_word_char(text[i - 1])) && (end == text.size() || !is_word_char(text[end])))
+            return true;
+    }
+    return false;
+}
+
+static constexpr std::wstring_view help_of(std::wstring_view command) {
+    if (command.substr(0, 7) == L"crypto ") {
+        for (size_t i = 0; i < std::size(cryptoCommands); i++) {
+            if (cryptoCommands[i] == command.substr(7))
+                return cryptoHelp[i];
+        }
+        return std::wstring_view();
+    }
+    for (size_t i = 0; i < std::size(commands); i++) {
+        if (commands[i] == command)
+            return commandHelp[i];
+    }
+    return std::wstring_view();
+}
+
+static constexpr bool keywords_documented() {
+    for (auto const &argument : arguments) {
+        auto help = help_of(argument.command);
+        if (help.empty())
+            return false;
+        for (size_t i = 0; i < argument.words.size(); ) {
+            auto end = std::min(argument.words.find(L' ', i), argument.words.size());
+            if (!contains_word(help, argument.words.substr(i, end - i)))
+                return false;
+            i = end + 1;
+        }
+    }
+    return true;
+}
+
+static_assert(keywords_documented(), "completion keyword of an unknown command or missing from its help");
+
+static bool starts_with_nocase(std::wstring_view text, std::wstring_view prefix) {
+    return text.size() >= prefix.size()
+        && std::equal(prefix.begin(), prefix.end(), text.begin(), [](wchar_t a, wchar_t b) { return towlower(a) == towlower(b); });
+}
+
+Completion::Completion(Values const &values)
+    : values_(values)
+{}
+
+std::vector<std::wstring> Completion::complete(std::wstring_view line) const {
+    std::vector<std::wstring_view> words;
+    for (size_t i = 0; i < line.size(); ) {
+        auto end = std::min(line.find(L' ', i), line.size());
+        if (end > i)
+            words.push_back(line.substr(i, end - i));
+        i = end + 1;
+    }
+    std::wstring_view word;
+    if (!line.empty() && line.back() != L' ' && !words.empty()) {
+        word = words.back();
+        words.pop_back();
+    }
+
+    std::wstring prefix(word);
+    std::transform(prefix.begin(), prefix.end(), prefix.begin(), ::towlower);
+
+    std::vector<std::wstring> candidates;
+    auto from_trie = [&](auto const &trie, auto const &names) {
+        if (auto node = trie.find(prefix); node != trie.None)
+            trie.visit(node, [&](uint16_t index) { candidates.emplace_back(names[index]); });
+    };
+
+    bool crypto = !words.empty() && words[0] == L"crypto";
+    if (words.empty()) {
+        from_trie(commandTrie, commands);
+        return candidates;
+    }
+    if (crypto && words.size() == 1) {
+        from_trie(cryptoTrie, cryptoCommands);
+        return candidates;
+    }
+
+    std::wstring command(words[0]);
+    if (crypto)
+        command += L' ' + std::wstring(words[1]);
+    auto position = static_cast<unsigned>(words.size() - (crypto ? 1 : 0));
+    auto after = words.back();
+
+    for (auto const &argument : arguments) {
+        if (argument.command != command || argument.position != position || (!argument.after.empty() && argument.after != after))
+            continue;
+
+        for (size_t i = 0; i < argument.words.size(); ) {
+            auto end = std::min(argument.words.find(L' ', i), argument.words.size());
+            auto candidate = argument.words.substr(i, end - i);
+            if (starts_with_nocase(candidate, prefix))
+                candidates.emplace_back(candidate);
+            i = end + 1;
+        }
+        if (argument.source != Source::None && values_) {
+            for (auto &value : values_(argument.source)) {
+                if (starts_with_nocase(value, prefix))
+                    candidates.push_back(std::move(value));
+            }
+        }
+    }
+
+    std::sort(candidates.begin(), candidates.end());
+    candidates.erase(std::unique(candidates.begin(), candidates.end()), candidates.end());
+    return candidates;
+}
+
+std::wstring Completion::common_prefix(std::vector<std::wstring> const &candidates) {
+    if (candidates.empty())
+        return std::wstring();
+
+    auto length = candidates[0].size();
+    for (auto const &candidate : candidates) {
+        auto mismatch = std::mismatch(candidates[0].begin(), candidates[0].begin() + std::min(length, candidate.size()), candidate.begin(),
+            [](wchar_t a, wchar_t b) { return towlower(a) == towlower(b); });
+        length = static_cast<size_t>(mismatch.first - candidates[0].begin());
+    }
+    return candidates[0].substr(0, length);
+}
@@ -0,0 +1,106 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Trie of a fixed word list, built at compile time. Siblings are kept in order, so that
+// the words under a prefix are visited sorted.
+template <size_t Nodes>
+class StaticTrie {
+public:
+    static constexpr uint16_t None = 0xFFFF;
+
+    template <size_t N>
+    constexpr explicit StaticTrie(std::wstring_view const (&words)[N]) {
+        static_assert(Nodes < None, "too many nodes");
+        for (size_t i = 0; i < N; i++)
+            insert(words[i], static_cast<uint16_t>(i));
+    }
+
+    // Node of the prefix, None when no word starts with it.
+    constexpr uint16_t find(std::wstring_view prefix) const {
+        uint16_t node = 0;
+        for (auto c : prefix) {
+            auto child = nodes_[node].child;
+            while (child != None && nodes_[child].c < c)
+                child = nodes_[child].sibling;
+            if (child == None || nodes_[child].c != c)
+                return None;
+            node = child;
+        }
+        return node;
+    }
+
+    // Calls f with the index of every word under the node, in order.
+    template <typename F>
+    void visit(uint16_t node, F &&f) const {
+        if (nodes_[node].word != None)
+            f(nodes_[node].word);
+        for (auto child = nodes_[node].child; child != None; child = nodes_[child].sibling)
+            visit(child, f);
+    }
+
+private:
+    struct Node {
+        wchar_t c = 0;
+        uint16_t child = None;
+        uint16_t sibling = None;
+        uint16_t word = None;
+    };
+
+    constexpr void insert(std::wstring_view word, uint16_t index) {
+        uint16_t node = 0;
+        for (auto c : word) {
+            // Link to the first child not less than c, insert before it unless it is c
+            uint16_t *link = &nodes_[node].child;
+            while (*link != None && nodes_[*link].c < c)
+                link = &nodes_[*link].sibling;
+            if (*link == None || nodes_[*link].c != c) {
+                nodes_[size_].c = c;
+                nodes_[size_].sibling = *link;
+                *link = size_++;
+            }
+            node = *link;
+        }
+        nodes_[node].word = index;
+    }
+
+    std::array<Node, Nodes> nodes_{};
+    uint16_t size_ = 1;     // root
+};
+
+template <size_t N>
+constexpr size_t trie_nodes(std::wstring_view const (&words)[N]) {
+    size_t nodes = 1;
+    for (auto word : words)
+        nodes += word.size();
+    return nodes;
+}
+
+// Tab completion of shell command lines: command names from the command tables, keywords
+// from argument grammars, and dynamic values (reader names, key sets, AIDs) from the sources.
+class Completion {
+public:
+    enum class Source : unsigned char {
+        None,
+        Readers,
+        KeySets,
+        Aids,
+    };
+
+    using Values = std::function<std::vector<std::wstring>(Source source)>;
+
+    explicit Completion(Values const &values);
+
+    // Candidates for the last word of the line, which is empty after a trailing space.
+    std::vector<std::wstring> complete(std::wstring_view line) const;
+
+    static std::wstring common_prefix(std::vector<std::wstring> const &candidates);
+
+private:
+    Values values_;
+};
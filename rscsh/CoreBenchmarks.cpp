@@ -0,0 +1,271 @@
+#include "CoreBenchmarks.h"
+#include "BenchSuite.h"
+#include "BerTlv.h"
+#include "BlockCipher.h"
+#include "CommandLine.h"
+#include "EmvCrypto.h"
+#include "Mac.h"
+#include "ParseText.h"
+#include "RsaKey.h"
+#include "SecureChannel.h"
+#include "SimulatedCard.h"
+#include "TextOutput.h"
+
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <unordered_map>
+
+#include <openssl/rand.h>
+
+static SecureChannel::KeySet test_keys() {
+    SecureChannel::KeySet keys;
+    keys.enc = scb::Bytes(L"404142434445464748494A4B4C4D4E4F");
+    keys.mac = keys.enc;
+    keys.dek = keys.enc;
+    return keys;
+}
+
+static void expect_success(scb::Bytes const &response, char const *command) {
+    if (response.size() < 2 || response[response.size() - 2] != 0x90 || response[response.size() - 1] != 0x00)
+        throw std::runtime_error(std::string(command) + " failed on the simulated card");
+}
+
+// Command names of the shells, from the same tables as their command maps
+static std::unordered_map<std::wstring, unsigned> const mainCommands{
+#define X(name, _, __) { name, 0 },
+#include "MainShell_commands.h"
+#undef X
+};
+static std::unordered_map<std::wstring, unsigned> const cardCommands{
+#define X(name, _, __) { name, 0 },
+#include "CardShell_commands.h"
+#undef X
+};
+static std::unordered_map<std::wstring, unsigned> const cryptoCommands{
+#define X(name, _, __) { name, 0 },
+#include "CryptoShell_commands.h"
+#undef X
+};
+
+// Lookups of MainShell::dispatch: main commands, then crypto, then the card shell.
+static bool find_command(std::vector<std::wstring> const &argv) {
+    if (mainCommands.find(argv[0]) != mainCommands.end())
+        return true;
+    if (is_keyword(argv[0], L"crypto"))
+        return argv.size() > 1 && cryptoCommands.find(argv[1]) != cryptoCommands.end();
+    return cardCommands.find(argv[0]) != cardCommands.end();
+}
+
+// The parse text as it was written before shell output became UTF-8: wide stream, bytes printed
+// by scb. Kept as the baseline of core/parse-dump.
+static void write_tlv_tree_utf16(std::wostream &output, BerTlvList const &tlvList, size_t depth = 0) {
+    std::wstring prefix;
+    for (size_t i = 0; i < depth; i++) {
+        prefix += L"| ";
+    }
+    for (auto const &tlv : tlvList) {
+        output
+            << prefix
+            << "* ";
+        tlv.tag().bytes().print(output);
+        output
+            << " (" << tlv.length() << ") " << tlv.tag().name()
+            << "\r\n"
+            << prefix
+            << "|\\\r\n";
+
+        if (tlv.tag().is_constructed()) {
+            write_tlv_tree_utf16(output, tlv.value_as_tlv_list(), depth + 1);
+        } else {
+            for (size_t i = 0; i < tlv.value().size(); i += 16) {
+                size_t length = 16;
+                if (i + length >= tlv.value().size())
+                    length = tlv.value().size() - i;
+                output << prefix << "| > ";
+                tlv.value().bytes(i, length).print(output);
+                output << "\r\n";
+            }
+            if (tlv.value().all_ascii()) {
+                output
+                    << prefix
+                    << "| > ASCII: "
+                    << tlv.value().ascii()
+                    << "\r\n";
+            }
+        }
+
+        output << prefix << "|/\r\n";
+    }
+
+    if (depth == 0)
+        output << prefix << "\r\n";
+}
+
+void add_core_benchmarks(BenchSuite &suite) {
+    // 256 bytes 00 to FF
+    auto block = std::make_shared<scb::Bytes>(256);
+    for (size_t i = 0; i < block->size(); i++)
+        (*block)[i] = static_cast<unsigned char>(i);
+    std::wstring hex;
+    for (int i = 0; i < 256; i++) {
+        hex += L"0123456789abcdef"[i >> 4];
+        hex += L"0123456789abcdef"[i & 0x0F];
+    }
+
+    suite.add("core/hex-decode", [hex] {
+        scb::Bytes bytes(hex);
+    });
+    auto text = std::make_shared<std::ostringstream>();
+    suite.add("core/hex-encode", [text, block] {
+        *text << hex_bytes(*block, " ");
+        text->seekp(0);
+    });
+
+    // READ RECORD response of a payment application, with nested templates
+    auto record = std::make_shared<scb::Bytes>(
+        L"7081a457134761739001010010d22122011143804400000f5f200f43415244484f4c4445522f564953419f1f0e3030303030303030303030303030"
+        L"8c159f02069f03069f1a0295055f2a029a039c019f37048d178a029f02069f03069f1a0295055f2a029a039c019f37045f24032212315a0847617390010100105f3401018e0e"
+        L"000000000000000042031e031f009f0702ff00bf0c109f4d020b0a9f6e080840000030300000");
+    suite.add("core/tlv-parse", [record] {
+        for (auto const &element : BerTlv::parse(*record)) {
+            if (element.constructed)
+                BerTlv::parse(*record, element.value_offset(), element.length);
+        }
+    });
+
+    // Command lines as typed, through the tokenizer and the command lookup of MainShell::execute
+    static wchar_t const *const lines[] = {
+        L"apdu 00 A4 04 00 07 A0000000031010 00",
+        L"Crypto SHA 256 0123456789abcdef",
+        L"history 5",
+        L"gp-load C:\\Cards\\Applet.cap",
+    };
+    auto argv = std::make_shared<std::vector<std::wstring>>();
+    suite.add("core/tokenize", [argv] {
+        for (auto line : lines) {
+            tokenize(line, *argv);
+            lowercase_command(*argv);
+        }
+    });
+    auto tokenized = std::make_shared<std::vector<std::vector<std::wstring>>>();
+    for (auto line : lines) {
+        tokenize(line, tokenized->emplace_back());
+        lowercase_command(tokenized->back());
+    }
+    suite.add("core/dispatch", [tokenized] {
+        for (auto const &command : *tokenized) {
+            if (!find_command(command))
+                throw std::runtime_error("command of the dispatch benchmark is unknown");
+        }
+    });
+
+    // Text of the parse and parse atr commands
+    auto parsed = std::make_shared<std::ostringstream>();
+    suite.add("core/parse-tlv", [parsed, record] {
+        write_tlv_tree(*parsed, BerTlvList(*record));
+        parsed->seekp(0);
+    });
+
+    // Dump of 64 records parsed once, into a new stream every time so that the bytes column shows
+    // the size of the text: UTF-8 as the shell writes it, UTF-16 as it did before
+    auto dump = std::make_shared<std::unique_ptr<BerTlvList>>();
+    auto parseDump = [record, dump] {
+        if (*dump)
+            return;
+        scb::Bytes records;
+        for (int i = 0; i < 64; i++)
+            records += *record;
+        *dump = std::make_unique<BerTlvList>(records);
+    };
+    suite.add("core/parse-dump", [dump] {
+        std::ostringstream text;
+        write_tlv_tree(text, **dump);
+    }, parseDump);
+    suite.add("core/parse-dump-utf16", [dump] {
+        std::wostringstream text;
+        write_tlv_tree_utf16(text, **dump);
+    }, parseDump);
+
+    auto atr = std::make_shared<scb::Bytes>(L"3bfe1300008131fe454a434f5076323431b7");
+    suite.add("core/parse-atr", [parsed, atr] {
+        parse_atr_fields(*atr, [&](std::wstring const &name, unsigned char value, std::wstring const &description) {
+            write_atr_field(*parsed, name, value, description);
+        });
+        parsed->seekp(0);
+    });
+
+    // Ciphers and MACs keep their key schedules, as on the per-APDU paths
+    scb::Bytes des(L"0123456789abcdeffedcba9876543210"), aes(L"000102030405060708090a0b0c0d0e0f");
+    auto data = std::make_shared<scb::Bytes>(*block);
+    for (auto const &[name, cipher] : { std::pair{ "core/des-cbc", std::shared_ptr<BlockCipher>(BlockCipher::des(des)) },
+                                        std::pair{ "core/aes-cbc", std::shared_ptr<BlockCipher>(BlockCipher::aes(aes)) } }) {
+        suite.add(name, [cipher = cipher, data] {
+            unsigned char iv[16] = {};
+            cipher->encrypt_cbc(data->data(), data->size(), iv);
+        });
+    }
+    for (auto const &[algorithm, key] : { std::pair{ L"retail", des }, std::pair{ L"des-cmac", des }, std::pair{ L"aes-cmac", aes } }) {
+        std::shared_ptr<Mac> mac = Mac::create(algorithm, key);
+        suite.add("core/mac-" + to_utf8(algorithm), [mac, block] {
+            unsigned char result[16];
+            mac->update(*block);
+            mac->final(result);
+        });
+    }
+
+    // Key generated once, when an RSA benchmark is selected
+    auto rsa = std::make_shared<std::unique_ptr<RsaKey>>();
+    auto rsaInput = std::make_shared<scb::Bytes>();
+    auto generate = [rsa, rsaInput] {
+        if (*rsa)
+            return;
+        *rsa = std::make_unique<RsaKey>(RsaKey::generate(2048, scb::Bytes(L"010001")));
+        *rsaInput = scb::Bytes((*rsa)->size());
+        for (size_t i = 1; i < rsaInput->size(); i++)
+            (*rsaInput)[i] = 0x55;
+    };
+    auto publicKey = std::make_shared<std::unique_ptr<RsaKey>>();
+    suite.add("core/rsa-public", [publicKey, rsaInput] {
+        (*publicKey)->transform(*rsaInput);
+    }, [generate, rsa, publicKey] {
+        generate();
+        *publicKey = std::make_unique<RsaKey>((*rsa)->modulus(), (*rsa)->public_exponent());
+    });
+    auto crtKey = std::make_shared<std::unique_ptr<RsaKey>>();
+    suite.add("core/rsa-crt", [crtKey, rsaInput] {
+        (*crtKey)->transform(*rsaInput);
+    }, [generate, rsa, crtKey] {
+        generate();
+        auto const &key = **rsa;
+        *crtKey = std::make_unique<RsaKey>(key.p(), key.q(), key.dp(), key.dq(), key.qinv());
+    });
+
+    auto emv = std::make_shared<EmvCrypto>(EmvCrypto::Des, des);
+    scb::Bytes pan(L"4761739001010010"), psn(L"01"), atc(L"0001");
+    scb::Bytes transaction(L"000000001000000000000000084000000000000840230101003c2a6b9e5800");
+    suite.add("core/emv-arqc", [emv, pan, psn, atc, transaction] {
+        emv->cryptogram(pan, psn, atc, transaction);
+    });
+
+    // GET DATA of the CPLC, the longest response of the simulated card
+    auto getData = std::make_shared<scb::Bytes>(L"80ca9f7f00");
+    auto plainCard = std::make_shared<SimulatedCard>(test_keys());
+    suite.add("core/sim-apdu", [plainCard, getData] {
+        plainCard->transmit(*getData);
+    });
+
+    auto card = std::make_shared<SimulatedCard>(test_keys());
+    auto session = std::make_shared<std::unique_ptr<SecureChannel>>();
+    suite.add("core/sim-scp03", [card, session, getData] {
+        (*session)->unwrap(card->transmit((*session)->wrap(*getData)));
+    }, [card, session] {
+        scb::Bytes hostChallenge(8);
+        if (RAND_bytes(hostChallenge.data(), static_cast<int>(hostChallenge.size())) != 1)
+            throw std::runtime_error("failed to generate host challenge");
+        auto response = card->transmit(SecureChannel::initialize_update(0, hostChallenge));
+        expect_success(response, "INITIALIZE UPDATE");
+        *session = SecureChannel::open(test_keys(), hostChallenge, response.left(response.size() - 2), SecureChannel::CMac);
+        expect_success(card->transmit((*session)->external_authenticate()), "EXTERNAL AUTHENTICATE");
+    });
+}
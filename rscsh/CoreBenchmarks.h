@@ -0,0 +1,9 @@
+#pragma once
+
+class BenchSuite;
+
+// Benchmarks of the code below the shell: hex, BER-TLV parsing, tokenizing and looking up command
+// lines, the text of parse and parse atr, block ciphers and MACs, RSA, EMV cryptograms and APDU round
+// trips with the simulated card, plain and through SCP03. Run by the bench command and by the
+// standalone benchmark, which is built without the shell and WinSCard.
+void add_core_benchmarks(BenchSuite &suite);
@@ -1,11 +1,25 @@
 #include "CryptoShell.h"
 
+#include "RsaKey.h"
+#include "EmvCrypto.h"
+#include "Mac.h"
+#include "Parallel.h"
+
 #include <scb/Bytes.h>
 #include <scc/Hash.h>
-#include <scc/RSA.h>
 #include <scc/DES.h>
 #include <scc/AES.h>
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cwctype>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <sstream>
+
 std::unordered_map<std::wstring, void (CryptoShell::*)(std::vector<std::wstring> const &)> const CryptoShell::command_map_{
 #define X(name, func, _) { name, &CryptoShell::func },
 #include "CryptoShell_commands.h"
@@ -18,13 +32,25 @@ std::unordered_map<std::wstring, std::wstring> const CryptoShell::help_map_{
 #undef X
 };
 
+CryptoShell::~CryptoShell() {
+    if (keygenJob_) {
+        keygenJob_->control.cancel = true;
+        keygenJob_->thread.join();
+    }
+}
+
 void CryptoShell::help(std::wstring const &prefix) {
     for (auto const& [cmd, help] : help_map_) {
-        execution_yield_ << "\r\n" << prefix << ' ' << cmd << ' ' << help << "\r\n";
+        execution_yield_ << "\r\n" << utf8(prefix) << ' ' << utf8(cmd) << ' ' << utf8(help) << "\r\n";
     }
     execution_yield_ << "\r\n";
 }
 
+CryptoShell::Command CryptoShell::find_command(std::wstring const &name) {
+    auto cmd = command_map_.find(name);
+    return cmd != command_map_.end() ? cmd->second : nullptr;
+}
+
 void CryptoShell::execute(std::vector<std::wstring> const &argv) {
     if (argv.size() < 2) {
         help(L"crypto");
@@ -41,7 +67,7 @@ void CryptoShell::execute(std::vector<std::wstring> const &argv) {
 scb::Bytes CryptoShell::to_bytes(scb::Bytes::StringAs as, std::vector<std::wstring>::const_iterator begin, std::vector<std::wstring>::const_iterator end) {
     scb::Bytes result;
     for (auto i = begin; i != end; ++i) {
-        result += scb::Bytes(i->c_str(), as);
+        result += ResponseHistory::is_reference(*i) ? hex_argument(*i) : scb::Bytes(i->c_str(), as);
     }
     return result;
 }
@@ -56,86 +82,293 @@ void CryptoShell::sha(std::vector<std::wstring> const &argv) {
     scb::Bytes buffer, result;
     int version = std::stoi(argv[2]);
 
-    if (argv[3] == L"hex") {
+    if (is_keyword(argv[3], L"hex")) {
         buffer = to_bytes(scb::Bytes::Hex, argv.begin() + 4, argv.end());
-    } else if (argv[3] == L"ascii") {
+    } else if (is_keyword(argv[3], L"ascii")) {
         buffer = to_bytes(scb::Bytes::ASCII, argv.begin() + 4, argv.end());
-    } else if (argv[3] == L"unicode") {
+    } else if (is_keyword(argv[3], L"unicode")) {
         buffer = to_bytes(scb::Bytes::Unicode, argv.begin() + 4, argv.end());
     } else {
         goto usage;
     }
 
-    switch (version) {
-        case 1:
-            result = scc::SHA1(buffer);
-            break;
-        case 224:
-            result = scc::SHA224(buffer);
-            break;
-        case 256:
-            result = scc::SHA256(buffer);
-            break;
-        case 384:
-            result = scc::SHA384(buffer);
-            break;
-        case 512:
-            result = scc::SHA512(buffer);
-            break;
-        default:
-            goto usage;
+    {
+        Profiler::Scope scope(profiler_, Profiler::Phase::Crypto);
+        switch (version) {
+            case 1:
+                result = scc::SHA1(buffer);
+                break;
+            case 224:
+                result = scc::SHA224(buffer);
+                break;
+            case 256:
+                result = scc::SHA256(buffer);
+                break;
+            case 384:
+                result = scc::SHA384(buffer);
+                break;
+            case 512:
+                result = scc::SHA512(buffer);
+                break;
+            default:
+                goto usage;
+        }
+    }
+
+    if (auto emitter = structured_output()) {
+        emitter->begin("digest");
+        emitter->field("algorithm", "sha" + std::to_string(version));
+        emitter->field("value", result);
+        emitter->end();
+        return;
     }
 
-    result.print(execution_yield_, L"");
+    execution_yield_ << hex_bytes(result);
     execution_yield_ << "\r\n";
 }
 
 void CryptoShell::rsa(std::vector<std::wstring> const &argv) {
     if (argv.size() < 5) {
     usage:
-        execution_yield_ << "crypto rsa <modulus> <exponent> <hex/ascii/unicode> {buffer}\r\n";
+        execution_yield_
+            << "crypto rsa <modulus> <exponent> <hex/ascii/unicode> {buffer}\r\n"
+            << "crypto rsa crt <p> <q> <dp> <dq> <qinv> <hex/ascii/unicode> {buffer}\r\n";
         return;
     }
 
-    scb::Bytes buffer, result;
-    auto modulus = to_bytes(scb::Bytes::Hex, argv.begin() + 2, argv.begin() + 3);
-    auto exponent = to_bytes(scb::Bytes::Hex, argv.begin() + 3, argv.begin() + 4);
+    auto nextArg = argv.begin() + 2;
+    std::unique_ptr<RsaKey> key;
 
-    if (argv[4] == L"hex") {
-        buffer = to_bytes(scb::Bytes::Hex, argv.begin() + 5, argv.end());
-    } else if (argv[4] == L"ascii") {
-        buffer = to_bytes(scb::Bytes::ASCII, argv.begin() + 5, argv.end());
-    } else if (argv[4] == L"unicode") {
-        buffer = to_bytes(scb::Bytes::Unicode, argv.begin() + 5, argv.end());
+    if (is_keyword(*nextArg, L"crt")) {
+        if (argv.size() < 9)
+            goto usage;
+        auto p = to_bytes(scb::Bytes::Hex, nextArg + 1, nextArg + 2);
+        auto q = to_bytes(scb::Bytes::Hex, nextArg + 2, nextArg + 3);
+        auto dp = to_bytes(scb::Bytes::Hex, nextArg + 3, nextArg + 4);
+        auto dq = to_bytes(scb::Bytes::Hex, nextArg + 4, nextArg + 5);
+        auto qinv = to_bytes(scb::Bytes::Hex, nextArg + 5, nextArg + 6);
+        key = std::make_unique<RsaKey>(p, q, dp, dq, qinv);
+        nextArg += 6;
+    } else {
+        auto modulus = to_bytes(scb::Bytes::Hex, nextArg, nextArg + 1);
+        auto exponent = to_bytes(scb::Bytes::Hex, nextArg + 1, nextArg + 2);
+        key = std::make_unique<RsaKey>(modulus, exponent);
+        nextArg += 2;
+    }
+
+    scb::Bytes buffer;
+
+    if (is_keyword(*nextArg, L"hex")) {
+        buffer = to_bytes(scb::Bytes::Hex, nextArg + 1, argv.end());
+    } else if (is_keyword(*nextArg, L"ascii")) {
+        buffer = to_bytes(scb::Bytes::ASCII, nextArg + 1, argv.end());
+    } else if (is_keyword(*nextArg, L"unicode")) {
+        buffer = to_bytes(scb::Bytes::Unicode, nextArg + 1, argv.end());
     } else {
         goto usage;
     }
 
-    scc::RSA rsa(modulus, exponent);
-    result = rsa.transorm(buffer);
+    scb::Bytes result;
+    {
+        Profiler::Scope scope(profiler_, Profiler::Phase::Crypto);
+        result = key->transform(buffer);
+    }
 
-    result.print(execution_yield_, L"");
+    execution_yield_ << hex_bytes(result);
     execution_yield_ << "\r\n";
 }
 
+void CryptoShell::rsa_batch(std::vector<std::wstring> const &argv) {
+    if (argv.size() < 5) {
+        execution_yield_ << "crypto rsa-batch <modulus> <exponent> <input file> [output file]\r\n";
+        return;
+    }
+
+    auto modulus = to_bytes(scb::Bytes::Hex, argv.begin() + 2, argv.begin() + 3);
+    auto exponent = to_bytes(scb::Bytes::Hex, argv.begin() + 3, argv.begin() + 4);
+    RsaKey key(modulus, exponent);
+
+    std::wifstream input(std::filesystem::path{ argv[4] });
+    if (!input)
+        throw std::runtime_error("cannot open input file");
+
+    std::vector<scb::Bytes> blocks;
+    for (std::wstring line; std::getline(input, line); ) {
+        line.erase(std::remove_if(line.begin(), line.end(), ::iswspace), line.end());
+        if (!line.empty())
+            blocks.emplace_back(line);
+    }
+
+    std::vector<scb::Bytes> results(blocks.size());
+    std::atomic<size_t> failures{ 0 };
+
+    auto start = std::chrono::steady_clock::now();
+    {
+        Profiler::Scope scope(profiler_, Profiler::Phase::Crypto);
+        parallel_for(blocks.size(), [&](size_t i) {
+            try {
+                results[i] = key.transform(blocks[i]);
+            } catch (std::exception const&) {
+                failures++;
+            }
+        });
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    if (argv.size() > 5) {
+        std::ofstream output(std::filesystem::path{ argv[5] });
+        if (!output)
+            throw std::runtime_error("cannot open output file");
+        for (auto const &result : results) {
+            if (result.empty())
+                output << '-';
+            else
+                output << hex_bytes(result);
+            output << '\n';
+        }
+    } else {
+        for (auto const &result : results) {
+            if (result.empty())
+                execution_yield_ << '-';
+            else
+                execution_yield_ << hex_bytes(result);
+            execution_yield_ << "\r\n";
+        }
+    }
+
+    execution_yield_
+        << "Blocks: " << blocks.size()
+        << ", failed: " << failures
+        << ", time: " << elapsed.count() << " s"
+        << ", rate: " << (elapsed.count() > 0 ? blocks.size() / elapsed.count() : 0) << " blocks/s\r\n";
+}
+
+static void print_rsa_key(std::ostream &stream, RsaKey const &rsa, char const *eol) {
+    stream
+        << "Modulus: " << hex_bytes(rsa.modulus()) << eol
+        << "Public Exponent: " << hex_bytes(rsa.public_exponent()) << eol
+        << "Private Exponent: " << hex_bytes(rsa.private_exponent()) << eol
+        << "P: " << hex_bytes(rsa.p()) << eol
+        << "Q: " << hex_bytes(rsa.q()) << eol
+        << "DP: " << hex_bytes(rsa.dp()) << eol
+        << "DQ: " << hex_bytes(rsa.dq()) << eol
+        << "QInv: " << hex_bytes(rsa.qinv()) << eol;
+}
+
 void CryptoShell::rsa_keygen(std::vector<std::wstring> const &argv) {
+    if (argv.size() == 3 && is_keyword(argv[2], L"status")) {
+        rsa_keygen_status();
+        return;
+    } else if (argv.size() == 3 && is_keyword(argv[2], L"cancel")) {
+        if (keygenJob_ && !keygenJob_->finished) {
+            keygenJob_->control.cancel = true;
+            execution_yield_ << "Cancelling RSA key generation ...\r\n";
+        } else {
+            execution_yield_ << "No RSA key generation in progress\r\n";
+        }
+        return;
+    }
+
     if (argv.size() < 4) {
-        execution_yield_ << "crypto rsa-keygen <bits> <public exponent>\r\n";
+    usage:
+        execution_yield_
+            << "crypto rsa-keygen <bits> <public exponent> [count <n> out <file>]\r\n"
+            << "crypto rsa-keygen <status / cancel>\r\n";
         return;
     }
 
-    unsigned bits = std::stoi(argv[2]);
-    auto exponent = to_bytes(scb::Bytes::Hex, argv.begin() + 3, argv.end());
+    // std::stoul would wrap negative numbers into huge ones
+    auto bits = std::stoi(argv[2]);
+    if (bits <= 0)
+        throw std::runtime_error("key size must be positive");
+    auto exponent = to_bytes(scb::Bytes::Hex, argv.begin() + 3, argv.begin() + 4);
 
-    scc::RSA rsa(bits, exponent);
+    if (argv.size() > 4) {
+        if (argv.size() != 8 || !is_keyword(argv[4], L"count") || !is_keyword(argv[6], L"out"))
+            goto usage;
+        auto count = std::stoi(argv[5]);
+        if (count <= 0)
+            throw std::runtime_error("count must be positive");
+        rsa_keygen_bulk(static_cast<unsigned>(bits), exponent, static_cast<unsigned>(count), argv[7]);
+        return;
+    }
 
-    execution_yield_ << "Modulus: ";
-    rsa.get_modulus().print(execution_yield_, L"");
-    execution_yield_ << "\r\nPublic Exponent: ";
-    rsa.get_public_exponent().print(execution_yield_, L"");
-    execution_yield_ << "\r\nPrivate Exponent: ";
-    rsa.get_private_exponent().print(execution_yield_, L"");
-    execution_yield_ << "\r\n";
+    RsaKey::GenerateControl control;
+    auto start = std::chrono::steady_clock::now();
+    std::unique_ptr<RsaKey> rsa;
+    {
+        Profiler::Scope scope(profiler_, Profiler::Phase::Crypto);
+        rsa = std::make_unique<RsaKey>(RsaKey::generate(static_cast<unsigned>(bits), exponent, 0, &control));
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    print_rsa_key(execution_yield_, *rsa, "\r\n");
+    execution_yield_ << "Candidates tested: " << control.candidates << ", time: " << elapsed.count() << " s\r\n";
+}
+
+void CryptoShell::rsa_keygen_bulk(unsigned bits, scb::Bytes const &exponent, unsigned count, std::wstring const &path) {
+    if (keygenJob_ && !keygenJob_->finished) {
+        execution_yield_ << "RSA key generation is already in progress, see `crypto rsa-keygen status`\r\n";
+        return;
+    }
+    if (keygenJob_)
+        keygenJob_->thread.join();
+
+    keygenJob_ = std::make_unique<KeygenJob>();
+    keygenJob_->count = count;
+    keygenJob_->path = path;
+    keygenJob_->started = std::chrono::steady_clock::now();
+
+    // Each key is generated on a single thread, and keys are generated in parallel,
+    // this keeps all cores busy without synchronizing prime searches.
+    keygenJob_->thread = std::thread([job = keygenJob_.get(), bits, exponent]() {
+        try {
+            std::ofstream output(std::filesystem::path{ job->path });
+            if (!output)
+                throw std::runtime_error("cannot open output file");
+            std::mutex output_mutex;
+
+            parallel_for(job->count, [&](size_t) {
+                auto rsa = RsaKey::generate(bits, exponent, 1, &job->control);
+                std::ostringstream record;
+                print_rsa_key(record, rsa, "\n");
+                record << '\n';
+
+                std::lock_guard<std::mutex> lock(output_mutex);
+                output << record.str();
+                output.flush();
+                job->generated++;
+            });
+        } catch (std::exception const &e) {
+            job->error = e.what();
+        }
+        job->finished = true;
+    });
+
+    execution_yield_ << "Generating " << count << " RSA keys in background, see `crypto rsa-keygen status`\r\n";
+}
+
+void CryptoShell::rsa_keygen_status() {
+    if (!keygenJob_) {
+        execution_yield_ << "No RSA key generation was started\r\n";
+        return;
+    }
+
+    auto const &job = *keygenJob_;
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - job.started;
+
+    if (!job.finished)
+        execution_yield_ << "In progress: ";
+    else if (!job.error.empty())
+        execution_yield_ << "Stopped (" << job.error.c_str() << "): ";
+    else
+        execution_yield_ << "Finished: ";
+
+    execution_yield_
+        << job.generated << '/' << job.count << " keys written to " << utf8(job.path)
+        << ", candidates tested: " << job.control.candidates
+        << ", time: " << elapsed.count() << " s"
+        << ", rate: " << (elapsed.count() > 0 ? job.generated / elapsed.count() : 0) << " keys/s\r\n";
 }
 
 void CryptoShell::des(std::vector<std::wstring> const &argv) {
@@ -149,9 +382,9 @@ void CryptoShell::des(std::vector<std::wstring> const &argv) {
 
     scc::operation::Operation operation;
     auto const &szOperation = *nextArg++;
-    if (szOperation == L"decrypt")
+    if (is_keyword(szOperation, L"decrypt"))
         operation = scc::operation::Decrypt;
-    else if (szOperation == L"encrypt")
+    else if (is_keyword(szOperation, L"encrypt"))
         operation = scc::operation::Encrypt;
     else
         goto usage;
@@ -160,11 +393,11 @@ void CryptoShell::des(std::vector<std::wstring> const &argv) {
 
     scc::mode::Mode mode;
     auto const &szMode = *nextArg++;
-    if (szMode == L"cbc") {
+    if (is_keyword(szMode, L"cbc")) {
         mode = scc::mode::CBC;
         iv = to_bytes(scb::Bytes::Hex, nextArg, nextArg + 1);
         ++nextArg;
-    } else if (szMode == L"ecb") {
+    } else if (is_keyword(szMode, L"ecb")) {
         mode = scc::mode::ECB;
     } else {
         goto usage;
@@ -175,13 +408,13 @@ void CryptoShell::des(std::vector<std::wstring> const &argv) {
 
     scb::Bytes buffer;
 
-    if (*nextArg == L"hex") {
+    if (is_keyword(*nextArg, L"hex")) {
         ++nextArg;
         buffer = to_bytes(scb::Bytes::Hex, nextArg, argv.end());
-    } else if (*nextArg == L"ascii") {
+    } else if (is_keyword(*nextArg, L"ascii")) {
         ++nextArg;
         buffer = to_bytes(scb::Bytes::ASCII, nextArg, argv.end());
-    } else if (*nextArg == L"unicode") {
+    } else if (is_keyword(*nextArg, L"unicode")) {
         ++nextArg;
         buffer = to_bytes(scb::Bytes::Unicode, nextArg, argv.end());
     } else {
@@ -189,14 +422,17 @@ void CryptoShell::des(std::vector<std::wstring> const &argv) {
     }
 
     scb::Bytes result;
-    scc::DES DES(key);
-    if (DES.key.size() > 8) {
-        result = DES.crypt3(buffer, operation, iv);
-    } else {
-        result = DES.crypt1(buffer, operation, iv);
+    {
+        Profiler::Scope scope(profiler_, Profiler::Phase::Crypto);
+        scc::DES DES(key);
+        if (DES.key.size() > 8) {
+            result = DES.crypt3(buffer, operation, iv);
+        } else {
+            result = DES.crypt1(buffer, operation, iv);
+        }
     }
 
-    result.print(execution_yield_, L"");
+    execution_yield_ << hex_bytes(result);
     execution_yield_ << "\r\n";
 }
 
@@ -209,14 +445,17 @@ void CryptoShell::des_kcv(std::vector<std::wstring> const &argv) {
     scb::Bytes kcv;
     auto key = to_bytes(scb::Bytes::Hex, argv.begin() + 2, argv.end());
 
-    scc::DES DES(key);
-    if (DES.key.size() > 8) {
-        kcv = DES.encrypt3_ecb(scb::Bytes(key.size()));
-    } else {
-        kcv = DES.encrypt1_ecb(scb::Bytes(key.size()));
+    {
+        Profiler::Scope scope(profiler_, Profiler::Phase::Crypto);
+        scc::DES DES(key);
+        if (DES.key.size() > 8) {
+            kcv = DES.encrypt3_ecb(scb::Bytes(key.size()));
+        } else {
+            kcv = DES.encrypt1_ecb(scb::Bytes(key.size()));
+        }
     }
 
-    kcv.left(3).print(execution_yield_, L"");
+    execution_yield_ << hex_bytes(kcv.left(3));
     execution_yield_ << "\r\n";
 }
 
@@ -231,9 +470,9 @@ void CryptoShell::aes(std::vector<std::wstring> const &argv) {
 
     scc::operation::Operation operation;
     auto const &szOperation = *nextArg++;
-    if (szOperation == L"decrypt")
+    if (is_keyword(szOperation, L"decrypt"))
         operation = scc::operation::Decrypt;
-    else if (szOperation == L"encrypt")
+    else if (is_keyword(szOperation, L"encrypt"))
         operation = scc::operation::Encrypt;
     else
         goto usage;
@@ -242,11 +481,11 @@ void CryptoShell::aes(std::vector<std::wstring> const &argv) {
 
     scc::mode::Mode mode;
     auto const &szMode = *nextArg++;
-    if (szMode == L"cbc") {
+    if (is_keyword(szMode, L"cbc")) {
         mode = scc::mode::CBC;
         iv = to_bytes(scb::Bytes::Hex, nextArg, nextArg + 1);
         ++nextArg;
-    } else if (szMode == L"ecb") {
+    } else if (is_keyword(szMode, L"ecb")) {
         mode = scc::mode::ECB;
     } else {
         goto usage;
@@ -257,23 +496,27 @@ void CryptoShell::aes(std::vector<std::wstring> const &argv) {
 
     scb::Bytes buffer;
 
-    if (*nextArg == L"hex") {
+    if (is_keyword(*nextArg, L"hex")) {
         ++nextArg;
         buffer = to_bytes(scb::Bytes::Hex, nextArg, argv.end());
-    } else if (*nextArg == L"ascii") {
+    } else if (is_keyword(*nextArg, L"ascii")) {
         ++nextArg;
         buffer = to_bytes(scb::Bytes::ASCII, nextArg, argv.end());
-    } else if (*nextArg == L"unicode") {
+    } else if (is_keyword(*nextArg, L"unicode")) {
         ++nextArg;
         buffer = to_bytes(scb::Bytes::Unicode, nextArg, argv.end());
     } else {
         goto usage;
     }
 
-    scc::AES AES(key);
-    auto result = AES.crypt(buffer, operation, iv);
+    scb::Bytes result;
+    {
+        Profiler::Scope scope(profiler_, Profiler::Phase::Crypto);
+        scc::AES AES(key);
+        result = AES.crypt(buffer, operation, iv);
+    }
 
-    result.print(execution_yield_, L"");
+    execution_yield_ << hex_bytes(result);
     execution_yield_ << "\r\n";
 }
 
@@ -285,9 +528,292 @@ void CryptoShell::aes_kcv(std::vector<std::wstring> const &argv) {
 
     auto key = to_bytes(scb::Bytes::Hex, argv.begin() + 2, argv.end());
 
-    scc::AES AES(key);
-    auto kcv = AES.encrypt_ecb(scb::Bytes(key.size()));
+    scb::Bytes kcv;
+    {
+        Profiler::Scope scope(profiler_, Profiler::Phase::Crypto);
+        scc::AES AES(key);
+        kcv = AES.encrypt_ecb(scb::Bytes(key.size()));
+    }
+
+    execution_yield_ << hex_bytes(kcv.left(3));
+    execution_yield_ << "\r\n";
+}
+
+void CryptoShell::mac(std::vector<std::wstring> const &argv) {
+    if (argv.size() < 5) {
+    usage:
+        execution_yield_ << "crypto mac <retail/des-cbc/aes-cbc/des-cmac/aes-cmac> <key> <hex/ascii/unicode> {buffer}\r\n";
+        return;
+    }
+
+    auto key = to_bytes(scb::Bytes::Hex, argv.begin() + 3, argv.begin() + 4);
+
+    scb::Bytes buffer;
+
+    if (is_keyword(argv[4], L"hex")) {
+        buffer = to_bytes(scb::Bytes::Hex, argv.begin() + 5, argv.end());
+    } else if (is_keyword(argv[4], L"ascii")) {
+        buffer = to_bytes(scb::Bytes::ASCII, argv.begin() + 5, argv.end());
+    } else if (is_keyword(argv[4], L"unicode")) {
+        buffer = to_bytes(scb::Bytes::Unicode, argv.begin() + 5, argv.end());
+    } else {
+        goto usage;
+    }
+
+    scb::Bytes result;
+    {
+        Profiler::Scope scope(profiler_, Profiler::Phase::Crypto);
+        result = Mac::create(lowercase(argv[2]), key)->compute(buffer);
+    }
+    execution_yield_ << hex_bytes(result);
+    execution_yield_ << "\r\n";
+}
+
+// MAC computed the way it is done without MAC contexts:
+// full CBC encryption of the padded message with a fresh key schedule, then the last block is taken.
+static scb::Bytes naive_cbc_mac(std::wstring const &algorithm, scb::Bytes const &key, scb::Bytes const &data) {
+    bool aes = algorithm.compare(0, 3, L"aes") == 0;
+    size_t block = aes ? 16 : 8;
+
+    auto padded = data;
+    bool cmac = algorithm.find(L"cmac") != std::wstring::npos;
+    bool complete = cmac && !data.empty() && data.size() % block == 0;
+    if (!complete) {
+        padded += scb::Bytes(L"80");
+        while (padded.size() % block)
+            padded += scb::Bytes(L"00");
+    }
+
+    auto encrypt = [&](scb::Bytes const &k, scb::Bytes const &buffer) {
+        if (aes)
+            return scc::AES(k).crypt(buffer, scc::operation::Encrypt, scb::Bytes(block));
+        scc::DES DES(k);
+        if (k.size() > 8)
+            return DES.crypt3(buffer, scc::operation::Encrypt, scb::Bytes(block));
+        return DES.crypt1(buffer, scc::operation::Encrypt, scb::Bytes(block));
+    };
+
+    if (cmac) {
+        auto subkey = encrypt(key, scb::Bytes(block));
+        for (int n = complete ? 1 : 2; n > 0; n--) {
+            unsigned char carry = subkey[0] >> 7;
+            for (size_t i = 0; i < block - 1; i++)
+                subkey[i] = static_cast<unsigned char>((subkey[i] << 1) | (subkey[i + 1] >> 7));
+            subkey[block - 1] = static_cast<unsigned char>(subkey[block - 1] << 1);
+            if (carry)
+                subkey[block - 1] ^= block == 16 ? 0x87 : 0x1B;
+        }
+        for (size_t i = 0; i < block; i++)
+            padded[padded.size() - block + i] ^= subkey[i];
+    }
+
+    if (algorithm == L"retail") {
+        auto h = encrypt(key.left(8), padded).bytes(padded.size() - 8, 8);
+        h = scc::DES(key.bytes(8, 8)).crypt1(h, scc::operation::Decrypt, scb::Bytes(8));
+        return scc::DES(key.left(8)).crypt1(h, scc::operation::Encrypt, scb::Bytes(8));
+    }
+
+    return encrypt(key, padded).bytes(padded.size() - block, block);
+}
+
+void CryptoShell::mac_bench(std::vector<std::wstring> const &argv) {
+    if (argv.size() != 6) {
+        execution_yield_ << "crypto mac-bench <retail/des-cbc/aes-cbc/des-cmac/aes-cmac> <key> <message size> <iterations>\r\n";
+        return;
+    }
+
+    auto const algorithm = lowercase(argv[2]);
+    auto key = to_bytes(scb::Bytes::Hex, argv.begin() + 3, argv.begin() + 4);
+    size_t size = std::stoul(argv[4]);
+    unsigned iterations = std::stoi(argv[5]);
+
+    scb::Bytes data(size);
+    for (size_t i = 0; i < size; i++)
+        data[i] = static_cast<unsigned char>(i);
+
+    scb::Bytes streamed, naive;
+    auto mac = Mac::create(algorithm, key);
+
+    std::chrono::duration<double> streamedTime, naiveTime;
+    {
+        Profiler::Scope scope(profiler_, Profiler::Phase::Crypto);
+        auto start = std::chrono::steady_clock::now();
+        for (unsigned i = 0; i < iterations; i++) {
+            // Feed the message in APDU-sized chunks, as CardShell does
+            for (size_t offset = 0; offset < size; offset += 255)
+                mac->update(data.data() + offset, std::min<size_t>(255, size - offset));
+            streamed = mac->final();
+        }
+        streamedTime = std::chrono::steady_clock::now() - start;
+
+        start = std::chrono::steady_clock::now();
+        for (unsigned i = 0; i < iterations; i++)
+            naive = naive_cbc_mac(algorithm, key, data);
+        naiveTime = std::chrono::steady_clock::now() - start;
+    }
+
+    double megabytes = static_cast<double>(size) * iterations / (1024 * 1024);
+    execution_yield_
+        << "MAC context: " << megabytes / streamedTime.count() << " MiB/s, "
+        << iterations / streamedTime.count() << " MACs/s\r\n"
+        << "Full CBC:    " << megabytes / naiveTime.count() << " MiB/s, "
+        << iterations / naiveTime.count() << " MACs/s\r\n"
+        << "Speedup:     " << naiveTime.count() / streamedTime.count() << "x\r\n";
+    if (streamed != naive)
+        execution_yield_ << "Warning: results differ\r\n";
+}
+
+void CryptoShell::emv(std::vector<std::wstring> const &argv) {
+    if (argv.size() < 6) {
+    usage:
+        execution_yield_
+            << "crypto emv derive <des/aes> <imk> <pan> <psn> [atc]\r\n"
+            << "crypto emv arqc <des/aes> <imk> <pan> <psn> <atc> <transaction data>\r\n"
+            << "crypto emv arpc <des/aes> <imk> <pan> <psn> <atc> <arqc> <arc>\r\n"
+            << "crypto emv arpc2 <des/aes> <imk> <pan> <psn> <atc> <arqc> <csu> [proprietary data]\r\n"
+            << "crypto emv batch <des/aes> <imk> <input csv> [output csv]\r\n"
+            << "    input lines: pan,psn,atc,transaction data[,expected cryptogram]\r\n";
+        return;
+    }
+
+    auto const &operation = argv[2];
+    EmvCrypto::Algorithm algorithm;
+    if (is_keyword(argv[3], L"des"))
+        algorithm = EmvCrypto::Des;
+    else if (is_keyword(argv[3], L"aes"))
+        algorithm = EmvCrypto::Aes;
+    else
+        goto usage;
+
+    EmvCrypto crypto(algorithm, hex_argument(argv[4]));
+
+    if (is_keyword(operation, L"batch")) {
+        emv_batch(crypto, argv[5], argv.size() > 6 ? argv[6] : L"");
+        return;
+    }
 
-    kcv.left(3).print(execution_yield_, L"");
+    if (argv.size() < 7)
+        goto usage;
+    auto pan = hex_argument(argv[5]), psn = hex_argument(argv[6]);
+
+    if (is_keyword(operation, L"derive")) {
+        scb::Bytes masterKey, sessionKey;
+        {
+            Profiler::Scope scope(profiler_, Profiler::Phase::Crypto);
+            masterKey = crypto.icc_master_key(pan, psn);
+            if (argv.size() > 7)
+                sessionKey = crypto.session_key(pan, psn, hex_argument(argv[7]));
+        }
+        execution_yield_ << "ICC master key: ";
+        execution_yield_ << hex_bytes(masterKey);
+        execution_yield_ << "\r\n";
+        if (argv.size() > 7) {
+            execution_yield_ << "Session key: ";
+            execution_yield_ << hex_bytes(sessionKey);
+            execution_yield_ << "\r\n";
+        }
+        return;
+    }
+
+    scb::Bytes result;
+    if (is_keyword(operation, L"arqc") && argv.size() >= 9) {
+        auto data = to_bytes(scb::Bytes::Hex, argv.begin() + 8, argv.end());
+        auto atc = hex_argument(argv[7]);
+        Profiler::Scope scope(profiler_, Profiler::Phase::Crypto);
+        result = crypto.cryptogram(pan, psn, atc, data);
+    } else if (is_keyword(operation, L"arpc") && argv.size() == 10) {
+        auto atc = hex_argument(argv[7]), arqc = hex_argument(argv[8]), arc = hex_argument(argv[9]);
+        Profiler::Scope scope(profiler_, Profiler::Phase::Crypto);
+        result = crypto.arpc_method1(pan, psn, atc, arqc, arc);
+    } else if (is_keyword(operation, L"arpc2") && argv.size() >= 10) {
+        auto atc = hex_argument(argv[7]), arqc = hex_argument(argv[8]), csu = hex_argument(argv[9]);
+        auto proprietary = to_bytes(scb::Bytes::Hex, argv.begin() + 10, argv.end());
+        Profiler::Scope scope(profiler_, Profiler::Phase::Crypto);
+        result = crypto.arpc_method2(pan, psn, atc, arqc, csu, proprietary);
+    } else {
+        goto usage;
+    }
+
+    execution_yield_ << hex_bytes(result);
     execution_yield_ << "\r\n";
 }
+
+void CryptoShell::emv_batch(EmvCrypto &crypto, std::wstring const &input, std::wstring const &output) {
+    std::wifstream file(std::filesystem::path{ input });
+    if (!file)
+        throw std::runtime_error("cannot open input file");
+
+    struct Transaction {
+        scb::Bytes pan, psn, atc, data, expected;
+        std::string result;
+        bool mismatch = false;
+        bool failed = false;
+    };
+
+    std::vector<std::vector<std::wstring>> lines;
+    for (std::wstring line; std::getline(file, line); ) {
+        line.erase(std::remove_if(line.begin(), line.end(), ::iswspace), line.end());
+        if (line.empty() || line[0] == L'#')
+            continue;
+        std::vector<std::wstring> fields;
+        std::wistringstream stream(line);
+        for (std::wstring field; std::getline(stream, field, L','); )
+            fields.push_back(field);
+        lines.push_back(std::move(fields));
+    }
+
+    std::vector<Transaction> transactions(lines.size());
+
+    auto start = std::chrono::steady_clock::now();
+    {
+        Profiler::Scope scope(profiler_, Profiler::Phase::Crypto);
+        parallel_for(lines.size(), [&](size_t i) {
+            auto const &fields = lines[i];
+            auto &transaction = transactions[i];
+            try {
+                if (fields.size() < 4 || fields.size() > 5)
+                    throw std::runtime_error("expected pan,psn,atc,data[,cryptogram]");
+                transaction.pan = scb::Bytes(fields[0]);
+                transaction.psn = scb::Bytes(fields[1]);
+                transaction.atc = scb::Bytes(fields[2]);
+                auto cryptogram = crypto.cryptogram(transaction.pan, transaction.psn, transaction.atc, scb::Bytes(fields[3]));
+
+                std::ostringstream result;
+                result << hex_bytes(cryptogram);
+                if (fields.size() == 5) {
+                    transaction.mismatch = cryptogram != scb::Bytes(fields[4]);
+                    result << (transaction.mismatch ? ",mismatch" : ",ok");
+                }
+                transaction.result = result.str();
+            } catch (std::exception const &e) {
+                transaction.result = std::string("error: ") + e.what();
+                transaction.failed = true;
+            }
+        });
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    size_t mismatches = 0, failures = 0;
+    std::ofstream out;
+    if (!output.empty()) {
+        out.open(std::filesystem::path{ output });
+        if (!out)
+            throw std::runtime_error("cannot open output file");
+    }
+    for (size_t i = 0; i < transactions.size(); i++) {
+        auto const &transaction = transactions[i];
+        mismatches += transaction.mismatch;
+        failures += transaction.failed;
+
+        std::ostream &stream = output.empty() ? static_cast<std::ostream&>(execution_yield_) : out;
+        stream << utf8(lines[i][0]) << ',' << utf8(lines[i].size() > 1 ? lines[i][1] : L"") << ',' << utf8(lines[i].size() > 2 ? lines[i][2] : L"") << ',' << transaction.result;
+        stream << (output.empty() ? "\r\n" : "\n");
+    }
+
+    execution_yield_
+        << "Transactions: " << transactions.size()
+        << ", mismatches: " << mismatches
+        << ", failed: " << failures
+        << ", time: " << elapsed.count() << " s"
+        << ", rate: " << (elapsed.count() > 0 ? transactions.size() / elapsed.count() : 0) << " transactions/s\r\n";
+}
@@ -1,7 +1,14 @@
 #pragma once
 
 #include "Shell.h"
+#include "RsaKey.h"
+#include "EmvCrypto.h"
 
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <thread>
 #include <vector>
 #include <unordered_map>
 
@@ -12,20 +19,52 @@ public:
     using Shell::Shell;
     using Shell::operator=;
 
+    ~CryptoShell();
+
     void help(std::wstring const &prefix);
     
     void execute(std::vector<std::wstring> const &argv);
 
+    using Command = void (CryptoShell::*)(std::vector<std::wstring> const &);
+    // Handler of the command, nullptr when unknown, so that a command can be resolved once and invoked many times.
+    static Command find_command(std::wstring const &name);
+    inline void invoke(Command command, std::vector<std::wstring> const &argv) {
+        (this->*command)(argv);
+    }
+
 private:
     scb::Bytes to_bytes(scb::Bytes::StringAs as, std::vector<std::wstring>::const_iterator begin, std::vector<std::wstring>::const_iterator end);
 
     void sha(std::vector<std::wstring> const &argv);
     void rsa(std::vector<std::wstring> const &argv);
+    void rsa_batch(std::vector<std::wstring> const &argv);
     void rsa_keygen(std::vector<std::wstring> const &argv);
     void des(std::vector<std::wstring> const &argv);
     void des_kcv(std::vector<std::wstring> const &argv);
     void aes(std::vector<std::wstring> const &argv);
     void aes_kcv(std::vector<std::wstring> const &argv);
+    void mac(std::vector<std::wstring> const &argv);
+    void mac_bench(std::vector<std::wstring> const &argv);
+    void emv(std::vector<std::wstring> const &argv);
+
+    void emv_batch(EmvCrypto &crypto, std::wstring const &input, std::wstring const &output);
+
+    void rsa_keygen_bulk(unsigned bits, scb::Bytes const &exponent, unsigned count, std::wstring const &path);
+    void rsa_keygen_status();
+
+    // Bulk key generation running in background, so that the shell stays responsive.
+    struct KeygenJob {
+        RsaKey::GenerateControl control;
+        std::atomic<unsigned> generated{ 0 };
+        std::atomic<bool> finished{ false };
+        unsigned count = 0;
+        std::wstring path;
+        std::string error;
+        std::chrono::steady_clock::time_point started;
+        std::thread thread;
+    };
+
+    std::unique_ptr<KeygenJob> keygenJob_;
 
     static const std::unordered_map<std::wstring, void (CryptoShell::*)(std::vector<std::wstring> const &)> command_map_;
     static const std::unordered_map<std::wstring, std::wstring> help_map_;
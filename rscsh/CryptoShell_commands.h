@@ -1,7 +1,11 @@
 X( L"sha",               sha,               L"[1/224/256/384/512] <hex/ascii/unicode> {buffer}\r\n\t-- Compute SHA1 hash of specified buffer." )
-X( L"rsa",               rsa,               L"<modulus> <exponent> <hex/ascii/unicode> {buffer}\r\n\t-- Make RSA transofrmation of specified buffer." )
-X( L"rsa-keygen",        rsa_keygen,        L"<bits> <public exponent>\r\n\t-- Generate RSA public-private key pair." )
+X( L"rsa",               rsa,               L"[<modulus> <exponent> / crt <p> <q> <dp> <dq> <qinv>] <hex/ascii/unicode> {buffer}\r\n\t-- Make RSA transofrmation of specified buffer." )
+X( L"rsa-batch",         rsa_batch,         L"<modulus> <exponent> <input file> [output file]\r\n\t-- Make RSA transformation of every hex line of input file on all CPU cores." )
+X( L"rsa-keygen",        rsa_keygen,        L"[<bits> <public exponent> [count <n> out <file>] / status / cancel]\r\n\t-- Generate RSA public-private key pair with CRT components, or <n> key pairs into <file> in background." )
 X( L"des",               des,               L"[decrypt / encrypt] [cbc <iv> / ecb] <key> <hex/ascii/unicode> {buffer}\r\n\t-- Decrypt / encrypt buffer using DES algorithm." )
 X( L"des-kcv",           des_kcv,           L"<key>\r\n\t-- Get KCV of the specified key." )
 X( L"aes",               aes,               L"[decrypt / encrypt] [cbc <iv> / ecb] <key> <hex/ascii/unicode> {buffer}\r\n\t-- Decrypt / encrypt buffer using AES algorithm." )
 X( L"aes-kcv",           aes_kcv,           L"<key>\r\n\t-- Get KCV of the specified key." )
+X( L"mac",               mac,               L"<retail/des-cbc/aes-cbc/des-cmac/aes-cmac> <key> <hex/ascii/unicode> {buffer}\r\n\t-- Compute MAC of specified buffer (ISO 9797-1 padding method 2 for CBC-MAC)." )
+X( L"mac-bench",         mac_bench,         L"<retail/des-cbc/aes-cbc/des-cmac/aes-cmac> <key> <message size> <iterations>\r\n\t-- Compare throughput of MAC context with full CBC encryption." )
+X( L"emv",               emv,               L"[derive / arqc / arpc / arpc2 / batch] <des/aes> <imk> ...\r\n\t-- Derive EMV ICC master and session keys, compute ARQC / ARPC, or cryptograms of a CSV of transactions on all CPU cores." )
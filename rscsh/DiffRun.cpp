@@ -0,0 +1,153 @@
+#include "DiffRun.h"
+#include "BerTlv.h"
+#include "CommandLine.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+using Clock = std::chrono::steady_clock;
+
+static void mask_tag(scb::Bytes &data, size_t offset, size_t size, unsigned tag) {
+    for (auto const &element : BerTlv::parse(data, offset, size)) {
+        if (element.tag == tag)
+            std::fill(data.begin() + element.value_offset(), data.begin() + element.end(), 0);
+        else if (element.constructed)
+            mask_tag(data, element.value_offset(), element.length, tag);
+    }
+}
+
+DiffRun::Mask DiffRun::parse_mask(std::wstring const &spec) {
+    Mask mask;
+    auto selector = lowercase(spec);
+    if (selector.size() > 3 && selector[2] == L':') {
+        mask.ins = static_cast<int>(std::stoul(selector.substr(0, 2), nullptr, 16));
+        selector = selector.substr(3);
+    }
+
+    if (selector.size() > 5 && selector.compare(0, 4, L"tag(") == 0 && selector.back() == L')') {
+        mask.tag = static_cast<unsigned>(std::stoul(selector.substr(4, selector.size() - 5), nullptr, 16));
+        if (mask.tag == 0)
+            throw std::runtime_error("invalid mask tag");
+        return mask;
+    }
+    if (selector.size() > 2 && selector.front() == L'[' && selector.back() == L']') {
+        auto range = selector.substr(1, selector.size() - 2);
+        auto dots = range.find(L"..");
+        mask.from = std::stoul(range.substr(0, dots));
+        if (dots == std::wstring::npos)
+            mask.to = mask.from + 1;
+        else if (dots + 2 < range.size())
+            mask.to = std::stoul(range.substr(dots + 2));
+        if (mask.to <= mask.from)
+            throw std::runtime_error("invalid mask range");
+        return mask;
+    }
+    throw std::runtime_error("invalid mask, expected [<ins>:]tag(<tag>) or [<ins>:][<from>..<to>]");
+}
+
+std::vector<DiffRun::Mask> DiffRun::emv_masks() {
+    std::vector<Mask> masks;
+    for (unsigned tag : { 0x9F36u, 0x9F26u, 0x9F10u, 0x9F4Bu, 0x9F4Cu, 0x9F37u }) {
+        Mask mask;
+        mask.tag = tag;
+        masks.push_back(mask);
+    }
+    // Format 1 responses after the tag 80 header: GENERATE AC after the CID, and INTERNAL
+    // AUTHENTICATE. Format 2 responses (tag 77) are covered by the tag masks.
+    masks.push_back({ 0xAE, 0, 3, static_cast<size_t>(-1), 0x80 });
+    masks.push_back({ 0x88, 0, 2, static_cast<size_t>(-1), 0x80 });
+    // GET CHALLENGE answers with the bare random number
+    masks.push_back({ 0x84, 0, 0 });
+    return masks;
+}
+
+DiffRun::DiffRun(std::vector<Mask> masks, bool stopAtFirst)
+    : masks_(std::move(masks))
+    , stopAtFirst_(stopAtFirst)
+{
+}
+
+scb::Bytes DiffRun::masked(scb::Bytes const &command, scb::Bytes const &response) const {
+    scb::Bytes bytes = response;
+    size_t dataSize = bytes.size() >= 2 ? bytes.size() - 2 : 0;
+    for (auto const &mask : masks_) {
+        if (mask.ins >= 0 && (command.size() < 2 || command[1] != mask.ins))
+            continue;
+        if (mask.lead >= 0 && (dataSize == 0 || bytes[0] != mask.lead))
+            continue;
+        if (mask.tag) {
+            // Response data which is no TLV has nothing to mask
+            try {
+                mask_tag(bytes, 0, dataSize, mask.tag);
+            } catch (std::exception const&) {
+            }
+        } else if (mask.from < dataSize) {
+            std::fill(bytes.begin() + mask.from, bytes.begin() + std::min(mask.to, dataSize), 0);
+        }
+    }
+    return bytes;
+}
+
+bool DiffRun::equal(scb::Bytes const &commandA, scb::Bytes const &responseA, scb::Bytes const &commandB, scb::Bytes const &responseB) const {
+    if (responseA.size() != responseB.size())
+        return false;
+    if (masks_.empty())
+        return responseA == responseB;
+    return masked(commandA, responseA) == masked(commandB, responseB);
+}
+
+void DiffRun::diverge(unsigned long long exchange, bool endedA, bool endedB) {
+    Divergence divergence;
+    divergence.exchange = exchange;
+    divergence.ended[0] = endedA;
+    divergence.ended[1] = endedB;
+    for (unsigned side = 0; side < 2; side++) {
+        if (!divergence.ended[side]) {
+            divergence.command[side] = sides_[side].command;
+            divergence.response[side] = sides_[side].response;
+        }
+    }
+    divergences_.push_back(std::move(divergence));
+    if (stopAtFirst_)
+        stopped_ = true;
+}
+
+void DiffRun::exchange(unsigned side, scb::Bytes const &command, scb::Bytes const &response) {
+    std::unique_lock lock(mutex_);
+    if (stopped_)
+        throw Stopped();
+
+    auto &own = sides_[side], &other = sides_[1 - side];
+    own.command = command;
+    own.response = response;
+    own.pending = true;
+
+    if (other.pending) {
+        // Second to arrive compares, the other side continues with its next command
+        compared_++;
+        if (!equal(sides_[0].command, sides_[0].response, sides_[1].command, sides_[1].response))
+            diverge(compared_, false, false);
+        own.pending = false;
+        other.pending = false;
+        changed_.notify_all();
+    } else if (!other.done) {
+        auto start = Clock::now();
+        changed_.wait(lock, [&] { return !own.pending || other.done || stopped_; });
+        own.waited += Clock::now() - start;
+    }
+
+    if (own.pending) {
+        // Exchanges after the end of the other script are reported once
+        own.pending = false;
+        if (other.done && !stopped_ && (divergences_.empty() || !divergences_.back().ended[1 - side]))
+            diverge(compared_ + 1, side == 1, side == 0);
+    }
+    if (stopped_)
+        throw Stopped();
+}
+
+void DiffRun::finish(unsigned side) {
+    std::lock_guard lock(mutex_);
+    sides_[side].done = true;
+    changed_.notify_all();
+}
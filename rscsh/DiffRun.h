@@ -0,0 +1,81 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <scb/Bytes.h>
+
+// Two runs of the same script in lockstep, on cards A (side 0) and B (side 1). After every exchange
+// a side waits for the exchange of the same number on the other side, so the cards work at the same
+// time and the run takes as long as the slower card. Responses are compared with the masked bytes
+// ignored:
+//   tag(9f36)      value of every BER-TLV element with the tag, at any depth
+//   [5..13]        bytes 5 to 12 of the response data, [5..] to the end
+//   ae:tag(9f26)   only in responses to commands with the INS
+// The status word is always compared.
+class DiffRun {
+public:
+    struct Mask {
+        int ins = -1;               // any command
+        unsigned tag = 0;           // 0 for a byte range
+        size_t from = 0;
+        size_t to = static_cast<size_t>(-1);
+        int lead = -1;              // any response data, else only data starting with the byte
+    };
+
+    struct Divergence {
+        unsigned long long exchange = 0;    // 1-based
+        scb::Bytes command[2];
+        scb::Bytes response[2];
+        bool ended[2] = { false, false };   // the side finished the script before this exchange
+    };
+
+    // Thrown on the side threads after the first divergence, when the run stops there.
+    struct Stopped {};
+
+    static Mask parse_mask(std::wstring const &spec);
+    // ATC, application cryptogram, issuer application data, signed dynamic application data,
+    // ICC dynamic number and unpredictable number.
+    static std::vector<Mask> emv_masks();
+
+    DiffRun(std::vector<Mask> masks, bool stopAtFirst);
+
+    // Called on the side thread after each exchange.
+    void exchange(unsigned side, scb::Bytes const &command, scb::Bytes const &response);
+    // Called on the side thread when its script ended or failed.
+    void finish(unsigned side);
+
+    bool equal(scb::Bytes const &commandA, scb::Bytes const &responseA, scb::Bytes const &commandB, scb::Bytes const &responseB) const;
+
+    // Read after both sides finished.
+    inline std::vector<Divergence> const& divergences() const noexcept { return divergences_; }
+    inline unsigned long long exchanges() const noexcept { return compared_; }
+    // Time a side waited for the other one.
+    inline double wait_ms(unsigned side) const noexcept { return std::chrono::duration<double, std::milli>(sides_[side].waited).count(); }
+
+private:
+    struct Side {
+        bool pending = false;
+        bool done = false;
+        scb::Bytes command;
+        scb::Bytes response;
+        std::chrono::steady_clock::duration waited{};
+    };
+
+    scb::Bytes masked(scb::Bytes const &command, scb::Bytes const &response) const;
+    void diverge(unsigned long long exchange, bool endedA, bool endedB);
+
+    std::vector<Mask> masks_;
+    bool stopAtFirst_;
+
+    std::mutex mutex_;
+    std::condition_variable changed_;
+    Side sides_[2];
+    unsigned long long compared_ = 0;
+    bool stopped_ = false;
+    std::vector<Divergence> divergences_;
+};
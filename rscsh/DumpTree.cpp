@@ -0,0 +1,232 @@
+#include "DumpTree.h"
+#include "BerTlv.h"
+
+#include <algorithm>
+#include <stdexcept>
+#include <string_view>
+#include <unordered_map>
+
+static char const hexDigits[] = "0123456789ABCDEF";
+
+static void append_hex(std::string &text, unsigned char const *data, size_t size) {
+    for (size_t i = 0; i < size; i++) {
+        text += hexDigits[data[i] >> 4];
+        text += hexDigits[data[i] & 0x0F];
+    }
+}
+
+static std::string hex(scb::Bytes const &bytes) {
+    std::string text;
+    text.reserve(2 * bytes.size());
+    append_hex(text, bytes.data(), bytes.size());
+    return text;
+}
+
+static std::string tag_key(unsigned tag) {
+    unsigned char bytes[4];
+    size_t size = 0;
+    for (int shift = 24; shift >= 0; shift -= 8) {
+        if ((tag >> shift) || size || shift == 0)
+            bytes[size++] = static_cast<unsigned char>(tag >> shift);
+    }
+    std::string key;
+    append_hex(key, bytes, size);
+    return key;
+}
+
+// Header, and name of a SELECT by name, so that selects of different applications are told apart
+static std::string exchange_key(scb::Bytes const &command) {
+    std::string key;
+    append_hex(key, command.data(), std::min<size_t>(command.size(), 4));
+    if (command.size() > 5 && command[1] == 0xA4 && command[2] == 0x04 && command.size() >= 5u + command[4]) {
+        key += ' ';
+        append_hex(key, command.data() + 5, command[4]);
+    }
+    return key;
+}
+
+// FNV-1a, 64 bit
+static constexpr unsigned long long hashBasis = 0xCBF29CE484222325ull;
+
+static unsigned long long hash_bytes(unsigned long long hash, void const *data, size_t size) {
+    auto bytes = static_cast<unsigned char const*>(data);
+    for (size_t i = 0; i < size; i++)
+        hash = (hash ^ bytes[i]) * 0x100000001B3ull;
+    return hash;
+}
+
+DumpTree::DumpTree(std::vector<EmvOda::Exchange> const &exchanges) {
+    nodes_.emplace_back();
+    nodes_.front().constructed = true;
+
+    for (auto const &exchange : exchanges) {
+        auto index = add_node(0, exchange_key(exchange.command));
+        nodes_[index].constructed = true;
+
+        auto const &response = exchange.response;
+        size_t dataSize = response.size() >= 2 ? response.size() - 2 : response.size();
+        if (dataSize && !add_elements(index, response, 0, dataSize)) {
+            auto data = add_node(index, "data");
+            nodes_[data].value = response.bytes(0, dataSize);
+            seal(data);
+        }
+        if (response.size() >= 2) {
+            auto sw = add_node(index, "SW");
+            nodes_[sw].value = response.bytes(dataSize, 2);
+            seal(sw);
+        }
+        seal(index);
+    }
+    seal(0);
+}
+
+DumpTree DumpTree::read(std::filesystem::path const &path) {
+    return DumpTree(EmvOda::read_transcript(path));
+}
+
+size_t DumpTree::add_node(size_t parent, std::string key) {
+    auto index = nodes_.size();
+    nodes_.emplace_back();
+    nodes_.back().key = std::move(key);
+    nodes_[parent].children.push_back(index);
+    return index;
+}
+
+bool DumpTree::add_elements(size_t parent, scb::Bytes const &data, size_t offset, size_t size) {
+    std::vector<BerTlv::Element> elements;
+    try {
+        elements = BerTlv::parse(data, offset, size);
+    } catch (std::exception const&) {
+        return false;
+    }
+
+    for (auto const &element : elements) {
+        auto index = add_node(parent, tag_key(element.tag));
+        // Constructed elements with content which is no TLV are kept as values
+        if (element.constructed && add_elements(index, data, element.value_offset(), element.length))
+            nodes_[index].constructed = true;
+        else
+            nodes_[index].value = BerTlv::value(data, element);
+        seal(index);
+    }
+    return true;
+}
+
+void DumpTree::seal(size_t index) {
+    auto &node = nodes_[index];
+    auto hash = hash_bytes(hashBasis, node.key.data(), node.key.size());
+    hash = hash_bytes(hash, &node.constructed, sizeof(node.constructed));
+    if (node.constructed) {
+        for (auto child : node.children)
+            hash = hash_bytes(hash, &nodes_[child].hash, sizeof(nodes_[child].hash));
+    } else {
+        auto size = node.value.size();
+        hash = hash_bytes(hash, &size, sizeof(size));
+        hash = hash_bytes(hash, node.value.data(), node.value.size());
+    }
+    node.hash = hash;
+}
+
+char const* DumpTree::kind_name(Difference::Kind kind) noexcept {
+    switch (kind) {
+        case Difference::Added:
+            return "added";
+        case Difference::Removed:
+            return "removed";
+        case Difference::Changed:
+            return "changed";
+        case Difference::Reordered:
+            return "reordered";
+    }
+    return "";
+}
+
+namespace {
+
+struct Comparer {
+    DumpTree const &a;
+    DumpTree const &b;
+    DumpTree::Comparison &comparison;
+
+    static std::string child_path(std::string const &path, std::string const &key, unsigned occurrence) {
+        auto child = path.empty() ? key : path + '/' + key;
+        if (occurrence)
+            child += '[' + std::to_string(occurrence) + ']';
+        return child;
+    }
+
+    static std::string keys(DumpTree const &tree, DumpTree::Node const &node) {
+        std::string text;
+        for (auto child : node.children) {
+            if (!text.empty())
+                text += ' ';
+            text += tree.node(child).key;
+        }
+        return text;
+    }
+
+    static std::string content(DumpTree const &tree, DumpTree::Node const &node) {
+        return node.constructed ? '{' + keys(tree, node) + '}' : hex(node.value);
+    }
+
+    void add(DumpTree::Difference::Kind kind, std::string path, std::string first, std::string second) {
+        comparison.differences.push_back({ kind, std::move(path), std::move(first), std::move(second) });
+    }
+
+    void compare(size_t i, size_t j, std::string const &path) {
+        auto const &nodeA = a.node(i), &nodeB = b.node(j);
+        comparison.visited++;
+        if (nodeA.hash == nodeB.hash)
+            return;
+
+        if (!nodeA.constructed || !nodeB.constructed) {
+            add(DumpTree::Difference::Changed, path, content(a, nodeA), content(b, nodeB));
+            return;
+        }
+
+        // Repeated keys, such as records of the same header, are matched in order of occurrence
+        std::unordered_map<std::string_view, std::vector<size_t>> positionsB;
+        for (size_t y = 0; y < nodeB.children.size(); y++)
+            positionsB[b.node(nodeB.children[y]).key].push_back(y);
+        std::unordered_map<std::string_view, unsigned> occurrencesA;
+        std::vector<bool> matchedB(nodeB.children.size());
+        size_t lastMatch = 0;
+        bool reordered = false, first = true;
+        for (auto childA : nodeA.children) {
+            auto const &key = a.node(childA).key;
+            auto occurrence = occurrencesA[key]++;
+            auto childPath = child_path(path, key, occurrence);
+
+            auto positions = positionsB.find(key);
+            if (positions == positionsB.end() || occurrence >= positions->second.size()) {
+                add(DumpTree::Difference::Removed, childPath, content(a, a.node(childA)), "");
+                continue;
+            }
+
+            auto y = positions->second[occurrence];
+            matchedB[y] = true;
+            if (!first && y < lastMatch)
+                reordered = true;
+            lastMatch = y;
+            first = false;
+            compare(childA, nodeB.children[y], childPath);
+        }
+        std::unordered_map<std::string_view, unsigned> occurrencesB;
+        for (size_t y = 0; y < nodeB.children.size(); y++) {
+            auto const &child = b.node(nodeB.children[y]);
+            auto occurrence = occurrencesB[child.key]++;
+            if (!matchedB[y])
+                add(DumpTree::Difference::Added, child_path(path, child.key, occurrence), "", content(b, child));
+        }
+        if (reordered)
+            add(DumpTree::Difference::Reordered, path, keys(a, nodeA), keys(b, nodeB));
+    }
+};
+
+}
+
+DumpTree::Comparison DumpTree::compare(DumpTree const &a, DumpTree const &b) {
+    Comparison comparison;
+    Comparer{ a, b, comparison }.compare(0, 0, "");
+    return comparison;
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include "EmvOda.h"
+
+#include <filesystem>
+#include <string>
+#include <vector>
+
+#include <scb/Bytes.h>
+
+// Card dump as a tree: the exchanges of a transcript, keyed by command header (and AID of a
+// SELECT), with the BER-TLV elements and the status word of their responses below them. Every
+// node has a hash of its key and content, and of the hashes of its children (Merkle style), so
+// that a diff skips equal subtrees without visiting them.
+class DumpTree {
+public:
+    struct Node {
+        std::string key;                // tag in hex, command of an exchange, "SW" or "data"
+        unsigned long long hash = 0;
+        bool constructed = false;
+        scb::Bytes value;               // primitive nodes only
+        std::vector<size_t> children;   // indices in the tree
+    };
+
+    struct Difference {
+        enum Kind { Added, Removed, Changed, Reordered };
+
+        Kind kind;
+        std::string path;               // keys from the exchange down, e.g. 00B2010C/70/5A, [n] for a repeated key
+        std::string a;                  // value in hex, or order of the children's keys
+        std::string b;
+    };
+
+    struct Comparison {
+        std::vector<Difference> differences;
+        size_t visited = 0;             // nodes compared below equal hashes were not
+    };
+
+    explicit DumpTree(std::vector<EmvOda::Exchange> const &exchanges);
+    // Transcript of the shell, "< " command and "> " response lines.
+    static DumpTree read(std::filesystem::path const &path);
+
+    inline Node const& root() const noexcept { return nodes_.front(); }
+    inline Node const& node(size_t index) const noexcept { return nodes_[index]; }
+    inline size_t size() const noexcept { return nodes_.size(); }
+
+    static Comparison compare(DumpTree const &a, DumpTree const &b);
+
+    static char const* kind_name(Difference::Kind kind) noexcept;
+
+private:
+    size_t add_node(size_t parent, std::string key);
+    // Children of the parent from data[offset, offset + size), false when it is no TLV (nothing is added).
+    bool add_elements(size_t parent, scb::Bytes const &data, size_t offset, size_t size);
+    void seal(size_t index);
+
+    std::vector<Node> nodes_;
+};
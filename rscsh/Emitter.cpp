@@ -0,0 +1,207 @@
+#include "Emitter.h"
+#include "TextOutput.h"
+
+#include <charconv>
+#include <ostream>
+
+static char const hexDigits[] = "0123456789abcdef";
+
+void Emitter::hex(unsigned char const *data, size_t size) {
+    auto offset = buffer_.size();
+    buffer_.resize(offset + 2 * size);
+    auto out = buffer_.data() + offset;
+    for (size_t i = 0; i < size; i++) {
+        *out++ = hexDigits[data[i] >> 4];
+        *out++ = hexDigits[data[i] & 0x0F];
+    }
+}
+
+void Emitter::cbor_head(unsigned char major, unsigned long long value) {
+    major <<= 5;
+    if (value < 24) {
+        buffer_ += static_cast<char>(major | value);
+        return;
+    }
+
+    unsigned bytes = value <= 0xFF ? 1 : value <= 0xFFFF ? 2 : value <= 0xFFFFFFFF ? 4 : 8;
+    buffer_ += static_cast<char>(major | (bytes == 1 ? 24 : bytes == 2 ? 25 : bytes == 4 ? 26 : 27));
+    for (unsigned i = bytes; i-- > 0; )
+        buffer_ += static_cast<char>(value >> (8 * i));
+}
+
+void Emitter::json_string(std::string_view text) {
+    buffer_ += '"';
+    for (auto c : text) {
+        switch (c) {
+            case '"':  buffer_ += "\\\""; break;
+            case '\\': buffer_ += "\\\\"; break;
+            case '\n': buffer_ += "\\n"; break;
+            case '\r': buffer_ += "\\r"; break;
+            case '\t': buffer_ += "\\t"; break;
+            default:
+                if (static_cast<unsigned char>(c) < 0x20) {
+                    buffer_ += "\\u00";
+                    buffer_ += hexDigits[c >> 4];
+                    buffer_ += hexDigits[c & 0x0F];
+                } else {
+                    buffer_ += c;
+                }
+        }
+    }
+    buffer_ += '"';
+}
+
+void Emitter::key(std::string_view name) {
+    if (format_ == Format::Cbor) {
+        cbor_head(3, name.size());
+        buffer_ += name;
+        return;
+    }
+
+    if (!first_)
+        buffer_ += ',';
+    first_ = false;
+    buffer_ += '"';
+    buffer_ += name;
+    buffer_ += "\":";
+}
+
+void Emitter::begin(std::string_view type) {
+    take_text();
+    begin_record(type);
+}
+
+void Emitter::begin_record(std::string_view type) {
+    if (format_ == Format::Cbor) {
+        // Indefinite length map, fields are not counted in advance
+        buffer_ += static_cast<char>(0xBF);
+    } else {
+        buffer_ += '{';
+        first_ = true;
+    }
+    field("type", type);
+}
+
+void Emitter::end() {
+    if (format_ == Format::Cbor)
+        buffer_ += static_cast<char>(0xFF);
+    else
+        buffer_ += "}\n";
+}
+
+void Emitter::field(std::string_view name, unsigned char const *data, size_t size) {
+    key(name);
+    if (format_ == Format::Cbor) {
+        cbor_head(2, size);
+        buffer_.append(reinterpret_cast<char const*>(data), size);
+    } else {
+        buffer_ += '"';
+        hex(data, size);
+        buffer_ += '"';
+    }
+}
+
+void Emitter::field(std::string_view name, scb::Bytes const &bytes) {
+    field(name, bytes.data(), bytes.size());
+}
+
+void Emitter::field(std::string_view name, unsigned long long value) {
+    key(name);
+    if (format_ == Format::Cbor) {
+        cbor_head(0, value);
+    } else {
+        char digits[20];
+        auto [end, _] = std::to_chars(digits, digits + sizeof(digits), value);
+        buffer_.append(digits, end);
+    }
+}
+
+void Emitter::field(std::string_view name, std::string_view text) {
+    key(name);
+    if (format_ == Format::Cbor) {
+        cbor_head(3, text.size());
+        buffer_ += text;
+    } else {
+        json_string(text);
+    }
+}
+
+void Emitter::field(std::string_view name, std::wstring_view text) {
+    field(name, std::string_view(to_utf8(text)));
+}
+
+void Emitter::exchange(scb::Bytes const &command, scb::Bytes const &response) {
+    exchange(command.data(), command.size(), response.data(), response.size());
+}
+
+void Emitter::exchange(unsigned char const *command, size_t commandSize, unsigned char const *response, size_t responseSize) {
+    begin("exchange");
+    field("command", command, commandSize);
+    if (responseSize >= 2) {
+        field("response", response, responseSize - 2);
+        field("sw", static_cast<unsigned long long>(response[responseSize - 2] << 8 | response[responseSize - 1]));
+    } else {
+        field("response", response, responseSize);
+    }
+    end();
+}
+
+void Emitter::text(std::string_view text) {
+    while (!text.empty()) {
+        auto eol = text.find_first_of("\r\n");
+        auto line = text.substr(0, eol);
+        if (!line.empty()) {
+            begin_record("text");
+            field("line", line);
+            end();
+        }
+        if (eol == std::string_view::npos)
+            break;
+        text.remove_prefix(eol + 1);
+    }
+}
+
+void Emitter::capture_text(std::ostringstream *stream, std::streampos mark) {
+    textStream_ = stream;
+    textMark_ = mark;
+}
+
+void Emitter::take_text() {
+    if (!textStream_ || textMark_ < 0)
+        return;
+    auto end = textStream_->tellp();
+    if (end <= textMark_)
+        return;
+
+    // Only the text since the mark is left in the stream, it is copied once and cut off
+    auto output = textStream_->str();
+    auto mark = static_cast<size_t>(textMark_);
+    text(std::string_view(output).substr(mark, static_cast<size_t>(end) - mark));
+    output.resize(mark);
+    textStream_->str(output);
+    textStream_->seekp(0, std::ios::end);
+}
+
+void Emitter::flush(std::ostream &output) {
+    if (hold_ || buffer_.empty())
+        return;
+
+    if (format_ == Format::Cbor) {
+        std::string line;
+        std::swap(line, buffer_);
+        hex(reinterpret_cast<unsigned char const*>(line.data()), line.size());
+        buffer_ += "\r\n";
+    }
+
+    // Records end in \r\n like every other shell line
+    size_t written = 0;
+    for (size_t i = 0; i < buffer_.size(); i++) {
+        if (buffer_[i] == '\n' && (i == 0 || buffer_[i - 1] != '\r')) {
+            output.write(buffer_.data() + written, static_cast<std::streamsize>(i - written));
+            output << "\r\n";
+            written = i + 1;
+        }
+    }
+    output.write(buffer_.data() + written, static_cast<std::streamsize>(buffer_.size() - written));
+    buffer_.clear();
+}
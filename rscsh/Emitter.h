@@ -0,0 +1,68 @@
+#pragma once
+
+#include <sstream>
+#include <string>
+#include <string_view>
+
+#include <scb/Bytes.h>
+
+// Typed output records for test harnesses, written straight into a byte buffer without stream formatting.
+// A record is a flat map whose first entry is its type:
+//   json:  {"type":"exchange","command":"00a4040000","response":"6f10...","sw":36864}  one record per line
+//   cbor:  {"type": "exchange", "command": h'00a4040000', ...}                          sequence of maps
+// Bytes are hex strings in JSON and byte strings in CBOR, text is UTF-8.
+class Emitter {
+public:
+    enum class Format {
+        Text,
+        Json,
+        Cbor,
+    };
+
+    inline void set_format(Format format) noexcept { format_ = format; }
+    inline Format format() const noexcept { return format_; }
+    inline bool structured() const noexcept { return format_ != Format::Text; }
+
+    // Held records stay in the buffer for the caller, e.g. the IPC server, instead of being flushed to the shell output.
+    inline void set_hold(bool hold) noexcept { hold_ = hold; }
+    inline bool hold() const noexcept { return hold_; }
+
+    void begin(std::string_view type);
+    void field(std::string_view name, scb::Bytes const &bytes);
+    void field(std::string_view name, unsigned char const *data, size_t size);
+    void field(std::string_view name, unsigned long long value);
+    void field(std::string_view name, std::string_view text);
+    void field(std::string_view name, std::wstring_view text);
+    void end();
+
+    void exchange(scb::Bytes const &command, scb::Bytes const &response);
+    void exchange(unsigned char const *command, size_t commandSize, unsigned char const *response, size_t responseSize);
+    // Lines of free text written by commands without typed records.
+    void text(std::string_view text);
+
+    // Free text written to the stream from the mark on is moved into text records before every
+    // typed record, so that records keep the order of the output. nullptr stops capturing.
+    void capture_text(std::ostringstream *stream, std::streampos mark = 0);
+    // Moves the text written since the mark or the last typed record, e.g. at the end of a command.
+    void take_text();
+
+    inline std::string const& buffer() const noexcept { return buffer_; }
+    inline void clear() noexcept { buffer_.clear(); }
+
+    // Writes the records to the shell output, JSON as is and CBOR in hex, and clears the buffer.
+    void flush(std::ostream &output);
+
+private:
+    void begin_record(std::string_view type);
+    void key(std::string_view name);
+    void cbor_head(unsigned char major, unsigned long long value);
+    void json_string(std::string_view text);
+    void hex(unsigned char const *data, size_t size);
+
+    Format format_ = Format::Text;
+    bool hold_ = false;
+    bool first_ = true;
+    std::string buffer_;
+    std::ostringstream *textStream_ = nullptr;
+    std::streampos textMark_ = 0;
+};
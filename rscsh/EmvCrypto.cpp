@@ -0,0 +1,158 @@
+#include "EmvCrypto.h"
+#include "Mac.h"
+
+#include <algorithm>
+#include <mutex>
+#include <stdexcept>
+
+namespace {
+
+// Digits of PAN (BCD, padded with F) and PSN, right aligned in a block of zero digits.
+scb::Bytes pan_block(scb::Bytes const &pan, scb::Bytes const &psn, size_t blockSize) {
+    std::string digits;
+    for (size_t i = 0; i < pan.size() * 2; i++) {
+        unsigned char digit = (pan[i / 2] >> (i % 2 ? 0 : 4)) & 0x0F;
+        if (digit == 0x0F)
+            break;
+        if (digit > 9)
+            throw std::runtime_error("PAN must be BCD");
+        digits += static_cast<char>('0' + digit);
+    }
+    if (psn.size() > 1)
+        throw std::runtime_error("PSN must be 1 byte");
+    unsigned char sequence = psn.empty() ? 0 : psn[0];
+    digits += static_cast<char>('0' + (sequence >> 4));
+    digits += static_cast<char>('0' + (sequence & 0x0F));
+
+    size_t count = blockSize * 2;
+    if (digits.size() > count)
+        digits = digits.substr(digits.size() - count);
+    else
+        digits.insert(0, count - digits.size(), '0');
+
+    scb::Bytes block(blockSize);
+    for (size_t i = 0; i < blockSize; i++)
+        block[i] = static_cast<unsigned char>(((digits[2 * i] - '0') << 4) | (digits[2 * i + 1] - '0'));
+    return block;
+}
+
+std::string key_of(scb::Bytes const &pan, scb::Bytes const &psn) {
+    std::string key(pan.begin(), pan.end());
+    key += '/';
+    key.append(psn.begin(), psn.end());
+    return key;
+}
+
+} // namespace
+
+EmvCrypto::EmvCrypto(Algorithm algorithm, scb::Bytes const &issuerMasterKey)
+    : algorithm_(algorithm)
+    , issuerMasterKey_(cipher(algorithm, issuerMasterKey))
+    , keyLength_(issuerMasterKey.size())
+{
+    if (algorithm == Des && keyLength_ != 16)
+        throw std::runtime_error("3DES issuer master key must be 16 bytes long");
+    if (algorithm == Aes && keyLength_ != 16 && keyLength_ != 32)
+        throw std::runtime_error("AES issuer master key must be 16 or 32 bytes long");
+}
+
+std::unique_ptr<BlockCipher> EmvCrypto::cipher(Algorithm algorithm, scb::Bytes const &key) {
+    return algorithm == Des ? BlockCipher::des(key) : BlockCipher::aes(key);
+}
+
+scb::Bytes EmvCrypto::derive(BlockCipher const &cipher, scb::Bytes block, size_t length, bool desParity) {
+    scb::Bytes key;
+    while (key.size() < length) {
+        scb::Bytes part(block.size());
+        cipher.encrypt_block(block.data(), part.data());
+        key += part;
+        for (auto &byte : block)
+            byte ^= 0xFF;
+    }
+    key = key.left(length);
+
+    // Odd parity of each DES key byte
+    if (desParity) {
+        for (auto &byte : key) {
+            unsigned char bits = byte >> 1;
+            bits ^= bits >> 4;
+            bits ^= bits >> 2;
+            bits ^= bits >> 1;
+            byte = static_cast<unsigned char>((byte & 0xFE) | (~bits & 0x01));
+        }
+    }
+    return key;
+}
+
+scb::Bytes EmvCrypto::icc_master_key(scb::Bytes const &pan, scb::Bytes const &psn) const {
+    return derive(*issuerMasterKey_, pan_block(pan, psn, issuerMasterKey_->block_size()), keyLength_, algorithm_ == Des);
+}
+
+std::shared_ptr<BlockCipher const> EmvCrypto::icc_master_cipher(scb::Bytes const &pan, scb::Bytes const &psn) {
+    auto key = key_of(pan, psn);
+    {
+        std::shared_lock<std::shared_mutex> lock(iccMasterKeysMutex_);
+        if (auto cached = iccMasterKeys_.find(key); cached != iccMasterKeys_.end())
+            return cached->second;
+    }
+
+    std::shared_ptr<BlockCipher const> masterKey = cipher(algorithm_, icc_master_key(pan, psn));
+    std::unique_lock<std::shared_mutex> lock(iccMasterKeysMutex_);
+    return iccMasterKeys_.emplace(key, masterKey).first->second;
+}
+
+scb::Bytes EmvCrypto::session_key(scb::Bytes const &pan, scb::Bytes const &psn, scb::Bytes const &atc) {
+    if (atc.size() != 2)
+        throw std::runtime_error("ATC must be 2 bytes");
+
+    auto masterKey = icc_master_cipher(pan, psn);
+
+    // Common session key: ATC | F0 | 00.. for the first block, ATC | 0F | 00.. for the second
+    scb::Bytes block(masterKey->block_size());
+    block[0] = atc[0];
+    block[1] = atc[1];
+    block[2] = 0xF0;
+
+    scb::Bytes key(block.size());
+    masterKey->encrypt_block(block.data(), key.data());
+    if (key.size() < keyLength_) {
+        block[2] = 0x0F;
+        scb::Bytes right(block.size());
+        masterKey->encrypt_block(block.data(), right.data());
+        key += right;
+    }
+    return key.left(keyLength_);
+}
+
+scb::Bytes EmvCrypto::mac(scb::Bytes const &sessionKey, scb::Bytes const &data) const {
+    if (algorithm_ == Des)
+        return RetailMac(sessionKey, Mac::Method2).compute(data);
+    return Cmac(BlockCipher::aes(sessionKey)).compute(data).left(8);
+}
+
+scb::Bytes EmvCrypto::cryptogram(scb::Bytes const &pan, scb::Bytes const &psn, scb::Bytes const &atc, scb::Bytes const &data) {
+    return mac(session_key(pan, psn, atc), data);
+}
+
+scb::Bytes EmvCrypto::arpc_method1(scb::Bytes const &pan, scb::Bytes const &psn, scb::Bytes const &atc, scb::Bytes const &arqc, scb::Bytes const &arc) {
+    if (arqc.size() != 8 || arc.size() != 2)
+        throw std::runtime_error("ARPC method 1 needs 8 bytes ARQC and 2 bytes ARC");
+
+    auto sessionKey = cipher(algorithm_, session_key(pan, psn, atc));
+    scb::Bytes block(sessionKey->block_size());
+    std::copy(arqc.begin(), arqc.end(), block.begin());
+    block[0] ^= arc[0];
+    block[1] ^= arc[1];
+    sessionKey->encrypt_block(block.data(), block.data());
+    return block.left(8);
+}
+
+scb::Bytes EmvCrypto::arpc_method2(scb::Bytes const &pan, scb::Bytes const &psn, scb::Bytes const &atc, scb::Bytes const &arqc, scb::Bytes const &csu, scb::Bytes const &proprietary) {
+    if (arqc.size() != 8 || csu.size() != 4)
+        throw std::runtime_error("ARPC method 2 needs 8 bytes ARQC and 4 bytes CSU");
+
+    auto data = arqc;
+    data += csu;
+    data += proprietary;
+    return mac(session_key(pan, psn, atc), data).left(4);
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include "BlockCipher.h"
+
+#include <memory>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+
+#include <scb/Bytes.h>
+
+// EMV application cryptograms (Book 2, Annex A1): ICC master key derivation (option A), common session
+// key derivation, ARQC / TC / AAC and ARPC method 1 / 2, with 3DES or AES keys.
+// An issuer master key expands its key schedule once; ICC master keys derived from it are cached
+// per PAN and PSN, so a batch of transactions of the same card derives the master key once.
+// All methods are safe to call from several threads.
+class EmvCrypto {
+public:
+    enum Algorithm {
+        Des,
+        Aes,
+    };
+
+    EmvCrypto(Algorithm algorithm, scb::Bytes const &issuerMasterKey);
+
+    inline Algorithm algorithm() const noexcept { return algorithm_; }
+
+    scb::Bytes icc_master_key(scb::Bytes const &pan, scb::Bytes const &psn) const;
+    scb::Bytes session_key(scb::Bytes const &pan, scb::Bytes const &psn, scb::Bytes const &atc);
+
+    // Application cryptogram over concatenated transaction data (CDOL data), 8 bytes.
+    scb::Bytes cryptogram(scb::Bytes const &pan, scb::Bytes const &psn, scb::Bytes const &atc, scb::Bytes const &data);
+
+    // ARPC method 1: ARQC xor ARC (2 bytes) encrypted with the session key.
+    scb::Bytes arpc_method1(scb::Bytes const &pan, scb::Bytes const &psn, scb::Bytes const &atc, scb::Bytes const &arqc, scb::Bytes const &arc);
+    // ARPC method 2: 4 bytes MAC over ARQC, CSU and proprietary authentication data.
+    scb::Bytes arpc_method2(scb::Bytes const &pan, scb::Bytes const &psn, scb::Bytes const &atc, scb::Bytes const &arqc, scb::Bytes const &csu, scb::Bytes const &proprietary);
+
+    static std::unique_ptr<BlockCipher> cipher(Algorithm algorithm, scb::Bytes const &key);
+
+private:
+    std::shared_ptr<BlockCipher const> icc_master_cipher(scb::Bytes const &pan, scb::Bytes const &psn);
+    // 3DES: ISO 9797-1 algorithm 3 with padding method 2, AES: CMAC truncated to 8 bytes.
+    scb::Bytes mac(scb::Bytes const &sessionKey, scb::Bytes const &data) const;
+
+    // Encrypts `block` and `block` xor FF.. until the key length is reached.
+    static scb::Bytes derive(BlockCipher const &cipher, scb::Bytes block, size_t length, bool desParity);
+
+    Algorithm algorithm_;
+    std::unique_ptr<BlockCipher> issuerMasterKey_;
+    size_t keyLength_;
+
+    std::unordered_map<std::string, std::shared_ptr<BlockCipher const>> iccMasterKeys_;
+    std::shared_mutex iccMasterKeysMutex_;
+};
@@ -0,0 +1,424 @@
+#include "EmvOda.h"
+#include "BerTlv.h"
+
+#include <algorithm>
+#include <cwctype>
+#include <fstream>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+
+#include <scc/Hash.h>
+
+namespace {
+
+std::string key_of(scb::Bytes const &bytes) {
+    return std::string(bytes.begin(), bytes.end());
+}
+
+std::string hex_tag(unsigned tag) {
+    std::ostringstream stream;
+    stream << std::uppercase << std::hex << tag;
+    return stream.str();
+}
+
+scb::Bytes const& required(EmvOda::CardData const &card, unsigned tag) {
+    auto value = card.tags.find(tag);
+    if (value == card.tags.end())
+        throw std::runtime_error("missing tag " + hex_tag(tag));
+    return value->second;
+}
+
+scb::Bytes optional(EmvOda::CardData const &card, unsigned tag) {
+    auto value = card.tags.find(tag);
+    return value != card.tags.end() ? value->second : scb::Bytes();
+}
+
+// Recovers data signed by `key`, and checks header, format and trailer.
+scb::Bytes recover(RsaKey const &key, scb::Bytes const &data, unsigned char format, std::string const &name) {
+    if (data.size() != key.size())
+        throw std::runtime_error(name + " length does not match the key length");
+    auto recovered = key.transform(data);
+    if (recovered[0] != 0x6A || recovered[1] != format || recovered[recovered.size() - 1] != 0xBC)
+        throw std::runtime_error(name + " recovery failed");
+    return recovered;
+}
+
+// Recovered data ends with SHA-1 over everything between the header and the hash, followed by `extra`.
+void check_hash(scb::Bytes const &recovered, unsigned char algorithm, scb::Bytes const &extra, std::string const &name) {
+    if (algorithm != 0x01)
+        throw std::runtime_error(name + " uses unsupported hash algorithm");
+    auto input = recovered.bytes(1, recovered.size() - 22);
+    input += extra;
+    if (scc::SHA1(input) != recovered.bytes(recovered.size() - 21, 20))
+        throw std::runtime_error(name + " hash mismatch");
+}
+
+// Compares BCD digits of `digits` (padded with F) with the leading digits of PAN.
+bool matches_pan(scb::Bytes const &digits, scb::Bytes const &pan) {
+    for (size_t i = 0; i < digits.size() * 2; i++) {
+        unsigned char digit = (digits[i / 2] >> (i % 2 ? 0 : 4)) & 0x0F;
+        if (digit == 0x0F)
+            return i > 0;
+        if (i / 2 >= pan.size() || digit != ((pan[i / 2] >> (i % 2 ? 0 : 4)) & 0x0F))
+            return false;
+    }
+    return true;
+}
+
+scb::Bytes public_key(scb::Bytes const &leftmost, scb::Bytes const &remainder, size_t length, std::string const &name) {
+    if (length <= leftmost.size())
+        return leftmost.left(length);
+    auto modulus = leftmost;
+    modulus += remainder;
+    if (modulus.size() != length)
+        throw std::runtime_error(name + " remainder is missing or has wrong length");
+    return modulus;
+}
+
+scb::Bytes from_hex(std::wstring line) {
+    line.erase(std::remove_if(line.begin(), line.end(), [](wchar_t c) { return std::iswspace(c); }), line.end());
+    return scb::Bytes(line);
+}
+
+} // namespace
+
+void EmvOda::add_ca_key(scb::Bytes const &rid, unsigned char index, scb::Bytes const &modulus, scb::Bytes const &exponent) {
+    if (rid.size() != 5)
+        throw std::runtime_error("RID must be 5 bytes long");
+    caKeys_[key_of(rid) + static_cast<char>(index)] = std::make_shared<RsaKey const>(modulus, exponent);
+}
+
+size_t EmvOda::load_ca_keys(std::filesystem::path const &path) {
+    std::wifstream file(path);
+    if (!file)
+        throw std::runtime_error("cannot open CA keys file");
+
+    size_t count = 0;
+    std::wstring line;
+    while (std::getline(file, line)) {
+        std::wistringstream fields(line);
+        std::wstring rid, index, modulus, exponent;
+        if (!(fields >> rid) || rid[0] == L'#' || rid[0] == L';')
+            continue;
+        if (!(fields >> index >> modulus >> exponent))
+            throw std::runtime_error("CA keys file line must be: <rid> <index> <modulus> <exponent>");
+        add_ca_key(scb::Bytes(rid), static_cast<unsigned char>(std::stoul(index, nullptr, 16)), scb::Bytes(modulus), scb::Bytes(exponent));
+        count++;
+    }
+    return count;
+}
+
+EmvOda::CardData EmvOda::collect(std::vector<Exchange> const &exchanges) {
+    CardData card;
+    scb::Bytes previous;
+
+    for (auto const &exchange : exchanges) {
+        auto command = exchange.command;
+        auto const &response = exchange.response;
+        if (command.size() < 4 || response.size() < 2)
+            continue;
+
+        unsigned char sw1 = response[response.size() - 2];
+        unsigned char sw2 = response[response.size() - 1];
+
+        // With T=0 the data of case 4 commands comes with GET RESPONSE
+        if (command[1] == 0xC0 && previous.size() >= 4)
+            command = previous;
+        previous = command;
+        if (sw1 != 0x90 || sw2 != 0x00)
+            continue;
+
+        auto data = response.left(response.size() - 2);
+        scb::Bytes commandData;
+        if (command.size() > 5 && command.size() >= 5u + command[4])
+            commandData = command.bytes(5, command[4]);
+
+        switch (command[1]) {
+            case 0xA4: // SELECT starts a new application
+                card = CardData();
+                BerTlv::collect(data, card.tags);
+                break;
+
+            case 0xA8: // GET PROCESSING OPTIONS
+                if (commandData.size() >= 2)
+                    card.pdolData = commandData.bytes(2, commandData.size() - 2);
+                if (auto elements = BerTlv::parse(data); !elements.empty() && elements[0].tag == 0x80 && elements[0].length >= 2) {
+                    auto value = BerTlv::value(data, elements[0]);
+                    card.tags[0x82] = value.left(2);
+                    card.tags[0x94] = value.bytes(2, value.size() - 2);
+                } else {
+                    BerTlv::collect(data, card.tags);
+                }
+                break;
+
+            case 0xB2: // READ RECORD
+                card.records[(command[3] >> 3) << 8 | command[2]] = data;
+                BerTlv::collect(data, card.tags);
+                break;
+
+            case 0x88: // INTERNAL AUTHENTICATE
+                card.ddolData = commandData;
+                if (auto elements = BerTlv::parse(data); !elements.empty() && elements[0].tag == 0x80)
+                    card.internalAuthenticateSdad = BerTlv::value(data, elements[0]);
+                else
+                    BerTlv::find(data, 0x9F4B, card.internalAuthenticateSdad);
+                break;
+
+            case 0xAE: // GENERATE AC, only the first one is verified
+                if (!card.cdolData.empty())
+                    break;
+                card.cdolData = commandData;
+                card.cdaRequested = (command[2] & 0x10) != 0;
+                if (auto elements = BerTlv::parse(data); !elements.empty() && elements[0].tag == 0x77)
+                    card.generateAcResponse = BerTlv::value(data, elements[0]);
+                break;
+
+            case 0xCA: // GET DATA
+                BerTlv::collect(data, card.tags);
+                break;
+        }
+    }
+
+    return card;
+}
+
+std::vector<EmvOda::Exchange> EmvOda::read_transcript(std::filesystem::path const &path) {
+    std::wifstream file(path);
+    if (!file)
+        throw std::runtime_error("cannot open transcript");
+
+    std::vector<Exchange> exchanges;
+    Exchange exchange;
+    bool hasCommand = false;
+
+    std::wstring line;
+    while (std::getline(file, line)) {
+        if (line.compare(0, 2, L"< ") == 0) {
+            exchange.command = from_hex(line.substr(2));
+            hasCommand = true;
+        } else if (line.compare(0, 2, L"> ") == 0 && hasCommand) {
+            exchange.response = from_hex(line.substr(2));
+            exchanges.push_back(exchange);
+            hasCommand = false;
+        }
+    }
+    return exchanges;
+}
+
+scb::Bytes EmvOda::dol_data(scb::Bytes const &dol, std::map<unsigned, scb::Bytes> const &values) {
+    scb::Bytes data;
+    for (auto const &entry : BerTlv::parse_dol(dol)) {
+        scb::Bytes field(entry.length);
+        if (auto value = values.find(entry.tag); value != values.end())
+            std::copy(value->second.begin(), value->second.begin() + std::min(entry.length, value->second.size()), field.begin());
+        data += field;
+    }
+    return data;
+}
+
+EmvOda::Result EmvOda::verify(CardData const &card) {
+    Result result;
+    std::wstring method = L"ODA";
+
+    try {
+        auto const &aip = required(card, 0x82);
+        if (aip.size() != 2)
+            throw std::runtime_error("invalid AIP");
+
+        scb::Bytes sdad;
+        if ((aip[0] & 0x01) && card.cdaRequested && BerTlv::find(card.generateAcResponse, 0x9F4B, sdad))
+            method = L"CDA";
+        else if ((aip[0] & 0x20) && !card.internalAuthenticateSdad.empty())
+            method = L"DDA";
+        else if (aip[0] & 0x40)
+            method = L"SDA";
+        else
+            throw std::runtime_error("no offline data authentication method is supported or captured");
+
+        auto staticData = static_data(card);
+        auto issuerKey = issuer_key(card);
+
+        if (method == L"SDA") {
+            verify_sda(card, *issuerKey, staticData);
+        } else {
+            auto iccKey = icc_key(card, *issuerKey, staticData);
+            if (method == L"DDA")
+                verify_dda(card, *iccKey);
+            else
+                verify_cda(card, *iccKey);
+        }
+
+        result.passed = true;
+        result.summary = method + L" ok";
+    } catch (std::exception const &e) {
+        std::string what = e.what();
+        result.summary = method + L" failed: " + std::wstring(what.begin(), what.end());
+    }
+
+    return result;
+}
+
+scb::Bytes EmvOda::static_data(CardData const &card) {
+    auto const &afl = required(card, 0x94);
+    if (afl.size() % 4)
+        throw std::runtime_error("invalid AFL");
+
+    scb::Bytes data;
+    for (size_t i = 0; i < afl.size(); i += 4) {
+        unsigned sfi = afl[i] >> 3;
+        for (unsigned number = afl[i + 1]; number < afl[i + 1] + afl[i + 3]; number++) {
+            auto record = card.records.find(sfi << 8 | number);
+            if (record == card.records.end())
+                throw std::runtime_error("record " + std::to_string(number) + " of SFI " + std::to_string(sfi) + " for ODA was not read");
+
+            // Records of SFI 1 to 10 contribute the value of template 70, others the whole record
+            if (sfi <= 10) {
+                auto elements = BerTlv::parse(record->second);
+                if (elements.size() != 1 || elements[0].tag != 0x70)
+                    throw std::runtime_error("record for ODA is not template 70");
+                data += BerTlv::value(record->second, elements[0]);
+            } else {
+                data += record->second;
+            }
+        }
+    }
+
+    if (auto tagList = card.tags.find(0x9F4A); tagList != card.tags.end()) {
+        if (tagList->second.size() != 1 || tagList->second[0] != 0x82)
+            throw std::runtime_error("static data authentication tag list may contain AIP only");
+        data += required(card, 0x82);
+    }
+
+    return data;
+}
+
+std::shared_ptr<RsaKey const> EmvOda::issuer_key(CardData const &card) {
+    auto aid = card.tags.count(0x4F) ? card.tags.at(0x4F) : required(card, 0x84);
+    if (aid.size() < 5)
+        throw std::runtime_error("invalid AID");
+    auto const &index = required(card, 0x8F);
+    if (index.size() != 1)
+        throw std::runtime_error("invalid CA public key index");
+
+    auto caKey = caKeys_.find(key_of(aid.left(5)) + static_cast<char>(index[0]));
+    if (caKeys_.end() == caKey)
+        throw std::runtime_error("CA public key " + hex_tag(index[0]) + " of this RID is not loaded");
+
+    auto const &certificate = required(card, 0x90);
+    auto remainder = optional(card, 0x92);
+    auto const &exponent = required(card, 0x9F32);
+
+    auto hashInput = certificate;
+    hashInput += remainder;
+    hashInput += exponent;
+    auto cacheKey = caKey->first + key_of(scc::SHA1(hashInput));
+
+    // Cards of other issuers may present the same certificate, the PAN is checked on every hit
+    {
+        std::shared_lock<std::shared_mutex> lock(issuerKeysMutex_);
+        if (auto cached = issuerKeys_.find(cacheKey); cached != issuerKeys_.end()) {
+            if (!matches_pan(cached->second.issuerIdentifier, required(card, 0x5A)))
+                throw std::runtime_error("issuer identifier does not match PAN");
+            cacheHits_++;
+            return cached->second.key;
+        }
+    }
+
+    std::string const name = "issuer public key certificate";
+    auto recovered = recover(*caKey->second, certificate, 0x02, name);
+    auto modulus = public_key(recovered.bytes(15, recovered.size() - 36), remainder, recovered[13], name);
+    auto extra = remainder;
+    extra += exponent;
+    check_hash(recovered, recovered[11], extra, name);
+    auto issuerIdentifier = recovered.bytes(2, 4);
+    if (!matches_pan(issuerIdentifier, required(card, 0x5A)))
+        throw std::runtime_error("issuer identifier does not match PAN");
+
+    auto key = std::make_shared<RsaKey const>(modulus, exponent);
+    recoveries_++;
+
+    std::unique_lock<std::shared_mutex> lock(issuerKeysMutex_);
+    return issuerKeys_.emplace(cacheKey, IssuerKey{ key, issuerIdentifier }).first->second.key;
+}
+
+std::shared_ptr<RsaKey const> EmvOda::icc_key(CardData const &card, RsaKey const &issuerKey, scb::Bytes const &staticData) {
+    auto remainder = optional(card, 0x9F48);
+    auto const &exponent = required(card, 0x9F47);
+
+    std::string const name = "ICC public key certificate";
+    auto recovered = recover(issuerKey, required(card, 0x9F46), 0x04, name);
+    auto modulus = public_key(recovered.bytes(21, recovered.size() - 42), remainder, recovered[19], name);
+
+    auto extra = remainder;
+    extra += exponent;
+    extra += staticData;
+    check_hash(recovered, recovered[17], extra, name);
+    if (!matches_pan(recovered.bytes(2, 10), required(card, 0x5A)))
+        throw std::runtime_error("ICC public key certificate PAN does not match");
+
+    return std::make_shared<RsaKey const>(modulus, exponent);
+}
+
+void EmvOda::verify_sda(CardData const &card, RsaKey const &issuerKey, scb::Bytes const &staticData) {
+    std::string const name = "signed static application data";
+    auto recovered = recover(issuerKey, required(card, 0x93), 0x03, name);
+    check_hash(recovered, recovered[2], staticData, name);
+}
+
+void EmvOda::verify_dda(CardData const &card, RsaKey const &iccKey) {
+    std::string const name = "signed dynamic application data";
+    auto recovered = recover(iccKey, card.internalAuthenticateSdad, 0x05, name);
+    check_hash(recovered, recovered[2], card.ddolData, name);
+}
+
+void EmvOda::verify_cda(CardData const &card, RsaKey const &iccKey) {
+    std::string const name = "signed dynamic application data";
+
+    scb::Bytes sdad;
+    BerTlv::find(card.generateAcResponse, 0x9F4B, sdad);
+    auto recovered = recover(iccKey, sdad, 0x05, name);
+
+    // Unpredictable number is taken from its position in CDOL1 data
+    scb::Bytes unpredictableNumber;
+    size_t offset = 0;
+    for (auto const &entry : BerTlv::parse_dol(required(card, 0x8C))) {
+        if (entry.tag == 0x9F37 && offset + entry.length <= card.cdolData.size())
+            unpredictableNumber = card.cdolData.bytes(offset, entry.length);
+        offset += entry.length;
+    }
+    if (unpredictableNumber.empty())
+        throw std::runtime_error("CDOL1 data has no unpredictable number");
+    check_hash(recovered, recovered[2], unpredictableNumber, name);
+
+    // ICC dynamic data: ICC dynamic number length | number | CID | AC | transaction data hash code
+    size_t length = recovered[3];
+    if (length + 25 > recovered.size())
+        throw std::runtime_error("invalid ICC dynamic data length");
+    auto dynamic = recovered.bytes(4, length);
+    size_t numberLength = dynamic.empty() ? 0 : dynamic[0];
+    if (dynamic.size() < numberLength + 30)
+        throw std::runtime_error("ICC dynamic data is too short for CDA");
+
+    scb::Bytes cid;
+    if (!BerTlv::find(card.generateAcResponse, 0x9F27, cid) || cid.size() != 1 || cid[0] != dynamic[1 + numberLength])
+        throw std::runtime_error("cryptogram information data does not match");
+
+    auto hashInput = card.pdolData;
+    hashInput += card.cdolData;
+    for (auto const &element : BerTlv::parse(card.generateAcResponse))
+        if (element.tag != 0x9F4B)
+            hashInput += card.generateAcResponse.bytes(element.offset, element.headerSize + element.length);
+    if (scc::SHA1(hashInput) != dynamic.bytes(numberLength + 10, 20))
+        throw std::runtime_error("transaction data hash code mismatch");
+}
+
+size_t EmvOda::cached_issuer_keys() const {
+    std::shared_lock<std::shared_mutex> lock(issuerKeysMutex_);
+    return issuerKeys_.size();
+}
+
+void EmvOda::clear_cache() {
+    std::unique_lock<std::shared_mutex> lock(issuerKeysMutex_);
+    issuerKeys_.clear();
+}
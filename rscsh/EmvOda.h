@@ -0,0 +1,81 @@
+#pragma once
+
+#include "RsaKey.h"
+
+#include <atomic>
+#include <filesystem>
+#include <map>
+#include <memory>
+#include <shared_mutex>
+#include <string>
+#include <vector>
+
+#include <scb/Bytes.h>
+
+// EMV offline data authentication (Book 2): recovers issuer and ICC public keys, verifies SDA, DDA and CDA.
+// Recovered issuer public keys are cached, keyed by CA key and hash of the certificate, remainder and exponent,
+// so cards of the same issuer recover the issuer key only once. verify() is safe to call from several threads.
+class EmvOda {
+public:
+    struct Exchange {
+        scb::Bytes command;
+        scb::Bytes response;    // including SW
+    };
+
+    // Data of one transaction, collected from SELECT, GET PROCESSING OPTIONS, READ RECORD,
+    // INTERNAL AUTHENTICATE and GENERATE AC exchanges.
+    struct CardData {
+        std::map<unsigned, scb::Bytes> tags;
+        std::map<unsigned, scb::Bytes> records;    // SFI << 8 | record number -> record template
+        scb::Bytes pdolData;
+        scb::Bytes ddolData;
+        scb::Bytes cdolData;
+        scb::Bytes internalAuthenticateSdad;
+        scb::Bytes generateAcResponse;             // contents of template 77
+        bool cdaRequested = false;
+    };
+
+    struct Result {
+        bool passed = false;
+        std::wstring summary;
+    };
+
+    void add_ca_key(scb::Bytes const &rid, unsigned char index, scb::Bytes const &modulus, scb::Bytes const &exponent);
+    // Lines of "<rid> <index> <modulus> <exponent>" in hex, returns number of keys loaded.
+    size_t load_ca_keys(std::filesystem::path const &path);
+    inline size_t ca_keys() const noexcept { return caKeys_.size(); }
+
+    static CardData collect(std::vector<Exchange> const &exchanges);
+    // Reads exchanges from a shell transcript, "< " command and "> " response lines.
+    static std::vector<Exchange> read_transcript(std::filesystem::path const &path);
+
+    // Command data for a Data Object List, values not in `values` are zero filled.
+    static scb::Bytes dol_data(scb::Bytes const &dol, std::map<unsigned, scb::Bytes> const &values);
+
+    Result verify(CardData const &card);
+
+    size_t cached_issuer_keys() const;
+    inline unsigned long long issuer_key_recoveries() const noexcept { return recoveries_; }
+    inline unsigned long long issuer_key_cache_hits() const noexcept { return cacheHits_; }
+    void clear_cache();
+
+private:
+    std::shared_ptr<RsaKey const> issuer_key(CardData const &card);
+    std::shared_ptr<RsaKey const> icc_key(CardData const &card, RsaKey const &issuerKey, scb::Bytes const &staticData);
+    void verify_sda(CardData const &card, RsaKey const &issuerKey, scb::Bytes const &staticData);
+    void verify_dda(CardData const &card, RsaKey const &iccKey);
+    void verify_cda(CardData const &card, RsaKey const &iccKey);
+
+    static scb::Bytes static_data(CardData const &card);
+
+    std::map<std::string, std::shared_ptr<RsaKey const>> caKeys_;
+    struct IssuerKey {
+        std::shared_ptr<RsaKey const> key;
+        scb::Bytes issuerIdentifier;    // leftmost PAN digits from the certificate, checked on every use
+    };
+
+    std::map<std::string, IssuerKey> issuerKeys_;
+    mutable std::shared_mutex issuerKeysMutex_;
+    std::atomic<unsigned long long> recoveries_{ 0 };
+    std::atomic<unsigned long long> cacheHits_{ 0 };
+};
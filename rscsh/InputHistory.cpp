@@ -0,0 +1,200 @@
+#include "InputHistory.h"
+
+#include <algorithm>
+#include <cwctype>
+#include <filesystem>
+
+#include <Windows.h>
+
+InputHistory::InputHistory(std::wstring const &path)
+    : path_(path)
+{
+    loader_ = std::thread(&InputHistory::load, this);
+    writer_ = std::thread(&InputHistory::write, this);
+}
+
+InputHistory::~InputHistory() {
+    loader_.join();
+    {
+        std::lock_guard lock(pendingMutex_);
+        stopping_ = true;
+    }
+    pendingChanged_.notify_one();
+    writer_.join();
+}
+
+std::wstring InputHistory::default_path() {
+    wchar_t buffer[MAX_PATH];
+    auto size = GetEnvironmentVariableW(L"LOCALAPPDATA", buffer, MAX_PATH);
+    if (size == 0 || size >= MAX_PATH)
+        return L"history.txt";
+    return (std::filesystem::path(buffer) / L"rscsh" / L"history.txt").wstring();
+}
+
+std::wstring InputHistory::lowercase(std::wstring text) {
+    std::transform(text.begin(), text.end(), text.begin(), ::towlower);
+    return text;
+}
+
+uint64_t InputHistory::trigram(wchar_t const *text) {
+    return static_cast<uint64_t>(static_cast<uint16_t>(text[0])) << 32
+        | static_cast<uint64_t>(static_cast<uint16_t>(text[1])) << 16
+        | static_cast<uint16_t>(text[2]);
+}
+
+void InputHistory::index(Trigrams &trigrams, std::wstring const &lowercaseEntry, uint32_t id) {
+    for (size_t i = 0; i + 3 <= lowercaseEntry.size(); i++) {
+        auto &ids = trigrams[trigram(lowercaseEntry.data() + i)];
+        // Trigram repeated in the entry is listed once
+        if (ids.empty() || ids.back() != id)
+            ids.push_back(id);
+    }
+}
+
+void InputHistory::load() {
+    std::vector<std::wstring> entries;
+    std::vector<std::wstring> lowercaseEntries;
+    Trigrams trigrams;
+
+    HANDLE file = CreateFileW(path_.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file != INVALID_HANDLE_VALUE) {
+        LARGE_INTEGER size;
+        HANDLE mapping = GetFileSizeEx(file, &size) && size.QuadPart > 0
+            ? CreateFileMappingW(file, NULL, PAGE_READONLY, 0, 0, NULL)
+            : NULL;
+        auto view = mapping ? static_cast<char const*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0)) : nullptr;
+
+        if (view) {
+            auto end = view + size.QuadPart;
+            for (auto line = view; line < end; ) {
+                auto eol = std::find(line, end, '\n');
+                auto length = static_cast<int>(eol - line);
+                if (length > 0 && line[length - 1] == '\r')
+                    length--;
+                if (length > 0) {
+                    std::wstring entry(MultiByteToWideChar(CP_UTF8, 0, line, length, NULL, 0), L'\0');
+                    MultiByteToWideChar(CP_UTF8, 0, line, length, entry.data(), static_cast<int>(entry.size()));
+                    if (entries.empty() || entries.back() != entry) {
+                        lowercaseEntries.push_back(lowercase(entry));
+                        index(trigrams, lowercaseEntries.back(), static_cast<uint32_t>(entries.size()));
+                        entries.push_back(std::move(entry));
+                    }
+                }
+                line = eol + 1;
+            }
+            UnmapViewOfFile(view);
+        }
+        if (mapping)
+            CloseHandle(mapping);
+        CloseHandle(file);
+    }
+
+    // Entries typed while loading follow the loaded ones
+    std::lock_guard lock(mutex_);
+    for (auto &entry : entries_) {
+        lowercaseEntries.push_back(lowercase(entry));
+        index(trigrams, lowercaseEntries.back(), static_cast<uint32_t>(entries.size()));
+        entries.push_back(std::move(entry));
+    }
+    entries_ = std::move(entries);
+    lowercase_ = std::move(lowercaseEntries);
+    trigrams_ = std::move(trigrams);
+}
+
+void InputHistory::write() {
+    HANDLE file = INVALID_HANDLE_VALUE;
+    std::unique_lock lock(pendingMutex_);
+    for (;;) {
+        pendingChanged_.wait(lock, [this] { return stopping_ || !pending_.empty(); });
+        if (pending_.empty())
+            break;
+
+        std::string lines;
+        for (auto const &entry : pending_) {
+            auto size = WideCharToMultiByte(CP_UTF8, 0, entry.data(), static_cast<int>(entry.size()), NULL, 0, NULL, NULL);
+            auto offset = lines.size();
+            lines.resize(offset + size);
+            WideCharToMultiByte(CP_UTF8, 0, entry.data(), static_cast<int>(entry.size()), lines.data() + offset, size, NULL, NULL);
+            lines += "\r\n";
+        }
+        pending_.clear();
+        lock.unlock();
+
+        if (file == INVALID_HANDLE_VALUE) {
+            std::error_code error;
+            std::filesystem::create_directories(std::filesystem::path(path_).parent_path(), error);
+            file = CreateFileW(path_.c_str(), FILE_APPEND_DATA, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+        }
+        // History is best effort, input is never refused because it cannot be stored
+        DWORD written;
+        if (file != INVALID_HANDLE_VALUE)
+            WriteFile(file, lines.data(), static_cast<DWORD>(lines.size()), &written, NULL);
+
+        lock.lock();
+    }
+
+    if (file != INVALID_HANDLE_VALUE)
+        CloseHandle(file);
+}
+
+void InputHistory::add(std::wstring const &entry) {
+    {
+        std::lock_guard lock(mutex_);
+        if (!entries_.empty() && entries_.back() == entry)
+            return;
+        lowercase_.push_back(lowercase(entry));
+        index(trigrams_, lowercase_.back(), static_cast<uint32_t>(entries_.size()));
+        entries_.push_back(entry);
+    }
+    {
+        std::lock_guard lock(pendingMutex_);
+        pending_.push_back(entry);
+    }
+    pendingChanged_.notify_one();
+}
+
+size_t InputHistory::size() const {
+    std::lock_guard lock(mutex_);
+    return entries_.size();
+}
+
+std::wstring InputHistory::at(size_t index) const {
+    std::lock_guard lock(mutex_);
+    return entries_.at(index);
+}
+
+size_t InputHistory::search(std::wstring const &query, size_t before) const {
+    auto key = lowercase(query);
+
+    std::lock_guard lock(mutex_);
+    before = std::min(before, entries_.size());
+    if (key.empty() || before == 0)
+        return npos;
+
+    if (key.size() < 3) {
+        for (auto id = before; id-- > 0; ) {
+            if (lowercase_[id].find(key) != std::wstring::npos)
+                return id;
+        }
+        return npos;
+    }
+
+    // Candidates come from the shortest list of the query's trigrams, the others have to contain them as well
+    std::vector<std::vector<uint32_t> const*> lists;
+    for (size_t i = 0; i + 3 <= key.size(); i++) {
+        auto it = trigrams_.find(trigram(key.data() + i));
+        if (it == trigrams_.end())
+            return npos;
+        lists.push_back(&it->second);
+    }
+    std::sort(lists.begin(), lists.end(), [](auto a, auto b) { return a->size() < b->size(); });
+
+    auto const &candidates = *lists.front();
+    for (auto it = std::lower_bound(candidates.begin(), candidates.end(), before); it != candidates.begin(); ) {
+        auto id = *--it;
+        bool all = std::all_of(lists.begin() + 1, lists.end(), [id](auto list) { return std::binary_search(list->begin(), list->end(), id); });
+        if (all && lowercase_[id].find(key) != std::wstring::npos)
+            return id;
+    }
+    return npos;
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+// Input lines kept across sessions in an append-only UTF-8 file, one line per entry.
+// The file is memory mapped and indexed on a background thread at startup; entries typed
+// meanwhile are kept and merged after the loaded ones. New entries are appended by a writer
+// thread, so that the input thread never waits for the disk.
+//
+// Substring search is backed by an index of trigrams (three lowercase characters) to the
+// entries containing them, a query is only compared against entries having all its trigrams.
+class InputHistory {
+public:
+    static constexpr size_t npos = static_cast<size_t>(-1);
+
+    explicit InputHistory(std::wstring const &path);
+    ~InputHistory();
+
+    InputHistory(InputHistory const&) = delete;
+    InputHistory& operator=(InputHistory const&) = delete;
+
+    // %LOCALAPPDATA%\rscsh\history.txt
+    static std::wstring default_path();
+
+    // Consecutive duplicates are not added.
+    void add(std::wstring const &entry);
+
+    size_t size() const;
+    std::wstring at(size_t index) const;
+
+    // Newest entry before the index containing the query, case insensitive, or npos.
+    size_t search(std::wstring const &query, size_t before) const;
+
+private:
+    void load();
+    void write();
+
+    using Trigrams = std::unordered_map<uint64_t, std::vector<uint32_t>>;
+    static void index(Trigrams &trigrams, std::wstring const &lowercaseEntry, uint32_t id);
+
+    static std::wstring lowercase(std::wstring text);
+    static uint64_t trigram(wchar_t const *text);
+
+    std::wstring path_;
+
+    std::vector<std::wstring> entries_;
+    std::vector<std::wstring> lowercase_;
+    Trigrams trigrams_;     // entry ids in ascending order
+    mutable std::mutex mutex_;
+    std::thread loader_;
+
+    std::deque<std::wstring> pending_;
+    bool stopping_ = false;
+    std::mutex pendingMutex_;
+    std::condition_variable pendingChanged_;
+    std::thread writer_;
+};
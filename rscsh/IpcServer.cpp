@@ -0,0 +1,292 @@
+#include "IpcServer.h"
+#include "MainShell.h"
+#include "TextOutput.h"
+
+#include <algorithm>
+#include <sstream>
+#include <stdexcept>
+
+#include <sddl.h>
+
+// UTF-8 text as frame data
+static scb::Bytes text_bytes(std::string_view text) {
+    scb::Bytes bytes(text.size());
+    std::copy(text.begin(), text.end(), bytes.begin());
+    return bytes;
+}
+
+static void put(scb::Bytes &buffer, size_t &offset, unsigned long value, size_t size) {
+    for (size_t i = 0; i < size; i++)
+        buffer[offset++] = static_cast<unsigned char>(value >> (8 * i));
+}
+
+static unsigned long get(scb::Bytes const &buffer, size_t &offset, size_t size) {
+    if (offset + size > buffer.size())
+        throw std::runtime_error("truncated IPC frame");
+    unsigned long value = 0;
+    for (size_t i = 0; i < size; i++)
+        value |= static_cast<unsigned long>(buffer[offset++]) << (8 * i);
+    return value;
+}
+
+// Security descriptor granting access to the user running the shell only, freed with LocalFree.
+static PSECURITY_DESCRIPTOR current_user_only() {
+    HANDLE token;
+    if (!OpenProcessToken(GetCurrentProcess(), TOKEN_QUERY, &token))
+        throw std::runtime_error("cannot open process token");
+    DWORD size = 0;
+    GetTokenInformation(token, TokenUser, NULL, 0, &size);
+    std::vector<unsigned char> user(size);
+    BOOL queried = GetTokenInformation(token, TokenUser, user.data(), size, &size);
+    CloseHandle(token);
+    if (!queried)
+        throw std::runtime_error("cannot query process user");
+
+    LPWSTR sid;
+    if (!ConvertSidToStringSidW(reinterpret_cast<TOKEN_USER*>(user.data())->User.Sid, &sid))
+        throw std::runtime_error("cannot convert user SID");
+    // Protected DACL with a single entry: generic all for the user
+    std::wstring sddl = L"D:P(A;;GA;;;" + std::wstring(sid) + L")";
+    LocalFree(sid);
+
+    PSECURITY_DESCRIPTOR descriptor;
+    if (!ConvertStringSecurityDescriptorToSecurityDescriptorW(sddl.c_str(), SDDL_REVISION_1, &descriptor, NULL))
+        throw std::runtime_error("cannot create pipe security descriptor");
+    return descriptor;
+}
+
+// Waits for overlapped I/O on the pipe, which is cancelled when the stop event is set first.
+static bool complete(HANDLE pipe, OVERLAPPED &overlapped, HANDLE stop, DWORD &transferred) {
+    HANDLE events[] = { overlapped.hEvent, stop };
+    if (WaitForMultipleObjects(2, events, FALSE, INFINITE) != WAIT_OBJECT_0) {
+        CancelIoEx(pipe, &overlapped);
+        GetOverlappedResult(pipe, &overlapped, &transferred, TRUE);
+        return false;
+    }
+    return GetOverlappedResult(pipe, &overlapped, &transferred, FALSE) != 0;
+}
+
+// ReadFile / WriteFile, overlapped and interrupted by the stop event when there is one.
+static bool transfer(HANDLE pipe, unsigned char *data, DWORD size, DWORD &transferred, bool write, HANDLE stop) {
+    if (!stop) {
+        return (write ? WriteFile(pipe, data, size, &transferred, NULL) : ReadFile(pipe, data, size, &transferred, NULL)) != 0;
+    }
+
+    OVERLAPPED overlapped{};
+    overlapped.hEvent = CreateEventW(NULL, TRUE, FALSE, NULL);
+    if (!overlapped.hEvent)
+        return false;
+    bool done;
+    if (write ? WriteFile(pipe, data, size, NULL, &overlapped) : ReadFile(pipe, data, size, NULL, &overlapped))
+        done = GetOverlappedResult(pipe, &overlapped, &transferred, FALSE) != 0;
+    else
+        done = GetLastError() == ERROR_IO_PENDING && complete(pipe, overlapped, stop, transferred);
+    CloseHandle(overlapped.hEvent);
+    return done;
+}
+
+IpcServer::IpcServer(rsc::Context const &context, std::wstring const &pipeName)
+    : context_(context)
+    , pipeName_(pipeName)
+    , security_(current_user_only())
+    , stopEvent_(CreateEventW(NULL, TRUE, FALSE, NULL))
+{
+    if (!stopEvent_) {
+        LocalFree(security_);
+        throw std::runtime_error("cannot create server stop event");
+    }
+    acceptThread_ = std::thread(&IpcServer::accept, this);
+}
+
+IpcServer::~IpcServer() {
+    // Pending connects, reads and writes return, clients executing a command stop after it
+    stopping_ = true;
+    SetEvent(stopEvent_);
+    acceptThread_.join();
+
+    std::vector<std::unique_ptr<Client>> clients;
+    {
+        std::lock_guard lock(clientsMutex_);
+        clients.swap(clients_);
+    }
+    for (auto &client : clients)
+        client->thread.join();
+
+    CloseHandle(stopEvent_);
+    LocalFree(security_);
+}
+
+size_t IpcServer::clients() const {
+    std::lock_guard lock(clientsMutex_);
+    return std::count_if(clients_.begin(), clients_.end(), [](auto const &client) { return !client->finished; });
+}
+
+void IpcServer::accept() {
+    // Local clients of the same user only, the sessions drive the card and read files
+    SECURITY_ATTRIBUTES attributes{ sizeof(attributes), security_, FALSE };
+    while (!stopping_) {
+        HANDLE pipe = CreateNamedPipeW(pipeName_.c_str(), PIPE_ACCESS_DUPLEX | FILE_FLAG_OVERLAPPED, PIPE_TYPE_BYTE | PIPE_READMODE_BYTE | PIPE_WAIT | PIPE_REJECT_REMOTE_CLIENTS,
+            PIPE_UNLIMITED_INSTANCES, 1 << 16, 1 << 16, 0, &attributes);
+        if (pipe == INVALID_HANDLE_VALUE)
+            return;
+
+        OVERLAPPED overlapped{};
+        overlapped.hEvent = CreateEventW(NULL, TRUE, FALSE, NULL);
+        bool connected = false;
+        if (overlapped.hEvent) {
+            DWORD unused;
+            connected = ConnectNamedPipe(pipe, &overlapped) || GetLastError() == ERROR_PIPE_CONNECTED
+                || (GetLastError() == ERROR_IO_PENDING && complete(pipe, overlapped, stopEvent_, unused));
+            CloseHandle(overlapped.hEvent);
+        }
+        if (!connected || stopping_) {
+            CloseHandle(pipe);
+            if (stopping_ || !overlapped.hEvent)
+                return;
+            continue;
+        }
+
+        std::lock_guard lock(clientsMutex_);
+        for (auto it = clients_.begin(); it != clients_.end(); ) {
+            if ((*it)->finished) {
+                (*it)->thread.join();
+                it = clients_.erase(it);
+            } else {
+                ++it;
+            }
+        }
+        auto &client = *clients_.emplace_back(std::make_unique<Client>());
+        client.pipe = pipe;
+        client.thread = std::thread(&IpcServer::serve, this, std::ref(client));
+    }
+}
+
+void IpcServer::serve(Client &client) {
+    // Session of this client: own shells, history, secure channel and card connection
+    std::ostringstream output;
+    MainShell shell(output, [] {});
+    shell.card_shell().set_context(context_);
+    shell.emitter().set_hold(true);
+
+    scb::Bytes request;
+    while (!stopping_ && read_frame(client.pipe, request, stopEvent_)) {
+        std::vector<Item> results;
+        try {
+            auto items = decode(request, false);
+            results.reserve(items.size());
+            for (auto const &item : items) {
+                Item result;
+                result.kind = item.kind;
+                try {
+                    // Commands lock their reader in the card shell, raw APDUs here
+                    if (item.kind == CommandLine) {
+                        shell.execute(from_utf8(std::string_view(reinterpret_cast<char const*>(item.data.data()), item.data.size())).c_str(), false);
+                        // Shell output is UTF-8 already, records and text are sent as they are
+                        if (shell.emitter().structured())
+                            result.data = text_bytes(shell.emitter().buffer());
+                        else
+                            result.data = text_bytes(output.str());
+                    } else {
+                        std::unique_lock<std::mutex> readerLock;
+                        if (shell.card_shell().has_card())
+                            readerLock = std::unique_lock(CardShell::reader_mutex(shell.card_shell().reader_name()));
+                        shell.card_shell().transmit(item.data);
+                        result.data = shell.card_shell().last_response().buffer();
+                    }
+                } catch (std::exception const &e) {
+                    result.failed = true;
+                    result.data = text_bytes(e.what());
+                }
+                output.str(std::string());
+                output.clear();
+                shell.emitter().clear();
+                results.push_back(std::move(result));
+            }
+            items_ += items.size();
+        } catch (std::exception const &e) {
+            Item error;
+            error.failed = true;
+            error.data = text_bytes(e.what());
+            results.assign(1, error);
+        }
+        requests_++;
+
+        if (!write_frame(client.pipe, encode(results, true), stopEvent_))
+            break;
+    }
+
+    DisconnectNamedPipe(client.pipe);
+    CloseHandle(client.pipe);
+    client.finished = true;
+}
+
+scb::Bytes IpcServer::encode(std::vector<Item> const &items, bool response) {
+    size_t size = 2;
+    for (auto const &item : items)
+        size += (response ? 6 : 5) + item.data.size();
+
+    scb::Bytes payload(size);
+    size_t offset = 0;
+    put(payload, offset, static_cast<unsigned long>(items.size()), 2);
+    for (auto const &item : items) {
+        if (response)
+            payload[offset++] = item.failed ? 1 : 0;
+        payload[offset++] = item.kind;
+        put(payload, offset, static_cast<unsigned long>(item.data.size()), 4);
+        std::copy(item.data.begin(), item.data.end(), payload.begin() + offset);
+        offset += item.data.size();
+    }
+    return payload;
+}
+
+std::vector<IpcServer::Item> IpcServer::decode(scb::Bytes const &payload, bool response) {
+    size_t offset = 0;
+    std::vector<Item> items(get(payload, offset, 2));
+    for (auto &item : items) {
+        if (response)
+            item.failed = get(payload, offset, 1) != 0;
+        auto kind = get(payload, offset, 1);
+        if (kind != CommandLine && kind != RawApdu)
+            throw std::runtime_error("unknown IPC item kind");
+        item.kind = static_cast<Kind>(kind);
+        auto size = get(payload, offset, 4);
+        if (offset + size > payload.size())
+            throw std::runtime_error("truncated IPC frame");
+        item.data = payload.bytes(offset, size);
+        offset += size;
+    }
+    return items;
+}
+
+bool IpcServer::read_frame(HANDLE pipe, scb::Bytes &payload, HANDLE stop) {
+    auto read_exactly = [pipe, stop](unsigned char *data, size_t size) {
+        while (size > 0) {
+            DWORD read = 0;
+            if (!transfer(pipe, data, static_cast<DWORD>(size), read, false, stop) || read == 0)
+                return false;
+            data += read;
+            size -= read;
+        }
+        return true;
+    };
+
+    unsigned char header[4];
+    if (!read_exactly(header, sizeof(header)))
+        return false;
+    size_t size = header[0] | (header[1] << 8) | (header[2] << 16) | (static_cast<size_t>(header[3]) << 24);
+    if (size > (1 << 24))
+        return false;
+    payload = scb::Bytes(size);
+    return read_exactly(payload.data(), size);
+}
+
+bool IpcServer::write_frame(HANDLE pipe, scb::Bytes const &payload, HANDLE stop) {
+    // Header and payload in one write, so that small responses are a single pipe message
+    scb::Bytes frame(4 + payload.size());
+    size_t offset = 0;
+    put(frame, offset, static_cast<unsigned long>(payload.size()), 4);
+    std::copy(payload.begin(), payload.end(), frame.begin() + 4);
+
+    DWORD written = 0;
+    return transfer(pipe, frame.data(), static_cast<DWORD>(frame.size()), written, true, stop) && written == frame.size();
+}
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <rsc/Context.h>
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <Windows.h>
+
+#include <scb/Bytes.h>
+
+// Named pipe server driving shell sessions from test harnesses, one session with its own
+// shells and history per client. Only local clients of the user running the shell may connect.
+// Commands of all sessions using the same reader are serialized.
+//
+// Frames are a 32-bit little endian length followed by the payload, both ways:
+//   request:  u16 count, count x { u8 kind, u32 length, data }
+//             kind 1: command line (UTF-8), kind 2: raw APDU
+//   response: u16 count, count x { u8 status, u8 kind, u32 length, data }
+//             status 0: ok, 1: error; data is command output (UTF-8, records after "output json/cbor"),
+//             response APDU, or error message
+class IpcServer {
+public:
+    enum Kind : unsigned char {
+        CommandLine = 1,
+        RawApdu = 2,
+    };
+
+    struct Item {
+        Kind kind = CommandLine;
+        bool failed = false;
+        scb::Bytes data;
+    };
+
+    static constexpr wchar_t const *DefaultPipeName = L"\\\\.\\pipe\\rscsh";
+
+    IpcServer(rsc::Context const &context, std::wstring const &pipeName);
+    ~IpcServer();
+
+    IpcServer(IpcServer const&) = delete;
+    IpcServer& operator=(IpcServer const&) = delete;
+
+    inline std::wstring const& pipe_name() const noexcept { return pipeName_; }
+    size_t clients() const;
+    inline unsigned long long requests() const noexcept { return requests_; }
+    inline unsigned long long items() const noexcept { return items_; }
+
+    static scb::Bytes encode(std::vector<Item> const &items, bool response);
+    static std::vector<Item> decode(scb::Bytes const &payload, bool response);
+
+    // Blocking on a pipe opened without FILE_FLAG_OVERLAPPED, else overlapped and given up
+    // when the stop event is set.
+    static bool read_frame(HANDLE pipe, scb::Bytes &payload, HANDLE stop = NULL);
+    static bool write_frame(HANDLE pipe, scb::Bytes const &payload, HANDLE stop = NULL);
+
+private:
+    struct Client {
+        HANDLE pipe = INVALID_HANDLE_VALUE;
+        std::thread thread;
+        std::atomic<bool> finished{ false };
+    };
+
+    void accept();
+    void serve(Client &client);
+
+    rsc::Context const &context_;
+    std::wstring pipeName_;
+    PSECURITY_DESCRIPTOR security_;
+    HANDLE stopEvent_;                  // manual reset, set when the server stops
+    std::atomic<bool> stopping_{ false };
+    std::thread acceptThread_;
+
+    std::vector<std::unique_ptr<Client>> clients_;
+    mutable std::mutex clientsMutex_;
+
+    std::atomic<unsigned long long> requests_{ 0 };
+    std::atomic<unsigned long long> items_{ 0 };
+};
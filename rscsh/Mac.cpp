@@ -0,0 +1,163 @@
+#include "Mac.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+Mac::Mac(std::unique_ptr<BlockCipher> cipher)
+    : cipher_(std::move(cipher))
+    , blockSize_(cipher_->block_size())
+    , buffered_(0)
+{
+    std::fill(std::begin(icv_), std::end(icv_), 0);
+    reset();
+}
+
+void Mac::set_icv(scb::Bytes const &icv) {
+    if (icv.size() != blockSize_)
+        throw std::runtime_error("ICV size must be equal to block size");
+    std::copy(icv.begin(), icv.end(), icv_);
+    reset();
+}
+
+void Mac::reset() {
+    std::copy(icv_, icv_ + blockSize_, chain_);
+    buffered_ = 0;
+}
+
+void Mac::update(unsigned char const *data, size_t length) {
+    // The last block is always kept in buffer_, because finish() may need to treat it specially.
+    if (buffered_ > 0 && buffered_ < blockSize_) {
+        auto count = std::min(blockSize_ - buffered_, length);
+        std::copy(data, data + count, buffer_ + buffered_);
+        buffered_ += count;
+        data += count;
+        length -= count;
+    }
+    if (length == 0)
+        return;
+
+    if (buffered_ == blockSize_) {
+        chain(buffer_);
+        buffered_ = 0;
+    }
+
+    for (; length > blockSize_; data += blockSize_, length -= blockSize_)
+        chain(data);
+
+    std::copy(data, data + length, buffer_);
+    buffered_ = length;
+}
+
+void Mac::final(unsigned char *mac) {
+    finish(buffer_, buffered_);
+    std::copy(chain_, chain_ + blockSize_, mac);
+    reset();
+}
+
+scb::Bytes Mac::final() {
+    scb::Bytes mac(blockSize_);
+    final(mac.data());
+    return mac;
+}
+
+scb::Bytes Mac::compute(scb::Bytes const &data) {
+    reset();
+    update(data);
+    return final();
+}
+
+void Mac::chain(unsigned char const *block) {
+    for (size_t i = 0; i < blockSize_; i++)
+        chain_[i] ^= block[i];
+    cipher_->encrypt_block(chain_, chain_);
+}
+
+std::unique_ptr<Mac> Mac::create(std::wstring const &algorithm, scb::Bytes const &key) {
+    if (algorithm == L"retail")
+        return std::make_unique<RetailMac>(key);
+    else if (algorithm == L"des-cbc")
+        return std::make_unique<CbcMac>(BlockCipher::des(key));
+    else if (algorithm == L"aes-cbc")
+        return std::make_unique<CbcMac>(BlockCipher::aes(key));
+    else if (algorithm == L"des-cmac")
+        return std::make_unique<Cmac>(BlockCipher::des(key));
+    else if (algorithm == L"aes-cmac")
+        return std::make_unique<Cmac>(BlockCipher::aes(key));
+    throw std::runtime_error("unknown MAC algorithm");
+}
+
+CbcMac::CbcMac(std::unique_ptr<BlockCipher> cipher, Padding padding)
+    : Mac(std::move(cipher))
+    , padding_(padding)
+{}
+
+void CbcMac::finish(unsigned char *block, size_t length) {
+    switch (padding_) {
+        case NoPadding:
+            if (length != blockSize_)
+                throw std::runtime_error("data length is not a multiple of block size");
+            break;
+        case Method1:
+            std::fill(block + length, block + blockSize_, 0);
+            break;
+        case Method2:
+            if (length == blockSize_) {
+                chain(block);
+                length = 0;
+            }
+            block[length] = 0x80;
+            std::fill(block + length + 1, block + blockSize_, 0);
+            break;
+    }
+    chain_last(block);
+}
+
+void CbcMac::chain_last(unsigned char const *block) {
+    chain(block);
+}
+
+RetailMac::RetailMac(scb::Bytes const &key, Padding padding)
+    : CbcMac(BlockCipher::des(key.left(8)), padding)
+    , last_(key)
+{
+    if (key.size() != 16 && key.size() != 24)
+        throw std::runtime_error("retail MAC key must be 16 or 24 bytes long");
+}
+
+void RetailMac::chain_last(unsigned char const *block) {
+    for (size_t i = 0; i < blockSize_; i++)
+        chain_[i] ^= block[i];
+    last_.encrypt_block(chain_, chain_);
+}
+
+Cmac::Cmac(std::unique_ptr<BlockCipher> cipher)
+    : Mac(std::move(cipher))
+{
+    unsigned char const rb = blockSize_ == 16 ? 0x87 : 0x1B;
+
+    auto dbl = [this, rb](unsigned char const *in, unsigned char *out) {
+        unsigned char carry = in[0] >> 7;
+        for (size_t i = 0; i < blockSize_ - 1; i++)
+            out[i] = static_cast<unsigned char>((in[i] << 1) | (in[i + 1] >> 7));
+        out[blockSize_ - 1] = static_cast<unsigned char>(in[blockSize_ - 1] << 1);
+        if (carry)
+            out[blockSize_ - 1] ^= rb;
+    };
+
+    unsigned char l[16] = {};
+    cipher_->encrypt_block(l, l);
+    dbl(l, k1_);
+    dbl(k1_, k2_);
+}
+
+void Cmac::finish(unsigned char *block, size_t length) {
+    unsigned char const *subkey = k1_;
+    if (length < blockSize_) {
+        block[length] = 0x80;
+        std::fill(block + length + 1, block + blockSize_, 0);
+        subkey = k2_;
+    }
+    for (size_t i = 0; i < blockSize_; i++)
+        block[i] ^= subkey[i];
+    chain(block);
+}
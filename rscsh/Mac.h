@@ -0,0 +1,92 @@
+#pragma once
+
+#include "BlockCipher.h"
+
+#include <memory>
+#include <string>
+
+#include <scb/Bytes.h>
+
+// Streaming MAC context.
+// Data can be fed chunk by chunk with update(), final() returns the MAC and
+// restarts the context from its ICV, so one context serves many messages
+// without expanding the key again.
+class Mac {
+public:
+    enum Padding {
+        NoPadding,
+        Method1,    // ISO/IEC 9797-1 padding method 1: zeros
+        Method2,    // ISO/IEC 9797-1 padding method 2: 80 followed by zeros
+    };
+
+    Mac(std::unique_ptr<BlockCipher> cipher);
+    Mac(Mac const &other) = delete;
+    Mac& operator=(Mac const &other) = delete;
+    virtual ~Mac() = default;
+
+    inline size_t size() const noexcept { return blockSize_; }
+    inline BlockCipher const& cipher() const noexcept { return *cipher_; }
+
+    void set_icv(scb::Bytes const &icv);
+    void reset();
+
+    void update(unsigned char const *data, size_t length);
+    inline void update(scb::Bytes const &data) { update(data.data(), data.size()); }
+
+    // Writes size() bytes of MAC to `mac` and resets the context.
+    void final(unsigned char *mac);
+    scb::Bytes final();
+
+    scb::Bytes compute(scb::Bytes const &data);
+
+    // retail (ISO 9797-1 algorithm 3), des-cbc / aes-cbc (algorithm 1), des-cmac / aes-cmac (NIST SP 800-38B)
+    static std::unique_ptr<Mac> create(std::wstring const &algorithm, scb::Bytes const &key);
+
+protected:
+    // Called with the last 0..size() bytes of the message.
+    virtual void finish(unsigned char *block, size_t length) = 0;
+
+    void chain(unsigned char const *block);
+
+    std::unique_ptr<BlockCipher> cipher_;
+    size_t blockSize_;
+    size_t buffered_;
+    unsigned char icv_[16];
+    unsigned char chain_[16];
+    unsigned char buffer_[16];
+};
+
+// ISO/IEC 9797-1 MAC algorithm 1 (CBC-MAC).
+class CbcMac : public Mac {
+public:
+    CbcMac(std::unique_ptr<BlockCipher> cipher, Padding padding = Method2);
+
+protected:
+    void finish(unsigned char *block, size_t length) override;
+    virtual void chain_last(unsigned char const *block);
+
+    Padding padding_;
+};
+
+// ISO/IEC 9797-1 MAC algorithm 3 (retail MAC): single DES chaining, 3DES on the last block.
+class RetailMac : public CbcMac {
+public:
+    RetailMac(scb::Bytes const &key, Padding padding = Method2);
+
+protected:
+    void chain_last(unsigned char const *block) override;
+
+    DesCipher last_;
+};
+
+// NIST SP 800-38B CMAC, subkeys are derived once at construction.
+class Cmac : public Mac {
+public:
+    Cmac(std::unique_ptr<BlockCipher> cipher);
+
+protected:
+    void finish(unsigned char *block, size_t length) override;
+
+    unsigned char k1_[16];
+    unsigned char k2_[16];
+};
@@ -1,10 +1,17 @@
 #include "MainShell.h"
 
 #include <sstream>
+#include <filesystem>
+#include <fstream>
 #include <iterator>
 #include <algorithm>
+#include <chrono>
+#include <cwctype>
 #include <thread>
 
+#include "CoreBenchmarks.h"
+#include "RsaKey.h"
+
 #include "version.ver"
 
 std::unordered_map<std::wstring, void (MainShell::*)(std::vector<std::wstring> const &)> const MainShell::command_map_{
@@ -19,49 +26,94 @@ std::unordered_map<std::wstring, std::wstring> const MainShell::help_map_{
 #undef X
 };
 
-MainShell::MainShell(std::wostringstream &execution_yield, FunctionEnd const &end)
+MainShell::MainShell(std::ostringstream &execution_yield, FunctionEnd const &end)
     : Shell(execution_yield)
     , end_(end)
     , cardShell_(execution_yield)
     , cryptoShell_(execution_yield)
-{}
-
-void MainShell::execute(LPCTSTR args) {
-    execution_yield_ << args << "\r\n";
+{
+    set_history(&responseHistory_);
+    cardShell_.set_history(&responseHistory_);
+    cryptoShell_.set_history(&responseHistory_);
+    set_emitter(&recordEmitter_);
+    cardShell_.set_emitter(&recordEmitter_);
+    cryptoShell_.set_emitter(&recordEmitter_);
+    set_arena(&commandArena_);
+    cardShell_.set_arena(&commandArena_);
+    cryptoShell_.set_arena(&commandArena_);
+    set_profiler(&commandProfiler_);
+    cardShell_.set_profiler(&commandProfiler_);
+    cryptoShell_.set_profiler(&commandProfiler_);
+}
 
-    std::wistringstream cmd_stream(args);
-    std::vector<std::wstring> argv{
-        std::istream_iterator<std::wstring, wchar_t>(cmd_stream),
-        std::istream_iterator<std::wstring, wchar_t>()
-    };
+void MainShell::execute(LPCTSTR args, bool echo) {
+    commandProfiler_.begin_command(args);
+    if (echo)
+        execution_yield_ << utf8(args) << "\r\n";
 
-    for (auto &arg : argv)
-        std::transform(arg.begin(), arg.end(), arg.begin(), ::tolower);
+    // Tokenized in place, so that the token strings keep their buffers from the previous command
+    {
+        Profiler::Scope scope(&commandProfiler_, Profiler::Phase::Tokenize);
+        tokenize(args, argv_);
+        lowercase_command(argv_);
+    }
 
-    execute(argv);
+    execute(argv_);
 }
 
-void MainShell::execute(std::vector<std::wstring> const argv) {
+void MainShell::execute(std::vector<std::wstring> const &argv) {
     if (argv.empty()) {
         end_();
         return;
     }
 
+    // Also when the command switches to typed records
+    recordEmitter_.capture_text(&execution_yield_, execution_yield_.tellp());
+    auto allocations = thread_allocations();
+    auto finish = [&] {
+        lastAllocations_ = thread_allocations() - allocations;
+        lastArenaBytes_ = commandArena_.used();
+        commandArena_.reset();
+        emit_records();
+    };
+    try {
+        dispatch(argv);
+    } catch (...) {
+        finish();
+        throw;
+    }
+    finish();
+
+    end_();
+}
+
+void MainShell::dispatch(std::vector<std::wstring> const &argv) {
+    Profiler::Scope scope(&commandProfiler_, Profiler::Phase::Dispatch);
     if (auto cmd = command_map_.find(argv[0]); cmd != command_map_.end()) {
         (this->*cmd->second)(argv);
-    } else if (argv[0] == L"crypto") {
+    } else if (is_keyword(argv[0], L"crypto")) {
         cryptoShell_.execute(argv);
     } else {
         cardShell_.execute(argv);
     }
+}
+
+void MainShell::emit_records() {
+    if (!recordEmitter_.structured()) {
+        recordEmitter_.capture_text(nullptr);
+        return;
+    }
 
-    end_();
+    Profiler::Scope scope(&commandProfiler_, Profiler::Phase::Format);
+    recordEmitter_.take_text();
+    recordEmitter_.capture_text(nullptr);
+    recordEmitter_.flush(execution_yield_);
 }
 
 void MainShell::help(std::vector<std::wstring> const&) {
     execution_yield_ << "Main Shell Help:\r\n";
     for (auto const& [cmd, help] : help_map_) {
-        execution_yield_ << "\r\n" << cmd << ' ' << help << "\r\n";
+        execution_yield_ << "\r\n" << utf8(cmd) << ' ' << utf8(help) << "\r\n";
     }
     execution_yield_ << "\r\n";
 
@@ -79,3 +131,547 @@ void MainShell::exit(std::vector<std::wstring> const&) {
 void MainShell::version(std::vector<std::wstring> const&) {
     execution_yield_ << VERSION << "\r\n";
 }
+
+void MainShell::history(std::vector<std::wstring> const &argv) {
+    size_t count = 10;
+    if (argv.size() == 3 && is_keyword(argv[1], L"budget")) {
+        responseHistory_.set_budget(std::stoul(argv[2]));
+    } else if (argv.size() == 2 && is_keyword(argv[1], L"clear")) {
+        responseHistory_.clear();
+    } else if (argv.size() == 2 && iswdigit(argv[1][0])) {
+        count = std::stoul(argv[1]);
+    } else if (argv.size() != 1) {
+        execution_yield_ << "usage: history [<count> / budget <bytes> / clear]\r\n";
+        return;
+    }
+
+    execution_yield_
+        << responseHistory_.size() << " exchanges, " << responseHistory_.used() << " of "
+        << responseHistory_.budget() << " bytes\r\n";
+    for (size_t n = 1; n <= std::min(count, responseHistory_.size()); n++) {
+        auto exchange = responseHistory_.at(n);
+        execution_yield_ << '$' << n << " < " << hex_bytes(exchange->command, " ")
+            << "\r\n" << std::string(std::to_string(n).size() + 1, ' ') << " > " << hex_bytes(exchange->response, " ") << "\r\n";
+    }
+}
+
+Script::Handler MainShell::resolve_command(std::vector<std::wstring> const &argv) {
+    if (auto cmd = command_map_.find(argv[0]); cmd != command_map_.end())
+        return [this, command = cmd->second](std::vector<std::wstring> const &args) { (this->*command)(args); };
+
+    if (is_keyword(argv[0], L"crypto")) {
+        auto command = argv.size() > 1 ? CryptoShell::find_command(lowercase(argv[1])) : nullptr;
+        if (!command)
+            return {};
+        return [this, command](std::vector<std::wstring> const &args) { cryptoShell_.invoke(command, args); };
+    }
+
+    auto command = CardShell::find_command(argv[0]);
+    if (!command)
+        return {};
+    return [this, command](std::vector<std::wstring> const &args) { cardShell_.invoke(command, args); };
+}
+
+Script MainShell::compile_script(std::wstring const &path) {
+    std::wifstream file(std::filesystem::path{ path });
+    if (!file)
+        throw std::runtime_error("cannot open script file");
+    return Script::compile(file, [this](std::vector<std::wstring> const &argv) { return resolve_command(argv); });
+}
+
+void MainShell::script(std::vector<std::wstring> const &argv) {
+    if (argv.size() == 2 || (argv.size() == 3 && is_keyword(argv[1], L"run"))) {
+        compile_script(argv.back()).run(responseHistory_, execution_yield_);
+    } else if (argv.size() == 3 && is_keyword(argv[1], L"dump")) {
+        compile_script(argv[2]).disassemble(execution_yield_);
+    } else if (argv.size() == 4 && is_keyword(argv[1], L"bench")) {
+        auto count = std::stoul(argv[3]);
+        if (count == 0)
+            throw std::runtime_error("count must be positive");
+
+        // Compiling every time is what a line by line interpreter pays for tokenizing and command lookup
+        auto start = std::chrono::steady_clock::now();
+        for (unsigned long i = 1; i < count; i++)
+            compile_script(argv[2]);
+        auto script = compile_script(argv[2]);
+        auto compiled = std::chrono::steady_clock::now();
+
+        unsigned long long instructions = 0;
+        for (unsigned long i = 0; i < count; i++)
+            instructions += script.run(responseHistory_, execution_yield_);
+        auto finished = std::chrono::steady_clock::now();
+
+        auto compileUs = std::chrono::duration<double, std::micro>(compiled - start).count() / count;
+        auto runUs = std::chrono::duration<double, std::micro>(finished - compiled).count() / count;
+        execution_yield_
+            << script.size() << " instructions, " << instructions / count << " executed per run\r\n"
+            << "Compile: " << compileUs << " us, run: " << runUs << " us, "
+            << runUs * 1000 * count / instructions << " ns/instruction\r\n";
+    } else {
+        execution_yield_ << "usage: script [run / dump] <file> / bench <file> <count>\r\n";
+    }
+}
+
+void MainShell::server(std::vector<std::wstring> const &argv) {
+    if (argv.size() >= 2 && argv.size() <= 3 && is_keyword(argv[1], L"start")) {
+        if (server_)
+            throw std::runtime_error("server is already running");
+        if (!cardShell_.context_established())
+            throw std::runtime_error("smart card context is not established");
+        server_ = std::make_unique<IpcServer>(cardShell_.context(), argv.size() == 3 ? argv[2] : IpcServer::DefaultPipeName);
+    } else if (argv.size() == 2 && is_keyword(argv[1], L"stop")) {
+        server_.reset();
+    } else if (argv.size() >= 3 && argv.size() <= 4 && is_keyword(argv[1], L"bench")) {
+        auto count = std::stoul(argv[2]);
+        auto batch = argv.size() == 4 ? std::stoul(argv[3]) : 1ul;
+        if (count == 0 || batch == 0 || batch > 0xFFFF)
+            throw std::runtime_error("count and batch size must be positive");
+
+        // The benchmark talks to a temporary server when none is running
+        std::unique_ptr<IpcServer> temporary;
+        if (!server_) {
+            if (!cardShell_.context_established())
+                throw std::runtime_error("smart card context is not established");
+            temporary = std::make_unique<IpcServer>(cardShell_.context(), std::wstring(IpcServer::DefaultPipeName) + L"-bench");
+        }
+        server_bench((server_ ? server_ : temporary)->pipe_name(), count, batch);
+        return;
+    } else if (argv.size() != 1) {
+        execution_yield_ << "usage: server [start [pipe name] / stop / bench <count> [batch size]]\r\n";
+        return;
+    }
+
+    if (server_) {
+        execution_yield_
+            << "Server listening on " << utf8(server_->pipe_name()) << ", " << server_->clients() << " clients, "
+            << server_->requests() << " requests, " << server_->items() << " items\r\n";
+    } else {
+        execution_yield_ << "Server is not running\r\n";
+    }
+}
+
+void MainShell::server_bench(std::wstring const &pipeName, unsigned long count, unsigned long batch) {
+    if (!WaitNamedPipeW(pipeName.c_str(), 5000))
+        throw std::runtime_error("server pipe is not available");
+    HANDLE pipe = CreateFileW(pipeName.c_str(), GENERIC_READ | GENERIC_WRITE, 0, NULL, OPEN_EXISTING, 0, NULL);
+    if (pipe == INVALID_HANDLE_VALUE)
+        throw std::runtime_error("cannot connect to server pipe");
+
+    // Small requests: `version` command lines, answered without touching the card
+    std::vector<IpcServer::Item> items(batch);
+    for (auto &item : items)
+        item.data = scb::Bytes(L"version", scb::Bytes::ASCII);
+    auto request = IpcServer::encode(items, false);
+
+    std::vector<double> latencies;
+    latencies.reserve(count);
+    scb::Bytes response;
+    auto start = std::chrono::steady_clock::now();
+    for (unsigned long i = 0; i < count; i++) {
+        auto sent = std::chrono::steady_clock::now();
+        if (!IpcServer::write_frame(pipe, request) || !IpcServer::read_frame(pipe, response)) {
+            CloseHandle(pipe);
+            throw std::runtime_error("server connection lost");
+        }
+        latencies.push_back(std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - sent).count());
+    }
+    auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    CloseHandle(pipe);
+
+    if (IpcServer::decode(response, true).size() != batch)
+        throw std::runtime_error("unexpected server response");
+
+    std::sort(latencies.begin(), latencies.end());
+    auto percentile = [&](double p) { return latencies[static_cast<size_t>(p * (latencies.size() - 1))]; };
+    execution_yield_
+        << count << " requests of " << batch << " commands, " << count / elapsed << " requests/s, "
+        << count * batch / elapsed << " commands/s\r\n"
+        << "Latency: p50 " << percentile(0.5) << " us, p99 " << percentile(0.99) << " us, max " << latencies.back() << " us\r\n";
+}
+
+void MainShell::output(std::vector<std::wstring> const &argv) {
+    if (argv.size() == 2 && is_keyword(argv[1], L"text")) {
+        recordEmitter_.set_format(Emitter::Format::Text);
+    } else if (argv.size() == 2 && is_keyword(argv[1], L"json")) {
+        recordEmitter_.set_format(Emitter::Format::Json);
+    } else if (argv.size() == 2 && is_keyword(argv[1], L"cbor")) {
+        recordEmitter_.set_format(Emitter::Format::Cbor);
+    } else if (argv.size() == 3 && is_keyword(argv[1], L"bench")) {
+        output_bench(std::stoul(argv[2]));
+    } else {
+        execution_yield_ << "usage: output text/json/cbor / bench <count>\r\n";
+    }
+}
+
+void MainShell::output_bench(unsigned long count) {
+    if (count == 0)
+        throw std::runtime_error("count must be positive");
+
+    // SELECT of a payment application and its FCI, the most common exchange in the logs
+    scb::Bytes command(L"00a4040007a000000003101000");
+    scb::Bytes response(L"6f1e8407a0000000031010a513500b56495341204352454449549f38039f1a029000");
+
+    // Same formatting as CardShell::transmit, into a UTF-16 stream as the shell output was and into the UTF-8 one
+    auto text_time = [&](auto &text, auto print, unsigned long count) {
+        text.str({});
+        auto start = std::chrono::steady_clock::now();
+        for (unsigned long i = 0; i < count; i++) {
+            text << "< ";
+            print(text, command);
+            text << "\r\n> ";
+            print(text, response);
+            text << "\r\n";
+            if (i % 1024 == 1023) {
+                text.str({});
+                text.clear();
+            }
+        }
+        return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / count;
+    };
+    auto printWide = [](std::wostream &text, scb::Bytes const &bytes) { bytes.print(text, L" "); };
+    auto printUtf8 = [](std::ostream &text, scb::Bytes const &bytes) { text << hex_bytes(bytes, " "); };
+    std::wostringstream wide;
+    std::ostringstream utf8Text;
+    auto wideTime = text_time(wide, printWide, count);
+    auto textTime = text_time(utf8Text, printUtf8, count);
+
+    // Buffer bytes of one exchange
+    text_time(wide, printWide, 1);
+    text_time(utf8Text, printUtf8, 1);
+    auto wideBytes = wide.str().size() * sizeof(wchar_t);
+    auto textBytes = utf8Text.str().size();
+
+    auto structured_time = [&](Emitter::Format format) {
+        Emitter emitter;
+        emitter.set_format(format);
+        auto start = std::chrono::steady_clock::now();
+        for (unsigned long i = 0; i < count; i++) {
+            emitter.exchange(command, response);
+            if (i % 1024 == 1023)
+                emitter.clear();
+        }
+        return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / count;
+    };
+    auto jsonTime = structured_time(Emitter::Format::Json);
+    auto cborTime = structured_time(Emitter::Format::Cbor);
+
+    execution_yield_
+        << "utf-16 text: " << wideTime << " ns/exchange, " << wideBytes << " bytes\r\n"
+        << "text: " << textTime << " ns/exchange, " << textBytes << " bytes (" << wideTime / textTime << "x)\r\n"
+        << "json: " << jsonTime << " ns/exchange (" << textTime / jsonTime << "x)\r\n"
+        << "cbor: " << cborTime << " ns/exchange (" << textTime / cborTime << "x)\r\n";
+}
+
+void MainShell::alloc(std::vector<std::wstring> const &argv) {
+    if (argv.size() >= 4 && is_keyword(argv[1], L"bench")) {
+        std::vector<std::wstring> command(argv.begin() + 3, argv.end());
+        lowercase_command(command);
+        alloc_bench(std::stoul(argv[2]), command);
+    } else if (argv.size() == 1) {
+        execution_yield_
+            << "Last command: " << lastAllocations_.count << " heap allocations, " << lastAllocations_.bytes << " bytes, "
+            << lastArenaBytes_ << " bytes from the command arena (most " << commandArena_.high_water() << ")\r\n";
+    } else {
+        execution_yield_ << "usage: alloc [bench <count> <command line>]\r\n";
+    }
+}
+
+void MainShell::alloc_bench(unsigned long count, std::vector<std::wstring> const &argv) {
+    if (count < 2)
+        throw std::runtime_error("count must be at least 2");
+    if (is_keyword(argv[0], L"alloc") || is_keyword(argv[0], L"script"))
+        throw std::runtime_error("command cannot be measured");
+
+    // Output of the runs is overwritten in place, the stream keeps its buffer after the first run
+    auto start = execution_yield_.tellp();
+    AllocationCount first, steady;
+    for (unsigned long i = 0; i < count; i++) {
+        auto before = thread_allocations();
+        dispatch(argv);
+        commandArena_.reset();
+        auto used = thread_allocations() - before;
+        if (i == 0)
+            first = used;
+        else
+            steady = steady + used;
+        execution_yield_.seekp(start);
+    }
+    auto all = execution_yield_.str();
+    execution_yield_.str(all.substr(0, static_cast<size_t>(start)));
+    execution_yield_.seekp(0, std::ios::end);
+
+    execution_yield_
+        << "First run: " << first.count << " allocations, " << first.bytes << " bytes\r\n"
+        << "Following runs: " << static_cast<double>(steady.count) / (count - 1) << " allocations, "
+        << static_cast<double>(steady.bytes) / (count - 1) << " bytes per run\r\n";
+}
+
+void MainShell::profile(std::vector<std::wstring> const &argv) {
+    if (argv.size() == 2 && is_keyword(argv[1], L"on")) {
+        commandProfiler_.set_enabled(true);
+    } else if (argv.size() == 2 && is_keyword(argv[1], L"off")) {
+        commandProfiler_.set_enabled(false);
+    } else if (argv.size() == 2 && is_keyword(argv[1], L"clear")) {
+        commandProfiler_.clear();
+    } else if (argv.size() == 3 && is_keyword(argv[1], L"export")) {
+        commandProfiler_.export_trace(argv[2]);
+        execution_yield_ << "Trace written to " << utf8(argv[2]) << "\r\n";
+    } else if (argv.size() == 1) {
+        commandProfiler_.print_summary(execution_yield_);
+    } else {
+        execution_yield_ << "usage: profile [on / off / clear / export <trace file>]\r\n";
+    }
+}
+
+void MainShell::bench(std::vector<std::wstring> const &argv) {
+    std::wstring filter, jsonPath, baselinePath;
+    double tolerance = 0.1;
+    for (size_t i = 1; i < argv.size(); i++) {
+        if (is_keyword(argv[i], L"json") && i + 1 < argv.size()) {
+            jsonPath = argv[++i];
+        } else if (is_keyword(argv[i], L"baseline") && i + 1 < argv.size()) {
+            baselinePath = argv[++i];
+        } else if (is_keyword(argv[i], L"tolerance") && i + 1 < argv.size()) {
+            tolerance = std::stod(argv[++i]) / 100;
+        } else if (filter.empty()) {
+            filter = lowercase(argv[i]);
+        } else {
+            execution_yield_ << "usage: bench [<filter>] [json <file>] [baseline <file> [tolerance <percent>]]\r\n";
+            return;
+        }
+    }
+    if (tolerance < 0)
+        throw std::runtime_error("tolerance must not be negative");
+
+    std::map<std::string, double> baseline;
+    if (!baselinePath.empty())
+        baseline = BenchSuite::read_baseline(baselinePath);
+
+    // Session of its own as for a server client, so that the simulated card, history and output of
+    // the benchmarks leave the card connection and output of this shell alone
+    std::ostringstream output;
+    MainShell session(output, [] {});
+    BenchSuite suite;
+    add_benchmarks(suite, session, output);
+
+    auto results = suite.run(to_utf8(filter));
+    if (results.empty())
+        throw std::runtime_error("no benchmark matches the filter");
+
+    BenchSuite::print(execution_yield_, results, baselinePath.empty() ? nullptr : &baseline, tolerance);
+    if (!jsonPath.empty()) {
+        BenchSuite::write_json(jsonPath, results);
+        execution_yield_ << "Results written to " << utf8(jsonPath) << "\r\n";
+    }
+    if (!baselinePath.empty()) {
+        // Fails the command, so that scripts and server clients see the regression
+        auto slower = BenchSuite::regressions(results, baseline, tolerance);
+        if (!slower.empty())
+            throw std::runtime_error(std::to_string(slower.size()) + " benchmarks are slower than the baseline by more than " + std::to_string(tolerance * 100) + "%");
+    }
+}
+
+static std::wstring hex_text(scb::Bytes const &bytes) {
+    std::ostringstream text;
+    text << hex_bytes(bytes);
+    auto hex = text.str();
+    return std::wstring(hex.begin(), hex.end());
+}
+
+void MainShell::add_benchmarks(BenchSuite &suite, MainShell &session, std::ostringstream &output) {
+    // Code below the shell, as measured by the standalone benchmark
+    add_core_benchmarks(suite);
+
+    // Output of an iteration is overwritten by the next one, the stream keeps its buffer
+    auto run = [&session, &output](std::wstring const &line) {
+        session.execute(line.c_str(), false);
+        output.seekp(0);
+    };
+    // A command line which only prints its usage would be measured as a fast benchmark
+    auto check = [&session, &output](std::wstring const &line) {
+        output.seekp(0);
+        session.execute(line.c_str(), false);
+        auto written = output.str().substr(0, static_cast<size_t>(output.tellp()));
+        output.seekp(0);
+        if (written.find("usage:") != std::string::npos)
+            throw std::runtime_error("benchmark command is not valid: " + to_utf8(line));
+    };
+    auto command = [&](std::string name, std::wstring line, std::vector<std::wstring> setup = {}) {
+        suite.add(std::move(name), [run, line] { run(line); }, [check, line, setup] {
+            for (auto const &step : setup)
+                check(step);
+            check(line);
+        });
+    };
+
+    // 256 bytes 00 to FF as hex
+    std::wstring buffer;
+    for (int i = 0; i < 256; i++) {
+        buffer += L"0123456789abcdef"[i >> 4];
+        buffer += L"0123456789abcdef"[i & 0x0F];
+    }
+
+    command("shell/execute", L"version");
+
+    auto tokens = std::make_shared<std::vector<std::wstring>>();
+    for (size_t i = 0; i < buffer.size(); i += 64)
+        tokens->push_back(buffer.substr(i, 64));
+    suite.add("hex/decode", [&session, tokens] {
+        session.hex_arguments(tokens->begin(), tokens->end());
+        session.commandArena_.reset();
+    });
+    auto text = std::make_shared<std::ostringstream>();
+    auto bytes = std::make_shared<scb::Bytes>(buffer);
+    suite.add("hex/encode", [text, bytes] {
+        *text << hex_bytes(*bytes, " ");
+        text->seekp(0);
+    });
+
+    // READ RECORD response of a payment application, with nested templates
+    command("parse/tlv",
+        L"parse 7081a457134761739001010010d22122011143804400000f5f200f43415244484f4c4445522f564953419f1f0e3030303030303030303030303030"
+        L"8c159f02069f03069f1a0295055f2a029a039c019f37048d178a029f02069f03069f1a0295055f2a029a039c019f37045f24032212315a0847617390010100105f3401018e0e"
+        L"000000000000000042031e031f009f0702ff00bf0c109f4d020b0a9f6e0808400000303000009000");
+    command("parse/atr", L"parse atr 3b8f8001804f0ca000000306030001000000006a");
+
+    auto des = std::wstring(L"0123456789abcdeffedcba9876543210"), aes = std::wstring(L"000102030405060708090a0b0c0d0e0f");
+    command("crypto/sha1", L"crypto sha 1 hex " + buffer);
+    command("crypto/sha256", L"crypto sha 256 hex " + buffer);
+    command("crypto/sha512", L"crypto sha 512 hex " + buffer);
+    command("crypto/des-ecb", L"crypto des encrypt ecb " + des + L" hex " + buffer);
+    command("crypto/des-cbc", L"crypto des encrypt cbc 0000000000000000 " + des + L" hex " + buffer);
+    command("crypto/des-kcv", L"crypto des-kcv " + des);
+    command("crypto/aes-ecb", L"crypto aes encrypt ecb " + aes + L" hex " + buffer);
+    command("crypto/aes-cbc", L"crypto aes encrypt cbc 00000000000000000000000000000000 " + aes + L" hex " + buffer);
+    command("crypto/aes-kcv", L"crypto aes-kcv " + aes);
+    for (auto algorithm : { L"retail", L"des-cbc", L"des-cmac" })
+        command("crypto/mac-" + to_utf8(algorithm), L"crypto mac " + std::wstring(algorithm) + L" " + des + L" hex " + buffer);
+    for (auto algorithm : { L"aes-cbc", L"aes-cmac" })
+        command("crypto/mac-" + to_utf8(algorithm), L"crypto mac " + std::wstring(algorithm) + L" " + aes + L" hex " + buffer);
+
+    // Key generated once, when an RSA benchmark is selected
+    auto rsa = std::make_shared<std::vector<std::wstring>>();
+    auto rsaLine = [rsa](bool crt) {
+        if (rsa->empty()) {
+            auto key = RsaKey::generate(2048, scb::Bytes(L"010001"));
+            auto input = std::wstring(L"00") + std::wstring(2 * (key.size() - 1), L'5');
+            rsa->push_back(L"crypto rsa " + hex_text(key.modulus()) + L" " + hex_text(key.public_exponent()) + L" hex " + input);
+            rsa->push_back(L"crypto rsa crt " + hex_text(key.p()) + L" " + hex_text(key.q()) + L" " + hex_text(key.dp()) + L" "
+                + hex_text(key.dq()) + L" " + hex_text(key.qinv()) + L" hex " + input);
+        }
+        return (*rsa)[crt ? 1 : 0];
+    };
+    for (auto crt : { false, true }) {
+        auto line = std::make_shared<std::wstring>();
+        suite.add(crt ? "crypto/rsa-crt" : "crypto/rsa-public", [run, line] { run(*line); }, [check, rsaLine, line, crt] {
+            *line = rsaLine(crt);
+            check(*line);
+        });
+    }
+
+    auto emv = std::wstring(L" des " + des + L" 4761739001010010 01 0001");
+    command("crypto/emv-derive", L"crypto emv derive" + emv);
+    command("crypto/emv-arqc", L"crypto emv arqc" + emv + L" 000000001000000000000000084000000000000840230101003c2a6b9e5800");
+    command("crypto/emv-arpc", L"crypto emv arpc" + emv + L" 1122334455667788 3030");
+
+    // Round trips with the simulated card, through the transmit path of the shell
+    std::vector<std::wstring> plain{ L"sim on", L"scp close" };
+    command("apdu/raw", L"raw 80ca9f7f00", plain);
+    command("apdu/apdu", L"apdu 80 ca 9f 7f 00", plain);
+    command("apdu/select", L"select a000000151000000", plain);
+    command("apdu/scp03", L"apdu 80 ca 9f 7f 00", { L"sim on", L"scp open" });
+}
+
+void MainShell::diff_run(std::vector<std::wstring> const &argv) {
+    if (argv.size() < 4) {
+    usage:
+        execution_yield_ << "usage: diff-run <reader a> <reader b> <script> [mask <tag(9f36) / [5..13] / ae:tag(9f26) / emv>]... [continue]\r\n";
+        return;
+    }
+
+    std::vector<DiffRun::Mask> masks;
+    bool stopAtFirst = true;
+    for (size_t i = 4; i < argv.size(); i++) {
+        if (is_keyword(argv[i], L"mask") && i + 1 < argv.size()) {
+            if (is_keyword(argv[++i], L"emv")) {
+                auto emv = DiffRun::emv_masks();
+                masks.insert(masks.end(), emv.begin(), emv.end());
+            } else {
+                masks.push_back(DiffRun::parse_mask(argv[i]));
+            }
+        } else if (is_keyword(argv[i], L"continue")) {
+            stopAtFirst = false;
+        } else {
+            goto usage;
+        }
+    }
+    if (argv[1] == argv[2] && !is_keyword(argv[1], L"sim"))
+        throw std::runtime_error("readers must differ");
+
+    // A session per card as for server clients, with its own connection, history and secure channel
+    std::ostringstream output[2];
+    std::unique_ptr<MainShell> sessions[2];
+    std::vector<Script> scripts;
+    for (unsigned side = 0; side < 2; side++) {
+        auto &session = sessions[side];
+        session = std::make_unique<MainShell>(output[side], [] {});
+        auto &card = session->card_shell();
+        if (is_keyword(argv[1 + side], L"sim")) {
+            card.invoke(CardShell::find_command(L"sim"), { L"sim", L"on" });
+        } else {
+            if (!cardShell_.context_established())
+                throw std::runtime_error("smart card context is not established");
+            card.set_context(cardShell_.context());
+            card.invoke(CardShell::find_command(L"connect"), { L"connect", argv[1 + side] });
+        }
+        scripts.push_back(session->compile_script(argv[3]));
+    }
+
+    DiffRun diff(std::move(masks), stopAtFirst);
+    std::string errors[2];
+    auto run = [&](unsigned side) {
+        sessions[side]->card_shell().set_exchange_observer([&diff, side](scb::Bytes const &command, scb::Bytes const &response) {
+            diff.exchange(side, command, response);
+        });
+        try {
+            scripts[side].run(sessions[side]->responseHistory_, output[side]);
+        } catch (DiffRun::Stopped const&) {
+        } catch (std::exception const &e) {
+            errors[side] = e.what();
+        }
+        diff.finish(side);
+    };
+
+    auto start = std::chrono::steady_clock::now();
+    std::thread cardA(run, 0);
+    run(1);
+    cardA.join();
+    auto elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+    static char const *const names[] = { "A", "B" };
+    for (auto const &divergence : diff.divergences()) {
+        execution_yield_ << "Exchange " << divergence.exchange << " differs";
+        for (unsigned side = 0; side < 2; side++) {
+            if (divergence.ended[side])
+                execution_yield_ << ", script on card " << names[side] << " ended";
+        }
+        execution_yield_ << ":\r\n";
+        bool sameCommand = divergence.command[0] == divergence.command[1];
+        for (unsigned side = 0; side < 2; side++) {
+            if (divergence.ended[side])
+                continue;
+            if (side == 0 || !sameCommand || divergence.ended[0])
+                execution_yield_ << names[side] << " < " << hex_bytes(divergence.command[side], " ") << "\r\n";
+            execution_yield_ << names[side] << " > " << hex_bytes(divergence.response[side], " ") << "\r\n";
+        }
+    }
+    for (unsigned side = 0; side < 2; side++) {
+        if (!errors[side].empty())
+            execution_yield_ << "Card " << names[side] << ": " << errors[side] << "\r\n";
+    }
+
+    execution_yield_
+        << diff.exchanges() << " exchanges compared, " << diff.divergences().size() << " divergences"
+        << (stopAtFirst && !diff.divergences().empty() ? " (stopped at the first)" : "") << "\r\n"
+        << "Time: " << elapsed << " ms, card A waited " << diff.wait_ms(0) << " ms, card B waited " << diff.wait_ms(1) << " ms\r\n";
+}
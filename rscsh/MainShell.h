@@ -3,6 +3,12 @@
 #include "Shell.h"
 #include "CardShell.h"
 #include "CryptoShell.h"
+#include "Script.h"
+#include "IpcServer.h"
+#include "CommandArena.h"
+#include "AllocationCounter.h"
+#include "BenchSuite.h"
+#include "DiffRun.h"
 
 #include <functional>
 
@@ -10,27 +16,63 @@ class MainShell : public Shell {
 public:
     using FunctionEnd = std::function<void()>;
 
-    MainShell(std::wostringstream &execution_yield, FunctionEnd const &end);
+    MainShell(std::ostringstream &execution_yield, FunctionEnd const &end);
     MainShell(MainShell const &other) = delete;
 
     using Shell::operator=;
 
-    void execute(LPCTSTR args);
-    void execute(std::vector<std::wstring> const argv);
+    void execute(LPCTSTR args, bool echo = true);
+    void execute(std::vector<std::wstring> const &argv);
 
     inline CardShell& card_shell() noexcept { return cardShell_; }
     inline CryptoShell& crypto_shell() noexcept { return cryptoShell_; }
+    inline Emitter& emitter() noexcept { return recordEmitter_; }
+    inline Profiler& profiler() noexcept { return commandProfiler_; }
 
 private:
     void help(std::vector<std::wstring> const&);
     void exit(std::vector<std::wstring> const&);
     void version(std::vector<std::wstring> const&);
+    void history(std::vector<std::wstring> const &argv);
+    void script(std::vector<std::wstring> const &argv);
+    void server(std::vector<std::wstring> const &argv);
+    void server_bench(std::wstring const &pipeName, unsigned long count, unsigned long batch);
+    void output(std::vector<std::wstring> const &argv);
+    void output_bench(unsigned long count);
+    void alloc(std::vector<std::wstring> const &argv);
+    void alloc_bench(unsigned long count, std::vector<std::wstring> const &argv);
+    void profile(std::vector<std::wstring> const &argv);
+    void bench(std::vector<std::wstring> const &argv);
+    // Benchmarks of the hot paths, run in the session with the simulated card.
+    static void add_benchmarks(BenchSuite &suite, MainShell &session, std::ostringstream &output);
+    void diff_run(std::vector<std::wstring> const &argv);
+
+    void dispatch(std::vector<std::wstring> const &argv);
+    // Turns the rest of the command's text into text records and writes the records, in JSON or CBOR output.
+    void emit_records();
+
+    // Binds a script command line to the handler in the main, card or crypto shell.
+    Script::Handler resolve_command(std::vector<std::wstring> const &argv);
+    Script compile_script(std::wstring const &path);
 
     FunctionEnd end_;
 
+    // Tokens of the last command line, their buffers are reused by the next one
+    std::vector<std::wstring> argv_;
+
+    CommandArena commandArena_;
+    AllocationCount lastAllocations_;
+    size_t lastArenaBytes_ = 0;
+
+    ResponseHistory responseHistory_;
+    Emitter recordEmitter_;
+    Profiler commandProfiler_;
+
     CardShell cardShell_;
     CryptoShell cryptoShell_;
 
+    std::unique_ptr<IpcServer> server_;
+
     static const std::unordered_map<std::wstring, void (MainShell::*)(std::vector<std::wstring> const &)> command_map_;
     static const std::unordered_map<std::wstring, std::wstring> help_map_;
 };
@@ -1,3 +1,11 @@
 X( L"help",                  help,                  L"\r\n\t-- Display this help text." )
 X( L"exit",                  exit,                  L"\r\n\t-- Exit the program." )
 X( L"version",               version,               L"\r\n\t-- Print the version of rscsh." )
+X( L"history",               history,               L"[<count> / budget <bytes> / clear]\r\n\t-- Lists recent exchanges, referenced in arguments as $1, $1[2..10], $1.tag(9f36), $1.sw, $1.cmd." )
+X( L"script",                script,                L"[run / dump] <file> / bench <file> <count>\r\n\t-- Compiles script with set, for, if / else, break, echo and stop around shell commands, and runs it." )
+X( L"server",                server,                L"[start [pipe name] / stop / bench <count> [batch size]]\r\n\t-- Serves shell sessions to test harnesses on a named pipe, with length-prefixed batches of commands and raw APDUs." )
+X( L"output",                output,                L"text/json/cbor / bench <count>\r\n\t-- Switches between text and typed records (exchanges, TLV nodes, ATR fields, digests, text lines) as JSON Lines or CBOR sequence. The bench compares the formats and UTF-16 with UTF-8 text." )
+X( L"alloc",                 alloc,                 L"[bench <count> <command line>]\r\n\t-- Shows heap allocations and command arena use of the last command, or of repeated runs of a command." )
+X( L"profile",               profile,               L"[on / off / clear / export <trace file>]\r\n\t-- Times every command by phase (tokenize, dispatch, hex decode, transmit, crypto, format, ui append) with its heap allocations, shows the totals and writes a Chrome trace." )
+X( L"bench",                 bench,                 L"[<filter>] [json <file>] [baseline <file> [tolerance <percent>]]\r\n\t-- Runs the benchmarks of tokenize / dispatch, hex, TLV and ATR parsing, crypto primitives and APDU exchanges with the simulated card, and fails when slower than the baseline." )
+X( L"diff-run",              diff_run,              L"<reader a> <reader b> <script> [mask <tag(9f36) / [5..13] / ae:tag(9f26) / emv>]... [continue]\r\n\t-- Runs the script on two cards at the same time (reader id, name or sim) and compares every response, ignoring masked volatile fields; stops at the first divergence unless continue." )
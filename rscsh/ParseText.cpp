@@ -0,0 +1,173 @@
+#include "ParseText.h"
+
+#include <iomanip>
+#include <sstream>
+
+#include <scb/ByteStream.h>
+
+static size_t tag_size(unsigned tag) noexcept {
+    size_t size = 1;
+    while (tag >>= 8)
+        size++;
+    return size;
+}
+
+BerTlvList::Tlv::Tlv(std::shared_ptr<scb::Bytes const> data, BerTlv::Element const &element)
+    : data_(std::move(data)), element_(element), tag_(data_->bytes(element.offset, tag_size(element.tag)), element.constructed) {
+}
+
+BerTlvList BerTlvList::Tlv::value_as_tlv_list() const {
+    return BerTlvList(data_, element_.value_offset(), element_.length);
+}
+
+BerTlvList::BerTlvList(scb::Bytes const &data)
+    : BerTlvList(std::make_shared<scb::Bytes const>(data), 0, data.size()) {
+}
+
+BerTlvList::BerTlvList(std::shared_ptr<scb::Bytes const> data, size_t offset, size_t size) {
+    auto elements = BerTlv::parse(*data, offset, size);
+    elements_.reserve(elements.size());
+    for (auto const &element : elements)
+        elements_.emplace_back(data, element);
+}
+
+static std::wstring interface_bytes(unsigned char byte, unsigned i) {
+    auto index = std::to_wstring(i);
+    std::wstring text;
+    if (byte & (1 << 4)) text += L"TA" + index + L' ';
+    if (byte & (1 << 5)) text += L"TB" + index + L' ';
+    if (byte & (1 << 6)) text += L"TC" + index + L' ';
+    if (byte & (1 << 7)) text += L"TD" + index + L' ';
+    return text;
+}
+
+bool parse_atr_fields(scb::Bytes const &atr, AtrYield const &yield) {
+    scb::ByteStream bs(atr);
+
+    auto TS = bs.next_u8();
+    switch (TS) {
+        case 0x3B:
+            yield(L"TS", TS, L"Direct convention");
+            break;
+        case 0x3F:
+            yield(L"TS", TS, L"Inverse convention");
+            break;
+        default:
+            yield(L"TS", TS, L"Unexpected value");
+    }
+
+    auto T0 = bs.next_u8();
+    yield(L"T0", T0, interface_bytes(T0, 1) + L"present, and " + std::to_wstring(T0 & 0x0F) + L" historical bytes");
+
+    // TA1
+    if (T0 & (1 << 4)) {
+        auto TA1 = bs.next_u8();
+        std::wostringstream description;
+        description << std::uppercase;
+        unsigned D = 0;
+        switch (TA1 & 0x0F) {
+            case 1: D = 1;  break; 
+            case 2: D = 2;  break; 
+            case 3: D = 4;  break; 
+            case 4: D = 8;  break; 
+            case 5: D = 16; break; 
+            case 6: D = 32; break; 
+            case 7: D = 64; break; 
+            case 8: D = 12; break; 
+            case 9: D = 20; break; 
+        }
+        if (D)
+            description << "D = " << D << ", ";
+        else
+            description << "D = unknown, ";
+
+        unsigned F = 0;
+        float fmax = 0;
+        switch (TA1 >> 4) {
+            case 1:  F = 372;  fmax = 5;   break; 
+            case 2:  F = 558;  fmax = 6;   break; 
+            case 3:  F = 744;  fmax = 8;   break; 
+            case 4:  F = 1116; fmax = 12;  break; 
+            case 5:  F = 1488; fmax = 16;  break; 
+            case 6:  F = 1860; fmax = 20;  break; 
+            case 9:  F = 512;  fmax = 5;   break; 
+            case 10: F = 768;  fmax = 7.5; break; 
+            case 11: F = 1024; fmax = 10;  break; 
+            case 12: F = 1536; fmax = 15;  break; 
+            case 13: F = 2048; fmax = 20;  break; 
+        }
+        if (F)
+            description << "F = " << F << " and fmax = " << fmax << ", ";
+        else
+            description << "F = Internal and fmax = 9600, ";
+
+        float etu;
+        if (F)
+            etu = 1.0f / static_cast<float>(D) * F / fmax;
+        else
+            etu = 1.0f / static_cast<float>(D) * 1.0f / 9600.0f;
+
+        description << "etu = " << etu;
+        yield(L"TA1", TA1, description.str());
+    }
+
+    // TB1
+    if (T0 & (1 << 5)) {
+        auto TB1 = bs.next_u8();
+
+        unsigned I = 0;
+        switch ((TB1 >> 5) & 0x03) {
+            case 0: I = 25; break;
+            case 1: I = 50; break;
+            case 2: I = 100; break;
+        }
+
+        unsigned PI1 = (TB1 & 0x1F);
+
+        yield(L"TB1", TB1, L"I = " + std::to_wstring(I) + L" and PI1 = " + std::to_wstring(PI1));
+    }
+
+    // TC1
+    if (T0 & (1 << 6)) {
+        auto TC1 = bs.next_u8();
+        yield(L"TC1", TC1, L"N = " + std::to_wstring(TC1));
+    }
+
+    // TD1
+    if (T0 & (1 << 7)) {
+        auto TD1 = bs.next_u8();
+
+        unsigned T = TD1 & 0x0F;
+
+        yield(L"TD1", TD1, interface_bytes(TD1, 2) + L"present, and protocol is T=" + std::to_wstring(T));
+
+        unsigned i = 2;
+        for (auto TDi = TD1; ; i++) {
+            auto index = std::to_wstring(i);
+            if (TDi & (1 << 4)) yield(L"TA" + index, bs.next_u8(), L"");
+            if (TDi & (1 << 5)) yield(L"TB" + index, bs.next_u8(), L"");
+            if (TDi & (1 << 6)) yield(L"TC" + index, bs.next_u8(), L"");
+            unsigned char next_TDi = 0;
+            if (TDi & (1 << 7)) {
+                next_TDi = bs.next_u8();
+                yield(L"TD" + index, next_TDi, next_TDi & 0xF0 ? interface_bytes(next_TDi, i + 1) + L"present" : L"");
+            }
+            if (!(TDi & 0xF0))
+                break;
+            TDi = next_TDi;
+        }
+        return true;
+    }
+    return false;
+}
+
+void write_atr_field(std::ostream &output, std::wstring const &name, unsigned char value, std::wstring const &description) {
+    std::ios::fmtflags flags(output.flags());
+    output
+        << utf8(name) << (name.size() < 3 ? " " : "") << " = "
+        << std::uppercase << std::hex << std::setfill('0') << std::setw(2) << static_cast<unsigned>(value);
+    output.flags(flags);
+    if (!description.empty())
+        output << " | " << utf8(description);
+    output << "\r\n";
+}
@@ -0,0 +1,110 @@
+#pragma once
+
+#include "BerTlv.h"
+#include "TextOutput.h"
+
+#include <functional>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include <scb/Bytes.h>
+
+// Text of the parse command, without the shell and rsc, so that the standalone benchmark renders
+// exactly what the shell prints.
+
+// Tree of TLV elements: tag, length and name, then the value of a primitive element in lines of
+// 16 bytes (and as ASCII when it is), or the children of a constructed one. TlvList is
+// rsc::TLVList in the shell and BerTlvList below it.
+template <typename TlvList>
+void write_tlv_tree(std::ostream &output, TlvList const &tlvList, size_t depth = 0) {
+    std::string prefix;
+    for (size_t i = 0; i < depth; i++) {
+        prefix += "| ";
+    }
+    for (auto const &tlv : tlvList) {
+        output
+            << prefix
+            << "* "
+            << hex_bytes(tlv.tag().bytes())
+            << " (" << tlv.length() << ") " << utf8(tlv.tag().name())
+            << "\r\n"
+            << prefix
+            << "|\\\r\n";
+
+        if (tlv.tag().is_constructed()) {
+            write_tlv_tree(output, tlv.value_as_tlv_list(), depth + 1);
+        } else {
+            auto const &value = tlv.value();
+            for (size_t i = 0; i < value.size(); i += 16) {
+                size_t length = 16;
+                if (i + length >= value.size())
+                    length = value.size() - i;
+                output << prefix << "| > " << hex_bytes(value.data() + i, length) << "\r\n";
+            }
+            if (value.all_ascii()) {
+                output
+                    << prefix
+                    << "| > ASCII: "
+                    << utf8(value.ascii())
+                    << "\r\n";
+            }
+        }
+
+        output << prefix << "|/\r\n";
+    }
+
+    if (depth == 0)
+        output << prefix << "\r\n";
+}
+
+// Elements of a buffer parsed with BerTlv, in the shape write_tlv_tree takes from rsc::TLVList.
+// Tags have no names.
+class BerTlvList {
+public:
+    class Tag {
+    public:
+        Tag(scb::Bytes bytes, bool constructed) : bytes_(std::move(bytes)), constructed_(constructed) {}
+
+        inline scb::Bytes const& bytes() const noexcept { return bytes_; }
+        inline std::wstring name() const { return std::wstring(); }
+        inline bool is_constructed() const noexcept { return constructed_; }
+
+    private:
+        scb::Bytes bytes_;
+        bool constructed_;
+    };
+
+    class Tlv {
+    public:
+        Tlv(std::shared_ptr<scb::Bytes const> data, BerTlv::Element const &element);
+
+        inline Tag const& tag() const noexcept { return tag_; }
+        inline size_t length() const noexcept { return element_.length; }
+        inline scb::Bytes value() const { return BerTlv::value(*data_, element_); }
+        BerTlvList value_as_tlv_list() const;
+
+    private:
+        std::shared_ptr<scb::Bytes const> data_;
+        BerTlv::Element element_;
+        Tag tag_;
+    };
+
+    explicit BerTlvList(scb::Bytes const &data);
+    BerTlvList(std::shared_ptr<scb::Bytes const> data, size_t offset, size_t size);
+
+    inline std::vector<Tlv>::const_iterator begin() const noexcept { return elements_.begin(); }
+    inline std::vector<Tlv>::const_iterator end() const noexcept { return elements_.end(); }
+
+private:
+    std::vector<Tlv> elements_;
+};
+
+// Fields of the ATR in order, e.g. yield(L"TA1", 0x96, L"D = 32, ..."); the description may be
+// empty. Returns false when TD1 is not present, the protocol is T=0 then.
+using AtrYield = std::function<void(std::wstring const &name, unsigned char value, std::wstring const &description)>;
+bool parse_atr_fields(scb::Bytes const &atr, AtrYield const &yield);
+
+// "TA1 = 96 | D = 32, ..." line of parse atr.
+void write_atr_field(std::ostream &output, std::wstring const &name, unsigned char value, std::wstring const &description);
@@ -0,0 +1,75 @@
+#include "Platform.h"
+
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <cerrno>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#ifdef _WIN32
+
+RaisedThreadPriority::RaisedThreadPriority()
+    : previous_(GetThreadPriority(GetCurrentThread()))
+    , raised_(SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_HIGHEST) != 0)
+{
+}
+
+RaisedThreadPriority::~RaisedThreadPriority() {
+    if (raised_)
+        SetThreadPriority(GetCurrentThread(), previous_);
+}
+
+std::wstring wide_of_utf8(std::string_view text) {
+    if (text.empty())
+        return std::wstring();
+    auto size = MultiByteToWideChar(CP_UTF8, 0, text.data(), static_cast<int>(text.size()), NULL, 0);
+    std::wstring wide(static_cast<size_t>(size), L'\0');
+    MultiByteToWideChar(CP_UTF8, 0, text.data(), static_cast<int>(text.size()), wide.data(), size);
+    return wide;
+}
+
+#else
+
+// Linux schedules threads as tasks, the nice value of the thread id applies to the thread only
+RaisedThreadPriority::RaisedThreadPriority() {
+    auto thread = static_cast<id_t>(syscall(SYS_gettid));
+    errno = 0;
+    previous_ = getpriority(PRIO_PROCESS, thread);
+    raised_ = errno == 0 && setpriority(PRIO_PROCESS, thread, previous_ - 10) == 0;
+}
+
+RaisedThreadPriority::~RaisedThreadPriority() {
+    if (raised_)
+        setpriority(PRIO_PROCESS, static_cast<id_t>(syscall(SYS_gettid)), previous_);
+}
+
+std::wstring wide_of_utf8(std::string_view text) {
+    std::wstring wide;
+    wide.reserve(text.size());
+    for (size_t i = 0; i < text.size(); ) {
+        auto lead = static_cast<unsigned char>(text[i]);
+        size_t length = lead < 0x80 ? 1 : (lead >> 5) == 0x06 ? 2 : (lead >> 4) == 0x0E ? 3 : (lead >> 3) == 0x1E ? 4 : 0;
+        unsigned long c = length == 1 ? lead : length == 2 ? lead & 0x1F : length == 3 ? lead & 0x0F : lead & 0x07;
+        bool valid = length != 0 && i + length <= text.size();
+        for (size_t j = 1; valid && j < length; j++) {
+            auto next = static_cast<unsigned char>(text[i + j]);
+            valid = (next & 0xC0) == 0x80;
+            c = c << 6 | (next & 0x3F);
+        }
+        // Overlong forms, surrogates and values beyond Unicode are invalid
+        static unsigned long const minimum[] = { 0, 0, 0x80, 0x800, 0x10000 };
+        if (!valid || c < minimum[length] || (c >= 0xD800 && c <= 0xDFFF) || c > 0x10FFFF) {
+            wide += L'\xFFFD';
+            i++;
+            continue;
+        }
+        wide += static_cast<wchar_t>(c);
+        i += length;
+    }
+    return wide;
+}
+
+#endif
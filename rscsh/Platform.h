@@ -0,0 +1,25 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+
+// The operating system services of code that is also built into the standalone benchmark,
+// for Windows and for POSIX systems.
+
+// Raises the priority of the calling thread while alive, so that measurements are preempted less
+// by other work on the machine. Best effort: without the right to raise it, the priority is kept.
+class RaisedThreadPriority {
+public:
+    RaisedThreadPriority();
+    ~RaisedThreadPriority();
+
+    RaisedThreadPriority(RaisedThreadPriority const&) = delete;
+    RaisedThreadPriority& operator=(RaisedThreadPriority const&) = delete;
+
+private:
+    int previous_ = 0;
+    bool raised_ = false;
+};
+
+// Wide string of UTF-8 text (UTF-16 on Windows), invalid sequences become U+FFFD.
+std::wstring wide_of_utf8(std::string_view text);
@@ -0,0 +1,226 @@
+#include "Profiler.h"
+#include "TextOutput.h"
+
+#include <cwctype>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <stdexcept>
+
+static char const *const phaseNames[] = {
+    "tokenize", "dispatch", "hex decode", "transmit", "crypto", "format", "ui append",
+};
+
+static void add(AllocationCount &to, AllocationCount const &count) {
+    to = to + count;
+}
+
+static void write_json_string(std::ostream &output, std::string_view text) {
+    static char const digits[] = "0123456789abcdef";
+    output << '"';
+    for (auto c : text) {
+        if (c == '"' || c == '\\')
+            output << '\\' << c;
+        else if (static_cast<unsigned char>(c) < 0x20)
+            output << "\\u00" << digits[c >> 4] << digits[c & 0x0F];
+        else
+            output << c;
+    }
+    output << '"';
+}
+
+Profiler::Scope::Scope(Profiler *profiler, Phase phase)
+    : profiler_(profiler && profiler->enabled_ ? profiler : nullptr)
+{
+    if (profiler_)
+        profiler_->open(phase);
+}
+
+Profiler::Scope::~Scope() {
+    if (profiler_)
+        profiler_->close();
+}
+
+char const* Profiler::phase_name(Phase phase) noexcept {
+    return phaseNames[static_cast<size_t>(phase)];
+}
+
+void Profiler::set_enabled(bool enabled) {
+    if (enabled == enabled_)
+        return;
+    if (!enabled) {
+        end_command();
+        enabled_ = false;
+        return;
+    }
+
+    if (events_.empty() && traced_.empty())
+        epoch_ = Clock::now();
+    open_.reserve(16);
+    events_.reserve(64 * 1024);
+    enabled_ = true;
+}
+
+double Profiler::since_epoch(Clock::time_point time) const {
+    return std::chrono::duration<double, std::nano>(time - epoch_).count();
+}
+
+void Profiler::begin_command(std::wstring_view line) {
+    if (!enabled_)
+        return;
+    end_command();
+
+    while (!line.empty() && iswspace(line.back()))
+        line.remove_suffix(1);
+    command_ = Command();
+    command_.line = to_utf8(line);
+    inCommand_ = true;
+    commandAllocations_ = thread_allocations();
+    commandStart_ = Clock::now();
+}
+
+void Profiler::end_command() {
+    if (!inCommand_)
+        return;
+    inCommand_ = false;
+
+    auto now = Clock::now();
+    command_.total.ns = std::chrono::duration<double, std::nano>(now - commandStart_).count();
+    command_.total.allocations = thread_allocations() - commandAllocations_;
+
+    auto name = command_.line.substr(0, command_.line.find(' '));
+    auto &totals = byCommand_[name.empty() ? std::string("(empty)") : name];
+    totals.count++;
+    totals.ns += command_.total.ns;
+    totals.maxNs = std::max(totals.maxNs, command_.total.ns);
+    add(totals.allocations, command_.total.allocations);
+    for (size_t i = 0; i < PhaseCount; i++) {
+        byPhase_[i].ns += command_.phases[i].ns;
+        add(byPhase_[i].allocations, command_.phases[i].allocations);
+    }
+    traced_.push_back({ command_.line, since_epoch(commandStart_), command_.total });
+}
+
+void Profiler::open(Phase phase) {
+    Open scope{ phase, {}, thread_allocations(), {} };
+    scope.start = Clock::now();
+    open_.push_back(scope);
+}
+
+void Profiler::close() {
+    auto now = Clock::now();
+    auto allocations = thread_allocations();
+    auto scope = open_.back();
+    open_.pop_back();
+
+    Cost inclusive{ std::chrono::duration<double, std::nano>(now - scope.start).count(), allocations - scope.allocations };
+    if (!open_.empty()) {
+        open_.back().children.ns += inclusive.ns;
+        add(open_.back().children.allocations, inclusive.allocations);
+    }
+    // Scope outliving the command, e.g. of `profile off`
+    if (!inCommand_)
+        return;
+
+    auto &phase = command_.phases[static_cast<size_t>(scope.phase)];
+    phase.ns += inclusive.ns - scope.children.ns;
+    add(phase.allocations, inclusive.allocations - scope.children.allocations);
+
+    if (events_.size() < MaxEvents)
+        events_.push_back({ static_cast<unsigned>(traced_.size()), scope.phase, since_epoch(scope.start), inclusive.ns, inclusive.allocations });
+    else
+        droppedEvents_++;
+}
+
+void Profiler::print_command(std::ostream &output) const {
+    auto flags = output.flags();
+    auto precision = output.precision();
+    output << std::fixed << std::setprecision(3)
+        << "profile: " << command_.total.ns / 1e6 << " ms, " << command_.total.allocations.count << " allocations, "
+        << command_.total.allocations.bytes << " bytes\r\n";
+    for (size_t i = 0; i < PhaseCount; i++) {
+        auto const &phase = command_.phases[i];
+        if (phase.ns == 0 && phase.allocations.count == 0)
+            continue;
+        output << "    " << std::left << std::setw(12) << phaseNames[i] << std::right
+            << std::setw(10) << phase.ns / 1e6 << " ms " << std::setw(8) << phase.allocations.count << " allocations "
+            << std::setw(10) << phase.allocations.bytes << " bytes\r\n";
+    }
+    output.flags(flags);
+    output.precision(precision);
+}
+
+void Profiler::print_summary(std::ostream &output) const {
+    auto flags = output.flags();
+    auto precision = output.precision();
+    output << "Profiling is " << (enabled_ ? "on" : "off") << ", " << traced_.size() << " commands, "
+        << events_.size() << " trace events";
+    if (droppedEvents_)
+        output << " (" << droppedEvents_ << " dropped)";
+    output << "\r\n";
+    if (byCommand_.empty()) {
+        output.flags(flags);
+        output.precision(precision);
+        return;
+    }
+
+    output << std::fixed << std::setprecision(3)
+        << "\r\n" << std::left << std::setw(16) << "command" << std::right << std::setw(8) << "count"
+        << std::setw(12) << "total ms" << std::setw(10) << "mean ms" << std::setw(10) << "max ms"
+        << std::setw(13) << "allocations" << std::setw(12) << "bytes" << "\r\n";
+    for (auto const &[name, totals] : byCommand_) {
+        output << std::left << std::setw(16) << name << std::right << std::setw(8) << totals.count
+            << std::setw(12) << totals.ns / 1e6 << std::setw(10) << totals.ns / 1e6 / totals.count << std::setw(10) << totals.maxNs / 1e6
+            << std::setw(13) << totals.allocations.count << std::setw(12) << totals.allocations.bytes << "\r\n";
+    }
+
+    double all = 0;
+    for (auto const &phase : byPhase_)
+        all += phase.ns;
+    output << "\r\n" << std::left << std::setw(16) << "phase" << std::right << std::setw(12) << "total ms"
+        << std::setw(8) << "share" << std::setw(13) << "allocations" << std::setw(12) << "bytes" << "\r\n";
+    for (size_t i = 0; i < PhaseCount; i++) {
+        auto const &phase = byPhase_[i];
+        output << std::left << std::setw(16) << phaseNames[i] << std::right << std::setw(12) << phase.ns / 1e6
+            << std::setprecision(1) << std::setw(7) << (all > 0 ? 100 * phase.ns / all : 0) << '%' << std::setprecision(3)
+            << std::setw(13) << phase.allocations.count << std::setw(12) << phase.allocations.bytes << "\r\n";
+    }
+    output.flags(flags);
+    output.precision(precision);
+}
+
+void Profiler::export_trace(std::wstring const &path) const {
+    std::ofstream file(std::filesystem::path{ path }, std::ios::binary);
+    if (!file)
+        throw std::runtime_error("cannot open trace file");
+
+    // Complete events ("ph":"X") in microseconds, commands enclose their phases on one track
+    file << std::fixed << std::setprecision(3) << "{\"traceEvents\":[\n";
+    bool first = true;
+    auto event = [&](std::string_view name, char const *category, double start, Cost const &cost) {
+        file << (first ? "" : ",\n") << "{\"name\":";
+        write_json_string(file, name);
+        file << ",\"cat\":\"" << category << "\",\"ph\":\"X\",\"pid\":1,\"tid\":1,\"ts\":" << start / 1e3 << ",\"dur\":" << cost.ns / 1e3
+            << ",\"args\":{\"allocations\":" << cost.allocations.count << ",\"bytes\":" << cost.allocations.bytes << "}}";
+        first = false;
+    };
+    for (auto const &command : traced_)
+        event(command.line, "command", command.start, command.total);
+    for (auto const &e : events_) {
+        if (e.command < traced_.size())
+            event(phaseNames[static_cast<size_t>(e.phase)], "phase", e.start, { e.ns, e.allocations });
+    }
+    file << "\n],\"displayTimeUnit\":\"ns\"}\n";
+
+    if (!file)
+        throw std::runtime_error("cannot write trace file");
+}
+
+void Profiler::clear() {
+    byCommand_.clear();
+    byPhase_ = {};
+    traced_.clear();
+    events_.clear();
+    droppedEvents_ = 0;
+    epoch_ = inCommand_ ? commandStart_ : Clock::now();
+}
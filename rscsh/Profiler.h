@@ -0,0 +1,124 @@
+#pragma once
+
+#include "AllocationCounter.h"
+
+#include <array>
+#include <chrono>
+#include <map>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Time and heap allocations of shell commands by phase. A phase is measured by a Scope around the
+// work; nested scopes are subtracted from the enclosing one, so every phase shows its own cost.
+// Scopes are opened on the shell thread only, and cost a null check when profiling is off.
+//
+// Each scope is also recorded as a trace event, written out in the Chrome trace-event format
+// (chrome://tracing, Perfetto).
+class Profiler {
+public:
+    enum class Phase : unsigned char {
+        Tokenize,
+        Dispatch,
+        HexDecode,
+        Transmit,
+        Crypto,
+        Format,
+        UiAppend,
+        Count,
+    };
+
+    static constexpr size_t PhaseCount = static_cast<size_t>(Phase::Count);
+    static constexpr size_t MaxEvents = 1 << 20;
+
+    class Scope {
+    public:
+        // No-op when the profiler is null or off.
+        Scope(Profiler *profiler, Phase phase);
+        ~Scope();
+
+        Scope(Scope const&) = delete;
+        Scope& operator=(Scope const&) = delete;
+
+    private:
+        Profiler *profiler_;
+    };
+
+    void set_enabled(bool enabled);
+    inline bool enabled() const noexcept { return enabled_; }
+
+    // A command lasts until the next one begins or it is ended, so that work done for it after
+    // the shell returns (appending its output to the window) is still counted.
+    void begin_command(std::wstring_view line);
+    void end_command();
+    inline bool in_command() const noexcept { return inCommand_; }
+
+    void print_command(std::ostream &output) const;
+    void print_summary(std::ostream &output) const;
+    void export_trace(std::wstring const &path) const;
+    void clear();
+
+    static char const* phase_name(Phase phase) noexcept;
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    struct Cost {
+        double ns = 0;
+        AllocationCount allocations;
+    };
+
+    struct Open {
+        Phase phase;
+        Clock::time_point start;
+        AllocationCount allocations;
+        Cost children;
+    };
+
+    struct Event {
+        unsigned command;       // index into traced_
+        Phase phase;
+        double start;           // ns since the profiler was enabled
+        double ns;
+        AllocationCount allocations;
+    };
+
+    struct Command {
+        std::string line;
+        std::array<Cost, PhaseCount> phases{};
+        Cost total;
+    };
+
+    struct TracedCommand {
+        std::string line;
+        double start;
+        Cost total;
+    };
+
+    struct Totals {
+        unsigned long long count = 0;
+        double ns = 0;
+        double maxNs = 0;
+        AllocationCount allocations;
+    };
+
+    void open(Phase phase);
+    void close();
+    double since_epoch(Clock::time_point time) const;
+
+    bool enabled_ = false;
+    Clock::time_point epoch_;
+    std::vector<Open> open_;
+
+    bool inCommand_ = false;
+    Command command_;
+    Clock::time_point commandStart_;
+    AllocationCount commandAllocations_;
+
+    std::map<std::string, Totals> byCommand_;       // first word of the command line
+    std::array<Cost, PhaseCount> byPhase_{};
+    std::vector<TracedCommand> traced_;
+    std::vector<Event> events_;
+    unsigned long long droppedEvents_ = 0;
+};
@@ -0,0 +1,143 @@
+#include "ReaderRegistry.h"
+
+#include <algorithm>
+#include <cwctype>
+#include <mutex>
+#include <stdexcept>
+
+static std::wstring lowercase(std::wstring s) {
+    std::transform(s.begin(), s.end(), s.begin(), ::towlower);
+    return s;
+}
+
+ReaderRegistry::Reader& ReaderRegistry::reader(std::wstring const &name) {
+    auto key = lowercase(name);
+    if (auto it = byName_.find(key); it != byName_.end())
+        return readers_[it->second];
+
+    byName_.emplace(key, readers_.size());
+    auto &reader = readers_.emplace_back();
+    reader.id = static_cast<unsigned>(readers_.size());
+    reader.name = name;
+    return reader;
+}
+
+void ReaderRegistry::synchronize(rsc::Context const &context, std::vector<std::wstring> const &names) {
+    std::vector<scb::Bytes> atrs;
+    for (auto const &name : names)
+        atrs.push_back(query_atr(context, name));
+
+    std::unique_lock lock(mutex_);
+    for (auto &reader : readers_) {
+        reader.attached = false;
+        reader.cardPresent = false;
+        reader.atr = scb::Bytes();
+    }
+    for (size_t i = 0; i < names.size(); i++) {
+        auto &entry = reader(names[i]);
+        entry.attached = true;
+        entry.cardPresent = !atrs[i].empty();
+        entry.atr = atrs[i];
+    }
+}
+
+void ReaderRegistry::update(rsc::Context const &context, std::wstring const &name, bool cardPresent) {
+    // Resource manager is asked outside the lock, readers of the registry are not blocked by it
+    auto atr = cardPresent ? query_atr(context, name) : scb::Bytes();
+
+    std::unique_lock lock(mutex_);
+    auto &entry = reader(name);
+    entry.attached = true;
+    entry.cardPresent = cardPresent;
+    entry.atr = atr;
+}
+
+void ReaderRegistry::detach(std::wstring const &name) {
+    std::unique_lock lock(mutex_);
+    if (auto it = byName_.find(lowercase(name)); it != byName_.end()) {
+        auto &reader = readers_[it->second];
+        reader.attached = false;
+        reader.cardPresent = false;
+        reader.atr = scb::Bytes();
+    }
+}
+
+std::vector<ReaderRegistry::Reader> ReaderRegistry::list() const {
+    std::shared_lock lock(mutex_);
+    return readers_;
+}
+
+bool ReaderRegistry::find_by_id(unsigned id, Reader &reader) const {
+    std::shared_lock lock(mutex_);
+    if (id == 0 || id > readers_.size())
+        return false;
+    reader = readers_[id - 1];
+    return true;
+}
+
+bool ReaderRegistry::find_by_name(std::wstring const &name, Reader &reader) const {
+    auto key = lowercase(name);
+
+    std::shared_lock lock(mutex_);
+    if (auto it = byName_.find(key); it != byName_.end()) {
+        reader = readers_[it->second];
+        return true;
+    }
+
+    Reader const *match = nullptr;
+    for (auto const &[readerName, index] : byName_) {
+        if (readerName.find(key) == std::wstring::npos || !readers_[index].attached)
+            continue;
+        if (match)
+            throw std::runtime_error("reader name is ambiguous");
+        match = &readers_[index];
+    }
+    if (!match)
+        return false;
+    reader = *match;
+    return true;
+}
+
+bool ReaderRegistry::find_by_atr(std::wstring const &pattern, Reader &reader) const {
+    if (pattern.size() % 2 != 0)
+        throw std::runtime_error("ATR pattern must have even number of digits");
+
+    // Pattern bytes with mask, wildcard bytes have zero mask
+    std::vector<unsigned char> value, mask;
+    for (size_t i = 0; i < pattern.size(); i += 2) {
+        auto byte = lowercase(pattern.substr(i, 2));
+        if (byte == L"??" || byte == L"xx") {
+            value.push_back(0);
+            mask.push_back(0);
+        } else {
+            value.push_back(static_cast<unsigned char>(std::stoul(byte, nullptr, 16)));
+            mask.push_back(0xFF);
+        }
+    }
+
+    std::shared_lock lock(mutex_);
+    for (auto const &candidate : readers_) {
+        if (!candidate.cardPresent || candidate.atr.size() < value.size())
+            continue;
+        bool matches = true;
+        for (size_t i = 0; i < value.size() && matches; i++)
+            matches = (candidate.atr[i] & mask[i]) == value[i];
+        if (matches) {
+            reader = candidate;
+            return true;
+        }
+    }
+    return false;
+}
+
+scb::Bytes ReaderRegistry::query_atr(rsc::Context const &context, std::wstring const &name) {
+    SCARD_READERSTATE state = {};
+    state.szReader = name.c_str();
+    state.dwCurrentState = SCARD_STATE_UNAWARE;
+    if (SCardGetStatusChange(context.handle(), 0, &state, 1) != SCARD_S_SUCCESS || !(state.dwEventState & SCARD_STATE_PRESENT))
+        return scb::Bytes();
+
+    scb::Bytes atr(state.cbAtr);
+    std::copy(state.rgbAtr, state.rgbAtr + state.cbAtr, atr.begin());
+    return atr;
+}
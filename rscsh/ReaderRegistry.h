@@ -0,0 +1,48 @@
+#pragma once
+
+#include <rsc/Context.h>
+
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <scb/Bytes.h>
+
+// Readers seen since start, fed by the reader event listener, so that listing and connecting
+// does not enumerate readers every time. Readers keep their id while the application runs,
+// also after they were unplugged and plugged in again. All methods are safe to call from several threads.
+class ReaderRegistry {
+public:
+    struct Reader {
+        unsigned id = 0;            // 1-based
+        std::wstring name;
+        bool attached = false;
+        bool cardPresent = false;
+        scb::Bytes atr;
+    };
+
+    // Seeds the registry from a full reader enumeration, readers not in `names` are marked detached.
+    void synchronize(rsc::Context const &context, std::vector<std::wstring> const &names);
+    // Reader event, reads ATR of the inserted card from the resource manager.
+    void update(rsc::Context const &context, std::wstring const &name, bool cardPresent);
+    void detach(std::wstring const &name);
+
+    inline bool empty() const { std::shared_lock lock(mutex_); return readers_.empty(); }
+    std::vector<Reader> list() const;
+
+    bool find_by_id(unsigned id, Reader &reader) const;
+    // Case insensitive, whole name or unique part of it.
+    bool find_by_name(std::wstring const &name, Reader &reader) const;
+    // First reader with card whose ATR matches hex pattern, "??" matches any byte, shorter pattern matches prefix.
+    bool find_by_atr(std::wstring const &pattern, Reader &reader) const;
+
+    static scb::Bytes query_atr(rsc::Context const &context, std::wstring const &name);
+
+private:
+    Reader& reader(std::wstring const &name);
+
+    std::vector<Reader> readers_;                       // index is id - 1
+    std::unordered_map<std::wstring, size_t> byName_;   // lowercase name -> index
+    mutable std::shared_mutex mutex_;
+};
@@ -0,0 +1,122 @@
+#include "ResponseHistory.h"
+#include "BerTlv.h"
+#include "CommandLine.h"
+
+#include <stdexcept>
+
+ResponseHistory::Slice::Slice(std::shared_ptr<Exchange const> exchange, scb::Bytes const &buffer, size_t offset, size_t size)
+    : exchange_(std::move(exchange))
+    , buffer_(&buffer)
+    , offset_(offset)
+    , size_(size)
+{}
+
+scb::Bytes ResponseHistory::Slice::bytes() const {
+    return buffer_->bytes(offset_, size_);
+}
+
+ResponseHistory::Slice ResponseHistory::Slice::sub(size_t offset, size_t size) const {
+    if (offset > size_ || size > size_ - offset)
+        throw std::runtime_error("history slice out of range");
+    return Slice(exchange_, *buffer_, offset_ + offset, size);
+}
+
+ResponseHistory::Slice ResponseHistory::Slice::tag(unsigned tag) const {
+    BerTlv::Element element;
+    if (!BerTlv::find(*buffer_, offset_, size_, tag, element))
+        throw std::runtime_error("tag not found in history entry");
+    return Slice(exchange_, *buffer_, element.value_offset(), element.length);
+}
+
+ResponseHistory::ResponseHistory(size_t budget)
+    : budget_(budget)
+{}
+
+size_t ResponseHistory::footprint(Exchange const &exchange) noexcept {
+    return sizeof(Exchange) + exchange.command.size() + exchange.response.size();
+}
+
+void ResponseHistory::record(scb::Bytes const &command, scb::Bytes const &response) {
+    auto exchange = std::make_shared<Exchange const>(Exchange{ command, response });
+    used_ += footprint(*exchange);
+    ring_.push_front(std::move(exchange));
+    evict();
+}
+
+void ResponseHistory::clear() {
+    ring_.clear();
+    used_ = 0;
+}
+
+void ResponseHistory::set_budget(size_t budget) {
+    budget_ = budget;
+    evict();
+}
+
+void ResponseHistory::evict() {
+    // The most recent exchange stays, even when it alone is over the budget
+    while (used_ > budget_ && ring_.size() > 1) {
+        used_ -= footprint(*ring_.back());
+        ring_.pop_back();
+    }
+}
+
+std::shared_ptr<ResponseHistory::Exchange const> ResponseHistory::at(size_t n) const {
+    if (n == 0 || n > ring_.size())
+        throw std::runtime_error("no such history entry");
+    return ring_[n - 1];
+}
+
+ResponseHistory::Slice ResponseHistory::resolve(std::wstring const &typed) const {
+    // Selectors in any case, e.g. $1.TAG(9F36)
+    auto const reference = lowercase(typed);
+    size_t position = 1;
+    auto number = [&](int base) {
+        size_t end;
+        auto value = std::stoul(reference.substr(position), &end, base);
+        position += end;
+        return value;
+    };
+    auto expect = [&](wchar_t const *token) {
+        if (reference.compare(position, std::char_traits<wchar_t>::length(token), token) != 0)
+            throw std::runtime_error("malformed history reference");
+        position += std::char_traits<wchar_t>::length(token);
+    };
+
+    if (!is_reference(reference) || position == reference.size() || !iswdigit(reference[position]))
+        throw std::runtime_error("malformed history reference");
+    auto exchange = at(number(10));
+
+    auto const &response = exchange->response;
+    auto dataSize = response.size() >= 2 ? response.size() - 2 : 0;
+    Slice slice(exchange, response, 0, dataSize);
+    if (reference.compare(position, 4, L".cmd") == 0) {
+        position += 4;
+        slice = Slice(exchange, exchange->command, 0, exchange->command.size());
+    } else if (reference.compare(position, 3, L".sw") == 0) {
+        position += 3;
+        slice = Slice(exchange, response, dataSize, response.size() - dataSize);
+    }
+
+    while (position < reference.size()) {
+        if (reference[position] == L'[') {
+            position++;
+            auto first = number(10);
+            auto last = first + 1;
+            if (reference.compare(position, 2, L"..") == 0) {
+                position += 2;
+                last = reference[position] == L']' ? slice.size() : number(10);
+            }
+            expect(L"]");
+            if (last < first)
+                throw std::runtime_error("history slice out of range");
+            slice = slice.sub(first, last - first);
+        } else {
+            expect(L".tag(");
+            auto tag = static_cast<unsigned>(number(16));
+            expect(L")");
+            slice = slice.tag(tag);
+        }
+    }
+    return slice;
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <deque>
+#include <memory>
+#include <string>
+
+#include <scb/Bytes.h>
+
+// Ring of recent exchanges within a memory budget, the oldest exchanges are dropped first.
+// Arguments reference them instead of hex strings:
+//   $1                 data of the most recent response (without SW), $2 the one before, ...
+//   $1.sw / $1.cmd     status word / command of the exchange
+//   $1[2..10]          bytes 2 to 9, [2..] to the end, [2] a single byte
+//   $1.tag(9f36)       value of the first BER-TLV element with the tag, at any depth
+// Selectors can be chained, e.g. $2.tag(70).tag(5a)[0..4]. A reference is resolved to a slice
+// sharing the recorded buffer, bytes are copied only into the command being built.
+class ResponseHistory {
+public:
+    struct Exchange {
+        scb::Bytes command;
+        scb::Bytes response;    // including SW
+    };
+
+    class Slice {
+    public:
+        Slice(std::shared_ptr<Exchange const> exchange, scb::Bytes const &buffer, size_t offset, size_t size);
+
+        inline unsigned char const* data() const noexcept { return buffer_->data() + offset_; }
+        inline size_t size() const noexcept { return size_; }
+        scb::Bytes bytes() const;
+
+        Slice sub(size_t offset, size_t size) const;
+        Slice tag(unsigned tag) const;
+
+    private:
+        std::shared_ptr<Exchange const> exchange_;  // keeps buffer_ alive after the exchange left the ring
+        scb::Bytes const *buffer_;
+        size_t offset_;
+        size_t size_;
+    };
+
+    static constexpr size_t DefaultBudget = 1 << 20;
+
+    explicit ResponseHistory(size_t budget = DefaultBudget);
+
+    void record(scb::Bytes const &command, scb::Bytes const &response);
+    void clear();
+
+    void set_budget(size_t budget);
+    inline size_t budget() const noexcept { return budget_; }
+    inline size_t used() const noexcept { return used_; }
+    inline size_t size() const noexcept { return ring_.size(); }
+
+    // 1-based, 1 is the most recent exchange.
+    std::shared_ptr<Exchange const> at(size_t n) const;
+
+    static inline bool is_reference(std::wstring const &argument) noexcept { return !argument.empty() && argument[0] == L'$'; }
+    Slice resolve(std::wstring const &reference) const;
+
+private:
+    static size_t footprint(Exchange const &exchange) noexcept;
+    void evict();
+
+    std::deque<std::shared_ptr<Exchange const>> ring_;  // front is the most recent
+    size_t budget_;
+    size_t used_ = 0;
+};
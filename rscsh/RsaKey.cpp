@@ -0,0 +1,228 @@
+#include "RsaKey.h"
+
+#include <algorithm>
+#include <mutex>
+#include <new>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+RsaKey::RsaKey(scb::Bytes const &modulus, scb::Bytes const &exponent)
+    : n_(to_bn(modulus))
+    , e_(to_bn(exponent))
+{
+    if (BN_is_zero(n_.get()) || !BN_is_odd(n_.get()))
+        throw std::runtime_error("invalid RSA modulus");
+    precompute();
+}
+
+RsaKey::RsaKey(scb::Bytes const &p, scb::Bytes const &q, scb::Bytes const &dp, scb::Bytes const &dq, scb::Bytes const &qinv)
+    : p_(to_bn(p))
+    , q_(to_bn(q))
+    , dp_(to_bn(dp))
+    , dq_(to_bn(dq))
+    , qinv_(to_bn(qinv))
+{
+    if (!BN_is_odd(p_.get()) || !BN_is_odd(q_.get()))
+        throw std::runtime_error("invalid RSA CRT primes");
+
+    BNCtx ctx(BN_CTX_new());
+    n_.reset(BN_new());
+    if (!ctx || !n_ || !BN_mul(n_.get(), p_.get(), q_.get(), ctx.get()))
+        throw std::runtime_error("failed to compute RSA modulus");
+    precompute();
+}
+
+RsaKey RsaKey::generate(unsigned bits, scb::Bytes const &public_exponent, unsigned threads, GenerateControl *control) {
+    if (bits < 256 || bits % 2)
+        throw std::runtime_error("RSA key size must be even and at least 256 bits");
+
+    RsaKey key;
+    key.e_ = to_bn(public_exponent);
+    if (!BN_is_odd(key.e_.get()) || BN_is_one(key.e_.get()))
+        throw std::runtime_error("RSA public exponent must be odd and greater than 1");
+
+    if (threads == 0)
+        threads = std::max(1u, std::thread::hardware_concurrency());
+
+    key.p_ = generate_prime(bits / 2, key.e_.get(), threads, control);
+    do {
+        key.q_ = generate_prime(bits / 2, key.e_.get(), threads, control);
+    } while (BN_cmp(key.p_.get(), key.q_.get()) == 0);
+
+    // Keep p > q, so that qInv = q^-1 mod p
+    if (BN_cmp(key.p_.get(), key.q_.get()) < 0)
+        key.p_.swap(key.q_);
+
+    BNCtx ctx(BN_CTX_new());
+    BN p1(BN_dup(key.p_.get())), q1(BN_dup(key.q_.get())), phi(BN_new());
+    key.n_.reset(BN_new());
+    key.d_.reset(BN_new());
+    key.dp_.reset(BN_new());
+    key.dq_.reset(BN_new());
+    key.qinv_.reset(BN_new());
+    if (!ctx || !p1 || !q1 || !phi || !key.n_ || !key.d_ || !key.dp_ || !key.dq_ || !key.qinv_)
+        throw std::bad_alloc();
+
+    if (!BN_sub_word(p1.get(), 1)
+        || !BN_sub_word(q1.get(), 1)
+        || !BN_mul(key.n_.get(), key.p_.get(), key.q_.get(), ctx.get())
+        || !BN_mul(phi.get(), p1.get(), q1.get(), ctx.get())
+        || !BN_mod_inverse(key.d_.get(), key.e_.get(), phi.get(), ctx.get())
+        || !BN_mod(key.dp_.get(), key.d_.get(), p1.get(), ctx.get())
+        || !BN_mod(key.dq_.get(), key.d_.get(), q1.get(), ctx.get())
+        || !BN_mod_inverse(key.qinv_.get(), key.q_.get(), key.p_.get(), ctx.get()))
+    {
+        throw std::runtime_error("failed to compute RSA private key");
+    }
+
+    key.precompute();
+    return key;
+}
+
+RsaKey::BN RsaKey::generate_prime(unsigned bits, BIGNUM const *public_exponent, unsigned threads, GenerateControl *control) {
+    struct Search {
+        std::atomic<bool> found{ false };
+        GenerateControl *control;
+    } search{ false, control };
+
+    // Called by OpenSSL for every sieved candidate (0) and primality test round (1).
+    // Returning 0 aborts BN_generate_prime_ex, which is how the losing threads stop.
+    auto callback = [](int a, int, BN_GENCB *cb) -> int {
+        auto search = static_cast<Search*>(BN_GENCB_get_arg(cb));
+        if (search->found || (search->control && search->control->cancel))
+            return 0;
+        if (a == 0 && search->control)
+            search->control->candidates++;
+        return 1;
+    };
+
+    BN result;
+    std::mutex result_mutex;
+
+    auto worker = [&]() {
+        std::unique_ptr<BN_GENCB, decltype(&BN_GENCB_free)> cb(BN_GENCB_new(), &BN_GENCB_free);
+        BNCtx ctx(BN_CTX_new());
+        BN prime(BN_new()), prime1(BN_new()), gcd(BN_new());
+        if (!cb || !ctx || !prime || !prime1 || !gcd)
+            return;
+        BN_GENCB_set(cb.get(), callback, &search);
+
+        while (!search.found && !(control && control->cancel)) {
+            if (!BN_generate_prime_ex(prime.get(), bits, 0, nullptr, nullptr, cb.get()))
+                break;
+            if (!BN_sub(prime1.get(), prime.get(), BN_value_one()) || !BN_gcd(gcd.get(), prime1.get(), public_exponent, ctx.get()))
+                continue;
+            if (!BN_is_one(gcd.get()))
+                continue;
+
+            std::lock_guard<std::mutex> lock(result_mutex);
+            if (!search.found) {
+                result = std::move(prime);
+                search.found = true;
+            }
+        }
+    };
+
+    std::vector<std::thread> pool;
+    for (unsigned i = 1; i < threads; i++)
+        pool.emplace_back(worker);
+    worker();
+    for (auto &thread : pool)
+        thread.join();
+
+    if (!result) {
+        if (control && control->cancel)
+            throw std::runtime_error("RSA key generation cancelled");
+        throw std::runtime_error("failed to generate RSA prime");
+    }
+    return result;
+}
+
+scb::Bytes RsaKey::transform(scb::Bytes const &input) const {
+    BNCtx ctx(BN_CTX_new());
+    BN x(to_bn(input)), y(BN_new());
+    if (!ctx || !y)
+        throw std::bad_alloc();
+
+    if (BN_cmp(x.get(), n_.get()) >= 0)
+        throw std::runtime_error("RSA input is not less than modulus");
+
+    if (!is_crt()) {
+        if (!BN_mod_exp_mont(y.get(), x.get(), e_.get(), n_.get(), ctx.get(), mont_n_.get()))
+            throw std::runtime_error("RSA transformation failed");
+        return to_bytes(y.get(), size());
+    }
+
+    // m1 = x^dp mod p, m2 = x^dq mod q, y = m2 + q * (qInv * (m1 - m2) mod p)
+    BN xp(BN_new()), xq(BN_new()), m1(BN_new()), m2(BN_new()), h(BN_new());
+    if (!xp || !xq || !m1 || !m2 || !h)
+        throw std::bad_alloc();
+
+    if (!BN_mod(xp.get(), x.get(), p_.get(), ctx.get())
+        || !BN_mod(xq.get(), x.get(), q_.get(), ctx.get())
+        || !BN_mod_exp_mont_consttime(m1.get(), xp.get(), dp_.get(), p_.get(), ctx.get(), mont_p_.get())
+        || !BN_mod_exp_mont_consttime(m2.get(), xq.get(), dq_.get(), q_.get(), ctx.get(), mont_q_.get())
+        || !BN_mod_sub(h.get(), m1.get(), m2.get(), p_.get(), ctx.get())
+        || !BN_mod_mul(h.get(), h.get(), qinv_.get(), p_.get(), ctx.get())
+        || !BN_mul(y.get(), h.get(), q_.get(), ctx.get())
+        || !BN_add(y.get(), y.get(), m2.get()))
+    {
+        throw std::runtime_error("RSA CRT transformation failed");
+    }
+
+    return to_bytes(y.get(), size());
+}
+
+size_t RsaKey::size() const {
+    return static_cast<size_t>(BN_num_bytes(n_.get()));
+}
+
+scb::Bytes RsaKey::modulus() const { return to_bytes(n_.get()); }
+scb::Bytes RsaKey::public_exponent() const { return to_bytes(e_.get()); }
+scb::Bytes RsaKey::private_exponent() const { return to_bytes(d_.get()); }
+scb::Bytes RsaKey::p() const { return to_bytes(p_.get()); }
+scb::Bytes RsaKey::q() const { return to_bytes(q_.get()); }
+scb::Bytes RsaKey::dp() const { return to_bytes(dp_.get(), BN_num_bytes(p_.get())); }
+scb::Bytes RsaKey::dq() const { return to_bytes(dq_.get(), BN_num_bytes(q_.get())); }
+scb::Bytes RsaKey::qinv() const { return to_bytes(qinv_.get(), BN_num_bytes(p_.get())); }
+
+RsaKey::BN RsaKey::to_bn(scb::Bytes const &bytes) {
+    BN bn(BN_bin2bn(bytes.data(), static_cast<int>(bytes.size()), nullptr));
+    if (!bn)
+        throw std::bad_alloc();
+    return bn;
+}
+
+scb::Bytes RsaKey::to_bytes(BIGNUM const *bn, size_t size) {
+    if (!bn)
+        return scb::Bytes();
+    if (size == 0)
+        size = static_cast<size_t>(BN_num_bytes(bn));
+    scb::Bytes bytes(size);
+    if (BN_bn2binpad(bn, bytes.data(), static_cast<int>(bytes.size())) < 0)
+        throw std::runtime_error("RSA number does not fit into buffer");
+    return bytes;
+}
+
+RsaKey::BNMont RsaKey::make_mont(BIGNUM const *modulus, BN_CTX *ctx) {
+    BNMont mont(BN_MONT_CTX_new());
+    if (!mont || !BN_MONT_CTX_set(mont.get(), modulus, ctx))
+        throw std::runtime_error("failed to prepare RSA modulus");
+    return mont;
+}
+
+void RsaKey::precompute() {
+    BNCtx ctx(BN_CTX_new());
+    if (!ctx)
+        throw std::bad_alloc();
+
+    if (is_crt()) {
+        BN_set_flags(dp_.get(), BN_FLG_CONSTTIME);
+        BN_set_flags(dq_.get(), BN_FLG_CONSTTIME);
+        mont_p_ = make_mont(p_.get(), ctx.get());
+        mont_q_ = make_mont(q_.get(), ctx.get());
+    } else {
+        mont_n_ = make_mont(n_.get(), ctx.get());
+    }
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+
+#include <scb/Bytes.h>
+
+#include <openssl/bn.h>
+
+// RSA key for raw (unpadded) transformations.
+// Holds either a plain key (modulus and exponent), or CRT components of the private key.
+// Montgomery contexts are precomputed once, and transform() is safe to call from several threads.
+class RsaKey {
+public:
+    // Shared with a running key generation to observe its progress and to cancel it.
+    struct GenerateControl {
+        std::atomic<bool> cancel{ false };
+        std::atomic<unsigned long long> candidates{ 0 };
+    };
+
+    RsaKey(scb::Bytes const &modulus, scb::Bytes const &exponent);
+    RsaKey(scb::Bytes const &p, scb::Bytes const &q, scb::Bytes const &dp, scb::Bytes const &dq, scb::Bytes const &qinv);
+    RsaKey(RsaKey &&other) = default;
+    RsaKey(RsaKey const &other) = delete;
+    RsaKey& operator=(RsaKey const &other) = delete;
+
+    // Prime search runs on `threads` threads (all cores if 0), the first thread to find a prime stops the others.
+    static RsaKey generate(unsigned bits, scb::Bytes const &public_exponent, unsigned threads = 0, GenerateControl *control = nullptr);
+
+    scb::Bytes transform(scb::Bytes const &input) const;
+
+    inline bool is_crt() const noexcept { return p_ != nullptr; }
+    size_t size() const;
+
+    scb::Bytes modulus() const;
+    scb::Bytes public_exponent() const;
+    scb::Bytes private_exponent() const;
+    scb::Bytes p() const;
+    scb::Bytes q() const;
+    scb::Bytes dp() const;
+    scb::Bytes dq() const;
+    scb::Bytes qinv() const;
+
+private:
+    struct BNDeleter { void operator()(BIGNUM *bn) const { BN_clear_free(bn); } };
+    struct BNMontDeleter { void operator()(BN_MONT_CTX *mont) const { BN_MONT_CTX_free(mont); } };
+    struct BNCtxDeleter { void operator()(BN_CTX *ctx) const { BN_CTX_free(ctx); } };
+
+    using BN = std::unique_ptr<BIGNUM, BNDeleter>;
+    using BNMont = std::unique_ptr<BN_MONT_CTX, BNMontDeleter>;
+    using BNCtx = std::unique_ptr<BN_CTX, BNCtxDeleter>;
+
+    RsaKey() = default;
+
+    static BN to_bn(scb::Bytes const &bytes);
+    static scb::Bytes to_bytes(BIGNUM const *bn, size_t size = 0);
+    static BNMont make_mont(BIGNUM const *modulus, BN_CTX *ctx);
+    static BN generate_prime(unsigned bits, BIGNUM const *public_exponent, unsigned threads, GenerateControl *control);
+
+    void precompute();
+
+    BN n_, e_, d_;
+    BN p_, q_, dp_, dq_, qinv_;
+
+    BNMont mont_n_, mont_p_, mont_q_;
+};
@@ -0,0 +1,308 @@
+#include "Script.h"
+#include "CommandLine.h"
+#include "TextOutput.h"
+
+#include <algorithm>
+#include <cwctype>
+#include <iterator>
+#include <sstream>
+#include <stdexcept>
+
+static std::runtime_error script_error(unsigned line, std::string const &message) {
+    return std::runtime_error("script line " + std::to_string(line) + ": " + message);
+}
+
+static bool is_hex(std::wstring const &token) {
+    return token.size() % 2 == 0 && std::all_of(token.begin(), token.end(), ::iswxdigit);
+}
+
+unsigned Script::slot(std::wstring const &typed) {
+    auto name = lowercase(typed);
+    if (auto it = std::find(variables_.begin(), variables_.end(), name); it != variables_.end())
+        return static_cast<unsigned>(it - variables_.begin());
+    variables_.push_back(std::move(name));
+    return static_cast<unsigned>(variables_.size() - 1);
+}
+
+Script::Operand Script::operand(std::wstring const &token, unsigned line) {
+    Operand result;
+    result.text = token;
+    if (is_keyword(token, L"sw")) {
+        result.kind = Operand::StatusWord;
+    } else if (ResponseHistory::is_reference(token) && token.size() > 1 && iswdigit(token[1])) {
+        result.kind = Operand::History;
+    } else if (ResponseHistory::is_reference(token)) {
+        if (token.size() == 1 || std::find(variables_.begin(), variables_.end(), lowercase(token.substr(1))) == variables_.end())
+            throw script_error(line, "unknown variable");
+        result.kind = Operand::Variable;
+        result.slot = slot(token.substr(1));
+    } else if (is_hex(token)) {
+        result.bytes = scb::Bytes(token);
+    }
+    return result;
+}
+
+Script Script::compile(std::wistream &source, Resolver const &resolver) {
+    struct Block {
+        enum Kind { If, Else, For } kind;
+        unsigned start;                     // If: JumpIfNot, Else: Jump over the else part, For: LoopTest
+        std::vector<unsigned> breaks;
+    };
+
+    Script script;
+    std::vector<Block> blocks;
+    unsigned line = 0;
+
+    auto emit = [&](Instruction instruction) {
+        instruction.line = line;
+        script.code_.push_back(std::move(instruction));
+        return static_cast<unsigned>(script.code_.size() - 1);
+    };
+    auto here = [&] { return static_cast<unsigned>(script.code_.size()); };
+
+    for (std::wstring text; std::getline(source, text); ) {
+        line++;
+        std::vector<std::wstring> argv;
+        tokenize(text, argv);
+        if (argv.empty() || argv[0][0] == L'#')
+            continue;
+
+        // Keywords and command names in any case, arguments and echo text as written
+        argv[0] = lowercase(argv[0]);
+        auto const &keyword = argv[0];
+        if (keyword == L"set") {
+            if (argv.size() < 3 || !iswalpha(argv[1][0]))
+                throw script_error(line, "usage: set <name> <values>");
+            Instruction set{ Op::Set };
+            for (size_t i = 2; i < argv.size(); i++) {
+                set.operands.push_back(script.operand(argv[i], line));
+                if (set.operands.back().kind == Operand::Literal && !is_hex(argv[i]))
+                    throw script_error(line, "value is not hex");
+            }
+            set.slot = script.slot(argv[1]);
+            emit(std::move(set));
+        } else if (keyword == L"for") {
+            auto dots = argv.size() == 4 ? argv[3].find(L"..") : std::wstring::npos;
+            if (dots == std::wstring::npos || !is_keyword(argv[2], L"in") || !iswalpha(argv[1][0]))
+                throw script_error(line, "usage: for <name> in <from>..<to>");
+            Instruction init{ Op::LoopInit };
+            init.slot = script.slot(argv[1]);
+            init.from = std::stoul(argv[3].substr(0, dots));
+            init.to = std::stoul(argv[3].substr(dots + 2));
+            if (init.to > 0xFFFF)
+                throw script_error(line, "loop counter is limited to two bytes");
+            Instruction test{ Op::LoopTest };
+            test.slot = init.slot;
+            test.to = init.to;
+            emit(std::move(init));
+            blocks.push_back({ Block::For, emit(std::move(test)) });
+        } else if (keyword == L"if") {
+            if (argv.size() != 4 || (argv[2] != L"==" && argv[2] != L"!="))
+                throw script_error(line, "usage: if <operand> ==/!= <operand>");
+            Instruction jump{ Op::JumpIfNot };
+            jump.equal = argv[2] == L"==";
+            jump.operands.push_back(script.operand(argv[1], line));
+            jump.operands.push_back(script.operand(argv[3], line));
+            for (auto const &operand : jump.operands)
+                if (operand.kind == Operand::Literal && !is_hex(operand.text))
+                    throw script_error(line, "operand is not hex");
+            blocks.push_back({ Block::If, emit(std::move(jump)) });
+        } else if (keyword == L"else") {
+            if (blocks.empty() || blocks.back().kind != Block::If)
+                throw script_error(line, "else without if");
+            auto jumpOverElse = emit(Instruction{ Op::Jump });
+            script.code_[blocks.back().start].target = here();
+            blocks.back().kind = Block::Else;
+            blocks.back().start = jumpOverElse;
+        } else if (keyword == L"end") {
+            if (blocks.empty())
+                throw script_error(line, "end without block");
+            auto block = std::move(blocks.back());
+            blocks.pop_back();
+            if (block.kind == Block::For) {
+                Instruction next{ Op::LoopNext };
+                next.slot = script.code_[block.start].slot;
+                next.target = block.start;
+                emit(std::move(next));
+                script.code_[block.start].target = here();
+                for (auto jump : block.breaks)
+                    script.code_[jump].target = here();
+            } else {
+                script.code_[block.start].target = here();
+            }
+        } else if (keyword == L"break") {
+            auto loop = std::find_if(blocks.rbegin(), blocks.rend(), [](auto const &block) { return block.kind == Block::For; });
+            if (loop == blocks.rend())
+                throw script_error(line, "break outside loop");
+            loop->breaks.push_back(emit(Instruction{ Op::Jump }));
+        } else if (keyword == L"echo") {
+            Instruction echo{ Op::Echo };
+            for (size_t i = 1; i < argv.size(); i++)
+                echo.operands.push_back(script.operand(argv[i], line));
+            emit(std::move(echo));
+        } else if (keyword == L"stop") {
+            emit(Instruction{ Op::Stop });
+        } else {
+            Instruction command{ Op::Command };
+            command.handler = resolver(argv);
+            if (!command.handler)
+                throw script_error(line, "unknown command");
+            bool variables = false;
+            for (auto const &arg : argv) {
+                command.operands.push_back(script.operand(arg, line));
+                variables |= command.operands.back().kind == Operand::Variable;
+            }
+            if (!variables)
+                command.argv = argv;
+            emit(std::move(command));
+        }
+    }
+
+    if (!blocks.empty())
+        throw script_error(line, "missing end");
+    return script;
+}
+
+unsigned long long Script::run(ResponseHistory const &history, std::ostream &output) const {
+    std::vector<scb::Bytes> variables(variables_.size());
+    std::vector<unsigned long> counters(variables_.size());
+    std::vector<std::wstring> argv;
+    unsigned long long executed = 0;
+
+    auto set_counter = [&](unsigned slot, unsigned long counter) {
+        counters[slot] = counter;
+        auto &bytes = variables[slot];
+        if (counter > 0xFF) {
+            bytes = scb::Bytes(2);
+            bytes[0] = static_cast<unsigned char>(counter >> 8);
+            bytes[1] = static_cast<unsigned char>(counter);
+        } else {
+            bytes = scb::Bytes(1);
+            bytes[0] = static_cast<unsigned char>(counter);
+        }
+    };
+
+    for (size_t pc = 0; pc < code_.size(); ) {
+        auto const &instruction = code_[pc++];
+        executed++;
+        try {
+            switch (instruction.op) {
+                case Op::Command:
+                    if (!instruction.argv.empty()) {
+                        instruction.handler(instruction.argv);
+                    } else {
+                        argv.resize(instruction.operands.size());
+                        for (size_t i = 0; i < argv.size(); i++) {
+                            auto const &operand = instruction.operands[i];
+                            argv[i] = operand.kind == Operand::Variable ? hex(variables[operand.slot]) : operand.text;
+                        }
+                        instruction.handler(argv);
+                    }
+                    break;
+                case Op::Set: {
+                    scb::Bytes bytes;
+                    for (auto const &operand : instruction.operands)
+                        bytes += value(operand, variables, history);
+                    variables[instruction.slot] = std::move(bytes);
+                    break;
+                }
+                case Op::Echo:
+                    for (size_t i = 0; i < instruction.operands.size(); i++) {
+                        auto const &operand = instruction.operands[i];
+                        if (i > 0)
+                            output << ' ';
+                        if (operand.kind == Operand::Literal)
+                            output << utf8(operand.text);
+                        else
+                            output << utf8(hex(value(operand, variables, history)));
+                    }
+                    output << "\r\n";
+                    break;
+                case Op::LoopInit:
+                    set_counter(instruction.slot, instruction.from);
+                    break;
+                case Op::LoopTest:
+                    if (counters[instruction.slot] > instruction.to)
+                        pc = instruction.target;
+                    break;
+                case Op::LoopNext:
+                    set_counter(instruction.slot, counters[instruction.slot] + 1);
+                    pc = instruction.target;
+                    break;
+                case Op::Jump:
+                    pc = instruction.target;
+                    break;
+                case Op::JumpIfNot: {
+                    auto equal = value(instruction.operands[0], variables, history) == value(instruction.operands[1], variables, history);
+                    if (equal != instruction.equal)
+                        pc = instruction.target;
+                    break;
+                }
+                case Op::Stop:
+                    return executed;
+            }
+        } catch (std::exception const &e) {
+            throw script_error(instruction.line, e.what());
+        }
+    }
+    return executed;
+}
+
+scb::Bytes Script::value(Operand const &operand, std::vector<scb::Bytes> const &variables, ResponseHistory const &history) {
+    switch (operand.kind) {
+        case Operand::Variable:
+            return variables[operand.slot];
+        case Operand::History:
+            return history.resolve(operand.text).bytes();
+        case Operand::StatusWord: {
+            auto const &response = history.at(1)->response;
+            if (response.size() < 2)
+                throw std::runtime_error("last response has no status word");
+            return response.bytes(response.size() - 2, 2);
+        }
+        default:
+            return operand.bytes;
+    }
+}
+
+std::wstring Script::hex(scb::Bytes const &bytes) {
+    static wchar_t const digits[] = L"0123456789abcdef";
+    std::wstring text(bytes.size() * 2, L'0');
+    for (size_t i = 0; i < bytes.size(); i++) {
+        text[2 * i] = digits[bytes[i] >> 4];
+        text[2 * i + 1] = digits[bytes[i] & 0x0F];
+    }
+    return text;
+}
+
+void Script::disassemble(std::ostream &output) const {
+    static char const *const names[] = {
+        "command", "set", "echo", "loop-init", "loop-test", "loop-next", "jump", "jump-if-not", "stop",
+    };
+
+    for (size_t pc = 0; pc < code_.size(); pc++) {
+        auto const &instruction = code_[pc];
+        output << pc << "\t[" << instruction.line << "]\t" << names[static_cast<size_t>(instruction.op)];
+        switch (instruction.op) {
+            case Op::Set:
+            case Op::LoopInit:
+            case Op::LoopTest:
+            case Op::LoopNext:
+                output << ' ' << utf8(variables_[instruction.slot]);
+                break;
+            default:
+                break;
+        }
+        if (instruction.op == Op::LoopInit)
+            output << " = " << instruction.from;
+        if (instruction.op == Op::LoopTest)
+            output << " > " << instruction.to << " -> " << instruction.target;
+        if (instruction.op == Op::LoopNext || instruction.op == Op::Jump)
+            output << " -> " << instruction.target;
+        if (instruction.op == Op::JumpIfNot)
+            output << (instruction.equal ? " ==" : " !=") << " -> " << instruction.target;
+        for (auto const &operand : instruction.operands)
+            output << ' ' << utf8(operand.text);
+        output << "\r\n";
+    }
+}
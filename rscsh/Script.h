@@ -0,0 +1,93 @@
+#pragma once
+
+#include "ResponseHistory.h"
+
+#include <functional>
+#include <istream>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include <scb/Bytes.h>
+
+// Test procedure scripts, compiled once to bytecode and then interpreted:
+//
+//   # comment
+//   set aid a0000000031010      variables hold byte strings, the tokens are concatenated
+//   select $aid                 $name is replaced with the variable in hex
+//   for record in 1..16         counter is one byte, two bytes above 255
+//       apdu 00 b2 $record 0c 00
+//       if sw != 9000
+//           break
+//       end
+//   end
+//   if $1.tag(9f36) == 0020     operands: sw, $name, history references ($1, $1[2..4], ...) and hex
+//       echo atc is $1.tag(9f36)
+//   else
+//       stop
+//   end
+//
+// Every other line is a shell command, its handler and its tokens are resolved at compile time.
+class Script {
+public:
+    using Handler = std::function<void(std::vector<std::wstring> const &)>;
+    // Handler of the command line, empty when the command is unknown.
+    using Resolver = std::function<Handler(std::vector<std::wstring> const &argv)>;
+
+    static Script compile(std::wistream &source, Resolver const &resolver);
+
+    // Returns number of executed instructions.
+    unsigned long long run(ResponseHistory const &history, std::ostream &output) const;
+
+    void disassemble(std::ostream &output) const;
+    inline size_t size() const noexcept { return code_.size(); }
+
+private:
+    enum class Op : unsigned char {
+        Command,
+        Set,
+        Echo,
+        LoopInit,
+        LoopTest,
+        LoopNext,
+        Jump,
+        JumpIfNot,
+        Stop,
+    };
+
+    struct Operand {
+        enum Kind : unsigned char {
+            Literal,
+            Variable,
+            History,
+            StatusWord,
+        };
+
+        Kind kind = Literal;
+        std::wstring text;
+        scb::Bytes bytes;       // literal parsed as hex, when it is hex
+        unsigned slot = 0;
+    };
+
+    struct Instruction {
+        Op op = Op::Stop;
+        unsigned line = 0;
+        unsigned slot = 0;                  // variable of Set and loops
+        unsigned target = 0;                // jumps, loop exit
+        unsigned long from = 0;             // loop bounds
+        unsigned long to = 0;
+        bool equal = true;                  // JumpIfNot: jumps unless operands are (not) equal
+        std::vector<Operand> operands;
+        std::vector<std::wstring> argv;     // command line without variables, passed as is, else empty
+        Handler handler;
+    };
+
+    Operand operand(std::wstring const &token, unsigned line);
+    unsigned slot(std::wstring const &name);
+
+    static scb::Bytes value(Operand const &operand, std::vector<scb::Bytes> const &variables, ResponseHistory const &history);
+    static std::wstring hex(scb::Bytes const &bytes);
+
+    std::vector<Instruction> code_;
+    std::vector<std::wstring> variables_;   // names, index is the slot
+};
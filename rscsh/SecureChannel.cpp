@@ -0,0 +1,312 @@
+#include "SecureChannel.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+SecureChannel::SecureChannel(unsigned char securityLevel)
+    : securityLevel_(securityLevel)
+{}
+
+std::unique_ptr<SecureChannel> SecureChannel::open(KeySet const &keys, scb::Bytes const &hostChallenge, scb::Bytes const &initializeUpdateResponse, unsigned char securityLevel) {
+    if (initializeUpdateResponse.size() < 12)
+        throw std::runtime_error("INITIALIZE UPDATE response is too short");
+
+    switch (initializeUpdateResponse[11]) {
+        case 0x02:
+            return std::make_unique<Scp02>(keys, hostChallenge, initializeUpdateResponse, securityLevel);
+        case 0x03:
+            return std::make_unique<Scp03>(keys, hostChallenge, initializeUpdateResponse, securityLevel);
+        default:
+            throw std::runtime_error("card requested unsupported secure channel protocol");
+    }
+}
+
+scb::Bytes SecureChannel::initialize_update(unsigned char keyVersion, scb::Bytes const &hostChallenge) {
+    scb::Bytes command(5 + hostChallenge.size() + 1);
+    command[0] = 0x80;
+    command[1] = 0x50;
+    command[2] = keyVersion;
+    command[3] = 0x00;
+    command[4] = static_cast<unsigned char>(hostChallenge.size());
+    std::copy(hostChallenge.begin(), hostChallenge.end(), command.begin() + 5);
+    return command;
+}
+
+size_t SecureChannel::max_data_size() const noexcept {
+    // Lc is limited to 255 bytes, including 8 bytes of C-MAC and padding of encrypted data
+    if (securityLevel_ & CDecryption)
+        return (255 - 8) / block_size() * block_size() - 1;
+    return 255 - 8;
+}
+
+SecureChannel::Command SecureChannel::parse_command(scb::Bytes const &capdu) {
+    if (capdu.size() < 4)
+        throw std::runtime_error("APDU is too short");
+
+    Command command;
+    std::copy(capdu.begin(), capdu.begin() + 4, command.header);
+    if (capdu.size() == 5) {
+        command.hasLe = true;
+        command.le = capdu[4];
+    } else if (capdu.size() > 5) {
+        size_t lc = capdu[4];
+        if (lc == 0 || (capdu.size() != 5 + lc && capdu.size() != 5 + lc + 1))
+            throw std::runtime_error("secure channel supports short APDUs only");
+        command.data = capdu.bytes(5, lc);
+        if (capdu.size() == 5 + lc + 1) {
+            command.hasLe = true;
+            command.le = capdu[5 + lc];
+        }
+    }
+    return command;
+}
+
+void SecureChannel::pad(scb::Bytes &data, size_t blockSize) {
+    scb::Bytes padded((data.size() / blockSize + 1) * blockSize);
+    std::copy(data.begin(), data.end(), padded.begin());
+    padded[data.size()] = 0x80;
+    data = std::move(padded);
+}
+
+void SecureChannel::unpad(scb::Bytes &data) {
+    size_t length = data.size();
+    while (length > 0 && data[length - 1] == 0x00)
+        length--;
+    if (length == 0 || data[length - 1] != 0x80)
+        throw std::runtime_error("invalid padding of decrypted data");
+    data = data.left(length - 1);
+}
+
+static scb::Bytes build_command(unsigned char const *header, scb::Bytes const &data, unsigned char const *mac, size_t macSize, bool hasLe, unsigned char le) {
+    if (data.size() + macSize > 255)
+        throw std::runtime_error("APDU data is too long for secure channel");
+
+    scb::Bytes command(5 + data.size() + macSize + (hasLe ? 1 : 0));
+    std::copy(header, header + 4, command.begin());
+    command[4] = static_cast<unsigned char>(data.size() + macSize);
+    std::copy(data.begin(), data.end(), command.begin() + 5);
+    std::copy(mac, mac + macSize, command.begin() + 5 + data.size());
+    if (hasLe)
+        command[command.size() - 1] = le;
+    return command;
+}
+
+Scp02::Scp02(KeySet const &keys, scb::Bytes const &hostChallenge, scb::Bytes const &response, unsigned char securityLevel)
+    : SecureChannel(securityLevel)
+    , icv_(8)
+{
+    if (response.size() < 28)
+        throw std::runtime_error("SCP02 INITIALIZE UPDATE response is too short");
+    if (securityLevel & (RMac | REncryption))
+        throw std::runtime_error("R-MAC and R-ENCRYPTION are not supported for SCP02");
+
+    auto sequenceCounter = response.bytes(12, 2);
+    auto cardChallenge = response.bytes(14, 6);
+    auto cardCryptogram = response.bytes(20, 8);
+
+    auto senc = derive(keys.enc, 0x82, sequenceCounter);
+    auto smac = derive(keys.mac, 0x01, sequenceCounter);
+    encCipher_ = BlockCipher::des(senc);
+    icvCipher_ = BlockCipher::des(smac.left(8));
+    cmac_ = std::make_unique<RetailMac>(smac);
+
+    CbcMac cryptogram(BlockCipher::des(senc));
+
+    cryptogram.update(hostChallenge);
+    cryptogram.update(sequenceCounter);
+    cryptogram.update(cardChallenge);
+    if (cryptogram.final() != cardCryptogram)
+        throw std::runtime_error("card cryptogram verification failed");
+
+    cryptogram.update(sequenceCounter);
+    cryptogram.update(cardChallenge);
+    cryptogram.update(hostChallenge);
+    hostCryptogram_ = cryptogram.final();
+}
+
+scb::Bytes Scp02::derive(scb::Bytes const &key, unsigned char constant, scb::Bytes const &sequenceCounter) {
+    scb::Bytes data(16);
+    data[0] = 0x01;
+    data[1] = constant;
+    std::copy(sequenceCounter.begin(), sequenceCounter.end(), data.begin() + 2);
+    return DesCipher(key).encrypt_cbc(data);
+}
+
+scb::Bytes Scp02::external_authenticate() {
+    scb::Bytes command(5 + hostCryptogram_.size());
+    command[0] = 0x80;
+    command[1] = 0x82;
+    command[2] = securityLevel_;
+    command[3] = 0x00;
+    command[4] = static_cast<unsigned char>(hostCryptogram_.size());
+    std::copy(hostCryptogram_.begin(), hostCryptogram_.end(), command.begin() + 5);
+
+    // EXTERNAL AUTHENTICATE is never encrypted
+    auto level = securityLevel_;
+    securityLevel_ = CMac;
+    auto wrapped = wrap(command);
+    securityLevel_ = level;
+    return wrapped;
+}
+
+scb::Bytes Scp02::wrap(scb::Bytes const &capdu) {
+    auto command = parse_command(capdu);
+
+    command.header[0] |= 0x04;
+
+    // C-MAC is computed over the modified header and plain data
+    unsigned char lc = static_cast<unsigned char>(command.data.size() + 8);
+    if (!firstCommand_)
+        icvCipher_->encrypt_block(icv_.data(), icv_.data());
+    cmac_->set_icv(icv_);
+    cmac_->update(command.header, 4);
+    cmac_->update(&lc, 1);
+    cmac_->update(command.data);
+    cmac_->final(icv_.data());
+    firstCommand_ = false;
+
+    if ((securityLevel_ & CDecryption) && !command.data.empty()) {
+        pad(command.data, 8);
+        unsigned char iv[8] = {};
+        encCipher_->encrypt_cbc(command.data.data(), command.data.size(), iv);
+    }
+
+    return build_command(command.header, command.data, icv_.data(), 8, command.hasLe, command.le);
+}
+
+scb::Bytes Scp02::unwrap(scb::Bytes const &rapdu) {
+    return rapdu;
+}
+
+Scp03::Scp03(KeySet const &keys, scb::Bytes const &hostChallenge, scb::Bytes const &response, unsigned char securityLevel)
+    : SecureChannel(securityLevel)
+{
+    if (response.size() < 29)
+        throw std::runtime_error("SCP03 INITIALIZE UPDATE response is too short");
+    if ((securityLevel & REncryption) && !(securityLevel & RMac))
+        throw std::runtime_error("R-ENCRYPTION requires R-MAC");
+
+    auto context = hostChallenge;
+    context += response.bytes(13, 8);
+    auto cardCryptogram = response.bytes(21, 8);
+    auto smac = derive(keys.mac, SMac, context, keys.mac.size() * 8);
+
+    encCipher_ = BlockCipher::aes(derive(keys.enc, SEnc, context, keys.enc.size() * 8));
+    cmac_ = std::make_unique<Cmac>(BlockCipher::aes(smac));
+    rmac_ = std::make_unique<Cmac>(BlockCipher::aes(derive(keys.mac, SRMac, context, keys.mac.size() * 8)));
+
+    if (derive(smac, CardCryptogram, context, 64) != cardCryptogram)
+        throw std::runtime_error("card cryptogram verification failed");
+    hostCryptogram_ = derive(smac, HostCryptogram, context, 64);
+}
+
+scb::Bytes Scp03::derive(scb::Bytes const &key, unsigned char constant, scb::Bytes const &context, size_t bits) {
+    Cmac prf(BlockCipher::aes(key));
+
+    // label (11 zero bytes and derivation constant) | separator | L | i | context
+    scb::Bytes data(16);
+    data[11] = constant;
+    data[13] = static_cast<unsigned char>(bits >> 8);
+    data[14] = static_cast<unsigned char>(bits);
+    data += context;
+
+    scb::Bytes result;
+    for (unsigned char i = 1; result.size() * 8 < bits; i++) {
+        data[15] = i;
+        result += prf.compute(data);
+    }
+    return result.left(bits / 8);
+}
+
+scb::Bytes Scp03::external_authenticate() {
+    scb::Bytes command(5 + hostCryptogram_.size());
+    command[0] = 0x80;
+    command[1] = 0x82;
+    command[2] = securityLevel_;
+    command[3] = 0x00;
+    command[4] = static_cast<unsigned char>(hostCryptogram_.size());
+    std::copy(hostCryptogram_.begin(), hostCryptogram_.end(), command.begin() + 5);
+
+    // EXTERNAL AUTHENTICATE is never encrypted, and does not advance the encryption counter
+    auto level = securityLevel_;
+    securityLevel_ = CMac;
+    auto wrapped = wrap(command);
+    securityLevel_ = level;
+    return wrapped;
+}
+
+scb::Bytes Scp03::wrap(scb::Bytes const &capdu) {
+    auto command = parse_command(capdu);
+
+    if (securityLevel_ & CDecryption) {
+        for (int i = 15; i >= 0 && ++counter_[i] == 0; i--)
+            ;
+        if (!command.data.empty()) {
+            unsigned char icv[16];
+            encCipher_->encrypt_block(counter_, icv);
+            pad(command.data, 16);
+            encCipher_->encrypt_cbc(command.data.data(), command.data.size(), icv);
+        }
+    }
+
+    command.header[0] |= 0x04;
+
+    unsigned char lc = static_cast<unsigned char>(command.data.size() + 8);
+    cmac_->update(chaining_, sizeof(chaining_));
+    cmac_->update(command.header, 4);
+    cmac_->update(&lc, 1);
+    cmac_->update(command.data);
+    cmac_->final(chaining_);
+
+    if (securityLevel_ & RMac) {
+        Pending pending;
+        std::copy(chaining_, chaining_ + 16, pending.chaining);
+        std::copy(counter_, counter_ + 16, pending.counter);
+        std::lock_guard<std::mutex> lock(pendingMutex_);
+        pending_.push_back(pending);
+    }
+
+    return build_command(command.header, command.data, chaining_, 8, command.hasLe, command.le);
+}
+
+scb::Bytes Scp03::unwrap(scb::Bytes const &rapdu) {
+    if (!(securityLevel_ & RMac))
+        return rapdu;
+    Pending pending;
+    {
+        std::lock_guard<std::mutex> lock(pendingMutex_);
+        if (pending_.empty())
+            throw std::runtime_error("response does not belong to any wrapped command");
+        pending = pending_.front();
+        pending_.pop_front();
+    }
+
+    if (rapdu.size() <= 2)
+        return rapdu;
+    if (rapdu.size() < 10)
+        throw std::runtime_error("response is too short for R-MAC");
+
+    auto data = rapdu.bytes(0, rapdu.size() - 10);
+    auto sw = rapdu.bytes(rapdu.size() - 2, 2);
+
+    unsigned char rmac[16];
+    rmac_->update(pending.chaining, sizeof(pending.chaining));
+    rmac_->update(data);
+    rmac_->update(sw);
+    rmac_->final(rmac);
+    if (!std::equal(rmac, rmac + 8, rapdu.end() - 10))
+        throw std::runtime_error("R-MAC verification failed");
+
+    if ((securityLevel_ & REncryption) && !data.empty()) {
+        unsigned char icv[16];
+        unsigned char counter[16];
+        std::copy(pending.counter, pending.counter + 16, counter);
+        counter[0] = 0x80;
+        encCipher_->encrypt_block(counter, icv);
+        encCipher_->decrypt_cbc(data.data(), data.size(), icv);
+        unpad(data);
+    }
+
+    data += sw;
+    return data;
+}
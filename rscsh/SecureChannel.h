@@ -0,0 +1,135 @@
+#pragma once
+
+#include "BlockCipher.h"
+#include "Mac.h"
+
+#include <deque>
+#include <memory>
+#include <mutex>
+
+#include <scb/Bytes.h>
+
+// GlobalPlatform secure channel session.
+// A session is created from the INITIALIZE UPDATE response, it derives session keys
+// and MAC contexts once, and then wraps every command / unwraps every response.
+class SecureChannel {
+public:
+    enum SecurityLevel : unsigned char {
+        CMac        = 0x01,
+        CDecryption = 0x02,
+        RMac        = 0x10,
+        REncryption = 0x20,
+    };
+
+    struct KeySet {
+        unsigned char version = 0;
+        scb::Bytes enc;
+        scb::Bytes mac;
+        scb::Bytes dek;
+    };
+
+    SecureChannel(unsigned char securityLevel);
+    SecureChannel(SecureChannel const &other) = delete;
+    SecureChannel& operator=(SecureChannel const &other) = delete;
+    virtual ~SecureChannel() = default;
+
+    // Verifies card cryptogram and creates SCP02 or SCP03 session, depending on the INITIALIZE UPDATE response.
+    static std::unique_ptr<SecureChannel> open(KeySet const &keys, scb::Bytes const &hostChallenge, scb::Bytes const &initializeUpdateResponse, unsigned char securityLevel);
+
+    static scb::Bytes initialize_update(unsigned char keyVersion, scb::Bytes const &hostChallenge);
+
+    // EXTERNAL AUTHENTICATE command, already wrapped.
+    virtual scb::Bytes external_authenticate() = 0;
+
+    // Commands may be wrapped ahead, even on another thread than responses are unwrapped,
+    // but responses must be unwrapped in the same order as commands were wrapped.
+    virtual scb::Bytes wrap(scb::Bytes const &capdu) = 0;
+    virtual scb::Bytes unwrap(scb::Bytes const &rapdu) = 0;
+
+    // Largest plain command data, which still fits into short APDU after wrapping.
+    size_t max_data_size() const noexcept;
+
+    virtual unsigned char protocol() const noexcept = 0;
+    inline unsigned char security_level() const noexcept { return securityLevel_; }
+
+protected:
+    // Splits short APDU into header, data and Le.
+    struct Command {
+        unsigned char header[4];
+        scb::Bytes data;
+        bool hasLe = false;
+        unsigned char le = 0;
+    };
+    static Command parse_command(scb::Bytes const &capdu);
+    static void pad(scb::Bytes &data, size_t blockSize);
+    static void unpad(scb::Bytes &data);
+
+    virtual size_t block_size() const noexcept = 0;
+
+    unsigned char securityLevel_;
+};
+
+// SCP02, implementation option i=15 (C-MAC on modified APDU, ICV encryption).
+class Scp02 : public SecureChannel {
+public:
+    Scp02(KeySet const &keys, scb::Bytes const &hostChallenge, scb::Bytes const &response, unsigned char securityLevel);
+
+    scb::Bytes external_authenticate() override;
+    scb::Bytes wrap(scb::Bytes const &capdu) override;
+    scb::Bytes unwrap(scb::Bytes const &rapdu) override;
+
+    unsigned char protocol() const noexcept override { return 0x02; }
+
+private:
+    size_t block_size() const noexcept override { return 8; }
+
+    static scb::Bytes derive(scb::Bytes const &key, unsigned char constant, scb::Bytes const &sequenceCounter);
+
+    std::unique_ptr<BlockCipher> encCipher_;
+    std::unique_ptr<BlockCipher> icvCipher_;
+    std::unique_ptr<Mac> cmac_;
+    scb::Bytes hostCryptogram_;
+    scb::Bytes icv_;
+    bool firstCommand_ = true;
+};
+
+// SCP03 (GlobalPlatform Amendment D), AES session keys.
+class Scp03 : public SecureChannel {
+public:
+    Scp03(KeySet const &keys, scb::Bytes const &hostChallenge, scb::Bytes const &response, unsigned char securityLevel);
+
+    scb::Bytes external_authenticate() override;
+    scb::Bytes wrap(scb::Bytes const &capdu) override;
+    scb::Bytes unwrap(scb::Bytes const &rapdu) override;
+
+    unsigned char protocol() const noexcept override { return 0x03; }
+
+    enum Derivation : unsigned char {
+        CardCryptogram = 0x00,
+        HostCryptogram = 0x01,
+        SEnc = 0x04,
+        SMac = 0x06,
+        SRMac = 0x07,
+    };
+
+    // NIST SP 800-108 KDF in counter mode with AES-CMAC, as specified by Amendment D.
+    static scb::Bytes derive(scb::Bytes const &key, unsigned char constant, scb::Bytes const &context, size_t bits);
+
+private:
+    size_t block_size() const noexcept override { return 16; }
+
+    // R-MAC is chained to the C-MAC of its command, and R-ENCRYPTION uses the command counter
+    struct Pending {
+        unsigned char chaining[16];
+        unsigned char counter[16];
+    };
+
+    std::unique_ptr<BlockCipher> encCipher_;
+    std::unique_ptr<Mac> cmac_;
+    std::unique_ptr<Mac> rmac_;
+    scb::Bytes hostCryptogram_;
+    unsigned char chaining_[16] = {};
+    unsigned char counter_[16] = {};
+    std::deque<Pending> pending_;
+    std::mutex pendingMutex_;
+};
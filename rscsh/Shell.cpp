@@ -1,7 +1,52 @@
 #include "Shell.h"
 
-Shell::Shell(std::wostringstream &execution_yield) 
+#include <algorithm>
+#include <stdexcept>
+
+Shell::Shell(std::ostringstream &execution_yield) 
     : execution_yield_(execution_yield)
 {}
 
 Shell::~Shell() {}
+
+scb::Bytes Shell::hex_argument(std::wstring const &argument) const {
+    Profiler::Scope scope(profiler_, Profiler::Phase::HexDecode);
+    if (history_ && ResponseHistory::is_reference(argument))
+        return history_->resolve(argument).bytes();
+    return scb::Bytes(argument);
+}
+
+static int hex_digit(wchar_t c) {
+    if (c >= L'0' && c <= L'9')
+        return c - L'0';
+    if (c >= L'a' && c <= L'f')
+        return c - L'a' + 10;
+    if (c >= L'A' && c <= L'F')
+        return c - L'A' + 10;
+    return -1;
+}
+
+scb::Bytes Shell::hex_arguments(std::vector<std::wstring>::const_iterator begin, std::vector<std::wstring>::const_iterator end) const {
+    Profiler::Scope scope(profiler_, Profiler::Phase::HexDecode);
+    std::pmr::vector<unsigned char> decoded(arena_);
+    for (auto arg = begin; arg != end; ++arg) {
+        if (history_ && ResponseHistory::is_reference(*arg)) {
+            auto slice = history_->resolve(*arg);
+            decoded.insert(decoded.end(), slice.data(), slice.data() + slice.size());
+            continue;
+        }
+
+        if (arg->size() % 2 != 0)
+            throw std::runtime_error("hex string has odd number of digits");
+        for (size_t i = 0; i < arg->size(); i += 2) {
+            auto high = hex_digit((*arg)[i]), low = hex_digit((*arg)[i + 1]);
+            if (high < 0 || low < 0)
+                throw std::runtime_error("invalid hex digit");
+            decoded.push_back(static_cast<unsigned char>(high << 4 | low));
+        }
+    }
+
+    scb::Bytes bytes(decoded.size());
+    std::copy(decoded.begin(), decoded.end(), bytes.begin());
+    return bytes;
+}
@@ -1,15 +1,42 @@
 #pragma once
 
+#include "CommandLine.h"
+#include "Emitter.h"
+#include "Profiler.h"
+#include "ResponseHistory.h"
+#include "TextOutput.h"
+
+#include <memory_resource>
 #include <sstream>
+#include <string>
+#include <vector>
+
+#include <scb/Bytes.h>
 
 class Shell {
 public:
-    Shell(std::wostringstream &execution_yield);
+    Shell(std::ostringstream &execution_yield);
     Shell(Shell const &other) = delete;
     Shell& operator=(Shell const &other) = delete;
 
     virtual ~Shell() = 0;
 
+    inline void set_history(ResponseHistory *history) noexcept { history_ = history; }
+    inline void set_emitter(Emitter *emitter) noexcept { emitter_ = emitter; }
+    inline void set_arena(std::pmr::memory_resource *arena) noexcept { arena_ = arena; }
+    inline void set_profiler(Profiler *profiler) noexcept { profiler_ = profiler; }
+
 protected:
-    std::wostringstream &execution_yield_;
+    // Hex string, or reference to the response history such as $1[2..10].
+    scb::Bytes hex_argument(std::wstring const &argument) const;
+    // Concatenation of hex / reference arguments, decoded in the command arena and copied once.
+    scb::Bytes hex_arguments(std::vector<std::wstring>::const_iterator begin, std::vector<std::wstring>::const_iterator end) const;
+    // Emitter of typed records when the output is JSON or CBOR, nullptr for text output.
+    inline Emitter* structured_output() const noexcept { return emitter_ && emitter_->structured() ? emitter_ : nullptr; }
+
+    std::ostringstream &execution_yield_;    // UTF-8
+    ResponseHistory *history_ = nullptr;
+    Emitter *emitter_ = nullptr;
+    std::pmr::memory_resource *arena_ = std::pmr::get_default_resource();
+    Profiler *profiler_ = nullptr;
 };
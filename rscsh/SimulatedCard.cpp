@@ -0,0 +1,260 @@
+#include "SimulatedCard.h"
+
+#include <algorithm>
+
+#include <openssl/rand.h>
+
+SimulatedCard::SimulatedCard(SecureChannel::KeySet const &keys)
+    : keys_(keys)
+    , atr_(L"3B8980014D525343534853494D")
+{
+    // TCK is required, because T=1 is indicated
+    unsigned char tck = 0;
+    for (size_t i = 1; i < atr_.size(); i++)
+        tck ^= atr_[i];
+    scb::Bytes check(1);
+    check[0] = tck;
+    atr_ += check;
+}
+
+scb::Bytes SimulatedCard::transmit(scb::Bytes const &capdu) {
+    commands_++;
+
+    if (capdu.size() < 4)
+        return status(0x6700);
+
+    scb::Bytes data;
+    if (capdu.size() > 5) {
+        size_t lc = capdu[4];
+        if (lc == 0 || (capdu.size() != 5 + lc && capdu.size() != 5 + lc + 1))
+            return status(0x6700);
+        data = capdu.bytes(5, lc);
+    }
+
+    unsigned char cla = capdu[0];
+    unsigned char ins = capdu[1];
+
+    if ((cla & 0x80) && (cla & 0x04)) {
+        if (!authenticated_ && (ins != 0x82 || !cmac_))
+            return status(0x6982);
+        if (!unwrap(capdu, data)) {
+            close_session();
+            return status(0x6982);
+        }
+        if (ins == 0x82)
+            return external_authenticate(capdu[2], data);
+
+        auto response = process(capdu.left(4), data);
+        auto sw = static_cast<unsigned short>((response[response.size() - 2] << 8) | response[response.size() - 1]);
+        auto wrapped = wrap(response.left(response.size() - 2), sw);
+        // SELECT ends the session, after its response was protected by it
+        if (ins == 0xA4)
+            close_session();
+        return wrapped;
+    }
+
+    // Commands of the security domain must be protected once the session is open
+    if (authenticated_ && (cla & 0x80) && ins != 0x50)
+        return status(0x6982);
+
+    if (ins == 0xA4)
+        close_session();
+    return process(capdu.left(4), data);
+}
+
+scb::Bytes SimulatedCard::process(scb::Bytes const &header, scb::Bytes const &data) {
+    unsigned char cla = header[0] & ~0x07;
+    unsigned char ins = header[1];
+
+    if (cla != 0x00 && cla != 0x80)
+        return status(0x6E00);
+
+    switch (ins) {
+        case 0xA4: { // SELECT
+            scb::Bytes fci(L"6F108408A000000151000000A5049F6501FF");
+            fci += status(0x9000);
+            return fci;
+        }
+
+        case 0xCA: // GET DATA
+        case 0xCB:
+            if (header[2] == 0x9F && header[3] == 0x7F) {
+                scb::Bytes cplc(3 + 0x2A);
+                cplc[0] = 0x9F;
+                cplc[1] = 0x7F;
+                cplc[2] = 0x2A;
+                for (size_t i = 3; i < cplc.size(); i++)
+                    cplc[i] = static_cast<unsigned char>(i);
+                cplc += status(0x9000);
+                return cplc;
+            }
+            return status(0x6A88);
+
+        case 0x50: // INITIALIZE UPDATE
+            if (cla != 0x80)
+                return status(0x6E00);
+            return initialize_update(data);
+
+        case 0xE2: // STORE DATA
+            storedBytes_ += data.size();
+            return status(0x9000);
+
+        case 0xE6: { // INSTALL
+            scb::Bytes response(1);
+            response += status(0x9000);
+            return response;
+        }
+
+        case 0xE8: // LOAD
+            if (data.size() > maxLoadBlock_)
+                return status(0x6700);
+            storedBytes_ += data.size();
+            if (header[2] & 0x80) {
+                scb::Bytes response(1);
+                response += status(0x9000);
+                return response;
+            }
+            return status(0x9000);
+
+        default:
+            return status(0x6D00);
+    }
+}
+
+scb::Bytes SimulatedCard::initialize_update(scb::Bytes const &data) {
+    close_session();
+
+    if (data.size() != 8)
+        return status(0x6700);
+
+    scb::Bytes cardChallenge(8);
+    if (RAND_bytes(cardChallenge.data(), static_cast<int>(cardChallenge.size())) != 1)
+        return status(0x6F00);
+
+    context_ = data;
+    context_ += cardChallenge;
+
+    auto bits = keys_.mac.size() * 8;
+    auto smac = Scp03::derive(keys_.mac, Scp03::SMac, context_, bits);
+    enc_ = BlockCipher::aes(Scp03::derive(keys_.enc, Scp03::SEnc, context_, keys_.enc.size() * 8));
+    cmac_ = std::make_unique<Cmac>(BlockCipher::aes(smac));
+    rmac_ = std::make_unique<Cmac>(BlockCipher::aes(Scp03::derive(keys_.mac, Scp03::SRMac, context_, bits)));
+    hostCryptogram_ = Scp03::derive(smac, Scp03::HostCryptogram, context_, 64);
+
+    // Key diversification data | key version, SCP03, i=60 (R-MAC and R-ENCRYPTION) | card challenge | card cryptogram
+    scb::Bytes response(L"00010203040506070809");
+    scb::Bytes keyInformation(3);
+    keyInformation[0] = keys_.version;
+    keyInformation[1] = 0x03;
+    keyInformation[2] = 0x60;
+    response += keyInformation;
+    response += cardChallenge;
+    response += Scp03::derive(smac, Scp03::CardCryptogram, context_, 64);
+    response += status(0x9000);
+    return response;
+}
+
+scb::Bytes SimulatedCard::external_authenticate(unsigned char level, scb::Bytes const &data) {
+    if (data != hostCryptogram_) {
+        close_session();
+        return status(0x6300);
+    }
+    if ((level & SecureChannel::REncryption) && !(level & SecureChannel::RMac)) {
+        close_session();
+        return status(0x6A86);
+    }
+
+    level_ = level;
+    authenticated_ = true;
+    return status(0x9000);
+}
+
+bool SimulatedCard::unwrap(scb::Bytes const &capdu, scb::Bytes &data) {
+    if (data.size() < 8)
+        return false;
+
+    auto body = data.left(data.size() - 8);
+
+    unsigned char mac[16];
+    cmac_->update(chaining_, sizeof(chaining_));
+    cmac_->update(capdu.data(), 5);
+    cmac_->update(body);
+    cmac_->final(mac);
+    if (!std::equal(mac, mac + 8, data.begin() + body.size()))
+        return false;
+    std::copy(mac, mac + 16, chaining_);
+
+    if (authenticated_ && (level_ & SecureChannel::CDecryption)) {
+        for (int i = 15; i >= 0 && ++counter_[i] == 0; i--)
+            ;
+        if (!body.empty()) {
+            if (body.size() % 16)
+                return false;
+            unsigned char icv[16];
+            enc_->encrypt_block(counter_, icv);
+            enc_->decrypt_cbc(body.data(), body.size(), icv);
+
+            size_t length = body.size();
+            while (length > 0 && body[length - 1] == 0x00)
+                length--;
+            if (length == 0 || body[length - 1] != 0x80)
+                return false;
+            body = body.left(length - 1);
+        }
+    }
+
+    data = body;
+    return true;
+}
+
+scb::Bytes SimulatedCard::wrap(scb::Bytes const &data, unsigned short sw) {
+    if (!(level_ & SecureChannel::RMac)) {
+        auto response = data;
+        response += status(sw);
+        return response;
+    }
+
+    auto response = data;
+    if ((level_ & SecureChannel::REncryption) && !data.empty()) {
+        scb::Bytes padded((data.size() / 16 + 1) * 16);
+        std::copy(data.begin(), data.end(), padded.begin());
+        padded[data.size()] = 0x80;
+
+        unsigned char counter[16];
+        unsigned char icv[16];
+        std::copy(counter_, counter_ + 16, counter);
+        counter[0] = 0x80;
+        enc_->encrypt_block(counter, icv);
+        enc_->encrypt_cbc(padded.data(), padded.size(), icv);
+        response = padded;
+    }
+
+    unsigned char mac[16];
+    rmac_->update(chaining_, sizeof(chaining_));
+    rmac_->update(response);
+    rmac_->update(status(sw));
+    rmac_->final(mac);
+
+    scb::Bytes rmac(8);
+    std::copy(mac, mac + 8, rmac.begin());
+    response += rmac;
+    response += status(sw);
+    return response;
+}
+
+void SimulatedCard::close_session() {
+    authenticated_ = false;
+    level_ = 0;
+    cmac_.reset();
+    rmac_.reset();
+    enc_.reset();
+    std::fill(std::begin(chaining_), std::end(chaining_), 0);
+    std::fill(std::begin(counter_), std::end(counter_), 0);
+}
+
+scb::Bytes SimulatedCard::status(unsigned short sw) {
+    scb::Bytes bytes(2);
+    bytes[0] = static_cast<unsigned char>(sw >> 8);
+    bytes[1] = static_cast<unsigned char>(sw);
+    return bytes;
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include "SecureChannel.h"
+
+#include <memory>
+
+#include <scb/Bytes.h>
+
+// In-process card used instead of a reader, to test and benchmark the shell without hardware.
+// Implements card side of GlobalPlatform SCP03, and answers a small set of commands:
+// SELECT, GET DATA, INITIALIZE UPDATE, EXTERNAL AUTHENTICATE, STORE DATA, INSTALL and LOAD.
+class SimulatedCard {
+public:
+    SimulatedCard(SecureChannel::KeySet const &keys);
+
+    inline scb::Bytes const& atr() const noexcept { return atr_; }
+    inline unsigned long long commands() const noexcept { return commands_; }
+    inline unsigned long long stored_bytes() const noexcept { return storedBytes_; }
+
+    scb::Bytes transmit(scb::Bytes const &capdu);
+
+    // Largest command data field accepted by LOAD, larger blocks are rejected with 6700.
+    inline void set_max_load_block(size_t size) noexcept { maxLoadBlock_ = size; }
+
+private:
+    scb::Bytes process(scb::Bytes const &header, scb::Bytes const &data);
+    scb::Bytes initialize_update(scb::Bytes const &data);
+    scb::Bytes external_authenticate(unsigned char level, scb::Bytes const &data);
+    bool unwrap(scb::Bytes const &capdu, scb::Bytes &data);
+    scb::Bytes wrap(scb::Bytes const &data, unsigned short sw);
+    void close_session();
+
+    static scb::Bytes status(unsigned short sw);
+
+    SecureChannel::KeySet keys_;
+    scb::Bytes atr_;
+
+    // Secure channel session
+    bool authenticated_ = false;
+    unsigned char level_ = 0;
+    scb::Bytes context_;
+    scb::Bytes hostCryptogram_;
+    std::unique_ptr<BlockCipher> enc_;
+    std::unique_ptr<Mac> cmac_;
+    std::unique_ptr<Mac> rmac_;
+    unsigned char chaining_[16] = {};
+    unsigned char counter_[16] = {};
+
+    size_t maxLoadBlock_ = 255;
+    unsigned long long commands_ = 0;
+    unsigned long long storedBytes_ = 0;
+};
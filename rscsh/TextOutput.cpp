@@ -0,0 +1,93 @@
+#include "TextOutput.h"
+#include "Platform.h"
+
+#include <sstream>
+
+static char const hexDigits[] = "0123456789ABCDEF";
+
+// Writes the code point at text[i] and moves i past it, returns the number of bytes.
+static size_t encode_utf8(std::wstring_view text, size_t &i, char *out) {
+    unsigned long c = static_cast<unsigned long>(text[i]);
+    if (c >= 0xD800 && c <= 0xDBFF && i + 1 < text.size() && text[i + 1] >= 0xDC00 && text[i + 1] <= 0xDFFF) {
+        c = 0x10000 + ((c - 0xD800) << 10) + (static_cast<unsigned long>(text[++i]) - 0xDC00);
+    } else if (c >= 0xD800 && c <= 0xDFFF) {
+        c = 0xFFFD;
+    }
+    i++;
+
+    if (c < 0x80) {
+        out[0] = static_cast<char>(c);
+        return 1;
+    }
+    if (c < 0x800) {
+        out[0] = static_cast<char>(0xC0 | (c >> 6));
+        out[1] = static_cast<char>(0x80 | (c & 0x3F));
+        return 2;
+    }
+    if (c < 0x10000) {
+        out[0] = static_cast<char>(0xE0 | (c >> 12));
+        out[1] = static_cast<char>(0x80 | ((c >> 6) & 0x3F));
+        out[2] = static_cast<char>(0x80 | (c & 0x3F));
+        return 3;
+    }
+    out[0] = static_cast<char>(0xF0 | (c >> 18));
+    out[1] = static_cast<char>(0x80 | ((c >> 12) & 0x3F));
+    out[2] = static_cast<char>(0x80 | ((c >> 6) & 0x3F));
+    out[3] = static_cast<char>(0x80 | (c & 0x3F));
+    return 4;
+}
+
+void append_utf8(std::string &out, std::wstring_view text) {
+    char buffer[4];
+    for (size_t i = 0; i < text.size(); )
+        out.append(buffer, encode_utf8(text, i, buffer));
+}
+
+std::string to_utf8(std::wstring_view text) {
+    std::string utf8;
+    utf8.reserve(text.size());
+    append_utf8(utf8, text);
+    return utf8;
+}
+
+std::wstring from_utf8(std::string_view text) {
+    return wide_of_utf8(text);
+}
+
+std::ostream& operator<<(std::ostream &stream, Utf8Text text) {
+    // Encoded in chunks on the stack, the stream buffer is the only copy
+    char buffer[256];
+    for (size_t i = 0; i < text.text.size(); ) {
+        size_t length = 0;
+        while (i < text.text.size() && length + 4 <= sizeof(buffer))
+            length += encode_utf8(text.text, i, buffer + length);
+        stream.write(buffer, static_cast<std::streamsize>(length));
+    }
+    return stream;
+}
+
+std::ostream& operator<<(std::ostream &stream, HexText hex) {
+    char buffer[256];
+    size_t separatorLength = hex.separator ? std::char_traits<char>::length(hex.separator) : 0;
+    size_t length = 0;
+    for (size_t i = 0; i < hex.size; i++) {
+        if (length + 2 + separatorLength > sizeof(buffer)) {
+            stream.write(buffer, static_cast<std::streamsize>(length));
+            length = 0;
+        }
+        if (i > 0 && separatorLength) {
+            std::char_traits<char>::copy(buffer + length, hex.separator, separatorLength);
+            length += separatorLength;
+        }
+        buffer[length++] = hexDigits[hex.data[i] >> 4];
+        buffer[length++] = hexDigits[hex.data[i] & 0x0F];
+    }
+    stream.write(buffer, static_cast<std::streamsize>(length));
+    return stream;
+}
+
+std::ostream& operator<<(std::ostream &stream, DumpText dump) {
+    std::wostringstream wide;
+    dump.bytes.dump(wide);
+    return stream << utf8(wide.str());
+}
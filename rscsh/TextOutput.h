@@ -0,0 +1,43 @@
+#pragma once
+
+#include <cstddef>
+#include <ostream>
+#include <string>
+#include <string_view>
+
+#include <scb/Bytes.h>
+
+// Shell output is UTF-8 text in narrow streams. Wide strings (tokens, reader names, file names)
+// are encoded as they are written, and the text is converted back to UTF-16 only for the window.
+
+// UTF-8 of UTF-16 text, unpaired surrogates become U+FFFD.
+void append_utf8(std::string &out, std::wstring_view text);
+std::string to_utf8(std::wstring_view text);
+std::wstring from_utf8(std::string_view text);
+
+struct Utf8Text {
+    std::wstring_view text;
+};
+
+// Writes wide text to a UTF-8 stream: stream << utf8(name)
+inline Utf8Text utf8(std::wstring_view text) noexcept { return { text }; }
+std::ostream& operator<<(std::ostream &stream, Utf8Text text);
+
+struct HexText {
+    unsigned char const *data;
+    size_t size;
+    char const *separator;
+};
+
+// Uppercase hex of the bytes with the separator between them: stream << hex_bytes(bytes, " ")
+inline HexText hex_bytes(scb::Bytes const &bytes, char const *separator = "") noexcept { return { bytes.data(), bytes.size(), separator }; }
+inline HexText hex_bytes(unsigned char const *data, size_t size, char const *separator = "") noexcept { return { data, size, separator }; }
+std::ostream& operator<<(std::ostream &stream, HexText hex);
+
+struct DumpText {
+    scb::Bytes const &bytes;
+};
+
+// Hex dump of scb::Bytes::dump, which only writes to wide streams.
+inline DumpText dump_bytes(scb::Bytes const &bytes) noexcept { return { bytes }; }
+std::ostream& operator<<(std::ostream &stream, DumpText dump);